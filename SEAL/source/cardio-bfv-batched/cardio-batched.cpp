@@ -78,61 +78,28 @@ void CardioBatched::setup_context_bfv(std::size_t poly_modulus_degree) {
     evaluator = std::make_unique<seal::Evaluator>(*context);
     decryptor = std::make_unique<seal::Decryptor>(*context, secretKey);
     encoder = std::make_unique<seal::BatchEncoder>(*context);
+    comparator = std::make_unique<BitComparator>(*evaluator, *encoder, relinKeys);
+    relinearizer = std::make_unique<LazyRelinearizer>(*evaluator, relinKeys);
+    levels = std::make_unique<LevelManager>(context, *evaluator);
+    // constants of a previous context would not match the new one
+    constants.clear();
 }
 
-CiphertextVector CardioBatched::slice(CiphertextVector ctxt, int idx_begin,
-                                      int idx_end) {
-    return CiphertextVector(ctxt.begin() + idx_begin, ctxt.begin() + idx_end);
+CiphertextSpan CardioBatched::slice(CiphertextSpan ctxt, int idx_begin,
+                                    int idx_end) {
+    return ctxt.subspan(idx_begin, idx_end - idx_begin);
 }
 
-CiphertextVector CardioBatched::slice(CiphertextVector ctxt, int idx_begin) {
-    return CiphertextVector(ctxt.begin() + idx_begin, ctxt.end());
+CiphertextSpan CardioBatched::slice(CiphertextSpan ctxt, int idx_begin) {
+    return ctxt.subspan(idx_begin);
 }
 
 // return lhs < rhs
-std::unique_ptr<seal::Ciphertext> CardioBatched::lower(CiphertextVector &lhs,
-                                                       CiphertextVector &rhs) {
-    std::unique_ptr<seal::Ciphertext> result =
-            std::make_unique<seal::Ciphertext>();
-
-    const int len = lhs.size();
-    if (len == 1) {
-        // andNY(lhs[0], rhs[0]) = !(lhs[0]) & rhs[0]
-        seal::Plaintext one;
-        std::vector<uint64_t> all_ones(encoder->slot_count(), 1);
-        encoder->encode(all_ones, one);
-        seal::Ciphertext lhs_neg = XOR(lhs[0], one);
-        evaluator->multiply(lhs_neg, rhs[0], *result);
-        evaluator->relinearize_inplace(*result, relinKeys);
-        return result;
-    }
-
-    auto get_level = [&](seal::Ciphertext &c) -> std::size_t {
-        return context->get_context_data(c.parms_id())->chain_index();
-    };
-
-    const int len2 = len >> 1;
-
-    CiphertextVector lhs_l = slice(lhs, 0, len2);
-    CiphertextVector lhs_h = slice(lhs, len2);
-    CiphertextVector rhs_l = slice(rhs, 0, len2);
-    CiphertextVector rhs_h = slice(rhs, len2);
-
-    seal::Ciphertext term1 = *lower(lhs_h, rhs_h);
-    seal::Ciphertext h_equal = *equal(lhs_h, rhs_h);
-    seal::Ciphertext l_equal = *lower(lhs_l, rhs_l);
-
-    seal::Ciphertext term2;
-
-    if (get_level(l_equal) > get_level(h_equal)) {
-    } else if (get_level(l_equal) < get_level(h_equal)) {
-    }
-
-    evaluator->multiply(h_equal, l_equal, term2);
-    evaluator->relinearize_inplace(term2, relinKeys);
-
-    *result = XOR(term1, term2);
-    return result;
+std::unique_ptr<seal::Ciphertext> CardioBatched::lower(CiphertextSpan lhs,
+                                                       CiphertextSpan rhs) {
+    // the comparator computes each prefix term only once, instead of
+    // recomputing the equality of the upper halves on every recursion level
+    return std::make_unique<seal::Ciphertext>(comparator->lower(lhs, rhs));
 }
 
 seal::Ciphertext CardioBatched::XOR(seal::Ciphertext &lhs,
@@ -141,8 +108,8 @@ seal::Ciphertext CardioBatched::XOR(seal::Ciphertext &lhs,
     // see https://stackoverflow.com/a/46674398
     seal::Ciphertext result;
     evaluator->sub(lhs, rhs, result);
-    evaluator->square_inplace(result);
-    evaluator->relinearize_inplace(result, relinKeys);
+    relinearizer->square_inplace(result);
+    relinearizer->finish(result);
     return result;
 }
 
@@ -152,8 +119,8 @@ seal::Ciphertext CardioBatched::XOR(seal::Ciphertext &lhs,
     // see https://stackoverflow.com/a/46674398
     seal::Ciphertext result;
     evaluator->sub_plain(lhs, rhs, result);
-    evaluator->square_inplace(result);
-    evaluator->relinearize_inplace(result, relinKeys);
+    relinearizer->square_inplace(result);
+    relinearizer->finish(result);
     return result;
 }
 
@@ -298,138 +265,156 @@ namespace {
     }
 }  // namespace
 
-void CardioBatched::run_cardio() {
-    std::stringstream ss_time;
-
-    auto t0 = Time::now();
-    // poly_modulus_degree:
-    // - must be a power of two
-    // - determines the number of ciphertext slots
-    // - determines the max. of the sum of coeff_moduli bits
-    // setup_context_bfv(32768);
-    setup_context_bfv(16384);
-
-    auto t1 = Time::now();
-    log_time(ss_time, t0, t1, false);
-
-    auto t2 = Time::now();
-
-    // encode and encrypt keystream
-    // assumption: this keystream is known by client and server
-    std::vector<uint64_t> keystream = {121, 58, 242, 156, 29, 94,
-                                       136, 91, 227, 68, 251, 70,
-                                       212, 155, 223, 154, 221, 251};
-
-    // === client-side computation ====================================
-
-    // define input values
-    bool man = false;
-    bool antecedent = true;
-    bool smoking = true;
-    bool diabetic = true;
-    bool pressure = true;
-    uint64_t age = 55;
-    uint64_t hdl = 50;
-    uint64_t height = 80;
-    uint64_t phy_act = 45;
-    uint64_t drinking = 4;
-    uint64_t weight = 80;
-
+std::vector<uint64_t> cardio_fields(const Patient &patient) {
     // == Conditions ====
-    // F  +1  if man                                  && 50 < [age]
-    // T  +1  if antecedent                           && 0 < [1]
-    // T  +1  if smoking                              && 0 < [1]
-    // T  +1  if diabetic                             && 0 < [1]
-    // T  +1  if high blood pressure                  && 0 < [1]
-    // F  +1  if man                                  && 3 < [alc_consumption]
-    // T  +1  if (!man)                               && 2 < [alc_consumption]
-    // F  +1  if TRUE                                 && [HDL] < 40
-    // T  +1  if TRUE                                 && [height] < [weight+90]
-    // F  +1  if TRUE                                 && [phy_act] < 30
-
-    // encode and encrypt the inputs
+    // +1  if man                                  && 50 < [age]
+    // +1  if antecedent                           && 0 < [1]
+    // +1  if smoking                              && 0 < [1]
+    // +1  if diabetic                             && 0 < [1]
+    // +1  if high blood pressure                  && 0 < [1]
+    // +1  if man                                  && 3 < [alc_consumption]
+    // +1  if (!man)                               && 2 < [alc_consumption]
+    // +1  if TRUE                                 && [HDL] < 40
+    // +1  if TRUE                                 && [height] < [weight+90]
+    // +1  if TRUE                                 && [phy_act] < 30
     std::vector<uint64_t> in;
-    in.push_back(man);
-    in.push_back(antecedent);
-    in.push_back(smoking);
-    in.push_back(diabetic);
-    in.push_back(pressure);
-    in.push_back(man);
-    in.push_back(!man);
-    in.push_back(age);
+    in.push_back(patient.man);
+    in.push_back(patient.antecedent);
+    in.push_back(patient.smoking);
+    in.push_back(patient.diabetic);
+    in.push_back(patient.pressure);
+    in.push_back(patient.man);
+    in.push_back(!patient.man);
+    in.push_back(patient.age);
     in.push_back(1);
     in.push_back(1);
     in.push_back(1);
     in.push_back(1);
-    in.push_back(drinking);
-    in.push_back(drinking);
-    in.push_back(hdl);
-    in.push_back(height);
-    in.push_back(phy_act);
-    in.push_back(weight + 90);
+    in.push_back(patient.drinking);
+    in.push_back(patient.drinking);
+    in.push_back(patient.hdl);
+    in.push_back(patient.height);
+    in.push_back(patient.phy_act);
+    in.push_back(patient.weight + 90);
+    return in;
+}
 
-    seal::Ciphertext result = encode_and_encrypt(in);
+uint64_t cardio_risk(const Patient &patient) {
+    return (patient.man && 50 < patient.age) + patient.antecedent +
+           patient.smoking + patient.diabetic + patient.pressure +
+           (patient.man && 3 < patient.drinking) +
+           (!patient.man && 2 < patient.drinking) + (patient.hdl < 40) +
+           (patient.height < patient.weight + 90) + (patient.phy_act < 30);
+}
 
-    auto t3 = Time::now();
-    log_time(ss_time, t2, t3, false);
+std::size_t CardioBatched::records_per_ciphertext() {
+    // the rotations are cyclic within each of the two rows of the batching
+    // matrix, so a record must not cross from one row into the other
+    return 2 * ((encoder->slot_count() / 2) / RECORD_SLOTS);
+}
 
-    // // transmit data to server...
+std::size_t CardioBatched::record_offset(std::size_t record) {
+    const std::size_t per_row = records_per_ciphertext() / 2;
+    return (record / per_row) * (encoder->slot_count() / 2) +
+           (record % per_row) * RECORD_SLOTS;
+}
 
-    // // === server-side computation ====================================
+seal::Plaintext CardioBatched::encode_records(
+        const std::vector<std::vector<uint64_t>> &records) {
+    assert(("Too many records for one ciphertext!",
+            records.size() <= records_per_ciphertext()));
+    std::vector<uint64_t> slots(encoder->slot_count(), 0);
+    for (std::size_t r = 0; r < records.size(); ++r) {
+        assert(("Record does not fit into its slots!",
+                records[r].size() * NUM_BITS <= RECORD_SLOTS));
+        const std::size_t offset = record_offset(r);
+        for (std::size_t k = 0; k < records[r].size(); ++k) {
+            // most significant bit first, like encode
+            for (std::size_t i = 0; i < NUM_BITS; ++i) {
+                slots[offset + k * NUM_BITS + i] =
+                        (records[r][k] >> (NUM_BITS - 1 - i)) & 1;
+            }
+        }
+    }
+    seal::Plaintext encoded_records;
+    encoder->encode(slots, encoded_records);
+    return encoded_records;
+}
 
-    auto t4 = Time::now();
+seal::Plaintext CardioBatched::encode_replicated(std::vector<uint64_t> numbers) {
+    return encode_records(std::vector<std::vector<uint64_t>>(
+            records_per_ciphertext(), numbers));
+}
+
+seal::Plaintext CardioBatched::replicated_mask(std::size_t begin,
+                                               std::size_t end) {
+    std::vector<uint64_t> mask(encoder->slot_count(), 0);
+    for (std::size_t r = 0; r < records_per_ciphertext(); ++r) {
+        for (std::size_t i = begin; i < end; i++) mask[record_offset(r) + i] = 1;
+    }
+    seal::Plaintext mask_enc;
+    encoder->encode(mask, mask_enc);
+    return mask_enc;
+}
+
+const seal::Plaintext &CardioBatched::constant(
+        const std::string &name, const std::function<seal::Plaintext()> &make) {
+    // BFV plaintexts do not depend on the level
+    return constants.get(name, seal::parms_id_zero, 0,
+                         [&](seal::Plaintext &ptxt) { ptxt = make(); });
+}
+
+seal::Ciphertext CardioBatched::evaluate_cardio(seal::Ciphertext &result) {
+    // every record is processed in its own RECORD_SLOTS slots, with the same
+    // masks, constants and rotations as a single record: the masks and
+    // constants are repeated in every record, and no rotation moves a value
+    // that is used later on from one record into another
 
     // homomorphically execute the Kreyvium algorithm to decrypt data
     // seal::Plaintext ks = encode(keystream);
     // seal::Ciphertext result = XOR(inputs, ks);
 
+    levels->checkpoint("records", {&result});
+
     // create a copy of the input vector
     seal::Ciphertext bool_flags = result;
     // mask the flags
-    seal::Plaintext mask = encode({1, 1, 1, 1, 1, 1, 1}, bool_flags.parms_id());
+    const seal::Plaintext &mask = constant("mask", [&] { return encode_replicated({1, 1, 1, 1, 1, 1, 1}); });
     evaluator->multiply_plain_inplace(bool_flags, mask);
     // set 1 at bit positions 63, 71, 78 (required for batching scheme)
-    seal::Plaintext addendum =
-            encode({0, 0, 0, 0, 0, 0, 0, 1, 1, 1}, bool_flags.parms_id());
+    const seal::Plaintext &addendum = constant("addendum", [&] {
+        return encode_replicated({0, 0, 0, 0, 0, 0, 0, 1, 1, 1});
+    });
     evaluator->add_plain_inplace(bool_flags, addendum);
 
     // prepare b by adding missing values and extracting values for lhs of smaller
     // equation
-    std::vector<uint64_t> mask_b(encoder->slot_count(), 0);
-    for (size_t i = 112; i < 112 + 3 * NUM_BITS; i++) mask_b[i] = 1;
-    seal::Plaintext mask_b_enc;
-    encoder->encode(mask_b, mask_b_enc);
+    const seal::Plaintext &mask_b_enc = constant("mask_b", [&] { return replicated_mask(112, 112 + 3 * NUM_BITS); });
     seal::Ciphertext b;
     evaluator->multiply_plain(result, mask_b_enc, b);
-    evaluator->relinearize_inplace(b, relinKeys);
     evaluator->rotate_rows_inplace(b, 56, galoisKeys);
     // merge with the constants that are not given as inputs
-    seal::Plaintext const_b = encode({50, 0, 0, 0, 0, 3, 2}, b.parms_id());
+    const seal::Plaintext &const_b = constant("const_b", [&] { return encode_replicated({50, 0, 0, 0, 0, 3, 2}); });
     evaluator->add_plain_inplace(b, const_b);
 
     // prepare c by adding missing values and extracting values for rhs of smaller
     // equation
-    std::vector<uint64_t> mask_c(encoder->slot_count(), 0);
-    for (size_t i = 56; i < 56 + 7 * NUM_BITS; i++) mask_c[i] = 1;
-    seal::Plaintext mask_c_enc;
-    encoder->encode(mask_c, mask_c_enc);
+    const seal::Plaintext &mask_c_enc = constant("mask_c", [&] { return replicated_mask(56, 56 + 7 * NUM_BITS); });
     seal::Ciphertext c;
     evaluator->multiply_plain(result, mask_c_enc, c);
-    evaluator->relinearize_inplace(c, relinKeys);
     evaluator->rotate_rows_inplace(c, 56, galoisKeys);
     // merge with the constants that are not given as inputs
-    seal::Plaintext const_c =
-            encode({0, 0, 0, 0, 0, 0, 0, 40, 0, 30}, c.parms_id());
+    const seal::Plaintext &const_c = constant("const_c", [&] {
+        return encode_replicated({0, 0, 0, 0, 0, 0, 0, 40, 0, 30});
+    });
     evaluator->add_plain_inplace(c, const_c);
 
     // extract and merge weight+90 into other values in ciphertext c
-    std::vector<uint64_t> mask_weight90(encoder->slot_count(), 0);
-    for (size_t i = 136; i < 136 + 1 * NUM_BITS; i++) mask_weight90[i] = 1;
-    seal::Plaintext mask_weight90_enc;
-    encoder->encode(mask_weight90, mask_weight90_enc);
+    const seal::Plaintext &mask_weight90_enc = constant("mask_weight90", [&] {
+        return replicated_mask(136, 136 + 1 * NUM_BITS);
+    });
     seal::Ciphertext weight90;
     evaluator->multiply_plain(result, mask_weight90_enc, weight90);
-    evaluator->relinearize_inplace(weight90, relinKeys);
     evaluator->rotate_rows_inplace(weight90, 72, galoisKeys);
     evaluator->add_inplace(c, weight90);
 
@@ -437,16 +422,29 @@ void CardioBatched::run_cardio() {
     // values, i.e., (index+1) mod 8 == 0 contains index-th input
     std::vector<seal::Ciphertext> b_encoded = split_by_binary_rep(b);
     std::vector<seal::Ciphertext> c_encoded = split_by_binary_rep(c);
+    std::vector<seal::Ciphertext *> bits;
+    for (std::size_t i = 0; i < b_encoded.size(); ++i) {
+        bits.push_back(&b_encoded[i]);
+        bits.push_back(&c_encoded[i]);
+    }
+    levels->checkpoint("bits", bits);
 
     // lower_result := b_encoded < c_encoded
     seal::Ciphertext lower_result = *lower(b_encoded, c_encoded);
+    std::cout << "Comparison: " << comparator->stats().multiplications
+              << " multiplications, " << comparator->stats().relinearizations
+              << " relinearizations, depth " << comparator->stats().depth
+              << std::endl;
 
     // condition_result := bool_flags & lower_result
+    levels->checkpoint("condition", {&bool_flags, &lower_result});
     seal::Ciphertext condition_result;
-    evaluator->multiply(bool_flags, lower_result, condition_result);
-    evaluator->relinearize_inplace(condition_result, relinKeys);
+    relinearizer->multiply(bool_flags, lower_result, condition_result);
+    // rotations need a relinearized ciphertext
+    relinearizer->finish(condition_result);
 
     // perform sum & rotate to compute the result of the cardio program
+    // (only reads slots 7..127 of each record, so the sums stay per record)
     seal::Ciphertext rot8, rot4, rot2, final_result;
     evaluator->rotate_rows(condition_result, 8 * NUM_BITS, galoisKeys, rot8);
     evaluator->add_inplace(rot8, condition_result);
@@ -456,22 +454,138 @@ void CardioBatched::run_cardio() {
     evaluator->add_inplace(rot2, rot4);
     evaluator->rotate_rows(rot2, 1 * NUM_BITS, galoisKeys, final_result);
     evaluator->add_inplace(final_result, rot2);
+    // the result only has to be decrypted, less primes are cheaper to send back
+    levels->checkpoint("result", {&final_result});
+    return final_result;
+}
+
+void CardioBatched::calibrate_levels(const seal::Ciphertext &records) {
+    seal::Ciphertext sample = records;
+    levels->start_calibration(*decryptor);
+    seal::Ciphertext result = evaluate_cardio(sample);
+    levels->finish_calibration({&result});
+    levels->print_levels(std::cout);
+}
+
+void CardioBatched::run_cardio(std::size_t num_records, bool manage_levels) {
+    std::stringstream ss_time;
+
+    auto t0 = Time::now();
+    // poly_modulus_degree:
+    // - must be a power of two
+    // - determines the number of ciphertext slots
+    // - determines the max. of the sum of coeff_moduli bits
+    // setup_context_bfv(32768);
+    setup_context_bfv(16384);
+
+    auto t1 = Time::now();
+    log_time(ss_time, t0, t1, false);
+
+    auto t2 = Time::now();
+
+    // encode and encrypt keystream
+    // assumption: this keystream is known by client and server
+    std::vector<uint64_t> keystream = {121, 58, 242, 156, 29, 94,
+                                       136, 91, 227, 68, 251, 70,
+                                       212, 155, 223, 154, 221, 251};
+
+    // === client-side computation ====================================
+
+    // define input values, the first patient is the fixed example with risk 6
+    std::vector<Patient> patients;
+    Patient example;
+    example.man = false;
+    example.antecedent = true;
+    example.smoking = true;
+    example.diabetic = true;
+    example.pressure = true;
+    example.age = 55;
+    example.hdl = 50;
+    example.height = 80;
+    example.phy_act = 45;
+    example.drinking = 4;
+    example.weight = 80;
+    patients.push_back(example);
+    // all other patients are random, but reproducible (all values fit into NUM_BITS bits)
+    std::mt19937 rng(42);
+    auto uniform = [&](uint64_t min, uint64_t max) {
+        return std::uniform_int_distribution<uint64_t>(min, max)(rng);
+    };
+    while (patients.size() < num_records) {
+        Patient p;
+        p.man = uniform(0, 1);
+        p.antecedent = uniform(0, 1);
+        p.smoking = uniform(0, 1);
+        p.diabetic = uniform(0, 1);
+        p.pressure = uniform(0, 1);
+        p.age = uniform(20, 90);
+        p.hdl = uniform(20, 90);
+        p.height = uniform(140, 200);
+        p.phy_act = uniform(0, 90);
+        p.drinking = uniform(0, 10);
+        p.weight = uniform(40, 120);
+        patients.push_back(p);
+    }
+
+    // encode and encrypt the inputs, records_per_ciphertext() patients per ciphertext
+    const std::size_t per_ciphertext = records_per_ciphertext();
+    std::vector<seal::Ciphertext> inputs;
+    for (std::size_t begin = 0; begin < patients.size(); begin += per_ciphertext) {
+        std::vector<std::vector<uint64_t>> records;
+        for (std::size_t r = begin; r < std::min(begin + per_ciphertext, patients.size()); ++r) {
+            records.push_back(cardio_fields(patients[r]));
+        }
+        seal::Ciphertext encrypted_records(*context);
+        encryptor->encrypt(encode_records(records), encrypted_records);
+        inputs.push_back(encrypted_records);
+    }
+
+    auto t3 = Time::now();
+    log_time(ss_time, t2, t3, false);
+
+    // // transmit data to server...
+
+    // // === server-side computation ====================================
+
+    // one-time calibration (like the parameter selection), not part of the
+    // timed evaluation
+    if (manage_levels) {
+        calibrate_levels(inputs[0]);
+    }
+
+    auto t4 = Time::now();
+
+    std::vector<seal::Ciphertext> final_results;
+    for (auto &input : inputs) {
+        final_results.push_back(evaluate_cardio(input));
+    }
 
     auto t5 = Time::now();
     log_time(ss_time, t4, t5, false);
 
     auto t6 = Time::now();
 
-    // retrieve the final result (ciphertext slot 7)
-    seal::Plaintext p;
-    decryptor->decrypt(final_result, p);
-    std::vector<uint64_t> dec;
-    encoder->decode(p, dec);
-    uint64_t risk_value = dec[7];
-    std::cout << "Result: " << risk_value << std::endl;
+    // retrieve the final results (ciphertext slot 7 of each record)
+    std::vector<uint64_t> risk_values;
+    for (auto &final_result : final_results) {
+        seal::Plaintext p;
+        decryptor->decrypt(final_result, p);
+        std::vector<uint64_t> dec;
+        encoder->decode(p, dec);
+        for (std::size_t r = 0; r < per_ciphertext && risk_values.size() < patients.size(); ++r) {
+            risk_values.push_back(dec[record_offset(r) + 7]);
+        }
+    }
+    std::cout << "Result: " << risk_values[0] << std::endl;
+    if (patients.size() > 1) {
+        std::cout << "Scored " << patients.size() << " patients in "
+                  << inputs.size() << " ciphertext(s)" << std::endl;
+    }
 
-    assert(
-            ("Cardio benchmark does not produce expected result!", risk_value == 6));
+    for (std::size_t r = 0; r < patients.size(); ++r) {
+        assert(("Cardio benchmark does not produce expected result!",
+                risk_values[r] == cardio_risk(patients[r])));
+    }
 
     auto t7 = Time::now();
     log_time(ss_time, t6, t7, true);
@@ -495,35 +609,30 @@ std::unique_ptr<seal::Ciphertext> CardioBatched::multvect(
     const int size = bitvec.size();
     for (std::size_t k = 1; k < size; k *= 2) {
         for (std::size_t i = 0; i < size - k; i += 2 * k) {
-            evaluator->multiply_inplace(bitvec[i], bitvec[i + k]);
-            evaluator->relinearize_inplace(bitvec[i], relinKeys);
+            relinearizer->multiply_inplace(bitvec[i], bitvec[i + k]);
         }
     }
-    return std::make_unique<seal::Ciphertext>(bitvec[0]);
+    relinearizer->finish(bitvec[0]);
+    return std::make_unique<seal::Ciphertext>(std::move(bitvec[0]));
 }
 
-std::unique_ptr<seal::Ciphertext> CardioBatched::equal(CiphertextVector &lhs,
-                                                       CiphertextVector &rhs) {
-    assert(("equal supports same-sized inputs only!", lhs.size() == rhs.size()));
-
-    CiphertextVector comp;
-    for (std::size_t i = 0; i < lhs.size(); ++i) {
-        seal::Ciphertext tmp;
-        tmp = XOR(lhs[i], rhs[i]);
-
-        seal::Plaintext one;
-        std::vector<uint64_t> all_ones(encoder->slot_count(), 1);
-        encoder->encode(all_ones, one);
-
-        tmp = XOR(tmp, one);
-        comp.push_back(tmp);
-    }
-    std::unique_ptr<seal::Ciphertext> mv_result = multvect(comp);
-    return mv_result;
+std::unique_ptr<seal::Ciphertext> CardioBatched::equal(CiphertextSpan lhs,
+                                                       CiphertextSpan rhs) {
+    return std::make_unique<seal::Ciphertext>(comparator->equal(lhs, rhs));
 }
 
 int main(int argc, char *argv[]) {
     std::cout << "Starting benchmark 'cardio-batched-bfv'..." << std::endl;
-    CardioBatched().run_cardio();
+    // Number of patients to score, packed into as few ciphertexts as possible
+    std::size_t num_records = 1;
+    auto num_records_env = std::getenv("NUM_RECORDS");
+    if (num_records_env != nullptr) {
+        num_records = std::max(1, std::atoi(num_records_env));
+    }
+    // Set AUTO_MOD_SWITCH=0 to evaluate everything at the full modulus chain
+    auto auto_mod_switch_env = std::getenv("AUTO_MOD_SWITCH");
+    bool manage_levels = auto_mod_switch_env == nullptr ||
+                         std::string(auto_mod_switch_env) != "0";
+    CardioBatched().run_cardio(num_records, manage_levels);
     return 0;
 }
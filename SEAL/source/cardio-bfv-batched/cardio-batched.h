@@ -19,12 +19,42 @@
 #include <random>
 #include <vector>
 
+#include "../ciphertext_span.h"
+#include "../lazy_relinearizer.h"
+#include "../level_manager.h"
+#include "../plaintext_cache.h"
+#include "comparator.h"
+
 #define NUM_BITS 8
 
+/// number of slots of one patient record: 18 fields of NUM_BITS bits each
+#define RECORD_SLOTS (18 * NUM_BITS)
+
 typedef std::vector<seal::Ciphertext> CiphertextVector;
 typedef std::chrono::high_resolution_clock Time;
 typedef std::chrono::milliseconds ms;
 
+/// inputs of one patient
+struct Patient {
+    bool man = false;
+    bool antecedent = false;
+    bool smoking = false;
+    bool diabetic = false;
+    bool pressure = false;
+    uint64_t age = 0;
+    uint64_t hdl = 0;
+    uint64_t height = 0;
+    uint64_t phy_act = 0;
+    uint64_t drinking = 0;
+    uint64_t weight = 0;
+};
+
+/// the 18 fields of a record, in the order of their slots
+std::vector<uint64_t> cardio_fields(const Patient &patient);
+
+/// plaintext reference of the risk score
+uint64_t cardio_risk(const Patient &patient);
+
 class CardioBatched {
 private:
     /// the seal context, i.e. object that holds params/etc
@@ -47,6 +77,18 @@ private:
     std::unique_ptr<seal::Decryptor> decryptor;
     std::unique_ptr<seal::BatchEncoder> encoder;
 
+    /// depth-optimal comparison circuits for lower and equal
+    std::unique_ptr<BitComparator> comparator;
+
+    /// multiplications that only relinearize when the product is used again
+    std::unique_ptr<LazyRelinearizer> relinearizer;
+
+    /// switches the intermediate results of evaluate_cardio down the modulus chain
+    std::unique_ptr<LevelManager> levels;
+
+    /// masks and constants of evaluate_cardio, encoded once for all ciphertexts
+    PlaintextCache constants;
+
     void print_vec(seal::Ciphertext &ctxt);
 
     void print_ciphertext(std::string name, seal::Ciphertext &ctxt);
@@ -65,10 +107,39 @@ private:
 
     seal::Ciphertext XOR(seal::Ciphertext &lhs, seal::Plaintext &rhs);
 
+    /// number of records that fit into one ciphertext
+    std::size_t records_per_ciphertext();
+
+    /// first slot of the given record
+    std::size_t record_offset(std::size_t record);
+
+    /// encodes the numbers of each record bitwise, starting at its offset
+    seal::Plaintext encode_records(const std::vector<std::vector<uint64_t>> &records);
+
+    /// encodes the same numbers into every record
+    seal::Plaintext encode_replicated(std::vector<uint64_t> numbers);
+
+    /// mask with ones in slots [begin, end) of every record
+    seal::Plaintext replicated_mask(std::size_t begin, std::size_t end);
+
+    /// the constant with the given name, encoded by make on first use
+    const seal::Plaintext &constant(const std::string &name,
+                                    const std::function<seal::Plaintext()> &make);
+
+    /// computes the risk scores of all records of the ciphertext, each ends up
+    /// in slot 7 of its record
+    seal::Ciphertext evaluate_cardio(seal::Ciphertext &records);
+
+    /// runs evaluate_cardio once on a copy of records to select the levels of
+    /// its intermediate results
+    void calibrate_levels(const seal::Ciphertext &records);
+
 public:
     void setup_context_bfv(std::size_t poly_modulus_degree);
 
-    void run_cardio();
+    /// \param manage_levels whether to calibrate and switch the intermediate
+    /// results to lower levels before the timed evaluation
+    void run_cardio(std::size_t num_records = 1, bool manage_levels = true);
 
     seal::Ciphertext encode_and_encrypt(std::vector<uint64_t> number);
 
@@ -77,17 +148,20 @@ public:
     seal::Plaintext encode(std::vector<uint64_t> numbers,
                            seal::parms_id_type parms_id);
 
-    std::unique_ptr<seal::Ciphertext> equal(CiphertextVector &lhs,
-                                            CiphertextVector &rhs);
+    std::unique_ptr<seal::Ciphertext> equal(CiphertextSpan lhs,
+                                            CiphertextSpan rhs);
 
-    CiphertextVector slice(CiphertextVector ctxt, int idx_begin, int idx_end);
+    /// View of the bits [idx_begin, idx_end), no ciphertexts are copied
+    CiphertextSpan slice(CiphertextSpan ctxt, int idx_begin, int idx_end);
 
-    CiphertextVector slice(CiphertextVector ctxt, int idx_begin);
+    /// View of the bits from idx_begin on, no ciphertexts are copied
+    CiphertextSpan slice(CiphertextSpan ctxt, int idx_begin);
 
+    /// Multiplies all bits, consumes bitvec (pass it with std::move to avoid copying it)
     std::unique_ptr<seal::Ciphertext> multvect(CiphertextVector bitvec);
 
-    std::unique_ptr<seal::Ciphertext> lower(CiphertextVector &lhs,
-                                            CiphertextVector &rhs);
+    std::unique_ptr<seal::Ciphertext> lower(CiphertextSpan lhs,
+                                            CiphertextSpan rhs);
 
     std::vector<seal::Ciphertext> split_by_binary_rep(seal::Ciphertext &ctxt);
 
@@ -0,0 +1,107 @@
+#include "comparator.h"
+
+#include <algorithm>
+#include <cassert>
+
+BitComparator::BitComparator(seal::Evaluator &evaluator, seal::BatchEncoder &encoder,
+                             const seal::RelinKeys &relin_keys)
+        : evaluator(evaluator), relinearizer(evaluator, relin_keys) {
+    std::vector<uint64_t> all_ones(encoder.slot_count(), 1);
+    encoder.encode(all_ones, one);
+}
+
+const BitComparator::Stats &BitComparator::stats() const {
+    return last_stats;
+}
+
+BitComparator::Term BitComparator::multiply(const seal::Ciphertext &lhs, const seal::Ciphertext &rhs) {
+    Term result;
+    relinearizer.multiply(lhs, rhs, result.ctxt);
+    result.depth = 1;
+    last_stats.multiplications++;
+    return result;
+}
+
+BitComparator::Term BitComparator::multiply(Term &lhs, Term &rhs) {
+    Term result;
+    relinearizer.multiply(lhs.ctxt, rhs.ctxt, result.ctxt);
+    result.depth = std::max(lhs.depth, rhs.depth) + 1;
+    last_stats.multiplications++;
+    return result;
+}
+
+BitComparator::Segment BitComparator::compare(CiphertextSpan lhs, CiphertextSpan rhs,
+                                              bool need_lower, bool need_equal) {
+    assert(lhs.size() == rhs.size() && !lhs.empty() && "comparison supports same-sized, non-empty inputs only!");
+    last_stats = Stats();
+    const std::size_t relinearizations_before = relinearizer.relinearizations();
+
+    // The equality of the lowest segment is only used for the equality of the whole number
+    auto equal_needed = [&](std::size_t segment) { return need_equal || segment != 0; };
+
+    // One segment per bit position
+    std::vector<Segment> segments(lhs.size());
+    for (std::size_t i = 0; i < lhs.size(); ++i) {
+        if (equal_needed(i)) {
+            // E_i = 1 - (a_i - b_i)^2
+            seal::Ciphertext diff;
+            evaluator.sub(lhs[i], rhs[i], diff);
+            Term square = multiply(diff, diff);
+            evaluator.negate_inplace(square.ctxt);
+            evaluator.add_plain_inplace(square.ctxt, one);
+            segments[i].equal = std::move(square);
+        }
+        if (need_lower) {
+            // L_i = (1 - a_i) * b_i
+            seal::Ciphertext not_lhs;
+            evaluator.negate(lhs[i], not_lhs);
+            evaluator.add_plain_inplace(not_lhs, one);
+            segments[i].lower = multiply(not_lhs, rhs[i]);
+        }
+    }
+
+    // Merge adjacent segments, each level halves their number
+    while (segments.size() > 1) {
+        std::vector<Segment> merged((segments.size() + 1) / 2);
+        for (std::size_t j = 0; j < merged.size(); ++j) {
+            if (2 * j + 1 == segments.size()) {
+                // Odd one out, moves up a level unchanged
+                merged[j] = std::move(segments[2 * j]);
+                continue;
+            }
+            Segment &low = segments[2 * j];
+            Segment &high = segments[2 * j + 1];
+            if (need_lower) {
+                // L = L_H + E_H * L_Lo, adding the unrelinearized L_H is fine
+                merged[j].lower = multiply(high.equal, low.lower);
+                evaluator.add_inplace(merged[j].lower.ctxt, high.lower.ctxt);
+                merged[j].lower.depth = std::max(merged[j].lower.depth, high.lower.depth);
+            }
+            if (equal_needed(j)) {
+                // E = E_H * E_Lo
+                merged[j].equal = multiply(high.equal, low.equal);
+            }
+        }
+        segments = std::move(merged);
+    }
+
+    // only the terms that leave the comparator have to be relinearized
+    if (need_lower) {
+        relinearizer.finish(segments[0].lower.ctxt);
+    }
+    if (need_equal) {
+        relinearizer.finish(segments[0].equal.ctxt);
+    }
+    last_stats.relinearizations = relinearizer.relinearizations() - relinearizations_before;
+    last_stats.depth = std::max(need_lower ? segments[0].lower.depth : 0,
+                                need_equal ? segments[0].equal.depth : 0);
+    return std::move(segments[0]);
+}
+
+seal::Ciphertext BitComparator::lower(CiphertextSpan lhs, CiphertextSpan rhs) {
+    return compare(lhs, rhs, true, false).lower.ctxt;
+}
+
+seal::Ciphertext BitComparator::equal(CiphertextSpan lhs, CiphertextSpan rhs) {
+    return compare(lhs, rhs, false, true).equal.ctxt;
+}
@@ -0,0 +1,88 @@
+#ifndef CARDIO_BATCHED_COMPARATOR_H_
+#define CARDIO_BATCHED_COMPARATOR_H_
+
+#include <seal/seal.h>
+
+#include <cstddef>
+#include <vector>
+
+#include "../ciphertext_span.h"
+#include "../lazy_relinearizer.h"
+
+/// Comparison circuits on bit vectors of BFV ciphertexts with one bit per slot.
+/// The bits are given least significant first, i.e. as returned by CardioBatched::split_by_binary_rep.
+///
+/// The comparison is computed as a parallel-prefix circuit: every bit position i is a segment with an equality
+/// term E_i = !(a_i ^ b_i) and a less-than term L_i = !a_i & b_i. Two adjacent segments (high H, low Lo) are merged
+/// into one with E = E_H & E_Lo and L = L_H | (E_H & L_Lo), where the | is an addition since both sides are never
+/// true at once. Merging the segments pairwise in a balanced tree computes every term exactly once, so a comparison
+/// of n-bit numbers takes depth 1 + ceil(log2(n)). The equality terms of the lowest segment of each level are only
+/// needed for the equality of the whole number, so lower() skips them.
+/// Products are relinearized lazily: the L_H terms are only added, so they are never relinearized on their own.
+class BitComparator {
+public:
+    /// Cost of the last comparison
+    struct Stats {
+        /// Number of ciphertext-ciphertext multiplications (including squarings)
+        std::size_t multiplications = 0;
+
+        /// Number of relinearizations, at most one per multiplication
+        std::size_t relinearizations = 0;
+
+        /// Multiplicative depth of the result, relative to the inputs
+        std::size_t depth = 0;
+    };
+
+    /// \param evaluator Evaluator of the context of the inputs
+    /// \param encoder Encoder of the context of the inputs, used once to encode the all-ones plaintext
+    /// \param relin_keys Keys to relinearize products before they are multiplied again or returned
+    BitComparator(seal::Evaluator &evaluator, seal::BatchEncoder &encoder, const seal::RelinKeys &relin_keys);
+
+    /// Computes lhs < rhs slot-wise
+    /// \param lhs Bits of the left-hand side, least significant first
+    /// \param rhs Bits of the right-hand side, same number as lhs
+    /// \return 1 in the slots where lhs < rhs, 0 elsewhere
+    seal::Ciphertext lower(CiphertextSpan lhs, CiphertextSpan rhs);
+
+    /// Computes lhs == rhs slot-wise
+    /// \param lhs Bits of the left-hand side, least significant first
+    /// \param rhs Bits of the right-hand side, same number as lhs
+    /// \return 1 in the slots where lhs == rhs, 0 elsewhere
+    seal::Ciphertext equal(CiphertextSpan lhs, CiphertextSpan rhs);
+
+    /// Multiplications and depth of the last call to lower or equal
+    const Stats &stats() const;
+
+private:
+    /// A ciphertext with its multiplicative depth
+    struct Term {
+        seal::Ciphertext ctxt;
+        std::size_t depth = 0;
+    };
+
+    /// Comparison of a range of bit positions, terms that are not needed are left empty (depth 0)
+    struct Segment {
+        Term equal;
+        Term lower;
+    };
+
+    seal::Evaluator &evaluator;
+
+    LazyRelinearizer relinearizer;
+
+    seal::Plaintext one;
+
+    Stats last_stats;
+
+    /// lhs * rhs of two input bits (squares if both are the same object), not relinearized
+    Term multiply(const seal::Ciphertext &lhs, const seal::Ciphertext &rhs);
+
+    /// lhs * rhs of two terms, which are relinearized in place first if needed, the product is not relinearized
+    Term multiply(Term &lhs, Term &rhs);
+
+    /// Merges the segments of all bit positions, need_equal selects whether the equality of the whole number is needed
+    Segment compare(CiphertextSpan lhs, CiphertextSpan rhs,
+                    bool need_lower, bool need_equal);
+};
+
+#endif  // CARDIO_BATCHED_COMPARATOR_H_
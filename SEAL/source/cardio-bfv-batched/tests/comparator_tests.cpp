@@ -0,0 +1,123 @@
+#include "gtest/gtest.h"
+#include "../comparator.h"
+
+#include <random>
+#include <utility>
+
+using namespace std;
+using namespace seal;
+
+namespace BitComparatorTests {
+
+    /**
+     * \brief Pairs of nb_bits wide values to compare, one per slot: first the boundary cases (0 and max against each
+     *  other and themselves, equal values, neighbours), then random pairs, half of them equal
+     * \param nb_bits Width of the values
+     * \param slot_count Number of pairs
+     */
+    vector<pair<uint64_t, uint64_t>> test_pairs(size_t nb_bits, size_t slot_count) {
+        const uint64_t max = (uint64_t(1) << nb_bits) - 1;
+        vector<pair<uint64_t, uint64_t>> pairs = {{0, 0}, {0, max}, {max, 0}, {max, max}};
+        for (uint64_t x = 0; x <= max && x < 64; ++x) {
+            pairs.emplace_back(x, x);
+            if (x < max) {
+                pairs.emplace_back(x, x + 1);
+                pairs.emplace_back(x + 1, x);
+            }
+        }
+
+        mt19937 rng(nb_bits);
+        uniform_int_distribution<uint64_t> value(0, max);
+        while (pairs.size() < slot_count) {
+            const uint64_t x = value(rng);
+            pairs.emplace_back(x, pairs.size() % 2 ? x : value(rng));
+        }
+        pairs.resize(slot_count);
+        return pairs;
+    }
+
+    /**
+     * \brief Helper function to test the comparator: encrypts the bits of the pairs from test_pairs (least significant
+     *  first, one pair per slot), compares them and checks every slot against the plaintext < and ==
+     * \param nb_bits Width of the values
+     */
+    void ComparatorTest(size_t nb_bits) {
+        // Setup SEAL Parameters
+        const size_t poly_modulus_degree = 8192;
+        EncryptionParameters params(scheme_type::bfv);
+        params.set_poly_modulus_degree(poly_modulus_degree);
+        params.set_coeff_modulus(CoeffModulus::BFVDefault(poly_modulus_degree));
+        params.set_plain_modulus(PlainModulus::Batching(poly_modulus_degree, 20));
+        SEALContext context(params);
+
+        // Generate required keys
+        KeyGenerator keygen(context);
+        auto secret_key = keygen.secret_key();
+        RelinKeys relin_keys;
+        keygen.create_relin_keys(relin_keys);
+
+        BatchEncoder encoder(context);
+        Encryptor encryptor(context, secret_key);
+        Decryptor decryptor(context, secret_key);
+        Evaluator evaluator(context);
+
+        const auto pairs = test_pairs(nb_bits, encoder.slot_count());
+        vector<Ciphertext> lhs(nb_bits), rhs(nb_bits);
+        for (size_t i = 0; i < nb_bits; ++i) {
+            vector<uint64_t> lhs_bits(pairs.size()), rhs_bits(pairs.size());
+            for (size_t s = 0; s < pairs.size(); ++s) {
+                lhs_bits[s] = (pairs[s].first >> i) & 1;
+                rhs_bits[s] = (pairs[s].second >> i) & 1;
+            }
+            Plaintext ptxt;
+            encoder.encode(lhs_bits, ptxt);
+            encryptor.encrypt_symmetric(ptxt, lhs[i]);
+            encoder.encode(rhs_bits, ptxt);
+            encryptor.encrypt_symmetric(ptxt, rhs[i]);
+        }
+
+        BitComparator comparator(evaluator, encoder, relin_keys);
+        size_t expected_depth = 1;
+        while ((size_t(1) << (expected_depth - 1)) < nb_bits) {
+            expected_depth++;
+        }
+
+        auto decrypt = [&](const Ciphertext &ctxt) {
+            EXPECT_EQ(ctxt.size(), 2u);
+            EXPECT_GT(decryptor.invariant_noise_budget(ctxt), 0);
+            Plaintext ptxt;
+            decryptor.decrypt(ctxt, ptxt);
+            vector<uint64_t> slots;
+            encoder.decode(ptxt, slots);
+            return slots;
+        };
+
+        const auto lower = decrypt(comparator.lower(lhs, rhs));
+        EXPECT_EQ(comparator.stats().depth, expected_depth);
+        const auto equal = decrypt(comparator.equal(lhs, rhs));
+        EXPECT_EQ(comparator.stats().depth, expected_depth);
+
+        for (size_t s = 0; s < pairs.size(); ++s) {
+            const auto &p = pairs[s];
+            EXPECT_EQ(lower[s], p.first < p.second ? 1u : 0u) << p.first << " < " << p.second << " in slot " << s;
+            EXPECT_EQ(equal[s], p.first == p.second ? 1u : 0u) << p.first << " == " << p.second << " in slot " << s;
+        }
+    }
+
+    TEST(BitComparatorTest, SingleBit) {
+        ComparatorTest(1);
+    }
+
+    TEST(BitComparatorTest, OddWidth) {
+        // 3 segments, the last one moves up a level unmerged
+        ComparatorTest(3);
+    }
+
+    TEST(BitComparatorTest, Byte) {
+        ComparatorTest(8);
+    }
+
+    TEST(BitComparatorTest, NonPowerOfTwoWidth) {
+        ComparatorTest(11);
+    }
+}
@@ -136,14 +136,15 @@ std::unique_ptr<seal::Ciphertext> Cardio::multvect(CiphertextVector bitvec) {
             evaluator->relinearize(bitvec[i], relinKeys, bitvec[i]);
         }
     }
-    return std::make_unique<seal::Ciphertext>(bitvec[0]);
+    return std::make_unique<seal::Ciphertext>(std::move(bitvec[0]));
 }
 
-std::unique_ptr<seal::Ciphertext> Cardio::equal(CiphertextVector lhs,
-                                                CiphertextVector rhs) {
+std::unique_ptr<seal::Ciphertext> Cardio::equal(CiphertextSpan lhs,
+                                                CiphertextSpan rhs) {
     assert(("equal supports same-sized inputs only!", lhs.size() == rhs.size()));
 
     CiphertextVector comp;
+    comp.reserve(lhs.size());
     for (std::size_t i = 0; i < lhs.size(); ++i) {
         seal::Ciphertext tmp;
         evaluator->add(lhs[i], rhs[i], tmp);
@@ -154,9 +155,9 @@ std::unique_ptr<seal::Ciphertext> Cardio::equal(CiphertextVector lhs,
         encoder->encode(one_vec, one_ptxt);
         encryptor->encrypt(one_ptxt, one);
         evaluator->add(tmp, one, tmp); // negate tmp
-        comp.push_back(tmp);
+        comp.push_back(std::move(tmp));
     }
-    return multvect(comp);
+    return multvect(std::move(comp));
 }
 
 void Cardio::print_ciphertext(std::string name, seal::Ciphertext &ctxt) {
@@ -169,7 +170,7 @@ void Cardio::print_ciphertext(std::string name, seal::Ciphertext &ctxt) {
 }
 
 /// Implements a ripple carry adder.
-CiphertextVector Cardio::add(CiphertextVector lhs, CiphertextVector rhs) {
+CiphertextVector Cardio::add(CiphertextSpan lhs, CiphertextSpan rhs) {
     auto size = lhs.size();
 
     seal::Ciphertext zero;
@@ -230,23 +231,22 @@ CiphertextVector Cardio::add(CiphertextVector lhs, CiphertextVector rhs) {
     return res;
 }
 
-CiphertextVector Cardio::slice(CiphertextVector ctxt, int idx_begin,
-                               int idx_end) {
-    return CiphertextVector(ctxt.begin() + idx_begin, ctxt.begin() + idx_end);
+CiphertextSpan Cardio::slice(CiphertextSpan ctxt, int idx_begin,
+                             int idx_end) {
+    return ctxt.subspan(idx_begin, idx_end - idx_begin);
 }
 
-CiphertextVector Cardio::slice(CiphertextVector ctxt, int idx_begin) {
-    return CiphertextVector(ctxt.begin() + idx_begin, ctxt.end());
+CiphertextSpan Cardio::slice(CiphertextSpan ctxt, int idx_begin) {
+    return ctxt.subspan(idx_begin);
 }
 
 // return lhs < rhs
-std::unique_ptr<seal::Ciphertext> Cardio::lower(CiphertextVector &lhs,
-                                                CiphertextVector &rhs) {
-    std::unique_ptr<seal::Ciphertext> result =
-            std::make_unique<seal::Ciphertext>();
-
+std::unique_ptr<seal::Ciphertext> Cardio::lower(CiphertextSpan lhs,
+                                                CiphertextSpan rhs) {
     const int len = lhs.size();
     if (len == 1) {
+        std::unique_ptr<seal::Ciphertext> result =
+                std::make_unique<seal::Ciphertext>();
         seal::Ciphertext one;
         std::size_t slot_count = encoder->slot_count();
         std::vector<uint64_t> one_vec(slot_count, 1ULL);
@@ -263,18 +263,18 @@ std::unique_ptr<seal::Ciphertext> Cardio::lower(CiphertextVector &lhs,
 
     const int len2 = len >> 1;
 
-    CiphertextVector lhs_l = slice(lhs, 0, len2);
-    CiphertextVector lhs_h = slice(lhs, len2);
+    CiphertextSpan lhs_l = slice(lhs, 0, len2);
+    CiphertextSpan lhs_h = slice(lhs, len2);
 
-    CiphertextVector rhs_l = slice(rhs, 0, len2);
-    CiphertextVector rhs_h = slice(rhs, len2);
+    CiphertextSpan rhs_l = slice(rhs, 0, len2);
+    CiphertextSpan rhs_h = slice(rhs, len2);
 
-    seal::Ciphertext term1 = *lower(lhs_h, rhs_h);
-    seal::Ciphertext term2;
-    evaluator->multiply(*equal(lhs_h, rhs_h), *lower(lhs_l, rhs_l), term2);
-    evaluator->relinearize(term2, relinKeys, term2);
-    evaluator->add(term1, term2, *result);
-    return result;
+    std::unique_ptr<seal::Ciphertext> term1 = lower(lhs_h, rhs_h);
+    std::unique_ptr<seal::Ciphertext> term2 = equal(lhs_h, rhs_h);
+    evaluator->multiply_inplace(*term2, *lower(lhs_l, rhs_l));
+    evaluator->relinearize_inplace(*term2, relinKeys);
+    evaluator->add_inplace(*term2, *term1);
+    return term2;
 }
 
 void Cardio::print_ciphertextvector(CiphertextVector &vec) {
@@ -17,6 +17,8 @@
 #include <random>
 #include <vector>
 
+#include "../ciphertext_span.h"
+
 typedef std::vector<seal::Ciphertext> CiphertextVector;
 typedef std::chrono::high_resolution_clock Time;
 typedef std::chrono::milliseconds ms;
@@ -44,8 +46,8 @@ private:
     std::unique_ptr<seal::BatchEncoder> encoder;
 
     void pre_computation(std::vector<CiphertextVector> &P,
-                         std::vector<CiphertextVector> &G, CiphertextVector &lhs,
-                         CiphertextVector &rhs);
+                         std::vector<CiphertextVector> &G, CiphertextSpan lhs,
+                         CiphertextSpan rhs);
 
     void evaluate_G(std::vector<CiphertextVector> &P,
                     std::vector<CiphertextVector> &G, int row_idx, int col_idx,
@@ -74,23 +76,26 @@ public:
 
     CiphertextVector encode_and_encrypt(int32_t number);
 
-    std::unique_ptr<seal::Ciphertext> equal(CiphertextVector lhs,
-                                            CiphertextVector rhs);
+    std::unique_ptr<seal::Ciphertext> equal(CiphertextSpan lhs,
+                                            CiphertextSpan rhs);
 
     void shift_right_inplace(CiphertextVector &ctxt);
 
     void shift_left_inplace(CiphertextVector &ctxt);
 
-    CiphertextVector slice(CiphertextVector ctxt, int idx_begin, int idx_end);
+    /// View of the bits [idx_begin, idx_end), no ciphertexts are copied
+    CiphertextSpan slice(CiphertextSpan ctxt, int idx_begin, int idx_end);
 
-    CiphertextVector slice(CiphertextVector ctxt, int idx_begin);
+    /// View of the bits from idx_begin on, no ciphertexts are copied
+    CiphertextSpan slice(CiphertextSpan ctxt, int idx_begin);
 
+    /// Multiplies all bits, consumes bitvec (pass it with std::move to avoid copying it)
     std::unique_ptr<seal::Ciphertext> multvect(CiphertextVector bitvec);
 
-    std::unique_ptr<seal::Ciphertext> lower(CiphertextVector &lhs,
-                                            CiphertextVector &rhs);
+    std::unique_ptr<seal::Ciphertext> lower(CiphertextSpan lhs,
+                                            CiphertextSpan rhs);
 
-    CiphertextVector add(CiphertextVector lhs, CiphertextVector rhs);
+    CiphertextVector add(CiphertextSpan lhs, CiphertextSpan rhs);
 
     int main(int argc, char *argv[]);
 };
@@ -49,36 +49,37 @@ void CardioBatched::setup_context_ckks(std::size_t poly_modulus_degree) {
     evaluator = std::make_unique<seal::Evaluator>(*context);
     decryptor = std::make_unique<seal::Decryptor>(*context, secretKey);
     encoder = std::make_unique<seal::CKKSEncoder>(*context);
+    // constants of a previous context would be at the wrong levels
+    constants.clear();
     // std::cout << "Number of slots: " << encoder->slot_count() << std::endl;
 }
 
-CiphertextVector CardioBatched::slice(CiphertextVector ctxt, int idx_begin,
-                                      int idx_end) {
-    return CiphertextVector(ctxt.begin() + idx_begin, ctxt.begin() + idx_end);
+CiphertextSpan CardioBatched::slice(CiphertextSpan ctxt, int idx_begin,
+                                    int idx_end) {
+    return ctxt.subspan(idx_begin, idx_end - idx_begin);
 }
 
-CiphertextVector CardioBatched::slice(CiphertextVector ctxt, int idx_begin) {
-    return CiphertextVector(ctxt.begin() + idx_begin, ctxt.end());
+CiphertextSpan CardioBatched::slice(CiphertextSpan ctxt, int idx_begin) {
+    return ctxt.subspan(idx_begin);
 }
 
 // return lhs < rhs
-std::unique_ptr<seal::Ciphertext> CardioBatched::lower(CiphertextVector &lhs,
-                                                       CiphertextVector &rhs) {
+std::unique_ptr<seal::Ciphertext> CardioBatched::lower(CiphertextSpan lhs,
+                                                       CiphertextSpan rhs) {
     std::unique_ptr<seal::Ciphertext> result =
             std::make_unique<seal::Ciphertext>();
 
     const int len = lhs.size();
     if (len == 1) {
         // andNY(lhs[0], rhs[0]) = !(lhs[0]) & rhs[0]
-        seal::Plaintext one;
-        encoder->encode(1.0, lhs[0].parms_id(), lhs[0].scale(), one);
-        seal::Ciphertext lhs_neg = XOR(lhs[0], one);
+        seal::Ciphertext lhs_neg = XOR(lhs[0], one(lhs[0].parms_id(), lhs[0].scale()));
         evaluator->rescale_to_next_inplace(lhs_neg);
         lhs_neg.scale() = initial_scale;
-        evaluator->mod_switch_to_inplace(rhs[0], lhs_neg.parms_id());
+        // the inputs are only viewed, so switch down a copy of rhs[0]
+        evaluator->mod_switch_to(rhs[0], lhs_neg.parms_id(), *result);
         // print_info(lhs_neg);
-        // print_info(rhs[0]);
-        evaluator->multiply(lhs_neg, rhs[0], *result);
+        // print_info(*result);
+        evaluator->multiply_inplace(*result, lhs_neg);
         evaluator->relinearize_inplace(*result, relinKeys);
         // print_info(*result);
         evaluator->rescale_to_next_inplace(*result);
@@ -89,23 +90,23 @@ std::unique_ptr<seal::Ciphertext> CardioBatched::lower(CiphertextVector &lhs,
         return result;
     }
 
-    auto get_level = [&](seal::Ciphertext &c) -> std::size_t {
+    auto get_level = [&](const seal::Ciphertext &c) -> std::size_t {
         return context->get_context_data(c.parms_id())->chain_index();
     };
 
     const int len2 = len >> 1;
 
-    CiphertextVector lhs_l = slice(lhs, 0, len2);
-    CiphertextVector lhs_h = slice(lhs, len2);
-    CiphertextVector rhs_l = slice(rhs, 0, len2);
-    CiphertextVector rhs_h = slice(rhs, len2);
+    CiphertextSpan lhs_l = slice(lhs, 0, len2);
+    CiphertextSpan lhs_h = slice(lhs, len2);
+    CiphertextSpan rhs_l = slice(rhs, 0, len2);
+    CiphertextSpan rhs_h = slice(rhs, len2);
 
-    seal::Ciphertext term1 = *lower(lhs_h, rhs_h);
+    seal::Ciphertext term1 = std::move(*lower(lhs_h, rhs_h));
     // print_info(term1);
-    evaluator->mod_switch_to_inplace(lhs_h[0], rhs_h[0].parms_id());
-    seal::Ciphertext h_equal = *equal(lhs_h, rhs_h);
+    // lower() leaves its inputs untouched, so both halves are still at the same level
+    seal::Ciphertext h_equal = std::move(*equal(lhs_h, rhs_h));
     // print_info(h_equal);
-    seal::Ciphertext l_equal = *lower(lhs_l, rhs_l);
+    seal::Ciphertext l_equal = std::move(*lower(lhs_l, rhs_l));
     // print_info(l_equal);
 
     seal::Ciphertext term2;
@@ -145,8 +146,15 @@ void CardioBatched::internal_print_info(std::string variable_name,
     std::cout.copyfmt(old_fmt);
 }
 
-seal::Ciphertext CardioBatched::XOR(seal::Ciphertext &lhs,
-                                    seal::Ciphertext &rhs) {
+const seal::Plaintext &CardioBatched::one(const seal::parms_id_type &parms_id,
+                                          double scale) {
+    return constants.get("one", parms_id, scale, [&](seal::Plaintext &ptxt) {
+        encoder->encode(1.0, parms_id, scale, ptxt);
+    });
+}
+
+seal::Ciphertext CardioBatched::XOR(const seal::Ciphertext &lhs,
+                                    const seal::Ciphertext &rhs) {
     // computes (a-b)^2 by assuming a,b are binary inputs
     // see https://stackoverflow.com/a/46674398
     seal::Ciphertext result;
@@ -156,8 +164,8 @@ seal::Ciphertext CardioBatched::XOR(seal::Ciphertext &lhs,
     return result;
 }
 
-seal::Ciphertext CardioBatched::XOR(seal::Ciphertext &lhs,
-                                    seal::Plaintext &rhs) {
+seal::Ciphertext CardioBatched::XOR(const seal::Ciphertext &lhs,
+                                    const seal::Plaintext &rhs) {
     // computes (a-b)^2 by assuming a,b are binary inputs
     // see https://stackoverflow.com/a/46674398
     seal::Ciphertext result;
@@ -518,14 +526,15 @@ std::unique_ptr<seal::Ciphertext> CardioBatched::multvect(
             // print_info(bitvec[i]);
         }
     }
-    return std::make_unique<seal::Ciphertext>(bitvec[0]);
+    return std::make_unique<seal::Ciphertext>(std::move(bitvec[0]));
 }
 
-std::unique_ptr<seal::Ciphertext> CardioBatched::equal(CiphertextVector &lhs,
-                                                       CiphertextVector &rhs) {
+std::unique_ptr<seal::Ciphertext> CardioBatched::equal(CiphertextSpan lhs,
+                                                       CiphertextSpan rhs) {
     assert(("equal supports same-sized inputs only!", lhs.size() == rhs.size()));
 
     CiphertextVector comp;
+    comp.reserve(lhs.size());
     for (std::size_t i = 0; i < lhs.size(); ++i) {
         seal::Ciphertext tmp;
         // evaluator->add(lhs[i], rhs[i], tmp);
@@ -537,17 +546,15 @@ std::unique_ptr<seal::Ciphertext> CardioBatched::equal(CiphertextVector &lhs,
         tmp.scale() = initial_scale;
         // print_info(tmp);
 
-        seal::Plaintext one;
-        encoder->encode(1.0, tmp.parms_id(), tmp.scale(), one);
         // print_info(tmp);
 
-        tmp = XOR(tmp, one);
+        tmp = XOR(tmp, one(tmp.parms_id(), tmp.scale()));
         evaluator->rescale_to_next_inplace(tmp);
         // print_info(tmp);
         tmp.scale() = initial_scale;
-        comp.push_back(tmp);
+        comp.push_back(std::move(tmp));
     }
-    std::unique_ptr<seal::Ciphertext> mv_result = multvect(comp);
+    std::unique_ptr<seal::Ciphertext> mv_result = multvect(std::move(comp));
     // print_info(*mv_result);
     return mv_result;
 }
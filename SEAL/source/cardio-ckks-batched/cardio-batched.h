@@ -19,6 +19,9 @@
 #include <random>
 #include <vector>
 
+#include "../ciphertext_span.h"
+#include "../plaintext_cache.h"
+
 typedef std::vector<seal::Ciphertext> CiphertextVector;
 #define print_info(name) internal_print_info(#name, (name))
 #define NUM_BITS 8
@@ -130,6 +133,12 @@ private:
 
     double initial_scale;
 
+    /// constants that are used at many places, encoded once per level and scale
+    PlaintextCache constants;
+
+    /// the all-ones plaintext at the given level and scale
+    const seal::Plaintext &one(const seal::parms_id_type &parms_id, double scale);
+
     void print_vec(seal::Ciphertext &ctxt);
 
     void pre_computation(std::vector<CiphertextVector> &P,
@@ -159,9 +168,9 @@ private:
 
     void print_ciphertext(seal::Ciphertext &ctxt);
 
-    seal::Ciphertext XOR(seal::Ciphertext &lhs, seal::Ciphertext &rhs);
+    seal::Ciphertext XOR(const seal::Ciphertext &lhs, const seal::Ciphertext &rhs);
 
-    seal::Ciphertext XOR(seal::Ciphertext &lhs, seal::Plaintext &rhs);
+    seal::Ciphertext XOR(const seal::Ciphertext &lhs, const seal::Plaintext &rhs);
 
     void internal_print_info(std::string variable_name, seal::Ciphertext &ctxt);
 
@@ -177,23 +186,26 @@ public:
     seal::Plaintext encode(std::vector<uint64_t> numbers,
                            seal::parms_id_type parms_id);
 
-    std::unique_ptr<seal::Ciphertext> equal(CiphertextVector &lhs,
-                                            CiphertextVector &rhs);
+    std::unique_ptr<seal::Ciphertext> equal(CiphertextSpan lhs,
+                                            CiphertextSpan rhs);
 
     void shift_right_inplace(CiphertextVector &ctxt);
 
     void shift_left_inplace(CiphertextVector &ctxt);
 
-    CiphertextVector slice(CiphertextVector ctxt, int idx_begin, int idx_end);
+    /// View of the bits [idx_begin, idx_end), no ciphertexts are copied
+    CiphertextSpan slice(CiphertextSpan ctxt, int idx_begin, int idx_end);
 
-    CiphertextVector slice(CiphertextVector ctxt, int idx_begin);
+    /// View of the bits from idx_begin on, no ciphertexts are copied
+    CiphertextSpan slice(CiphertextSpan ctxt, int idx_begin);
 
+    /// Multiplies all bits, consumes bitvec (pass it with std::move to avoid copying it)
     std::unique_ptr<seal::Ciphertext> multvect(CiphertextVector bitvec);
 
-    std::unique_ptr<seal::Ciphertext> lower(CiphertextVector &lhs,
-                                            CiphertextVector &rhs);
+    std::unique_ptr<seal::Ciphertext> lower(CiphertextSpan lhs,
+                                            CiphertextSpan rhs);
 
-    CiphertextVector add(CiphertextVector lhs, CiphertextVector rhs);
+    CiphertextVector add(CiphertextSpan lhs, CiphertextSpan rhs);
 
     std::vector<seal::Ciphertext> split_by_binary_rep(seal::Ciphertext &ctxt);
 
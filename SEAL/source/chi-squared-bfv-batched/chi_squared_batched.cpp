@@ -2,6 +2,9 @@
 
 #include "../common.h"
 
+ChiSquaredBatched::ChiSquaredBatched(std::size_t num_threads)
+        : num_threads(std::max<std::size_t>(num_threads, 1)) {}
+
 void ChiSquaredBatched::setup_context_bfv_batched(std::size_t poly_modulus_degree,
                                           std::uint64_t plain_modulus) {
     /// Wrapper for parameters
@@ -30,6 +33,8 @@ void ChiSquaredBatched::setup_context_bfv_batched(std::size_t poly_modulus_degre
     evaluator = std::make_unique<seal::Evaluator>(*context);
     decryptor = std::make_unique<seal::Decryptor>(*context, secretKey);
     encoder = std::make_unique<seal::BatchEncoder>(*context);
+    levels = std::make_unique<LevelManager>(context, *evaluator);
+    thread_pool = std::make_unique<ThreadPool>(num_threads - 1);
 }
 
 namespace {
@@ -47,53 +52,149 @@ int64_t ChiSquaredBatched::get_first_decrypted_value(seal::Ciphertext value) {
     decryptor->decrypt(value, tmp);
     std::vector<int64_t> values;
     encoder->decode(tmp, values);
-    return tmp[0];
+    return values[0];
+}
+
+std::vector<int64_t> ChiSquaredBatched::decrypt_all_slots(
+        const seal::Ciphertext &value) {
+    seal::Plaintext tmp;
+    decryptor->decrypt(value, tmp);
+    std::vector<int64_t> values;
+    encoder->decode(tmp, values);
+    return values;
+}
+
+std::vector<EncryptedCounts> ChiSquaredBatched::encrypt_counts(
+        const GenotypeCounts &counts) {
+    assert(("All counts must cover the same SNPs!",
+            counts.n_1.size() == counts.n_0.size() &&
+            counts.n_2.size() == counts.n_0.size()));
+    const std::size_t slot_count = encoder->slot_count();
+    const std::size_t num_ctxts =
+            (counts.n_0.size() + slot_count - 1) / slot_count;
+
+    // the SNPs [c * slot_count, (c + 1) * slot_count) of values, unused slots
+    // of the last ciphertext are zero
+    auto encrypt_batch = [&](const std::vector<int64_t> &values, std::size_t c,
+                             seal::Ciphertext &destination) {
+        auto first = values.begin() + c * slot_count;
+        auto last = values.begin() + std::min(values.size(), (c + 1) * slot_count);
+        std::vector<int64_t> slots(first, last);
+        slots.resize(slot_count, 0);
+        seal::Plaintext ptxt;
+        encoder->encode(slots, ptxt);
+        encryptor->encrypt(ptxt, destination);
+    };
+
+    std::vector<EncryptedCounts> encrypted(num_ctxts);
+    for (std::size_t c = 0; c < num_ctxts; ++c) {
+        encrypt_batch(counts.n_0, c, encrypted[c].n_0);
+        encrypt_batch(counts.n_1, c, encrypted[c].n_1);
+        encrypt_batch(counts.n_2, c, encrypted[c].n_2);
+    }
+    return encrypted;
+}
+
+std::vector<ResultCiphertexts> ChiSquaredBatched::compute_alpha_betas(
+        const std::vector<EncryptedCounts> &counts) {
+    std::vector<ResultCiphertexts> results;
+    results.reserve(counts.size());
+    for (const auto &batch : counts) {
+        results.push_back(compute_alpha_betas(batch.n_0, batch.n_1, batch.n_2));
+    }
+    return results;
+}
+
+ChiSquaredResults ChiSquaredBatched::decrypt_results(
+        const std::vector<ResultCiphertexts> &results, std::size_t num_snps) {
+    ChiSquaredResults decrypted;
+    auto append = [&](std::vector<int64_t> &values, const seal::Ciphertext &ctxt) {
+        auto slots = decrypt_all_slots(ctxt);
+        slots.resize(std::min(slots.size(), num_snps - values.size()));
+        values.insert(values.end(), slots.begin(), slots.end());
+    };
+    for (const auto &result : results) {
+        append(decrypted.alpha, result.alpha);
+        append(decrypted.beta_1, result.beta_1);
+        append(decrypted.beta_2, result.beta_2);
+        append(decrypted.beta_3, result.beta_3);
+    }
+    return decrypted;
+}
+
+ChiSquaredResults ChiSquaredBatched::compute_plain(const GenotypeCounts &counts) {
+    // the decrypted values are reduced modulo t, into (-t/2, t/2]
+    const int64_t t = context->first_context_data()->parms().plain_modulus().value();
+    auto reduce = [t](int64_t value) {
+        value %= t;
+        if (value < 0) value += t;
+        return value > t / 2 ? value - t : value;
+    };
+
+    ChiSquaredResults expected;
+    for (std::size_t i = 0; i < counts.n_0.size(); ++i) {
+        const int64_t n0 = counts.n_0[i], n1 = counts.n_1[i], n2 = counts.n_2[i];
+        const int64_t alpha = reduce(4 * n0 * n2 - n1 * n1);
+        expected.alpha.push_back(reduce(alpha * alpha));
+        expected.beta_1.push_back(reduce(2 * (2 * n0 + n1) * (2 * n0 + n1)));
+        expected.beta_2.push_back(reduce((2 * n0 + n1) * (2 * n2 + n1)));
+        expected.beta_3.push_back(reduce(2 * (2 * n2 + n1) * (2 * n2 + n1)));
+    }
+    return expected;
 }
 
 ResultCiphertexts ChiSquaredBatched::compute_alpha_betas(
         const seal::Ciphertext &N_0, const seal::Ciphertext &N_1,
         const seal::Ciphertext &N_2) {
-    seal::Plaintext four = encode_all_slots(4);
-    seal::Plaintext two = encode_all_slots(2);
-
-    // compute alpha
-    seal::Ciphertext alpha;
-    evaluator->multiply_plain(N_0, four, alpha);
-    evaluator->relinearize_inplace(alpha, relinKeys);
-    evaluator->multiply_inplace(alpha, N_2);
-    evaluator->relinearize_inplace(alpha, relinKeys);
-    seal::Ciphertext N_1_pow2;
-    evaluator->exponentiate(N_1, 2, relinKeys, N_1_pow2);
-    evaluator->sub_inplace(alpha, N_1_pow2);
-    evaluator->exponentiate_inplace(alpha, 2, relinKeys);
-
-    // compute beta_1
-    seal::Ciphertext beta_1;
-    seal::Ciphertext N_0_t2;
-    evaluator->multiply_plain(N_0, two, N_0_t2);
-    evaluator->relinearize_inplace(N_0_t2, relinKeys);
-    seal::Ciphertext twot_N_0__plus__N_1;
-    evaluator->add(N_0_t2, N_1, twot_N_0__plus__N_1);
-    evaluator->exponentiate(twot_N_0__plus__N_1, 2, relinKeys, beta_1);
-    evaluator->multiply_plain_inplace(beta_1, two);
-    evaluator->relinearize_inplace(beta_1, relinKeys);
-
-    // compute beta_2
-    seal::Ciphertext beta_2;
-    seal::Ciphertext t2_N_2;
-    evaluator->multiply_plain(N_2, two, t2_N_2);
-    evaluator->relinearize_inplace(t2_N_2, relinKeys);
-    seal::Ciphertext twot_N_2__plus__N_1;
-    evaluator->add(t2_N_2, N_1, twot_N_2__plus__N_1);
-    evaluator->multiply(twot_N_0__plus__N_1, twot_N_2__plus__N_1, beta_2);
-    evaluator->relinearize_inplace(beta_2, relinKeys);
-
-    // compute beta_3
-    seal::Ciphertext beta_3;
-    evaluator->exponentiate(twot_N_2__plus__N_1, 2, relinKeys, beta_3);
-    evaluator->multiply_plain_inplace(beta_3, two);
-    evaluator->relinearize_inplace(beta_3, relinKeys);
+    // products are only relinearized before they are squared or returned,
+    // sub and add work on unrelinearized ciphertexts as well
+    LazyRelinearizer relinearizer(*evaluator, relinKeys);
 
+    // alpha = (2*N_0 * 2*N_2 - N_1^2)^2 shares 2*N_0 and 2*N_2 with the
+    // betas, which are products of 2*N_0+N_1 and 2*N_2+N_1. Independent
+    // branches run concurrently, doubling is done by addition.
+    seal::Ciphertext N_0_t2, N_2_t2, N_1_pow2;
+    seal::Ciphertext twot_N_0__plus__N_1, twot_N_2__plus__N_1;
+    seal::Ciphertext alpha, beta_1, beta_2, beta_3;
+    TaskGraph graph;
+    auto sum_0 = graph.add([&] {
+        evaluator->add(N_0, N_0, N_0_t2);
+        evaluator->add(N_0_t2, N_1, twot_N_0__plus__N_1);
+    });
+    auto sum_2 = graph.add([&] {
+        evaluator->add(N_2, N_2, N_2_t2);
+        evaluator->add(N_2_t2, N_1, twot_N_2__plus__N_1);
+    });
+    auto pow_1 = graph.add([&] { relinearizer.multiply(N_1, N_1, N_1_pow2); });
+    graph.add([&] {
+        relinearizer.multiply(N_0_t2, N_2_t2, alpha);
+        evaluator->sub_inplace(alpha, N_1_pow2);
+        levels->checkpoint("alpha", {&alpha});
+        relinearizer.square_inplace(alpha);
+        relinearizer.finish(alpha);
+    }, {sum_0, sum_2, pow_1});
+    auto sums = graph.add([&] {
+        levels->checkpoint("sums", {&twot_N_0__plus__N_1, &twot_N_2__plus__N_1});
+    }, {sum_0, sum_2});
+    // the sums have size 2, so the betas only read them
+    graph.add([&] {
+        relinearizer.square(twot_N_0__plus__N_1, beta_1);
+        evaluator->add_inplace(beta_1, beta_1);
+        relinearizer.finish(beta_1);
+    }, {sums});
+    graph.add([&] {
+        relinearizer.multiply(twot_N_0__plus__N_1, twot_N_2__plus__N_1, beta_2);
+        relinearizer.finish(beta_2);
+    }, {sums});
+    graph.add([&] {
+        relinearizer.square(twot_N_2__plus__N_1, beta_3);
+        evaluator->add_inplace(beta_3, beta_3);
+        relinearizer.finish(beta_3);
+    }, {sums});
+    graph.run(thread_pool.get());
+
+    // the results only have to be decrypted, less primes are cheaper to send back
+    levels->checkpoint("results", {&alpha, &beta_1, &beta_2, &beta_3});
     return ResultCiphertexts(alpha, beta_1, beta_2, beta_3);
 }
 
@@ -111,7 +212,8 @@ seal::Plaintext ChiSquaredBatched::encode_all_slots(int64_t value) {
     return temp;
 }
 
-void ChiSquaredBatched::run_chi_squared_batched() {
+void ChiSquaredBatched::run_chi_squared_batched(bool manage_levels,
+                                                std::size_t num_snps) {
     std::stringstream ss_time;
 
     // set up the BFV scheme
@@ -120,46 +222,61 @@ void ChiSquaredBatched::run_chi_squared_batched() {
     auto t1 = Time::now();
     log_time(ss_time, t0, t1, false);
 
+    GenotypeCounts counts;
+    if (num_snps == 0) {
+        // the same counts in every slot
+        num_snps = encoder->slot_count();
+        counts.n_0.assign(num_snps, 2);
+        counts.n_1.assign(num_snps, 7);
+        counts.n_2.assign(num_snps, 9);
+    } else {
+        // small counts, so that the results do not wrap around the plaintext
+        // modulus
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<int64_t> count(0, 10);
+        for (std::size_t i = 0; i < num_snps; ++i) {
+            counts.n_0.push_back(count(rng));
+            counts.n_1.push_back(count(rng));
+            counts.n_2.push_back(count(rng));
+        }
+    }
+
     auto t2 = Time::now();
-    int64_t n0_val = 2, n1_val = 7, n2_val = 9;
-    seal::Ciphertext n0 = encode_all_slots_and_encrypt(n0_val);
-    seal::Ciphertext n1 = encode_all_slots_and_encrypt(n1_val);
-    seal::Ciphertext n2 = encode_all_slots_and_encrypt(n2_val);
+    auto encrypted = encrypt_counts(counts);
     auto t3 = Time::now();
     log_time(ss_time, t2, t3, false);
 
+    // one-time calibration (like the parameter selection), not part of the timed computation
+    if (manage_levels) {
+        levels->start_calibration(*decryptor);
+        auto sample = compute_alpha_betas(encrypted[0].n_0, encrypted[0].n_1, encrypted[0].n_2);
+        levels->finish_calibration({&sample.alpha, &sample.beta_1, &sample.beta_2, &sample.beta_3});
+        levels->print_levels(std::cout);
+    }
+
     // perform FHE computation
     auto t4 = Time::now();
-    auto result = compute_alpha_betas(n0, n1, n2);
+    auto result = compute_alpha_betas(encrypted);
     auto t5 = Time::now();
     log_time(ss_time, t4, t5, false);
 
     // decrypt results
     auto t6 = Time::now();
-    int64_t result_alpha = get_first_decrypted_value(result.alpha);
-    int64_t result_beta1 = get_first_decrypted_value(result.beta_1);
-    int64_t result_beta2 = get_first_decrypted_value(result.beta_2);
-    int64_t result_beta3 = get_first_decrypted_value(result.beta_3);
+    auto computed = decrypt_results(result, num_snps);
     auto t7 = Time::now();
     log_time(ss_time, t6, t7, true);
 
     // check results
-    auto exp_alpha = std::pow((4 * n0_val * n2_val) - std::pow(n1_val, 2), 2);
-    assert(("Unexpected result for 'alpha' encountered!",
-            result_alpha == exp_alpha));
-    std::cout << "Expected alpha: " << exp_alpha << ", calculated alpha: " << result_alpha << std::endl;
-    auto exp_beta_1 = 2 * std::pow(2 * n0_val + n1_val, 2);
-    assert(("Unexpected result for 'beta_1' encountered!",
-            result_beta1 == exp_beta_1));
-    std::cout << "Expected beta_1: " << exp_beta_1 << ", calculated beta_1: " << result_beta1 << std::endl;
-    auto exp_beta_2 = ((2 * n0_val) + n1_val) * ((2 * n2_val) + n1_val);
-    assert(("Unexpected result for 'beta_2' encountered!",
-            result_beta2 == exp_beta_2));
-    std::cout << "Expected beta_2: " << exp_beta_2 << ", calculated beta_2: " << result_beta2 << std::endl;
-    auto exp_beta_3 = 2 * std::pow(2 * n2_val + n1_val, 2);
-    assert(("Unexpected result for 'beta_3' encountered!",
-            result_beta3 == exp_beta_3));
-    std::cout << "Expected beta_3: " << exp_beta_3 << ", calculated beta_3: " << result_beta3 << std::endl;
+    auto expected = compute_plain(counts);
+    std::cout << "Expected alpha: " << expected.alpha[0] << ", calculated alpha: " << computed.alpha[0] << std::endl;
+    std::cout << "Expected beta_1: " << expected.beta_1[0] << ", calculated beta_1: " << computed.beta_1[0] << std::endl;
+    std::cout << "Expected beta_2: " << expected.beta_2[0] << ", calculated beta_2: " << computed.beta_2[0] << std::endl;
+    std::cout << "Expected beta_3: " << expected.beta_3[0] << ", calculated beta_3: " << computed.beta_3[0] << std::endl;
+    assert(("Unexpected result for 'alpha' encountered!", computed.alpha == expected.alpha));
+    assert(("Unexpected result for 'beta_1' encountered!", computed.beta_1 == expected.beta_1));
+    assert(("Unexpected result for 'beta_2' encountered!", computed.beta_2 == expected.beta_2));
+    assert(("Unexpected result for 'beta_3' encountered!", computed.beta_3 == expected.beta_3));
+    std::cout << "Checked " << num_snps << " SNPs in " << encrypted.size() << " ciphertext(s)." << std::endl;
 
     // write ss_time into file
     std::ofstream myfile;
@@ -174,6 +291,22 @@ void ChiSquaredBatched::run_chi_squared_batched() {
 
 int main(int argc, char *argv[]) {
     std::cout << "Starting benchmark 'chi-squared-bfv-batched'..." << std::endl;
-    ChiSquaredBatched().run_chi_squared_batched();
+    // Set AUTO_MOD_SWITCH=0 to compute everything at the full modulus chain
+    auto auto_mod_switch_env = std::getenv("AUTO_MOD_SWITCH");
+    bool manage_levels = auto_mod_switch_env == nullptr || std::string(auto_mod_switch_env) != "0";
+    // NUM_SNPS computes random counts of that many SNPs, spread over as many
+    // ciphertexts as needed, instead of the same counts in every slot
+    std::size_t num_snps = 0;
+    auto num_snps_env = std::getenv("NUM_SNPS");
+    if (num_snps_env != nullptr) {
+        num_snps = std::stoul(num_snps_env);
+    }
+    // Number of threads the independent branches of the circuit run on
+    std::size_t num_threads = 1;
+    auto num_threads_env = std::getenv("NUM_THREADS");
+    if (num_threads_env != nullptr) {
+        num_threads = std::max(1, std::atoi(num_threads_env));
+    }
+    ChiSquaredBatched(num_threads).run_chi_squared_batched(manage_levels, num_snps);
     return 0;
 }
@@ -15,6 +15,10 @@
 #include <vector>
 #include <cassert>
 
+#include "../lazy_relinearizer.h"
+#include "../level_manager.h"
+#include "../task_graph.h"
+
 typedef std::chrono::high_resolution_clock Time;
 typedef std::chrono::milliseconds ms;
 
@@ -30,6 +34,28 @@ public:
             : alpha(alpha), beta_1(beta_1), beta_2(beta_2), beta_3(beta_3) {};
 };
 
+/// Genotype counts of many SNPs, entry i of each vector belongs to SNP i
+struct GenotypeCounts {
+    std::vector<int64_t> n_0;
+    std::vector<int64_t> n_1;
+    std::vector<int64_t> n_2;
+};
+
+/// Encrypted genotype counts of up to slot_count SNPs, one SNP per slot
+struct EncryptedCounts {
+    seal::Ciphertext n_0;
+    seal::Ciphertext n_1;
+    seal::Ciphertext n_2;
+};
+
+/// Decrypted results, entry i of each vector belongs to SNP i (modulo the plaintext modulus, centered around zero)
+struct ChiSquaredResults {
+    std::vector<int64_t> alpha;
+    std::vector<int64_t> beta_1;
+    std::vector<int64_t> beta_2;
+    std::vector<int64_t> beta_3;
+};
+
 class ChiSquaredBatched {
 private:
     /// the seal context, i.e. object that holds params/etc
@@ -52,12 +78,30 @@ private:
     std::unique_ptr<seal::Decryptor> decryptor;
     std::unique_ptr<seal::BatchEncoder> encoder;
 
+    /// switches the intermediate results of compute_alpha_betas down the modulus chain
+    std::unique_ptr<LevelManager> levels;
+
+    /// threads compute_alpha_betas runs on (including the calling thread)
+    std::size_t num_threads;
+
+    std::unique_ptr<ThreadPool> thread_pool;
+
     seal::Ciphertext encode_all_slots_and_encrypt(int64_t value);
 
     seal::Plaintext encode_all_slots(int64_t value);
 
+    /// decrypts all slots of value
+    std::vector<int64_t> decrypt_all_slots(const seal::Ciphertext &value);
+
 public:
-    void run_chi_squared_batched();
+    /// \param num_threads number of threads the independent parts of compute_alpha_betas run on
+    explicit ChiSquaredBatched(std::size_t num_threads = 1);
+
+    /// \param manage_levels whether to calibrate and switch the intermediate results to lower levels before the
+    /// timed computation
+    /// \param num_snps number of SNPs with random counts, or 0 to fill every slot of a single ciphertext with the same
+    /// counts
+    void run_chi_squared_batched(bool manage_levels = true, std::size_t num_snps = 0);
 
     void setup_context_bfv_batched(std::size_t poly_modulus_degree,
                            std::uint64_t plain_modulus);
@@ -66,6 +110,18 @@ public:
                                           const seal::Ciphertext &N_1,
                                           const seal::Ciphertext &N_2);
 
+    /// Encrypts the counts of all SNPs, SNP i goes to slot i % slot_count of ciphertext i / slot_count
+    std::vector<EncryptedCounts> encrypt_counts(const GenotypeCounts &counts);
+
+    /// Computes alpha and the betas of every SNP, one result per ciphertext of counts
+    std::vector<ResultCiphertexts> compute_alpha_betas(const std::vector<EncryptedCounts> &counts);
+
+    /// Decrypts the results of the first num_snps SNPs
+    ChiSquaredResults decrypt_results(const std::vector<ResultCiphertexts> &results, std::size_t num_snps);
+
+    /// Expected results of the counts, computed on plaintexts
+    ChiSquaredResults compute_plain(const GenotypeCounts &counts);
+
     int main(int argc, char *argv[]);
 
     int64_t get_first_decrypted_value(seal::Ciphertext value);
@@ -2,6 +2,9 @@
 
 #include "../common.h"
 
+ChiSquared::ChiSquared(std::size_t num_threads)
+        : num_threads(std::max<std::size_t>(num_threads, 1)) {}
+
 void ChiSquared::setup_context_bfv_opt(std::size_t poly_modulus_degree,
                                    std::uint64_t plain_modulus) {
     /// Wrapper for parameters
@@ -42,6 +45,7 @@ void ChiSquared::setup_context_bfv_opt(std::size_t poly_modulus_degree,
     evaluator = std::make_unique<seal::Evaluator>(*context);
     decryptor = std::make_unique<seal::Decryptor>(*context, secretKey);
     encoder = std::make_unique<seal::BatchEncoder>(*context);
+    thread_pool = std::make_unique<ThreadPool>(num_threads - 1);
 
     auto qualifiers = context->first_context_data()->qualifiers();
     std::cout << "Batching enabled: " << std::boolalpha << qualifiers.using_batching << std::endl;
@@ -68,53 +72,53 @@ uint64_t ChiSquared::get_decrypted_value(seal::Ciphertext value) {
 ResultCiphertexts ChiSquared::compute_alpha_betas(const seal::Ciphertext &N_0,
                                                   const seal::Ciphertext &N_1,
                                                   const seal::Ciphertext &N_2) {
-    std::size_t slot_count = encoder->slot_count();
-    std::vector<uint64_t> four_vec(slot_count, 4ULL);
-    seal::Plaintext four;
-    encoder->encode(four_vec, four);
-
-    std::vector<uint64_t> two_vec(slot_count, 2ULL);
-    seal::Plaintext two;
-    encoder->encode(two_vec, two);
+    // products are only relinearized before they are squared or returned,
+    // sub and add work on unrelinearized ciphertexts as well
+    LazyRelinearizer relinearizer(*evaluator, relinKeys);
+
+    // alpha = (2*N_0 * 2*N_2 - N_1^2)^2 shares 2*N_0 and 2*N_2 with the
+    // betas, which are products of 2*N_0+N_1 and 2*N_2+N_1. Independent
+    // branches run concurrently, doubling is done by addition.
+    seal::Ciphertext N_0_t2, N_2_t2, N_1_pow2;
+    seal::Ciphertext twot_N_0__plus__N_1, twot_N_2__plus__N_1;
+    seal::Ciphertext alpha, beta_1, beta_2, beta_3;
+    TaskGraph graph;
+    auto sum_0 = graph.add([&] {
+        evaluator->add(N_0, N_0, N_0_t2);
+        evaluator->add(N_0_t2, N_1, twot_N_0__plus__N_1);
+    });
+    auto sum_2 = graph.add([&] {
+        evaluator->add(N_2, N_2, N_2_t2);
+        evaluator->add(N_2_t2, N_1, twot_N_2__plus__N_1);
+    });
+    auto pow_1 = graph.add([&] { relinearizer.multiply(N_1, N_1, N_1_pow2); });
 
     // compute alpha
-    std::cout << "Computing alpha" << std::endl;
-    seal::Ciphertext alpha;
-    evaluator->multiply_plain(N_0, four, alpha);
-    evaluator->relinearize_inplace(alpha, relinKeys);
-    evaluator->multiply_inplace(alpha, N_2);
-    evaluator->relinearize_inplace(alpha, relinKeys);
-    seal::Ciphertext N_1_pow2;
-    evaluator->exponentiate(N_1, 2, relinKeys, N_1_pow2);
-    evaluator->sub_inplace(alpha, N_1_pow2);
-    evaluator->exponentiate_inplace(alpha, 2, relinKeys);
-
-    // compute beta_1
-    seal::Ciphertext beta_1;
-    seal::Ciphertext N_0_t2;
-    evaluator->multiply_plain(N_0, two, N_0_t2);
-    evaluator->relinearize_inplace(N_0_t2, relinKeys);
-    seal::Ciphertext twot_N_0__plus__N_1;
-    evaluator->add(N_0_t2, N_1, twot_N_0__plus__N_1);
-    evaluator->exponentiate(twot_N_0__plus__N_1, 2, relinKeys, beta_1);
-    evaluator->multiply_plain_inplace(beta_1, two);
-    evaluator->relinearize_inplace(beta_1, relinKeys);
-
-    // compute beta_2
-    seal::Ciphertext beta_2;
-    seal::Ciphertext t2_N_2;
-    evaluator->multiply_plain(N_2, two, t2_N_2);
-    evaluator->relinearize_inplace(t2_N_2, relinKeys);
-    seal::Ciphertext twot_N_2__plus__N_1;
-    evaluator->add(t2_N_2, N_1, twot_N_2__plus__N_1);
-    evaluator->multiply(twot_N_0__plus__N_1, twot_N_2__plus__N_1, beta_2);
-    evaluator->relinearize_inplace(beta_2, relinKeys);
-
-    // compute beta_3
-    seal::Ciphertext beta_3;
-    evaluator->exponentiate(twot_N_2__plus__N_1, 2, relinKeys, beta_3);
-    evaluator->multiply_plain_inplace(beta_3, two);
-    evaluator->relinearize_inplace(beta_3, relinKeys);
+    graph.add([&] {
+        relinearizer.multiply(N_0_t2, N_2_t2, alpha);
+        evaluator->sub_inplace(alpha, N_1_pow2);
+        relinearizer.square_inplace(alpha);
+        relinearizer.finish(alpha);
+    }, {sum_0, sum_2, pow_1});
+
+    // compute the betas, the sums have size 2 so the branches only read them
+    graph.add([&] {
+        relinearizer.square(twot_N_0__plus__N_1, beta_1);
+        evaluator->add_inplace(beta_1, beta_1);
+        relinearizer.finish(beta_1);
+    }, {sum_0});
+    graph.add([&] {
+        relinearizer.multiply(twot_N_0__plus__N_1, twot_N_2__plus__N_1, beta_2);
+        relinearizer.finish(beta_2);
+    }, {sum_0, sum_2});
+    graph.add([&] {
+        relinearizer.square(twot_N_2__plus__N_1, beta_3);
+        evaluator->add_inplace(beta_3, beta_3);
+        relinearizer.finish(beta_3);
+    }, {sum_2});
+
+    std::cout << "Computing alpha and betas" << std::endl;
+    graph.run(thread_pool.get());
 
     return ResultCiphertexts(alpha, beta_1, beta_2, beta_3);
 }
@@ -194,6 +198,12 @@ void ChiSquared::run_chi_squared_opt() {
 
 int main(int argc, char *argv[]) {
     std::cout << "Starting benchmark 'chi-squared-bfv-opt'..." << std::endl;
-    ChiSquared().run_chi_squared_opt();
+    // Number of threads the independent branches of the circuit run on
+    std::size_t num_threads = 1;
+    auto num_threads_env = std::getenv("NUM_THREADS");
+    if (num_threads_env != nullptr) {
+        num_threads = std::max(1, std::atoi(num_threads_env));
+    }
+    ChiSquared(num_threads).run_chi_squared_opt();
     return 0;
 }
@@ -15,6 +15,9 @@
 #include <vector>
 #include <cassert>
 
+#include "../lazy_relinearizer.h"
+#include "../task_graph.h"
+
 typedef std::chrono::high_resolution_clock Time;
 typedef std::chrono::milliseconds ms;
 
@@ -52,7 +55,15 @@ private:
     std::unique_ptr<seal::Decryptor> decryptor;
     std::unique_ptr<seal::BatchEncoder> encoder;
 
+    /// threads compute_alpha_betas runs on (including the calling thread)
+    std::size_t num_threads;
+
+    std::unique_ptr<ThreadPool> thread_pool;
+
 public:
+    /// \param num_threads number of threads the independent parts of compute_alpha_betas run on
+    explicit ChiSquared(std::size_t num_threads = 1);
+
     void run_chi_squared_opt();
 
     void setup_context_bfv_opt(std::size_t poly_modulus_degree,
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+#include "seal/seal.h"
+
+/**
+ * \brief Non-owning view of consecutive ciphertexts, e.g. the bits of an encrypted number.
+ *  Halving a bit vector for a recursive comparison only moves two pointers instead of copying every ciphertext of
+ *  the half, which for BFV/CKKS means copying full polynomials per bit.
+ *  The viewed ciphertexts must outlive the span and must not be reallocated while it is in use (e.g. by pushing to
+ *  the vector it was created from).
+ */
+class CiphertextSpan {
+public:
+    CiphertextSpan() = default;
+
+    CiphertextSpan(const seal::Ciphertext *data, std::size_t size) : ptr(data), count(size) {}
+
+    CiphertextSpan(const std::vector<seal::Ciphertext> &ctxts) : ptr(ctxts.data()), count(ctxts.size()) {}
+
+    std::size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    const seal::Ciphertext &operator[](std::size_t i) const {
+        assert(i < count && "index out of range!");
+        return ptr[i];
+    }
+
+    const seal::Ciphertext *begin() const {
+        return ptr;
+    }
+
+    const seal::Ciphertext *end() const {
+        return ptr + count;
+    }
+
+    /// The length ciphertexts starting at offset
+    CiphertextSpan subspan(std::size_t offset, std::size_t length) const {
+        assert(offset <= count && length <= count - offset && "subspan out of range!");
+        return CiphertextSpan(ptr + offset, length);
+    }
+
+    /// All ciphertexts starting at offset
+    CiphertextSpan subspan(std::size_t offset) const {
+        return subspan(offset, count - offset);
+    }
+
+private:
+    const seal::Ciphertext *ptr = nullptr;
+
+    std::size_t count = 0;
+};
@@ -1,4 +1,5 @@
 #include "kernel_batched.h"
+#include "kernel_service.h"
 
 namespace {
     void log_time(std::stringstream &ss,
@@ -10,27 +11,15 @@ namespace {
     }
 }  // namespace
 
-Evaluation::Evaluation(int image_size) : image_size(image_size) {};
+Evaluation::Evaluation(int image_size, std::vector<StencilKernel> filters)
+        : image_size(image_size), filters(std::move(filters)) {};
 
 void Evaluation::check_results(VecInt2D img,
                                std::vector<int64_t> computed_values) {
-    // run the original algorithm derived from Ramparts' paper
-    VecInt2D expected_values = img;
-    for (int x = 1; x < img.size() - 1; x++) {
-        for (int y = 1; y < img.at(x).size() - 1; y++) {
-            int value = 0;
-            for (int j = -1; j < 2; ++j) {
-                for (int i = -1; i < 2; ++i) {
-                    value += weight_matrix.at((i + 1) * std::log2(weight_matrix.size()) +
-                                              (j + 1)) *
-                             img.at(x + i).at(y + j);
-                }
-            }
-            // original: img2[x][y] = img[x][y] - (value / 2);
-            // modified variant as we cannot divide in FHE:
-            expected_values[x][y] = (2 * img[x][y]) - value;
-        }
-    }
+    // run the filters on the plaintext image, the sharpening filter is the
+    // original algorithm derived from Ramparts' paper, modified as we cannot
+    // divide in FHE: img2[x][y] = 2 * img[x][y] - value
+    auto expected_values = StencilEngine::apply_plain(img, filters);
 
     // compare FHE computation result with original algorithm's result
     for (size_t x = 0; x < img.size(); x++) {
@@ -65,20 +54,6 @@ void print_all(std::vector<int64_t> &vector) {
     std::cout << "===================================" << std::endl;
 }
 
-std::vector<int64_t> Evaluation::generate_border_mask(bool invert) {
-    std::vector<int64_t> data(image_size * image_size, invert);
-    for (size_t i = 0; i < image_size * image_size; i++) {
-        int x = i % image_size;
-        int y = i / image_size;
-        data[i] = (y == 0)                          // top border
-                  || (y == image_size - 1)  // bottom border
-                  || (x == 0 || x == 7)     // lhs and rhs borders
-                  ? !invert
-                  : invert;
-    }
-    return data;
-}
-
 std::vector<int64_t> Evaluation::run_kernel(VecInt2D img) {
     std::stringstream ss_time;
     Timepoint t_start_keygen = Time::now();
@@ -98,7 +73,9 @@ std::vector<int64_t> Evaluation::run_kernel(VecInt2D img) {
     seal::KeyGenerator keygen(*context);
     secret_key = keygen.secret_key();
     keygen.create_public_key(public_key);
-    keygen.create_galois_keys(galois_keys);
+    // only the rotations the filters need
+    keygen.create_galois_keys(
+            StencilEngine::rotation_steps(image_size, filters), galois_keys);
     keygen.create_relin_keys(relin_keys);
 
     // Create helper objects
@@ -111,80 +88,36 @@ std::vector<int64_t> Evaluation::run_kernel(VecInt2D img) {
     Timepoint t_end_keygen = Time::now();
     log_time(ss_time, t_start_keygen, t_end_keygen, false);
 
-    // Encrypt input image
+    // encodes the weights and masks once, splits larger images into tiles
+    engine = std::make_unique<StencilEngine>(*evaluator, *encoder, image_size,
+                                             filters);
+    const std::size_t num_ctxts = engine->num_ciphertexts();
+
+    // Encrypt input image, row-wise in tiles of consecutive rows
     Timepoint t_start_input_encryption = Time::now();
-    std::vector<int64_t> img_as_vec(image_size * image_size, 0);
-    for (size_t i = 0; i < img.size(); i++) {
-        for (size_t j = 0; j < img[i].size(); j++) {
-            img_as_vec[i * image_size + j] = img[i][j];
-        }
+    std::vector<seal::Ciphertext> img_ctxts(num_ctxts);
+    for (size_t c = 0; c < num_ctxts; c++) {
+        seal::Plaintext img_ptxt;
+        encoder->encode(engine->pack_image(img, c), img_ptxt);
+        // symm is more efficient
+        encryptor->encrypt_symmetric(img_ptxt, img_ctxts[c]);
     }
-    seal::Plaintext img_ptxt;
-    encoder->encode(img_as_vec, img_ptxt);
-    seal::Ciphertext img_ctxt;
-    encryptor->encrypt_symmetric(img_ptxt, img_ctxt);  // symm is more efficient
 
     Timepoint t_end_input_encryption = Time::now();
     log_time(ss_time, t_start_input_encryption, t_end_input_encryption, false);
 
     Timepoint t_start_computation = Time::now();
-
-    // Create rotated copies of the image and multiplicate by weights
-    std::vector<int> rotations = {-0,
-                                  -1,
-                                  -2,
-                                  -image_size,
-                                  -(image_size + 1),
-                                  -(image_size + 2),
-                                  -(2 * image_size),
-                                  -(2 * image_size + 1),
-                                  -(2 * image_size + 2)};
-    seal::Plaintext w_ptxt;
-    std::vector<seal::Ciphertext> img_ctxts(weight_matrix.size(),
-                                            seal::Ciphertext(*context));
-    for (size_t i = 0; i < weight_matrix.size(); ++i) {
-        evaluator->rotate_rows(img_ctxt, rotations[i], galois_keys, img_ctxts[i]);
-        encoder->encode(
-                std::vector<int64_t>(encoder->slot_count(), weight_matrix[i]), w_ptxt);
-        evaluator->multiply_plain_inplace(img_ctxts[i], w_ptxt);
+    for (size_t c = 0; c < num_ctxts; c++) {
+        engine->apply(img_ctxts[c], c, galois_keys);
     }
-
-    // Sum up all the ciphertexts
-    seal::Ciphertext res_ctxt(*context);
-    evaluator->add_many(img_ctxts, res_ctxt);
-
-    // Move the computed result to the expected position, e.g., first computed
-    // value must be at (1,1) as kernel leaves border untouched
-    evaluator->rotate_rows_inplace(res_ctxt, image_size + 1, galois_keys);
-
-    // result = 2*img_ctxt - value
-    // (1) 2*img_ctxt
-    seal::Plaintext two;
-    std::vector<int64_t> full_two(encoder->slot_count(), 2);
-    encoder->encode(full_two, two);
-    seal::Ciphertext two_times_img_ctxt;
-    evaluator->multiply_plain(img_ctxt, two, two_times_img_ctxt);
-    // (2) [2*img_ctxt] - value
-    evaluator->sub_inplace(two_times_img_ctxt, res_ctxt);
-
-    // Remove anything except the border from the input image
-    std::vector<int64_t> data_border = generate_border_mask(false);
-    seal::Plaintext mask_border_only;
-    encoder->encode(data_border, mask_border_only);
-    evaluator->multiply_plain_inplace(img_ctxt, mask_border_only);
-    // Remove the border from the computed result
-    std::vector<int64_t> data_inner = generate_border_mask(true);
-    seal::Plaintext mask_inner_only;
-    encoder->encode(data_inner, mask_inner_only);
-    evaluator->multiply_plain_inplace(two_times_img_ctxt, mask_inner_only);
-    // Merge the input image (border-only) with the computed kernel (border = 0)
-    evaluator->add_inplace(img_ctxt, two_times_img_ctxt);
-
     Timepoint t_end_computation = Time::now();
     log_time(ss_time, t_start_computation, t_end_computation, false);
 
     Timepoint t_start_decryption = Time::now();
-    auto final_result = decrypt_and_decode(img_ctxt);
+    std::vector<int64_t> final_result(image_size * image_size, 0);
+    for (size_t c = 0; c < num_ctxts; c++) {
+        engine->unpack_image(decrypt_and_decode(img_ctxts[c]), c, final_result);
+    }
     Timepoint t_end_decryption = Time::now();
     log_time(ss_time, t_start_decryption, t_end_decryption, true);
 
@@ -202,11 +135,101 @@ std::vector<int64_t> Evaluation::run_kernel(VecInt2D img) {
     return final_result;
 }
 
+// Filters every frame of the stream with a single KernelService, writes the
+// timings of each frame (keygen only for the first) and optionally the results
+void run_stream(std::istream &frames, int image_size,
+                const std::vector<StencilKernel> &filters) {
+    KernelService service(image_size, filters);
+    Evaluation eval(image_size, filters);
+
+    std::ofstream times_file;
+    auto out_filename = std::getenv("OUTPUT_FILENAME");
+    if (out_filename != nullptr) times_file.open(out_filename, std::ios_base::app);
+    std::ofstream results_file;
+    auto results_filename = std::getenv("FRAMES_OUT");
+    if (results_filename != nullptr) results_file.open(results_filename);
+
+    long long setup_ms = service.setup_time();
+    auto num_frames = service.process_stream(
+            frames, [&](const KernelService::Frame &frame,
+                        const std::vector<int64_t> &result,
+                        const KernelService::FrameTimes &times) {
+                eval.check_results(frame, result);
+                if (times_file.is_open()) {
+                    times_file << setup_ms << "," << times.encryption << ","
+                               << times.computation << "," << times.decryption
+                               << std::endl;
+                }
+                setup_ms = 0;
+                if (results_file.is_open()) {
+                    for (size_t i = 0; i < result.size(); i++) {
+                        results_file << (i ? " " : "") << result[i];
+                    }
+                    results_file << std::endl;
+                }
+            });
+    std::cout << "Processed " << num_frames << " frames." << std::endl;
+
+    write_parameters_to_file(service.get_context(), "fhe_parameters_kernel.txt");
+}
+
 int main(int argc, char *argv[]) {
     std::cout << "Starting benchmark 'kernel-bfv-batched'..." << std::endl;
 
     // std::vector<int> image_sizes = { 8, 16, 32, 64, 96, 128 };
     std::vector<int> image_sizes = {8};
+    // IMAGE_SIZES (e.g. "8,128") overrides the default, images larger than a
+    // row of the batching matrix are processed in several tiles
+    auto image_sizes_env = std::getenv("IMAGE_SIZES");
+    if (image_sizes_env != nullptr) {
+        image_sizes.clear();
+        std::stringstream ss(image_sizes_env);
+        std::string size;
+        while (std::getline(ss, size, ',')) {
+            image_sizes.push_back(std::stoi(size));
+        }
+    }
+
+    // FILTERS (e.g. "blur,sobel_x") selects the filters that are applied one
+    // after another, out of sharpen, blur (3x3 box), sobel_x and sobel_y
+    std::vector<StencilKernel> filters = {StencilEngine::sharpen()};
+    auto filters_env = std::getenv("FILTERS");
+    if (filters_env != nullptr) {
+        filters.clear();
+        std::stringstream ss(filters_env);
+        std::string name;
+        while (std::getline(ss, name, ',')) {
+            if (name == "sharpen") {
+                filters.push_back(StencilEngine::sharpen());
+            } else if (name == "blur") {
+                filters.push_back(StencilEngine::box_blur(3));
+            } else if (name == "sobel_x") {
+                filters.push_back(StencilEngine::sobel_x());
+            } else if (name == "sobel_y") {
+                filters.push_back(StencilEngine::sobel_y());
+            } else {
+                throw std::invalid_argument("Unknown filter '" + name + "'.");
+            }
+        }
+    }
+
+    // FRAMES (a file, or "-" for stdin) streams frames of the first image size
+    // through a single set of keys, see KernelService for the format. The
+    // results are written to FRAMES_OUT (if set), one frame per line.
+    auto frames_env = std::getenv("FRAMES");
+    if (frames_env != nullptr) {
+        if (std::string(frames_env) == "-") {
+            run_stream(std::cin, image_sizes.front(), filters);
+        } else {
+            std::ifstream frames(frames_env);
+            if (!frames) {
+                throw std::runtime_error("Cannot open '" +
+                                         std::string(frames_env) + "'.");
+            }
+            run_stream(frames, image_sizes.front(), filters);
+        }
+        return 0;
+    }
 
     for (auto img_size : image_sizes) {
         // generate input image with dummy data
@@ -216,7 +239,7 @@ int main(int argc, char *argv[]) {
 
         // run kernel using FHE
         std::vector<std::vector<int>> img(img_size, vec);
-        Evaluation eval(img.size());
+        Evaluation eval(img.size(), filters);
         auto result = eval.run_kernel(img);
 
         eval.check_results(img, result);
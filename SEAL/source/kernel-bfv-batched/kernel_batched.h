@@ -2,12 +2,16 @@
 #define LAPLACIAN_SHARPENING_BATCHED_H_
 #endif
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <numeric>
+#include <stdexcept>
 #include <vector>
 #include <seal/seal.h>
 
 #include "../common.h"
+#include "stencil_engine.h"
 
 typedef std::vector<std::vector<int>> VecInt2D;
 
@@ -25,7 +29,10 @@ private:
     // e.g., image_size=8 corresponds to a 8x8 pixels image
     int image_size;
 
-    const std::vector<int> weight_matrix = {1, 1, 1, 1, -8, 1, 1, 1, 1};
+    // filters applied to the image, in this order
+    std::vector<StencilKernel> filters;
+
+    std::unique_ptr<StencilEngine> engine;
 
     std::shared_ptr<seal::SEALContext> context;
 
@@ -43,10 +50,9 @@ private:
 
     std::vector<int64_t> decode(seal::Plaintext &ptxt);
 
-    std::vector<int64_t> generate_border_mask(bool invert);
-
 public:
-    Evaluation(int image_size);
+    Evaluation(int image_size,
+               std::vector<StencilKernel> filters = {StencilEngine::sharpen()});
 
     std::vector<int64_t> run_kernel(VecInt2D img);
 
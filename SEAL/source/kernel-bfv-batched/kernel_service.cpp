@@ -0,0 +1,137 @@
+#include "kernel_service.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "../thread_pool.h"
+
+namespace {
+    typedef std::chrono::high_resolution_clock Clock;
+
+    long long elapsed_ms(Clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+    }
+
+    /// A frame read from the stream and its ciphertexts, produced by the worker
+    struct EncryptedFrame {
+        bool valid = false;
+        KernelService::Frame frame;
+        std::vector<seal::Ciphertext> ctxts;
+        long long encryption_ms = 0;
+    };
+}  // namespace
+
+KernelService::KernelService(int image_size, std::vector<StencilKernel> filters, std::size_t poly_modulus_degree)
+        : image_size(image_size), filters(std::move(filters)) {
+    auto start = Clock::now();
+
+    seal::EncryptionParameters parms(seal::scheme_type::bfv);
+    parms.set_poly_modulus_degree(poly_modulus_degree);
+    // Let SEAL select a "suitable" coefficient modulus (not necessarily maximal)
+    parms.set_coeff_modulus(seal::CoeffModulus::BFVDefault(parms.poly_modulus_degree()));
+    // Let SEAL select a plaintext modulus that actually supports batching
+    parms.set_plain_modulus(seal::PlainModulus::Batching(parms.poly_modulus_degree(), 20));
+    context = std::make_shared<seal::SEALContext>(parms);
+
+    seal::KeyGenerator keygen(*context);
+    secret_key = keygen.secret_key();
+    // only the rotations the filters need, frames are encrypted symmetrically
+    keygen.create_galois_keys(StencilEngine::rotation_steps(image_size, this->filters), galois_keys);
+
+    encoder = std::make_unique<seal::BatchEncoder>(*context);
+    encryptor = std::make_unique<seal::Encryptor>(*context, secret_key);
+    decryptor = std::make_unique<seal::Decryptor>(*context, secret_key);
+    evaluator = std::make_unique<seal::Evaluator>(*context);
+    engine = std::make_unique<StencilEngine>(*evaluator, *encoder, image_size, this->filters);
+
+    setup_ms = elapsed_ms(start);
+}
+
+bool KernelService::read_frame(std::istream &in, Frame &frame) const {
+    frame.assign(image_size, std::vector<int>(image_size));
+    for (int y = 0; y < image_size; ++y) {
+        for (int x = 0; x < image_size; ++x) {
+            if (!(in >> frame[y][x])) {
+                if (x == 0 && y == 0 && in.eof()) return false;
+                throw std::runtime_error("Incomplete or malformed frame at row " + std::to_string(y) + ", column " +
+                                         std::to_string(x) + ".");
+            }
+        }
+    }
+    return true;
+}
+
+std::vector<seal::Ciphertext> KernelService::encrypt_frame(const Frame &frame) const {
+    std::vector<seal::Ciphertext> ctxts(engine->num_ciphertexts());
+    for (std::size_t c = 0; c < ctxts.size(); ++c) {
+        seal::Plaintext ptxt;
+        encoder->encode(engine->pack_image(frame, c), ptxt);
+        encryptor->encrypt_symmetric(ptxt, ctxts[c]);
+    }
+    return ctxts;
+}
+
+void KernelService::evaluate(std::vector<seal::Ciphertext> &frame_ctxts) const {
+    for (std::size_t c = 0; c < frame_ctxts.size(); ++c) {
+        engine->apply(frame_ctxts[c], c, galois_keys);
+    }
+}
+
+std::vector<int64_t> KernelService::decrypt_frame(const std::vector<seal::Ciphertext> &frame_ctxts) const {
+    std::vector<int64_t> image(image_size * image_size, 0);
+    for (std::size_t c = 0; c < frame_ctxts.size(); ++c) {
+        seal::Plaintext ptxt;
+        decryptor->decrypt(frame_ctxts[c], ptxt);
+        std::vector<int64_t> slots;
+        encoder->decode(ptxt, slots);
+        engine->unpack_image(slots, c, image);
+    }
+    return image;
+}
+
+std::size_t KernelService::process_stream(std::istream &in, const ResultCallback &on_result) {
+    // the worker only ever runs one task at a time, so it is the only one reading the stream and encrypting
+    ThreadPool worker(1);
+    auto prepare_next = [this, &in] {
+        EncryptedFrame next;
+        if (!read_frame(in, next.frame)) return next;
+        auto start = Clock::now();
+        next.ctxts = encrypt_frame(next.frame);
+        next.encryption_ms = elapsed_ms(start);
+        next.valid = true;
+        return next;
+    };
+
+    std::size_t num_frames = 0;
+    auto pending = worker.submit(prepare_next);
+    while (true) {
+        EncryptedFrame current = pending.get();
+        if (!current.valid) break;
+        // overlaps with the evaluation of the current frame
+        pending = worker.submit(prepare_next);
+
+        FrameTimes times;
+        times.encryption = current.encryption_ms;
+        auto start_computation = Clock::now();
+        evaluate(current.ctxts);
+        times.computation = elapsed_ms(start_computation);
+
+        auto start_decryption = Clock::now();
+        auto result = decrypt_frame(current.ctxts);
+        times.decryption = elapsed_ms(start_decryption);
+
+        on_result(current.frame, result, times);
+        num_frames++;
+    }
+    return num_frames;
+}
+
+long long KernelService::setup_time() const {
+    return setup_ms;
+}
+
+std::shared_ptr<seal::SEALContext> KernelService::get_context() const {
+    return context;
+}
@@ -0,0 +1,83 @@
+#ifndef KERNEL_SERVICE_H_
+#define KERNEL_SERVICE_H_
+
+#include <seal/seal.h>
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "stencil_engine.h"
+
+/// Applies a stencil to a stream of frames (e.g. a video), with parameters, keys, weights and masks that are set up
+/// only once for all frames.
+///
+/// Frames are processed in a pipeline of two stages: while the calling thread evaluates (and decrypts) frame i, a
+/// worker thread already reads, encodes and encrypts frame i+1.
+class KernelService {
+public:
+    typedef std::vector<std::vector<int>> Frame;
+
+    /// Per-frame timings in ms, measured on the thread that ran the stage
+    struct FrameTimes {
+        long long encryption = 0;
+        long long computation = 0;
+        long long decryption = 0;
+    };
+
+    /// Called for every processed frame with the plaintext frame, the decrypted result (row-major) and its timings
+    typedef std::function<void(const Frame &, const std::vector<int64_t> &, const FrameTimes &)> ResultCallback;
+
+    /// \param image_size Width and height of the frames
+    /// \param filters Kernels applied to every frame, in this order
+    /// \param poly_modulus_degree Ring dimension (= number of slots) of the BFV parameters
+    /// \throw std::invalid_argument if the stencil engine does not support the image size or filters
+    KernelService(int image_size, std::vector<StencilKernel> filters = {StencilEngine::sharpen()},
+                  std::size_t poly_modulus_degree = 16384);
+
+    /// Reads the next frame, image_size * image_size whitespace-separated pixels in row-major order
+    /// \return false if the stream ended before the first pixel of a frame
+    /// \throw std::runtime_error if the stream ends or is malformed within a frame
+    bool read_frame(std::istream &in, Frame &frame) const;
+
+    /// Encrypts a frame into the ciphertexts of its row tiles
+    std::vector<seal::Ciphertext> encrypt_frame(const Frame &frame) const;
+
+    /// Applies the filters to an encrypted frame
+    void evaluate(std::vector<seal::Ciphertext> &frame_ctxts) const;
+
+    /// Decrypts a filtered frame (row-major)
+    std::vector<int64_t> decrypt_frame(const std::vector<seal::Ciphertext> &frame_ctxts) const;
+
+    /// Processes all frames of the stream until it ends
+    /// \return Number of processed frames
+    std::size_t process_stream(std::istream &in, const ResultCallback &on_result);
+
+    /// Time it took to set up the context, keys and the stencil engine in ms
+    long long setup_time() const;
+
+    std::shared_ptr<seal::SEALContext> get_context() const;
+
+private:
+    int image_size;
+
+    std::vector<StencilKernel> filters;
+
+    long long setup_ms = 0;
+
+    std::shared_ptr<seal::SEALContext> context;
+
+    seal::SecretKey secret_key;
+    seal::GaloisKeys galois_keys;
+
+    std::unique_ptr<seal::BatchEncoder> encoder;
+    std::unique_ptr<seal::Encryptor> encryptor;
+    std::unique_ptr<seal::Decryptor> decryptor;
+    std::unique_ptr<seal::Evaluator> evaluator;
+
+    std::unique_ptr<StencilEngine> engine;
+};
+
+#endif  // KERNEL_SERVICE_H_
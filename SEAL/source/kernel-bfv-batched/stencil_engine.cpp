@@ -0,0 +1,226 @@
+#include "stencil_engine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <stdexcept>
+#include <string>
+
+StencilEngine::StencilEngine(seal::Evaluator &evaluator, seal::BatchEncoder &encoder, int image_size,
+                             std::vector<StencilKernel> filters)
+        : evaluator(evaluator), image_size(image_size), filters(std::move(filters)),
+          row_size(encoder.slot_count() / 2), halo(0) {
+    for (const auto &filter : this->filters) {
+        const int radius = kernel_size(filter) / 2;
+        if (image_size <= 2 * radius) {
+            throw std::invalid_argument("The image must be larger than the kernel.");
+        }
+        if (std::all_of(filter.begin(), filter.end(), [](int64_t w) { return w == 0; })) {
+            // the result would be a transparent ciphertext
+            throw std::invalid_argument("Kernels must have a non-zero weight.");
+        }
+        halo += radius;
+    }
+    if (image_size > static_cast<int>(row_size)) {
+        throw std::invalid_argument("Image rows must fit into a row of " + std::to_string(row_size) + " slots.");
+    }
+
+    // small images fit into a single tile
+    tile_rows = std::min<int>(image_size, row_size / image_size);
+    if (tile_rows < image_size && tile_rows <= 2 * halo) {
+        throw std::invalid_argument("Image size " + std::to_string(image_size) +
+                                    " leaves no inner rows besides the halo rows of a tile.");
+    }
+    for (int first = 0;; first += tile_rows - 2 * halo) {
+        // the last tile is moved up to end at the last row of the image
+        first = std::min(first, image_size - tile_rows);
+        tile_first_rows.push_back(first);
+        if (first + tile_rows >= image_size) break;
+    }
+
+    // weights 0 and 1 are skipped and used as they are in apply()
+    for (const auto &filter : this->filters) {
+        for (auto w : filter) {
+            if (w != 0 && w != 1 && weights.find(w) == weights.end()) {
+                encoder.encode(std::vector<int64_t>(encoder.slot_count(), w), weights[w]);
+            }
+        }
+    }
+
+    inner_masks.resize(num_ciphertexts());
+    border_masks.resize(num_ciphertexts());
+    for (std::size_t c = 0; c < num_ciphertexts(); ++c) {
+        for (const auto &filter : this->filters) {
+            const int radius = kernel_size(filter) / 2;
+            std::vector<int64_t> inner(encoder.slot_count(), 0), border(encoder.slot_count(), 0);
+            for (std::size_t row = 0; row < 2 && 2 * c + row < tile_first_rows.size(); ++row) {
+                for (int i = 0; i < tile_rows; ++i) {
+                    const int y = tile_first_rows[2 * c + row] + i;
+                    for (int x = 0; x < image_size; ++x) {
+                        auto &mask = is_border(x, y, radius) ? border : inner;
+                        mask[row * row_size + i * image_size + x] = 1;
+                    }
+                }
+            }
+            inner_masks[c].emplace_back();
+            encoder.encode(inner, inner_masks[c].back());
+            border_masks[c].emplace_back();
+            encoder.encode(border, border_masks[c].back());
+        }
+    }
+}
+
+int StencilEngine::kernel_size(const StencilKernel &filter) {
+    const int size = static_cast<int>(std::lround(std::sqrt(static_cast<double>(filter.size()))));
+    if (size * size != static_cast<int>(filter.size()) || size % 2 == 0) {
+        throw std::invalid_argument("Kernels must be KxK matrices with odd K.");
+    }
+    return size;
+}
+
+bool StencilEngine::is_border(int x, int y, int radius) const {
+    return x < radius || y < radius || x >= image_size - radius || y >= image_size - radius;
+}
+
+std::vector<int> StencilEngine::rotation_steps(int image_size, const std::vector<StencilKernel> &filters) {
+    std::set<int> steps;
+    for (const auto &filter : filters) {
+        const int size = kernel_size(filter);
+        const int radius = size / 2;
+        for (int dy = -radius; dy <= radius; ++dy) {
+            for (int dx = -radius; dx <= radius; ++dx) {
+                const int step = dy * image_size + dx;
+                if (step != 0 && filter[(dy + radius) * size + dx + radius] != 0) {
+                    steps.insert(step);
+                }
+            }
+        }
+    }
+    return std::vector<int>(steps.begin(), steps.end());
+}
+
+std::vector<int> StencilEngine::rotation_steps() const {
+    return rotation_steps(image_size, filters);
+}
+
+std::size_t StencilEngine::num_ciphertexts() const {
+    return (tile_first_rows.size() + 1) / 2;
+}
+
+std::vector<int64_t> StencilEngine::pack_image(const std::vector<std::vector<int>> &img,
+                                               std::size_t ctxt_idx) const {
+    std::vector<int64_t> slots(2 * row_size, 0);
+    for (std::size_t row = 0; row < 2 && 2 * ctxt_idx + row < tile_first_rows.size(); ++row) {
+        for (int i = 0; i < tile_rows; ++i) {
+            const auto &pixels = img[tile_first_rows[2 * ctxt_idx + row] + i];
+            std::copy(pixels.begin(), pixels.end(), slots.begin() + row * row_size + i * image_size);
+        }
+    }
+    return slots;
+}
+
+void StencilEngine::apply(seal::Ciphertext &ctxt, std::size_t ctxt_idx, const seal::GaloisKeys &galois_keys) const {
+    for (std::size_t f = 0; f < filters.size(); ++f) {
+        const int size = kernel_size(filters[f]);
+        const int radius = size / 2;
+
+        // the pixel at (y + dy, x + dx) is dy * image_size + dx slots to the left
+        std::vector<seal::Ciphertext> products;
+        for (int dy = -radius; dy <= radius; ++dy) {
+            for (int dx = -radius; dx <= radius; ++dx) {
+                const int64_t w = filters[f][(dy + radius) * size + dx + radius];
+                if (w == 0) continue;
+                seal::Ciphertext product;
+                const int step = dy * image_size + dx;
+                if (step == 0) {
+                    product = ctxt;
+                } else {
+                    evaluator.rotate_rows(ctxt, step, galois_keys, product);
+                }
+                if (w != 1) {
+                    evaluator.multiply_plain_inplace(product, weights.at(w));
+                }
+                products.push_back(std::move(product));
+            }
+        }
+        seal::Ciphertext sum;
+        evaluator.add_many(products, sum);
+        if (radius == 0) {
+            // without neighbours there is no border
+            ctxt = std::move(sum);
+            continue;
+        }
+
+        // merge the computed pixels with the border pixels that keep their value
+        evaluator.multiply_plain_inplace(ctxt, border_masks[ctxt_idx][f]);
+        evaluator.multiply_plain_inplace(sum, inner_masks[ctxt_idx][f]);
+        evaluator.add_inplace(ctxt, sum);
+    }
+}
+
+void StencilEngine::unpack_image(const std::vector<int64_t> &slots, std::size_t ctxt_idx,
+                                 std::vector<int64_t> &image) const {
+    const std::size_t last_tile = tile_first_rows.size() - 1;
+    for (std::size_t row = 0; row < 2 && 2 * ctxt_idx + row <= last_tile; ++row) {
+        const std::size_t t = 2 * ctxt_idx + row;
+        for (int i = 0; i < tile_rows; ++i) {
+            // the halo rows only count at the top and bottom of the image,
+            // where there are no neighbouring rows that could be missing
+            const bool inner_row = i >= halo && i < tile_rows - halo;
+            if (!inner_row && !(t == 0 && i < halo) && !(t == last_tile && i >= tile_rows - halo)) continue;
+            const int y = tile_first_rows[t] + i;
+            std::copy_n(slots.begin() + row * row_size + i * image_size, image_size,
+                        image.begin() + y * image_size);
+        }
+    }
+}
+
+std::vector<std::vector<int64_t>> StencilEngine::apply_plain(const std::vector<std::vector<int>> &img,
+                                                             const std::vector<StencilKernel> &filters) {
+    const int n = img.size();
+    std::vector<std::vector<int64_t>> current(n);
+    for (int y = 0; y < n; ++y) {
+        current[y].assign(img[y].begin(), img[y].end());
+    }
+    for (const auto &filter : filters) {
+        const int size = kernel_size(filter);
+        const int radius = size / 2;
+        auto next = current;
+        for (int y = radius; y < n - radius; ++y) {
+            for (int x = radius; x < n - radius; ++x) {
+                int64_t value = 0;
+                for (int dy = -radius; dy <= radius; ++dy) {
+                    for (int dx = -radius; dx <= radius; ++dx) {
+                        value += filter[(dy + radius) * size + dx + radius] * current[y + dy][x + dx];
+                    }
+                }
+                next[y][x] = value;
+            }
+        }
+        current = std::move(next);
+    }
+    return current;
+}
+
+StencilKernel StencilEngine::sharpen() {
+    // 2 * center - (sum of the neighbours - 8 * center)
+    return {-1, -1, -1,
+            -1, 10, -1,
+            -1, -1, -1};
+}
+
+StencilKernel StencilEngine::box_blur(int size) {
+    return StencilKernel(size * size, 1);
+}
+
+StencilKernel StencilEngine::sobel_x() {
+    return {-1, 0, 1,
+            -2, 0, 2,
+            -1, 0, 1};
+}
+
+StencilKernel StencilEngine::sobel_y() {
+    return {-1, -2, -1,
+            0, 0, 0,
+            1, 2, 1};
+}
@@ -0,0 +1,97 @@
+#ifndef STENCIL_ENGINE_H_
+#define STENCIL_ENGINE_H_
+
+#include <seal/seal.h>
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+/// A KxK integer filter kernel (K odd) in row-major order, the center weight applies to the pixel itself
+typedef std::vector<int64_t> StencilKernel;
+
+/// Applies a chain of integer filter kernels (stencils) to square images encrypted with batched BFV.
+///
+/// The image is stored row-wise, so the neighbour at (dy, dx) of a pixel is dy * image_size + dx slots away and a
+/// filter is the sum of the rotated images times their weights. Rotations are only cyclic within a row of the
+/// batching matrix (slot_count / 2 slots), so larger images are split into tiles of consecutive rows, one per
+/// matrix row (i.e., two per ciphertext). Consecutive tiles share halo rows, as many as the radii of all filters
+/// add up to, so that every inner row of a tile still has all its neighbours after the whole chain.
+/// Pixels closer to the image border than the radius of a filter keep their value (like in the original kernel).
+class StencilEngine {
+public:
+    /// \param evaluator Evaluator of the context of the ciphertexts
+    /// \param encoder Encoder of the context, used to encode the weights and masks once
+    /// \param image_size Width and height of the images
+    /// \param filters Kernels in the order they are applied
+    /// \throw std::invalid_argument if a kernel is not KxK with odd K, or the image is too large for its halo rows
+    StencilEngine(seal::Evaluator &evaluator, seal::BatchEncoder &encoder, int image_size,
+                  std::vector<StencilKernel> filters);
+
+    /// Rotation steps the given filters need, to create only these Galois keys
+    static std::vector<int> rotation_steps(int image_size, const std::vector<StencilKernel> &filters);
+
+    /// Rotation steps of the filters of this engine
+    std::vector<int> rotation_steps() const;
+
+    /// Number of ciphertexts an image takes
+    std::size_t num_ciphertexts() const;
+
+    /// Slot values of ciphertext ctxt_idx of the image
+    std::vector<int64_t> pack_image(const std::vector<std::vector<int>> &img, std::size_t ctxt_idx) const;
+
+    /// Applies all filters to ciphertext ctxt_idx of an image
+    void apply(seal::Ciphertext &ctxt, std::size_t ctxt_idx, const seal::GaloisKeys &galois_keys) const;
+
+    /// Copies the rows of the decoded ciphertext ctxt_idx that are valid after the filters into image (row-major)
+    void unpack_image(const std::vector<int64_t> &slots, std::size_t ctxt_idx, std::vector<int64_t> &image) const;
+
+    /// Applies the filters to a plaintext image, as a reference for the encrypted result
+    static std::vector<std::vector<int64_t>> apply_plain(const std::vector<std::vector<int>> &img,
+                                                         const std::vector<StencilKernel> &filters);
+
+    /// 3x3 sharpening: 2 * img - laplacian(img) (the original kernel, which cannot divide by 2)
+    static StencilKernel sharpen();
+
+    /// size x size box blur, the sum of all pixels (without the division)
+    static StencilKernel box_blur(int size);
+
+    /// 3x3 horizontal Sobel operator
+    static StencilKernel sobel_x();
+
+    /// 3x3 vertical Sobel operator
+    static StencilKernel sobel_y();
+
+private:
+    seal::Evaluator &evaluator;
+
+    int image_size;
+
+    std::vector<StencilKernel> filters;
+
+    std::size_t row_size;
+
+    /// Image rows per tile, including the halo rows
+    int tile_rows;
+
+    /// Radii of all filters added up
+    int halo;
+
+    /// First image row of each tile
+    std::vector<int> tile_first_rows;
+
+    /// Every distinct weight, encoded once
+    std::map<int64_t, seal::Plaintext> weights;
+
+    /// Per ciphertext and filter, the mask of the pixels the filter computes and of those it leaves unchanged
+    std::vector<std::vector<seal::Plaintext>> inner_masks;
+    std::vector<std::vector<seal::Plaintext>> border_masks;
+
+    /// Kernel width of a filter
+    static int kernel_size(const StencilKernel &filter);
+
+    /// Whether the filter with the given radius leaves the pixel unchanged
+    bool is_border(int x, int y, int radius) const;
+};
+
+#endif  // STENCIL_ENGINE_H_
@@ -0,0 +1,127 @@
+#include "gtest/gtest.h"
+#include "../stencil_engine.h"
+
+#include <memory>
+#include <random>
+
+using namespace std;
+using namespace seal;
+
+namespace StencilEngineTests {
+
+    /**
+     * \brief Random image with small pixel values, so that the filtered values stay far below the plain modulus
+     * \param image_size Width and height of the image
+     * \param seed Seed of the pixel values
+     */
+    vector<vector<int>> random_image(int image_size, unsigned seed) {
+        mt19937 rng(seed);
+        uniform_int_distribution<int> pixel(0, 15);
+        vector<vector<int>> img(image_size, vector<int>(image_size));
+        for (auto &row : img) {
+            for (auto &p : row) {
+                p = pixel(rng);
+            }
+        }
+        return img;
+    }
+
+    /**
+     * \brief Helper function to test the encrypted filters: packs and encrypts a random image, applies the filters,
+     *  decrypts and unpacks the result and compares every pixel to StencilEngine::apply_plain
+     * \param image_size Width and height of the image
+     * \param filters Kernels in the order they are applied
+     * \param poly_modulus_degree Ring dimension, half of it is the number of slots a tile can use
+     * \param expected_ciphertexts Number of ciphertexts the image should take (i.e., ceil(tiles / 2))
+     */
+    void StencilTest(int image_size, const vector<StencilKernel> &filters, size_t poly_modulus_degree,
+                     size_t expected_ciphertexts) {
+        const auto img = random_image(image_size, image_size);
+        const auto expected = StencilEngine::apply_plain(img, filters);
+
+        // Setup SEAL Parameters
+        EncryptionParameters params(scheme_type::bfv);
+        params.set_poly_modulus_degree(poly_modulus_degree);
+        params.set_coeff_modulus(CoeffModulus::BFVDefault(poly_modulus_degree));
+        params.set_plain_modulus(PlainModulus::Batching(poly_modulus_degree, 20));
+        SEALContext context(params);
+
+        // Generate required keys
+        KeyGenerator keygen(context);
+        auto secret_key = keygen.secret_key();
+        GaloisKeys galois_keys;
+        keygen.create_galois_keys(StencilEngine::rotation_steps(image_size, filters), galois_keys);
+
+        BatchEncoder encoder(context);
+        Encryptor encryptor(context, secret_key);
+        Decryptor decryptor(context, secret_key);
+        Evaluator evaluator(context);
+
+        StencilEngine engine(evaluator, encoder, image_size, filters);
+        ASSERT_EQ(engine.num_ciphertexts(), expected_ciphertexts);
+
+        vector<int64_t> result(image_size * image_size, 0);
+        for (size_t c = 0; c < engine.num_ciphertexts(); ++c) {
+            Plaintext ptxt;
+            encoder.encode(engine.pack_image(img, c), ptxt);
+            Ciphertext ctxt;
+            encryptor.encrypt_symmetric(ptxt, ctxt);
+
+            engine.apply(ctxt, c, galois_keys);
+            ASSERT_GT(decryptor.invariant_noise_budget(ctxt), 0);
+
+            decryptor.decrypt(ctxt, ptxt);
+            vector<int64_t> slots;
+            encoder.decode(ptxt, slots);
+            engine.unpack_image(slots, c, result);
+        }
+
+        for (int y = 0; y < image_size; ++y) {
+            for (int x = 0; x < image_size; ++x) {
+                EXPECT_EQ(result[y * image_size + x], expected[y][x]) << "at row " << y << ", column " << x;
+            }
+        }
+    }
+
+    TEST(StencilEngineTest, SingleTile) {
+        // 16 rows of 16 pixels fit into one row of the batching matrix
+        StencilTest(16, {StencilEngine::sharpen()}, 8192, 1);
+    }
+
+    TEST(StencilEngineTest, MovedUpLastTile) {
+        // tiles of 4096 / 91 = 45 rows start at rows 0 and 43, the third one would start at 86 and is moved up to 46
+        StencilTest(91, {StencilEngine::sharpen()}, 8192, 2);
+    }
+
+    TEST(StencilEngineTest, SeveralTiles) {
+        // tiles of 32 rows start at rows 0, 30, 60, 90 and (moved up from 120) 96
+        StencilTest(128, {StencilEngine::sharpen()}, 8192, 3);
+    }
+
+    TEST(StencilEngineTest, ChainedBlurSobel) {
+        // two halo rows per tile: tiles of 32 rows start at rows 0, 28, 56, 84 and (moved up from 112) 96
+        StencilTest(128, {StencilEngine::box_blur(3), StencilEngine::sobel_x()}, 8192, 3);
+    }
+
+    TEST(StencilEngineTest, ChainedBlurSobelMovedUp) {
+        // two halo rows per tile: tiles of 45 rows start at rows 0, 41 and (moved up from 82) 46
+        StencilTest(91, {StencilEngine::box_blur(3), StencilEngine::sobel_y()}, 8192, 2);
+    }
+
+    TEST(StencilEngineTest, LargerKernel) {
+        // a 5x5 blur has the same halo as blur + sobel, but needs rotations by two rows
+        StencilTest(64, {StencilEngine::box_blur(5)}, 8192, 1);
+    }
+
+    TEST(StencilEngineTest, ImageTooLarge) {
+        EncryptionParameters params(scheme_type::bfv);
+        params.set_poly_modulus_degree(8192);
+        params.set_coeff_modulus(CoeffModulus::BFVDefault(8192));
+        params.set_plain_modulus(PlainModulus::Batching(8192, 20));
+        SEALContext context(params);
+        BatchEncoder encoder(context);
+        Evaluator evaluator(context);
+        // rows longer than a row of the batching matrix cannot be rotated
+        EXPECT_THROW(StencilEngine(evaluator, encoder, 4097, {StencilEngine::sharpen()}), invalid_argument);
+    }
+}
@@ -10,7 +10,8 @@ namespace {
     }
 }  // namespace
 
-Evaluation::Evaluation(int image_size) : image_size(image_size) {};
+Evaluation::Evaluation(int image_size, Mode mode)
+        : image_size(image_size), mode(mode) {};
 
 Duration Evaluation::compute_duration(Timepoint start, Timepoint end) {
     if (end < start) {
@@ -71,6 +72,95 @@ void Evaluation::print_all(std::vector<int64_t> &vector) {
     std::cout << "===================================" << std::endl;
 }
 
+seal::Ciphertext Evaluation::compute_per_pixel(seal::Ciphertext &img_ctxt,
+                                               seal::Plaintext &border_mask) {
+    seal::Ciphertext img2_ctxt;
+    evaluator->multiply_plain(img_ctxt, border_mask, img2_ctxt);
+
+    for (int x = 1; x < image_size - 1; ++x) {
+        for (int y = 1; y < image_size - 1; ++y) {
+            seal::Ciphertext value;
+            seal::Plaintext value_ptxt;
+            std::vector<int64_t> zero(image_size * image_size, 0);
+            encoder->encode(zero, value_ptxt);
+            encryptor->encrypt(value_ptxt, value);
+
+            for (int j = -1; j < 2; ++j) {
+                for (int i = -1; i < 2; ++i) {
+                    // set weight at index where input is
+                    seal::Plaintext w;
+                    std::vector<int64_t> data(image_size * image_size, 0);
+                    data.at((y + j) + (x + i) * image_size) =
+                            weight_matrix.at(i + 1).at(j + 1);
+                    encoder->encode(data, w);
+
+                    // temp = img_ctxt * w
+                    seal::Ciphertext temp;
+                    evaluator->multiply_plain(img_ctxt, w, temp);
+
+                    // rotate ciphertext temp so that the value is at index (x,y)
+                    evaluator->rotate_rows_inplace(temp, (j + i * image_size),
+                                                   galois_keys);
+
+                    // value = value + temp
+                    evaluator->add_inplace(value, temp);
+                }
+            }
+
+            // temp = img_ctxt[x][y] * 2
+            seal::Plaintext two;
+            std::vector<int64_t> two_data(image_size * image_size, 0);
+            two_data.at(y + x * image_size) = 2;
+            encoder->encode(two_data, two);
+            seal::Ciphertext temp;
+            evaluator->multiply_plain(img_ctxt, two, temp);
+
+            // temp = temp - value
+            evaluator->sub_inplace(temp, value);
+
+            // img2_ctxt = img2_ctxt + temp
+            evaluator->add_inplace(img2_ctxt, temp);
+        }
+    }
+    return img2_ctxt;
+}
+
+seal::Ciphertext Evaluation::compute_vectorized(seal::Ciphertext &img_ctxt,
+                                                seal::Plaintext &border_mask,
+                                                std::vector<int64_t> &border_data) {
+    // The border keeps its value, this also starts the sum without having to
+    // encrypt zero
+    seal::Ciphertext img2_ctxt;
+    evaluator->multiply_plain(img_ctxt, border_mask, img2_ctxt);
+
+    // Rotating the whole image by (j + i * image_size) moves the neighbour
+    // (x + i, y + j) of every pixel to the index of (x, y), so each weight
+    // needs a single rotation for all pixels. The weights are only set at
+    // inner pixels and already include 2 * img[x][y] - value.
+    for (int j = -1; j < 2; ++j) {
+        for (int i = -1; i < 2; ++i) {
+            int64_t weight = -weight_matrix.at(i + 1).at(j + 1);
+            if (i == 0 && j == 0) weight += 2;
+            seal::Plaintext w;
+            std::vector<int64_t> data(image_size * image_size, 0);
+            for (size_t k = 0; k < data.size(); k++) {
+                if (!border_data[k]) data[k] = weight;
+            }
+            encoder->encode(data, w);
+
+            // temp = rotate(img_ctxt) * w
+            seal::Ciphertext temp;
+            evaluator->rotate_rows(img_ctxt, (j + i * image_size), galois_keys,
+                                   temp);
+            evaluator->multiply_plain_inplace(temp, w);
+
+            // img2_ctxt = img2_ctxt + temp
+            evaluator->add_inplace(img2_ctxt, temp);
+        }
+    }
+    return img2_ctxt;
+}
+
 std::vector<int64_t> Evaluation::apply_kernel(VecInt2D &img) {
     std::stringstream ss_time;
 
@@ -95,10 +185,11 @@ std::vector<int64_t> Evaluation::apply_kernel(VecInt2D &img) {
     std::vector<int> steps;
     for (int j = -1; j < 2; ++j) {
         for (int i = -1; i < 2; ++i) {
-            steps.push_back(j + i * image_size);
+            // rotating by 0 steps does not need a key
+            if (j != 0 || i != 0) steps.push_back(j + i * image_size);
         }
     }
-    keygen.create_galois_keys(galois_keys);
+    keygen.create_galois_keys(steps, galois_keys);
     keygen.create_relin_keys(relin_keys);
 
     // Create helper objects
@@ -136,60 +227,15 @@ std::vector<int64_t> Evaluation::apply_kernel(VecInt2D &img) {
     for (size_t i = 0; i < image_size * image_size; i++) {
         int x = i % image_size;
         int y = i / image_size;
-        data[i] = (y == 0)                  // top border
-                  || (y == image_size - 1)  // bottom border
-                  || (x == 0 || x == 7);    // lhs and rhs borders
+        data[i] = (y == 0)                             // top border
+                  || (y == image_size - 1)             // bottom border
+                  || (x == 0 || x == image_size - 1);  // lhs and rhs borders
     }
     seal::Plaintext mask;
     encoder->encode(data, mask);
-    seal::Ciphertext img2_ctxt;
-    evaluator->multiply_plain(img_ctxt, mask, img2_ctxt);
-
-    for (int x = 1; x < image_size - 1; ++x) {
-        for (int y = 1; y < img.at(x).size() - 1; ++y) {
-            seal::Ciphertext value;
-            seal::Plaintext value_ptxt;
-            std::vector<int64_t> zero(image_size * image_size, 0);
-            encoder->encode(zero, value_ptxt);
-            encryptor->encrypt(value_ptxt, value);
-
-            for (int j = -1; j < 2; ++j) {
-                for (int i = -1; i < 2; ++i) {
-                    // set weight at index where input is
-                    seal::Plaintext w;
-                    std::vector<int64_t> data(image_size * image_size, 0);
-                    data.at((y + j) + (x + i) * image_size) =
-                            weight_matrix.at(i + 1).at(j + 1);
-                    encoder->encode(data, w);
-
-                    // temp = img_ctxt * w
-                    seal::Ciphertext temp;
-                    evaluator->multiply_plain(img_ctxt, w, temp);
-
-                    // rotate ciphertext temp so that the value is at index (x,y)
-                    evaluator->rotate_rows_inplace(temp, (j + i * image_size),
-                                                   galois_keys);
-
-                    // value = value + temp
-                    evaluator->add_inplace(value, temp);
-                }
-            }
-
-            // temp = img_ctxt[x][y] * 2
-            seal::Plaintext two;
-            std::vector<int64_t> two_data(image_size * image_size, 0);
-            two_data.at(y + x * image_size) = 2;
-            encoder->encode(two_data, two);
-            seal::Ciphertext temp;
-            evaluator->multiply_plain(img_ctxt, two, temp);
-
-            // temp = temp - value
-            evaluator->sub_inplace(temp, value);
-
-            // img2_ctxt = img2_ctxt + temp
-            evaluator->add_inplace(img2_ctxt, temp);
-        }
-    }
+    seal::Ciphertext img2_ctxt = (mode == Mode::VECTORIZED)
+                                 ? compute_vectorized(img_ctxt, mask, data)
+                                 : compute_per_pixel(img_ctxt, mask);
 
     Timepoint t_end_computation = Time::now();
     log_time(ss_time, t_start_computation, t_end_computation, false);
@@ -218,6 +264,12 @@ int main(int argc, char *argv[]) {
 
     // std::vector<int> image_sizes = {8, 16, 32, 64, 96, 128};
     std::vector<int> image_sizes = {8};
+    // KERNEL_MODE=vectorized applies the kernel to all pixels at once instead
+    // of pixel by pixel
+    auto mode_env = std::getenv("KERNEL_MODE");
+    auto mode = (mode_env != nullptr && std::string(mode_env) == "vectorized")
+                ? Evaluation::Mode::VECTORIZED
+                : Evaluation::Mode::PER_PIXEL;
 
     for (auto img_size : image_sizes) {
         // generate input
@@ -226,7 +278,7 @@ int main(int argc, char *argv[]) {
         std::vector<std::vector<int>> img(img_size, vec);
 
         // perform FHE computation
-        Evaluation eval(img.size());
+        Evaluation eval(img.size(), mode);
         auto fhe_result = eval.apply_kernel(img);
 
         // check correctness of results
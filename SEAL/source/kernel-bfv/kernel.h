@@ -4,6 +4,8 @@
 
 #include <chrono>
 #include <iostream>
+#include <numeric>
+#include <string>
 #include <vector>
 #include <seal/seal.h>
 
@@ -19,10 +21,21 @@ typedef std::chrono::milliseconds ms;
 #define PRINT_LIMIT 70
 
 class Evaluation {
+public:
+    enum class Mode {
+        // computes each pixel on its own with single-slot weights, as in the
+        // original benchmark
+        PER_PIXEL,
+        // computes all pixels at once with one rotation per kernel weight
+        VECTORIZED
+    };
+
 private:
     // e.g., image_size=8 corresponds to a 8x8 pixels image
     int image_size;
 
+    Mode mode;
+
     const VecInt2D weight_matrix = {{1, 1,  1},
                                     {1, -8, 1},
                                     {1, 1,  1}};
@@ -47,10 +60,18 @@ private:
 
     void print_all(std::vector<int64_t> &vector);
 
+    // result = border of img_ctxt + kernel applied to its inner pixels
+    seal::Ciphertext compute_per_pixel(seal::Ciphertext &img_ctxt,
+                                       seal::Plaintext &border_mask);
+
+    seal::Ciphertext compute_vectorized(seal::Ciphertext &img_ctxt,
+                                        seal::Plaintext &border_mask,
+                                        std::vector<int64_t> &border_data);
+
 public:
     int main(int argc, char *argv[]);
 
-    Evaluation(int image_size);
+    Evaluation(int image_size, Mode mode = Mode::PER_PIXEL);
 
     std::vector<int64_t> apply_kernel(VecInt2D &img);
 
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include "seal/seal.h"
+
+/**
+ * \brief Ciphertext-ciphertext multiplications that postpone relinearization until it is actually needed.
+ *  A product has size 3 and can still be added, subtracted, negated and multiplied with plaintexts, so it is only
+ *  relinearized right before it is multiplied with another ciphertext (or rotated) and, via finish(), before it
+ *  leaves a circuit. Sums of several products therefore cost a single relinearization instead of one per product.
+ *  Relinearizing is a key switch, the most expensive BFV primitive after rotations.
+ *  Inputs of a multiplication are relinearized in place, callers should not expect them to keep their size.
+ *  It can be shared between threads that work on different ciphertexts (or only read ciphertexts of size 2).
+ */
+class LazyRelinearizer {
+public:
+    /**
+     * \param[in] evaluator Evaluator of the context of the ciphertexts
+     * \param[in] relin_keys Keys used whenever a ciphertext has to be relinearized, must outlive this object
+     */
+    LazyRelinearizer(seal::Evaluator &evaluator, const seal::RelinKeys &relin_keys)
+            : evaluator(evaluator), relin_keys(relin_keys) {}
+
+    /// Relinearizes ctxt if it is larger than 2, e.g. before it is rotated or returned
+    void finish(seal::Ciphertext &ctxt) {
+        if (ctxt.size() > 2) {
+            evaluator.relinearize_inplace(ctxt, relin_keys);
+            relinearization_count++;
+        }
+    }
+
+    /// destination = lhs * rhs, left unrelinearized (the inputs are relinearized first if needed)
+    void multiply(seal::Ciphertext &lhs, seal::Ciphertext &rhs, seal::Ciphertext &destination) {
+        finish(lhs);
+        finish(rhs);
+        if (&lhs == &rhs) {
+            evaluator.square(lhs, destination);
+        } else {
+            evaluator.multiply(lhs, rhs, destination);
+        }
+    }
+
+    /// destination = lhs * rhs for inputs that must not change, left unrelinearized (inputs of size 3 are copied to
+    /// relinearize them, which fresh ciphertexts never need)
+    void multiply(const seal::Ciphertext &lhs, const seal::Ciphertext &rhs, seal::Ciphertext &destination) {
+        if (lhs.size() > 2 || rhs.size() > 2) {
+            seal::Ciphertext lhs_copy = lhs;
+            if (&lhs == &rhs) {
+                multiply(lhs_copy, lhs_copy, destination);
+            } else {
+                seal::Ciphertext rhs_copy = rhs;
+                multiply(lhs_copy, rhs_copy, destination);
+            }
+        } else if (&lhs == &rhs) {
+            evaluator.square(lhs, destination);
+        } else {
+            evaluator.multiply(lhs, rhs, destination);
+        }
+    }
+
+    /// lhs = lhs * rhs, left unrelinearized (the inputs are relinearized first if needed)
+    void multiply_inplace(seal::Ciphertext &lhs, seal::Ciphertext &rhs) {
+        finish(lhs);
+        finish(rhs);
+        if (&lhs == &rhs) {
+            evaluator.square_inplace(lhs);
+        } else {
+            evaluator.multiply_inplace(lhs, rhs);
+        }
+    }
+
+    /// destination = ctxt^2, left unrelinearized (the input is relinearized first if needed)
+    void square(seal::Ciphertext &ctxt, seal::Ciphertext &destination) {
+        multiply(ctxt, ctxt, destination);
+    }
+
+    /// ctxt = ctxt^2, left unrelinearized (the input is relinearized first if needed)
+    void square_inplace(seal::Ciphertext &ctxt) {
+        multiply_inplace(ctxt, ctxt);
+    }
+
+    /// Number of relinearizations performed so far
+    std::size_t relinearizations() const {
+        return relinearization_count;
+    }
+
+private:
+    seal::Evaluator &evaluator;
+
+    const seal::RelinKeys &relin_keys;
+
+    std::atomic<std::size_t> relinearization_count{0};
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "seal/seal.h"
+
+/**
+ * \brief Switches intermediate BFV ciphertexts down the modulus chain to the lowest level that still leaves enough
+ *  noise budget for the rest of the circuit. Multiplications, relinearizations and rotations get cheaper with every
+ *  prime that is dropped.
+ *  The circuit marks intermediate results with named checkpoints. A calibration run (on sample inputs, with the
+ *  secret key) measures the invariant noise budget at every checkpoint for every lower level, and the budget that is
+ *  left in the results. The budget the circuit consumes after a checkpoint is the difference of the two, so the
+ *  checkpoint can drop primes as long as the remaining budget covers it plus a safety margin.
+ *  Without calibration, checkpoints only bring the ciphertexts of a group to a common level.
+ *  Checkpoints with different ciphertexts may be reached concurrently, e.g. from independent branches of a circuit.
+ */
+class LevelManager {
+public:
+    /**
+     * \param[in] context Context of the ciphertexts
+     * \param[in] evaluator Evaluator used to switch ciphertexts down
+     * \param[in] margin_bits Noise budget (in bits) that must be left in the results
+     */
+    LevelManager(std::shared_ptr<seal::SEALContext> context, seal::Evaluator &evaluator, int margin_bits = 10)
+            : context(std::move(context)), evaluator(evaluator), margin_bits(margin_bits) {}
+
+    /**
+     * \brief Starts a calibration run, all checkpoints until finish_calibration() only measure and do not switch
+     *  (besides aligning their ciphertexts). Discards a previous calibration.
+     * \param[in] decryptor Decryptor to measure the noise budget with, must stay valid until finish_calibration()
+     */
+    void start_calibration(seal::Decryptor &decryptor) {
+        calibration_decryptor = &decryptor;
+        checkpoints.clear();
+    }
+
+    /**
+     * \brief Ends the calibration run and selects the level of every checkpoint
+     * \param[in] results Outputs of the circuit, their smallest noise budget is what the circuit leaves over
+     */
+    void finish_calibration(const std::vector<const seal::Ciphertext *> &results) {
+        int final_budget = std::numeric_limits<int>::max();
+        for (const auto *result : results) {
+            final_budget = std::min(final_budget, calibration_decryptor->invariant_noise_budget(*result));
+        }
+        for (auto &entry : checkpoints) {
+            Checkpoint &checkpoint = entry.second;
+            // budget the circuit consumes from this checkpoint on
+            const int consumed = checkpoint.budgets[0] - final_budget;
+            std::size_t drops = 0;
+            while (drops + 1 < checkpoint.budgets.size() &&
+                   checkpoint.budgets[drops + 1] - consumed >= margin_bits) {
+                drops++;
+            }
+            checkpoint.target = checkpoint.measured - drops;
+        }
+        calibration_decryptor = nullptr;
+    }
+
+    /**
+     * \brief Marks an intermediate point of the circuit. Brings all ciphertexts to the lowest level among them, and
+     *  further down to the level selected for this checkpoint (if calibrated). All ciphertexts of the group can be
+     *  combined with each other afterwards.
+     * \param[in] name Identifies the checkpoint, the same name has to be used in the calibration run
+     * \param[in,out] ctxts Ciphertexts that are switched down
+     */
+    void checkpoint(const std::string &name, const std::vector<seal::Ciphertext *> &ctxts) {
+        std::size_t level = std::numeric_limits<std::size_t>::max();
+        for (const auto *ctxt : ctxts) {
+            level = std::min(level, chain_index(*ctxt));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = checkpoints.find(name);
+            if (!calibration_decryptor && it != checkpoints.end()) {
+                level = std::min(level, it->second.target);
+            }
+        }
+        for (auto *ctxt : ctxts) {
+            if (chain_index(*ctxt) > level) {
+                evaluator.mod_switch_to_inplace(*ctxt, parms_id_at(level));
+            }
+        }
+        if (calibration_decryptor) {
+            measure(name, ctxts, level);
+        }
+    }
+
+    /// Prints the level selected for each checkpoint (as the chain index, 0 being the last level)
+    void print_levels(std::ostream &out) const {
+        for (const auto &entry : checkpoints) {
+            out << "Level of '" << entry.first << "': " << entry.second.target << " (from " << entry.second.measured
+                << ")" << std::endl;
+        }
+    }
+
+private:
+    /// Calibration result of a checkpoint
+    struct Checkpoint {
+        /// Chain index of the ciphertexts in the calibration run
+        std::size_t measured = 0;
+
+        /// Smallest noise budget of the ciphertexts after switching down 0, 1, ... levels from measured
+        std::vector<int> budgets;
+
+        /// Chain index the ciphertexts are switched to
+        std::size_t target = 0;
+    };
+
+    std::shared_ptr<seal::SEALContext> context;
+
+    seal::Evaluator &evaluator;
+
+    int margin_bits;
+
+    seal::Decryptor *calibration_decryptor = nullptr;
+
+    std::map<std::string, Checkpoint> checkpoints;
+
+    /// Guards checkpoints against concurrent checkpoint() calls
+    std::mutex mutex;
+
+    std::size_t chain_index(const seal::Ciphertext &ctxt) const {
+        return context->get_context_data(ctxt.parms_id())->chain_index();
+    }
+
+    seal::parms_id_type parms_id_at(std::size_t chain_index) const {
+        auto data = context->first_context_data();
+        while (data->chain_index() > chain_index) {
+            data = data->next_context_data();
+        }
+        return data->parms_id();
+    }
+
+    /// Records the noise budget of ctxts (all at the given level) at this and every lower level
+    void measure(const std::string &name, const std::vector<seal::Ciphertext *> &ctxts, std::size_t level) {
+        std::vector<int> budgets(level + 1, std::numeric_limits<int>::max());
+        for (const auto *ctxt : ctxts) {
+            seal::Ciphertext lower = *ctxt;
+            for (std::size_t drops = 0; drops <= level; ++drops) {
+                if (drops > 0) {
+                    evaluator.mod_switch_to_next_inplace(lower);
+                }
+                budgets[drops] = std::min(budgets[drops], calibration_decryptor->invariant_noise_budget(lower));
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        Checkpoint &checkpoint = checkpoints[name];
+        if (checkpoint.budgets.empty()) {
+            checkpoint.measured = level;
+            checkpoint.budgets = budgets;
+        } else {
+            // reached several times (e.g. once per ciphertext), keep the worst case
+            for (std::size_t drops = 0; drops < std::min(budgets.size(), checkpoint.budgets.size()); ++drops) {
+                checkpoint.budgets[drops] = std::min(checkpoint.budgets[drops], budgets[drops]);
+            }
+        }
+        checkpoint.target = checkpoint.measured;
+    }
+};
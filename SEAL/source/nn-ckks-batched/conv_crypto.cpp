@@ -0,0 +1,276 @@
+#include "conv_crypto.h"
+#include <memory>
+#include <stdexcept>
+#include "hoisted_rotations.h"
+
+using namespace std;
+using namespace seal;
+
+ImageLayout ImageLayout::dense(size_t height, size_t width) {
+    return {height, width, width, 1};
+}
+
+size_t ImageLayout::slot(size_t y, size_t x) const {
+    return y * row_stride + x * col_stride;
+}
+
+size_t ImageLayout::span() const {
+    return (height == 0 || width == 0) ? 0 : slot(height - 1, width - 1) + 1;
+}
+
+vec ImageLayout::pack(const vec &image) const {
+    if (image.size() != height * width) {
+        throw invalid_argument("Image size does not match the layout.");
+    }
+    vec slots(span(), 0);
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            slots[slot(y, x)] = image[y * width + x];
+        }
+    }
+    return slots;
+}
+
+vec ImageLayout::unpack(const vec &slots) const {
+    if (slots.size() < span()) {
+        throw invalid_argument("Not enough slots for the layout.");
+    }
+    vec image(height * width);
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            image[y * width + x] = slots[slot(y, x)];
+        }
+    }
+    return image;
+}
+
+ImageLayout ImageLayout::pooled(size_t pool_size) const {
+    if (pool_size == 0 || height % pool_size != 0 || width % pool_size != 0) {
+        throw invalid_argument("Image height and width must be multiples of the pool size.");
+    }
+    return {height / pool_size, width / pool_size, row_stride * pool_size, col_stride * pool_size};
+}
+
+PreparedConvolution::PreparedConvolution(CKKSEncoder &encoder, const vector<vector<matrix>> &kernels,
+                                         const ImageLayout &layout, parms_id_type parms_id, double scale)
+        : weights(kernels), image_layout(layout), level(parms_id), weight_scale(scale) {
+    if (kernels.empty() || kernels[0].empty() || kernels[0][0].empty()) {
+        throw invalid_argument("Convolution must have at least one input and output channel.");
+    }
+    const size_t k = kernels[0][0].size();
+    for (const auto &out_channel : kernels) {
+        if (out_channel.size() != kernels[0].size()) {
+            throw invalid_argument("All output channels must have the same number of input channels.");
+        }
+        for (const auto &kernel : out_channel) {
+            if (kernel.size() != k) {
+                throw invalid_argument("All kernels must have the same size.");
+            }
+            for (const auto &row : kernel) {
+                if (row.size() != k) {
+                    throw invalid_argument("Kernels must be square.");
+                }
+            }
+        }
+    }
+    if (k % 2 == 0 || k > layout.height || k > layout.width) {
+        throw invalid_argument("Kernel size must be odd and must not exceed the image size.");
+    }
+    if (layout.span() > encoder.slot_count()) {
+        throw invalid_argument("Image does not fit into a ciphertext.");
+    }
+
+    // mask(dy, dx) keeps the pixels whose source pixel (y + dy - k/2, x + dx - k/2) lies inside of the image
+    const long padding = k / 2;
+    masks.resize(k * k);
+    for (size_t dy = 0; dy < k; ++dy) {
+        for (size_t dx = 0; dx < k; ++dx) {
+            vec mask(layout.span(), 0);
+            for (size_t y = 0; y < layout.height; ++y) {
+                for (size_t x = 0; x < layout.width; ++x) {
+                    const long src_y = (long) y + (long) dy - padding;
+                    const long src_x = (long) x + (long) dx - padding;
+                    if (src_y >= 0 && src_y < (long) layout.height && src_x >= 0 && src_x < (long) layout.width) {
+                        mask[layout.slot(y, x)] = 1;
+                    }
+                }
+            }
+            encoder.encode(mask, parms_id, scale, masks[dy * k + dx]);
+        }
+    }
+}
+
+size_t PreparedConvolution::in_channels() const {
+    return weights[0].size();
+}
+
+size_t PreparedConvolution::out_channels() const {
+    return weights.size();
+}
+
+size_t PreparedConvolution::kernel_size() const {
+    return weights[0][0].size();
+}
+
+const ImageLayout &PreparedConvolution::layout() const {
+    return image_layout;
+}
+
+const parms_id_type &PreparedConvolution::parms_id() const {
+    return level;
+}
+
+double PreparedConvolution::scale() const {
+    return weight_scale;
+}
+
+double PreparedConvolution::weight(size_t o, size_t i, size_t dy, size_t dx) const {
+    return weights[o][i][dy][dx];
+}
+
+const Plaintext &PreparedConvolution::mask(size_t dy, size_t dx) const {
+    return masks[dy * kernel_size() + dx];
+}
+
+int PreparedConvolution::offset(size_t dy, size_t dx) const {
+    const long padding = kernel_size() / 2;
+    return static_cast<int>(((long) dy - padding) * (long) image_layout.row_stride +
+                            ((long) dx - padding) * (long) image_layout.col_stride);
+}
+
+vector<int> conv_rotation_steps(const ImageLayout &layout, size_t kernel_size) {
+    const long padding = kernel_size / 2;
+    vector<int> steps;
+    for (long dy = -padding; dy <= padding; ++dy) {
+        for (long dx = -padding; dx <= padding; ++dx) {
+            if (dy != 0 || dx != 0) {
+                steps.push_back(static_cast<int>(dy * (long) layout.row_stride + dx * (long) layout.col_stride));
+            }
+        }
+    }
+    return steps;
+}
+
+namespace {
+    /// Convolution, running in parallel if a pool is given
+    void convolution(ThreadPool *pool, const SEALContext &context, const GaloisKeys &galois_keys,
+                     Evaluator &evaluator, CKKSEncoder &encoder, const PreparedConvolution &conv,
+                     const vector<Ciphertext> &inputs, vector<Ciphertext> &outputs) {
+        if (inputs.size() != conv.in_channels()) {
+            throw invalid_argument("Number of input channels does not match the convolution.");
+        }
+        for (const auto &input : inputs) {
+            if (input.parms_id() != conv.parms_id()) {
+                throw invalid_argument("Convolution was not prepared for the level of the input channels.");
+            }
+        }
+        const size_t k = conv.kernel_size();
+
+        // Every input channel is rotated by all k*k offsets, so the key switching decomposition is done only once
+        vector<unique_ptr<HoistedCiphertext>> hoisted(inputs.size());
+        for_each_index(pool, inputs.size(), [&](size_t i) {
+            hoisted[i] = make_unique<HoistedCiphertext>(context, inputs[i]);
+        });
+
+        vector<Ciphertext> results(conv.out_channels());
+        // Not vector<bool>, since the output channels are written to from different threads
+        vector<char> started(conv.out_channels(), false);
+        vector<Ciphertext> rotated(inputs.size());
+        for (size_t dy = 0; dy < k; ++dy) {
+            for (size_t dx = 0; dx < k; ++dx) {
+                // Bring the source pixels of this kernel position to their output pixels
+                for_each_index(pool, inputs.size(), [&](size_t i) {
+                    hoisted[i]->rotate_vector(conv.offset(dy, dx), galois_keys, rotated[i]);
+                });
+
+                for_each_index(pool, conv.out_channels(), [&](size_t o) {
+                    // sum = sum_i w[o][i][dy][dx] * rotated[i]
+                    Ciphertext sum;
+                    bool empty = true;
+                    Plaintext ptxt_weight;
+                    for (size_t i = 0; i < inputs.size(); ++i) {
+                        const double w = conv.weight(o, i, dy, dx);
+                        if (w == 0) {
+                            // Multiplying with an all-zero plaintext would also give a transparent ciphertext
+                            continue;
+                        }
+                        encoder.encode(w, rotated[i].parms_id(), conv.scale(), ptxt_weight);
+                        Ciphertext product;
+                        evaluator.multiply_plain(rotated[i], ptxt_weight, product);
+                        if (empty) {
+                            sum = std::move(product);
+                            empty = false;
+                        } else {
+                            evaluator.add_inplace(sum, product);
+                        }
+                    }
+                    if (empty) {
+                        return;
+                    }
+
+                    // Zero padding
+                    evaluator.multiply_plain_inplace(sum, conv.mask(dy, dx));
+
+                    if (!started[o]) {
+                        results[o] = std::move(sum);
+                        started[o] = true;
+                    } else {
+                        evaluator.add_inplace(results[o], sum);
+                    }
+                });
+            }
+        }
+
+        for (size_t o = 0; o < results.size(); ++o) {
+            if (!started[o]) {
+                throw invalid_argument("All weights of an output channel are zero.");
+            }
+        }
+        outputs = std::move(results);
+    }
+}
+
+void ptxt_weights_enc_input_conv(const SEALContext &context, const GaloisKeys &galois_keys,
+                                 Evaluator &evaluator, CKKSEncoder &encoder,
+                                 const PreparedConvolution &conv, const vector<Ciphertext> &inputs,
+                                 vector<Ciphertext> &outputs) {
+    convolution(nullptr, context, galois_keys, evaluator, encoder, conv, inputs, outputs);
+}
+
+void ptxt_weights_enc_input_conv(ThreadPool &pool, const SEALContext &context, const GaloisKeys &galois_keys,
+                                 Evaluator &evaluator, CKKSEncoder &encoder, const PreparedConvolution &conv,
+                                 const vector<Ciphertext> &inputs, vector<Ciphertext> &outputs) {
+    convolution(&pool, context, galois_keys, evaluator, encoder, conv, inputs, outputs);
+}
+
+vector<int> sum_pool_rotation_steps(const ImageLayout &layout, size_t pool_size) {
+    vector<int> steps;
+    for (size_t d = 1; d < pool_size; ++d) {
+        steps.push_back(static_cast<int>(d * layout.col_stride));
+        steps.push_back(static_cast<int>(d * layout.row_stride));
+    }
+    return steps;
+}
+
+void enc_sum_pool(const GaloisKeys &galois_keys, Evaluator &evaluator, const ImageLayout &layout,
+                  size_t pool_size, const Ciphertext &ctxt, Ciphertext &result) {
+    // Only checks the arguments, the pooled layout is up to the caller
+    layout.pooled(pool_size);
+
+    // Sum along the rows of the windows
+    Ciphertext row_sum = ctxt;
+    for (size_t dx = 1; dx < pool_size; ++dx) {
+        Ciphertext rotated;
+        evaluator.rotate_vector(ctxt, static_cast<int>(dx * layout.col_stride), galois_keys, rotated);
+        evaluator.add_inplace(row_sum, rotated);
+    }
+
+    // Sum the row sums along the columns of the windows
+    Ciphertext window_sum = row_sum;
+    for (size_t dy = 1; dy < pool_size; ++dy) {
+        Ciphertext rotated;
+        evaluator.rotate_vector(row_sum, static_cast<int>(dy * layout.row_stride), galois_keys, rotated);
+        evaluator.add_inplace(window_sum, rotated);
+    }
+    result = std::move(window_sum);
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <vector>
+#include "matrix_vector.h"
+#include "seal/seal.h"
+#include "../thread_pool.h"
+
+/**
+ * \brief Position of the pixels of one (channel of an) image in the slots of a ciphertext.
+ *  Pixel (y, x) is in slot y * row_stride + x * col_stride. An image starts out dense (row-major, col_stride = 1),
+ *  and every pooling layer multiplies the strides by the pool size instead of moving the results together,
+ *  which would cost a rotation and a mask per pixel. The slots in between hold garbage that is never read.
+ */
+struct ImageLayout {
+    /// Number of rows of the image
+    size_t height;
+
+    /// Number of columns of the image
+    size_t width;
+
+    /// Distance in slots between vertically adjacent pixels
+    size_t row_stride;
+
+    /// Distance in slots between horizontally adjacent pixels
+    size_t col_stride;
+
+    /// Row-major layout of a height x width image
+    static ImageLayout dense(size_t height, size_t width);
+
+    /// Slot that holds pixel (y, x)
+    size_t slot(size_t y, size_t x) const;
+
+    /// Number of slots from the first to the last pixel (inclusive)
+    size_t span() const;
+
+    /**
+     * \brief Place the pixels of an image in their slots
+     * \param image Image of size height x width in row-major order
+     * \return Vector of length span(), with zeros between the pixels
+     * \throw std::invalid_argument if the image has the wrong size
+     */
+    vec pack(const vec &image) const;
+
+    /**
+     * \brief Inverse of pack
+     * \param slots Decoded slots, at least span() many
+     * \return Image of size height x width in row-major order
+     * \throw std::invalid_argument if there are not enough slots
+     */
+    vec unpack(const vec &slots) const;
+
+    /**
+     * \brief Layout of the result of a pooling layer with non-overlapping pool_size x pool_size windows
+     * \param pool_size Size of the pooling windows
+     * \return Layout with height and width divided by pool_size, and both strides multiplied by it
+     * \throw std::invalid_argument if the height or width is not a multiple of pool_size
+     */
+    ImageLayout pooled(size_t pool_size) const;
+};
+
+/**
+ * \brief The weights of a multi-channel 2D convolution ("same" padding, stride 1), prepared for
+ *  ptxt_weights_enc_input_conv at one level.
+ *  For every kernel position (dy, dx), the input channels are rotated by the matching offset in the layout and
+ *  multiplied with the scalar weights, and the sum over the input channels is multiplied with a mask that removes
+ *  the pixels whose source lies outside the image (this is the zero padding). The masks only depend on the layout,
+ *  so just k*k of them are encoded here. The weights are encoded as constants when they are used, since encoding
+ *  all out_channels * in_channels * k * k of them as full plaintexts would take gigabytes.
+ *  Weights and masks are encoded at a scale of about the square root of the ciphertext primes, so that the two
+ *  plaintext multiplications together only use up one level.
+ */
+class PreparedConvolution {
+public:
+    /**
+     * \brief Encode the masks of a convolution
+     * \param[in] encoder Encoder object from SEAL
+     * \param[in] kernels Weights, kernels[o][i] is the k x k kernel from input channel i to output channel o
+     * \param[in] layout Layout of the input channels (and of the output channels, since padding is "same")
+     * \param[in] parms_id Level of the encrypted input channels
+     * \param[in] scale Scale of the weights and masks
+     * \throw std::invalid_argument if the kernels are not all of the same odd size k <= height, width or the image does not fit into a ciphertext
+     */
+    PreparedConvolution(seal::CKKSEncoder &encoder, const std::vector<std::vector<matrix>> &kernels,
+                        const ImageLayout &layout, seal::parms_id_type parms_id, double scale);
+
+    /// Number of input channels
+    size_t in_channels() const;
+
+    /// Number of output channels
+    size_t out_channels() const;
+
+    /// Size k of the k x k kernels
+    size_t kernel_size() const;
+
+    /// Layout of the input and output channels
+    const ImageLayout &layout() const;
+
+    /// Level of the encrypted input channels
+    const seal::parms_id_type &parms_id() const;
+
+    /// Scale of the weights and masks
+    double scale() const;
+
+    /// Weight at kernel position (dy, dx) from input channel i to output channel o
+    double weight(size_t o, size_t i, size_t dy, size_t dx) const;
+
+    /// Encoded mask for kernel position (dy, dx)
+    const seal::Plaintext &mask(size_t dy, size_t dx) const;
+
+    /// Rotation for kernel position (dy, dx), i.e. the distance in slots from an output pixel to its source
+    int offset(size_t dy, size_t dx) const;
+
+private:
+    std::vector<std::vector<matrix>> weights;
+
+    ImageLayout image_layout;
+
+    seal::parms_id_type level;
+
+    double weight_scale;
+
+    /// Indexed by dy * kernel_size + dx
+    std::vector<seal::Plaintext> masks;
+};
+
+/**
+ * \brief Rotation steps used by ptxt_weights_enc_input_conv
+ * \param[in] layout Layout of the input channels
+ * \param[in] kernel_size Size k of the k x k kernels
+ * \return The offsets of all kernel positions except the center.
+ *  The rotations are hoisted (see HoistedCiphertext), so the galois keys must contain these exact steps.
+ */
+std::vector<int> conv_rotation_steps(const ImageLayout &layout, size_t kernel_size);
+
+/**
+ * \brief Computes a multi-channel 2D convolution ("same" padding, stride 1) of encrypted channels with plaintext weights.
+ *  Each input channel is rotated once per kernel position (hoisted), the products are summed per output channel.
+ *  Uses one level, but does not rescale: the scale of the results is the input scale times conv.scale() squared.
+ *  The masks also clear all slots that do not hold a pixel of the layout.
+ * \param[in] context SEAL context that the inputs belong to
+ * \param[in] galois_keys Rotation keys, **must contain a key for each step of conv_rotation_steps**
+ * \param[in] evaluator Evaluation object from SEAL
+ * \param[in] encoder Encoder object from SEAL, used to encode the weights as constants
+ * \param[in] conv The prepared weights
+ * \param[in] inputs One ciphertext per input channel, at the level of conv and in its layout
+ * \param[out] outputs One ciphertext per output channel, in the same layout
+ * \throw std::invalid_argument if the number or level of the inputs does not match the convolution or a key is missing
+ */
+void ptxt_weights_enc_input_conv(const seal::SEALContext &context, const seal::GaloisKeys &galois_keys,
+                                 seal::Evaluator &evaluator, seal::CKKSEncoder &encoder,
+                                 const PreparedConvolution &conv, const std::vector<seal::Ciphertext> &inputs,
+                                 std::vector<seal::Ciphertext> &outputs);
+
+/**
+ * \brief Same as ptxt_weights_enc_input_conv, but spreads the work across a thread pool:
+ *  the rotations of the input channels and the sums of the output channels run in parallel
+ * \param[in] pool Thread pool to run on (the calling thread takes part as well)
+ * \param[in] context SEAL context that the inputs belong to
+ * \param[in] galois_keys Rotation keys, **must contain a key for each step of conv_rotation_steps**
+ * \param[in] evaluator Evaluation object from SEAL
+ * \param[in] encoder Encoder object from SEAL, used to encode the weights as constants
+ * \param[in] conv The prepared weights
+ * \param[in] inputs One ciphertext per input channel, at the level of conv and in its layout
+ * \param[out] outputs One ciphertext per output channel, in the same layout
+ * \throw std::invalid_argument if the number or level of the inputs does not match the convolution or a key is missing
+ */
+void ptxt_weights_enc_input_conv(ThreadPool &pool, const seal::SEALContext &context,
+                                 const seal::GaloisKeys &galois_keys, seal::Evaluator &evaluator,
+                                 seal::CKKSEncoder &encoder, const PreparedConvolution &conv,
+                                 const std::vector<seal::Ciphertext> &inputs, std::vector<seal::Ciphertext> &outputs);
+
+/**
+ * \brief Rotation steps used by enc_sum_pool
+ * \param[in] layout Layout of the input
+ * \param[in] pool_size Size of the pooling windows
+ * \return The steps along a row and along a column of the window
+ */
+std::vector<int> sum_pool_rotation_steps(const ImageLayout &layout, size_t pool_size);
+
+/**
+ * \brief Sums up non-overlapping pool_size x pool_size windows of an encrypted image channel, i.e. average pooling
+ *  without the division by the window size. That division is linear and can be folded into the weights of the next
+ *  layer, which saves the level a multiplication would use up. Sums first along the rows and then along the
+ *  columns, so this takes 2 * (pool_size - 1) rotations and no multiplications.
+ * \param[in] galois_keys Rotation keys, should contain the steps of sum_pool_rotation_steps
+ * \param[in] evaluator Evaluation object from SEAL
+ * \param[in] layout Layout of the input
+ * \param[in] pool_size Size of the pooling windows
+ * \param[in] ctxt Encrypted image channel
+ * \param[out] result Sums of the windows, in the layout layout.pooled(pool_size)
+ * \throw std::invalid_argument if the height or width is not a multiple of pool_size
+ */
+void enc_sum_pool(const seal::GaloisKeys &galois_keys, seal::Evaluator &evaluator, const ImageLayout &layout,
+                  size_t pool_size, const seal::Ciphertext &ctxt, seal::Ciphertext &result);
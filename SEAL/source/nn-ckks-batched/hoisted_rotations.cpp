@@ -0,0 +1,149 @@
+#include "hoisted_rotations.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "seal/util/ntt.h"
+#include "seal/util/uintarithsmallmod.h"
+
+using namespace std;
+using namespace seal;
+using namespace seal::util;
+
+HoistedCiphertext::HoistedCiphertext(const SEALContext &context, const Ciphertext &ctxt)
+        : context(context), ctxt(ctxt) {
+    if (!context.using_keyswitching()) {
+        throw invalid_argument("Encryption parameters do not support key switching.");
+    }
+    if (ctxt.size() != 2 || !ctxt.is_ntt_form()) {
+        throw invalid_argument("Hoisting requires a ciphertext of size 2 in NTT form.");
+    }
+    auto context_data = context.get_context_data(ctxt.parms_id());
+    if (!context_data) {
+        throw invalid_argument("Ciphertext is not valid for the encryption parameters.");
+    }
+    auto key_context_data = context.key_context_data();
+    const auto &key_modulus = key_context_data->parms().coeff_modulus();
+    const auto key_ntt_tables = key_context_data->small_ntt_tables();
+    const size_t key_modulus_size = key_modulus.size();
+
+    decomp_modulus_size = context_data->parms().coeff_modulus().size();
+    coeff_count = context_data->parms().poly_modulus_degree();
+    const size_t rns_modulus_size = decomp_modulus_size + 1;
+
+    // Bring the second component into coefficient representation, one digit per ciphertext prime
+    vector<uint64_t> digits(ctxt.data(1), ctxt.data(1) + decomp_modulus_size * coeff_count);
+    for (size_t j = 0; j < decomp_modulus_size; ++j) {
+        inverse_ntt_negacyclic_harvey(digits.data() + j * coeff_count, key_ntt_tables[j]);
+    }
+
+    // Reduce every digit modulo every key-switching prime and transform it back into NTT form.
+    // This is the part of the key switching that is shared between all rotations.
+    decomposition.resize(decomp_modulus_size * rns_modulus_size * coeff_count);
+    for (size_t j = 0; j < decomp_modulus_size; ++j) {
+        const uint64_t *digit = digits.data() + j * coeff_count;
+        for (size_t i = 0; i < rns_modulus_size; ++i) {
+            const size_t key_index = (i == decomp_modulus_size) ? key_modulus_size - 1 : i;
+            uint64_t *dest = decomposition.data() + (j * rns_modulus_size + i) * coeff_count;
+            if (i == j) {
+                // Digit j modulo its own prime is exactly the input, which is already in NTT form
+                copy_n(ctxt.data(1) + j * coeff_count, coeff_count, dest);
+            } else {
+                const Modulus &modulus = key_modulus[key_index];
+                for (size_t c = 0; c < coeff_count; ++c) {
+                    dest[c] = barrett_reduce_64(digit[c], modulus);
+                }
+                ntt_negacyclic_harvey(dest, key_ntt_tables[key_index]);
+            }
+        }
+    }
+}
+
+void HoistedCiphertext::rotate_vector(int steps, const GaloisKeys &galois_keys, Ciphertext &destination) const {
+    if (steps == 0) {
+        destination = ctxt;
+        return;
+    }
+    if (galois_keys.parms_id() != context.key_parms_id()) {
+        throw invalid_argument("Galois keys are not valid for the encryption parameters.");
+    }
+
+    auto context_data = context.get_context_data(ctxt.parms_id());
+    auto galois_tool = context_data->galois_tool();
+    const uint32_t galois_elt = galois_tool->get_elt_from_step(steps);
+    if (!galois_keys.has_key(galois_elt)) {
+        throw invalid_argument("Galois keys do not contain a key for a rotation by " + to_string(steps) +
+                               " steps, which is required for hoisted rotations.");
+    }
+    const auto &key_vector = galois_keys.key(galois_elt);
+
+    auto key_context_data = context.key_context_data();
+    const auto &key_modulus = key_context_data->parms().coeff_modulus();
+    const auto key_ntt_tables = key_context_data->small_ntt_tables();
+    const size_t key_modulus_size = key_modulus.size();
+    const size_t rns_modulus_size = decomp_modulus_size + 1;
+
+    // Multiply the permuted digits with the key switching key and accumulate, for both key components and all moduli
+    vector<uint64_t> products(2 * rns_modulus_size * coeff_count, 0);
+    vector<uint64_t> permuted(coeff_count);
+    for (size_t j = 0; j < decomp_modulus_size; ++j) {
+        for (size_t i = 0; i < rns_modulus_size; ++i) {
+            const size_t key_index = (i == decomp_modulus_size) ? key_modulus_size - 1 : i;
+            const Modulus &modulus = key_modulus[key_index];
+            galois_tool->apply_galois_ntt(decomposition.data() + (j * rns_modulus_size + i) * coeff_count,
+                                          galois_elt, permuted.data());
+            for (size_t k = 0; k < 2; ++k) {
+                const uint64_t *key = key_vector[j].data().data(k) + key_index * coeff_count;
+                uint64_t *acc = products.data() + (k * rns_modulus_size + i) * coeff_count;
+                for (size_t c = 0; c < coeff_count; ++c) {
+                    acc[c] = add_uint_mod(acc[c], multiply_uint_mod(permuted[c], key[c], modulus), modulus);
+                }
+            }
+        }
+    }
+
+    // The first component is only permuted, the key switching result gets added to it below
+    destination = ctxt;
+    for (size_t i = 0; i < decomp_modulus_size; ++i) {
+        galois_tool->apply_galois_ntt(ctxt.data(0) + i * coeff_count, galois_elt,
+                                      destination.data(0) + i * coeff_count);
+    }
+
+    // Divide by the special prime (with rounding) to get back to the ciphertext modulus
+    const Modulus &special_modulus = key_modulus[key_modulus_size - 1];
+    const uint64_t special_half = special_modulus.value() >> 1;
+    vector<uint64_t> last(coeff_count);
+    vector<uint64_t> correction(coeff_count);
+    for (size_t k = 0; k < 2; ++k) {
+        const uint64_t *acc = products.data() + k * rns_modulus_size * coeff_count;
+        copy_n(acc + decomp_modulus_size * coeff_count, coeff_count, last.begin());
+        inverse_ntt_negacyclic_harvey(last.data(), key_ntt_tables[key_modulus_size - 1]);
+        // Add (p-1)/2 to change from flooring to rounding
+        for (size_t c = 0; c < coeff_count; ++c) {
+            last[c] = barrett_reduce_64(last[c] + special_half, special_modulus);
+        }
+
+        for (size_t i = 0; i < decomp_modulus_size; ++i) {
+            const Modulus &modulus = key_modulus[i];
+            const uint64_t special_half_mod = barrett_reduce_64(special_half, modulus);
+            uint64_t inv_special;
+            try_invert_uint_mod(barrett_reduce_64(special_modulus.value(), modulus), modulus, inv_special);
+
+            for (size_t c = 0; c < coeff_count; ++c) {
+                correction[c] = sub_uint_mod(barrett_reduce_64(last[c], modulus), special_half_mod, modulus);
+            }
+            ntt_negacyclic_harvey(correction.data(), key_ntt_tables[i]);
+
+            const uint64_t *acc_i = acc + i * coeff_count;
+            uint64_t *dest = destination.data(k) + i * coeff_count;
+            for (size_t c = 0; c < coeff_count; ++c) {
+                const uint64_t scaled = multiply_uint_mod(sub_uint_mod(acc_i[c], correction[c], modulus),
+                                                          inv_special, modulus);
+                dest[c] = (k == 0) ? add_uint_mod(dest[c], scaled, modulus) : scaled;
+            }
+        }
+    }
+}
+
+const Ciphertext &HoistedCiphertext::ciphertext() const {
+    return ctxt;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include "seal/seal.h"
+
+/**
+ * \brief A CKKS ciphertext prepared for many rotations by different steps, using Halevi-Shoup "hoisting".
+ *  A normal rotation permutes the ciphertext and then key-switches its second component, which starts by decomposing
+ *  that component into its RNS digits and converting each digit into the NTT domain of every key-switching modulus.
+ *  That decomposition does not depend on the rotation amount, since automorphisms commute with the digit decomposition,
+ *  so it is computed here once and every rotation only has to permute the digits and multiply them with the key.
+ *  See Appendix of "GAZELLE: A Low Latency Framework for Secure Neural Network Inference" by Juvekar et al. and
+ *  "Faster Homomorphic Linear Transformations in HElib" by Halevi and Shoup.
+ *  SEAL does not expose hoisting through its public API, so this re-implements the key-switching step on top of
+ *  the SEAL utility functions, following the structure of seal::Evaluator::switch_key_inplace.
+ */
+class HoistedCiphertext {
+public:
+    /**
+     * \brief Decompose a ciphertext so that it can afterwards be rotated by arbitrary steps
+     * \param[in] context SEAL context the ciphertext belongs to. Must stay alive as long as this object.
+     * \param[in] ctxt Ciphertext of size 2, in NTT form (i.e. CKKS) at any level that still supports key switching
+     * \throw std::invalid_argument if the context does not support key switching or the ciphertext is not of size 2 in NTT form
+     */
+    HoistedCiphertext(const seal::SEALContext &context, const seal::Ciphertext &ctxt);
+
+    /**
+     * \brief Rotate the hoisted ciphertext, equivalent to seal::Evaluator::rotate_vector(ctxt, steps, galois_keys, destination)
+     * \param[in] steps Number of slots to rotate to the left (negative values rotate to the right)
+     * \param[in] galois_keys Rotation keys, **must contain a key for exactly this step**, since hoisting cannot be
+     *  combined with SEAL's decomposition of rotations into several power-of-two rotations
+     * \param[out] destination Rotated ciphertext
+     * \throw std::invalid_argument if galois_keys does not contain a key for this step
+     */
+    void rotate_vector(int steps, const seal::GaloisKeys &galois_keys, seal::Ciphertext &destination) const;
+
+    /// The original ciphertext
+    const seal::Ciphertext &ciphertext() const;
+
+private:
+    const seal::SEALContext &context;
+
+    seal::Ciphertext ctxt;
+
+    /// Number of RNS primes of the ciphertext (the number of digits of the decomposition)
+    size_t decomp_modulus_size;
+
+    /// Number of coefficients per polynomial
+    size_t coeff_count;
+
+    /// For each digit j and each modulus i (ciphertext primes followed by the special prime), the digit j of the second
+    /// ciphertext component reduced modulo prime i, in NTT form. Stored as [j][i][coeff] in a flat vector.
+    std::vector<std::uint64_t> decomposition;
+};
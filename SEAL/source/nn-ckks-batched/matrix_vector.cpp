@@ -7,31 +7,22 @@
 using namespace std;
 
 matrix random_matrix(size_t m, size_t n) {
-    matrix M(m);
-    for (size_t i = 0; i < M.size(); i++) {
-        M[i].resize(n);
-        for (size_t j = 0; j < n; j++) {
-            M[i][j] = (static_cast<double>(rand()) / RAND_MAX) - 0.5;
+    matrix M(m, n);
+    for (auto &x : M) {
+        for (auto &y : x) {
+            y = (static_cast<double>(rand()) / RAND_MAX) - 0.5;
         }
     }
     return M;
 }
 
 matrix random_square_matrix(size_t dim) {
-    matrix M(dim);
-    for (size_t i = 0; i < M.size(); i++) {
-        M[i].resize(dim);
-        for (size_t j = 0; j < dim; j++) {
-            M[i][j] = (static_cast<double>(rand()) / RAND_MAX) - 0.5;
-        }
-    }
-    return M;
+    return random_matrix(dim, dim);
 }
 
 matrix identity_matrix(size_t dim) {
-    matrix M(dim);
-    for (size_t i = 0; i < M.size(); i++) {
-        M[i].resize(dim);
+    matrix M(dim, dim);
+    for (size_t i = 0; i < dim; i++) {
         M[i][i] = 1;
     }
     return M;
@@ -45,66 +36,127 @@ vec random_vector(size_t dim) {
     return v;
 }
 
-vec mvp(matrix M, vec v) {
-    if (M.size() == 0) {
+vec mvp(matrix_view M, vec_view v) {
+    if (M.rows() == 0) {
         throw invalid_argument("Matrix must be well formed and non-zero-dimensional");
     }
+    if (v.size() != M.cols()) {
+        throw invalid_argument("Vector and Matrix dimension not compatible.");
+    }
 
-    vec Mv(M.size(), 0);
-    for (size_t i = 0; i < M.size(); i++) {
-        if (v.size() != M[0].size()) {
-            throw invalid_argument("Vector and Matrix dimension not compatible.");
-        } else {
-            for (size_t j = 0; j < M[0].size(); j++) {
-                Mv[i] += M[i][j] * v[j];
-            }
+    vec Mv(M.rows(), 0);
+    for (size_t i = 0; i < M.rows(); i++) {
+        const double *row = M[i].data();
+        double sum = 0;
+        for (size_t j = 0; j < M.cols(); j++) {
+            sum += row[j] * v[j];
         }
+        Mv[i] = sum;
     }
     return Mv;
 }
 
-matrix add(matrix A, matrix B) {
-    if (A.size() != B.size() || (A.size() > 0 && A[0].size() != B[0].size())) {
+matrix add(matrix_view A, matrix_view B) {
+    if (A.rows() != B.rows() || A.cols() != B.cols()) {
         throw invalid_argument("Matrices must have the same dimensions.");
-    } else {
-        matrix C(A.size());
-        for (size_t i = 0; i < A.size(); i++) {
-            C[i].resize(A[0].size());
-            for (size_t j = 0; j < A[0].size(); j++) {
-                C[i][j] = A[i][j] + B[i][j];
-            }
-        }
-        return C;
     }
+    matrix C(A.rows(), A.cols());
+    const double *a = A.data();
+    const double *b = B.data();
+    double *c = C.data();
+    for (size_t i = 0; i < A.rows() * A.cols(); i++) {
+        c[i] = a[i] + b[i];
+    }
+    return C;
 }
 
-vec add(vec a, vec b) {
+vec add(vec_view a, vec_view b) {
     if (a.size() != b.size()) {
         throw invalid_argument("Vectors must have the same dimensions.");
-    } else {
-        vec c(a.size());
-        for (size_t i = 0; i < a.size(); i++) {
-            c[i] = a[i] + b[i];
-        }
-        return c;
     }
+    vec c(a.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        c[i] = a[i] + b[i];
+    }
+    return c;
 }
 
-vec mult(vec a, vec b) {
+vec mult(vec_view a, vec_view b) {
     if (a.size() != b.size()) {
         throw invalid_argument("Vectors must have the same dimensions.");
-    } else {
-        vec c(a.size());
-        for (size_t i = 0; i < a.size(); i++) {
-            c[i] = a[i] * b[i];
+    }
+    vec c(a.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        c[i] = a[i] * b[i];
+    }
+    return c;
+}
+
+namespace {
+    /// acc[k] += a[k] * b[(k + shift) % n] for all k < n, i.e. acc += a * rot(b, shift) without copying b.
+    /// Split at the wrap-around of b, so that both loops are contiguous and can be vectorized.
+    void multiply_add_rotated(double *acc, const double *a, const double *b, size_t n, size_t shift) {
+        shift %= n;
+        const size_t until_wrap = n - shift;
+        for (size_t k = 0; k < until_wrap; ++k) {
+            acc[k] += a[k] * b[k + shift];
+        }
+        for (size_t k = until_wrap; k < n; ++k) {
+            acc[k] += a[k] * b[k - until_wrap];
         }
-        return c;
+    }
+
+    /// Checks the dimensions of the hybrid algorithm, returns log2(n/m)
+    size_t check_general_dimensions(size_t m, size_t n, size_t v_size) {
+        if (m == 0) {
+            throw invalid_argument(
+                    "Matrix must not be empty!");
+        }
+        if (n != v_size || n == 0) {
+            throw invalid_argument(
+                    "Matrix and vector must have matching non-zero dimension");
+        }
+        size_t n_div_m = n / m;
+        size_t log2_n_div_m = ceil(log2(n_div_m));
+        if (m * n_div_m != n || (2ULL << (log2_n_div_m - 1) != n_div_m && n_div_m != 1)) {
+            throw invalid_argument(
+                    "Matrix dimension m must divide n and the result must be power of two");
+        }
+        return log2_n_div_m;
+    }
+
+    /// Hybrid algorithm, diagonals[i] is the i-th diagonal (anything that can be indexed), see general_mvp_from_diagonals
+    template<typename Diagonals>
+    vec general_mvp_impl(const Diagonals &diagonals, size_t m, size_t n, vec_view v) {
+        // Hybrid algorithm based on "GAZELLE: A Low Latency Framework for Secure Neural Network Inference" by Juvekar et al.
+        // Available at https://www.usenix.org/conference/usenixsecurity18/presentation/juvekar
+        // Actual Implementation based on the description in
+        // "DArL: Dynamic Parameter Adjustment for LWE-based Secure Inference" by Bian et al. 2019.
+        // Available at https://ieeexplore.ieee.org/document/8715110/ (paywall)
+
+        // t = sum_i diagonals[i] * rot(v, i)
+        vec r(n, 0);
+        for (size_t i = 0; i < m; ++i) {
+            multiply_add_rotated(r.data(), diagonals[i].data(), v.data(), n, i);
+        }
+
+        // r = r + rot(r, offset) for offset = n/2, n/4, ..., m
+        // Only the first offset elements are read by the later steps, so only those are updated (in place)
+        //TODO: if n/m isn't a power of two, we need to masking/padding here
+        for (size_t offset = n / 2; offset >= m && offset > 0; offset /= 2) {
+            for (size_t k = 0; k < offset; ++k) {
+                r[k] += r[k + offset];
+            }
+        }
+
+        r.resize(m);
+        return r;
     }
 }
 
-vec diag(matrix M, size_t d) {
-    const size_t m = M.size();
-    const size_t n = m > 0 ? M[0].size() : 0;
+vec diag(matrix_view M, size_t d) {
+    const size_t m = M.rows();
+    const size_t n = M.cols();
     if (m == 0 || n == 0 || m > n) {
         throw invalid_argument("Matrix must have non-zero dimensions and must have m <= n.");
     }
@@ -118,20 +170,20 @@ vec diag(matrix M, size_t d) {
     return diag;
 }
 
-vector<vec> diagonals(const matrix M) {
-    const size_t m = M.size();
-    const size_t n = m > 0 ? M[0].size() : 0;
+vector<vec> diagonals(matrix_view M) {
+    const size_t m = M.rows();
+    const size_t n = M.cols();
     if (m == 0 || n == 0 || m > n) {
         throw invalid_argument("Matrix must have non-zero dimensions and must have m <= n.");
     }
     vector<vec> diagonals(m);
-    for (size_t i = 0; i < M.size(); ++i) {
+    for (size_t i = 0; i < m; ++i) {
         diagonals[i] = diag(M, i);
     }
     return diagonals;
 }
 
-vec duplicate(const vec v) {
+vec duplicate(vec_view v) {
     size_t dim = v.size();
     vec r;
     r.reserve(2 * dim);
@@ -140,26 +192,45 @@ vec duplicate(const vec v) {
     return r;
 }
 
-vec mvp_from_diagonals(std::vector<vec> diagonals, vec v) {
+vec pack_blocks(const std::vector<vec> &vs, size_t block_size) {
+    if (block_size == 0) {
+        throw invalid_argument("Block size must not be zero");
+    }
+    vec r(vs.size() * block_size, 0);
+    for (size_t b = 0; b < vs.size(); ++b) {
+        if (vs[b].size() > block_size) {
+            throw invalid_argument("Vectors must fit into a block");
+        }
+        copy(vs[b].begin(), vs[b].end(), r.begin() + b * block_size);
+    }
+    return r;
+}
+
+vector<vec> unpack_blocks(vec_view v, size_t block_size, size_t length, size_t num_blocks) {
+    if (length > block_size || v.size() < num_blocks * block_size) {
+        throw invalid_argument("Vector is too short for the given blocks");
+    }
+    vector<vec> r;
+    for (size_t b = 0; b < num_blocks; ++b) {
+        r.emplace_back(v.begin() + b * block_size, v.begin() + b * block_size + length);
+    }
+    return r;
+}
+
+vec mvp_from_diagonals(const std::vector<vec> &diagonals, vec_view v) {
     const size_t dim = diagonals.size();
     if (dim == 0 || diagonals[0].size() != dim || v.size() != dim) {
         throw invalid_argument("Matrix must be square, Matrix and vector must have matching non-zero dimension.");
     }
-    vec r(dim);
+    // r = sum_i diagonals[i] * rot(v, i)
+    vec r(dim, 0);
     for (size_t i = 0; i < dim; ++i) {
-        // t = diagonals[i] * v, component wise
-        vec t = mult(diagonals[i], v);
-
-        // Accumulate result
-        r = add(r, t);
-
-        // Rotate v to next position (at the end, because it needs to be un-rotated for first iteration)
-        rotate(v.begin(), v.begin() + 1, v.end());
+        multiply_add_rotated(r.data(), diagonals[i].data(), v.data(), dim, i);
     }
     return r;
 }
 
-vec mvp_from_diagonals_bsgs(std::vector<vec> diagonals, vec v) {
+vec mvp_from_diagonals_bsgs(const std::vector<vec> &diagonals, vec_view v) {
     const size_t n = diagonals.size();
     if (n == 0 || diagonals[0].size() != n || v.size() != n) {
         throw invalid_argument(
@@ -176,24 +247,28 @@ vec mvp_from_diagonals_bsgs(std::vector<vec> diagonals, vec v) {
     vec r(n, 0);
 
     // Precompute the inner rotations (space-runtime tradeoff of BSGS) at the cost of n1 rotations
-    vector<vec> rotated_vs(n1, v);
+    vector<vec> rotated_vs(n1, v.to_vec());
     for (size_t j = 0; j < n1; ++j) {
         rotate(rotated_vs[j].begin(), rotated_vs[j].begin() + j, rotated_vs[j].end());
     }
 
+    vec current_diagonal(n);
+    vec inner_sum(n);
     for (size_t k = 0; k < n2; ++k) {
-        vec inner_sum(n, 0);
+        fill(inner_sum.begin(), inner_sum.end(), 0);
         for (size_t j = 0; j < n1; ++j) {
             // Take the current_diagonal and rotate it by -k*n1 to match the not-yet-enough-rotated vector v
-            vec current_diagonal = diagonals[(k * n1 + j) % n];
-            rotate(current_diagonal.begin(), current_diagonal.begin() + current_diagonal.size() - k * n1,
-                   current_diagonal.end());
+            const vec &diagonal = diagonals[(k * n1 + j) % n];
+            rotate_copy(diagonal.begin(), diagonal.begin() + diagonal.size() - k * n1, diagonal.end(),
+                        current_diagonal.begin());
 
             // inner_sum += rot(current_diagonal) * current_rot_v
-            inner_sum = add(inner_sum, mult(current_diagonal, rotated_vs[j]));
+            multiply_add_rotated(inner_sum.data(), current_diagonal.data(), rotated_vs[j].data(), n, 0);
+        }
+        // r += rot(inner_sum, k*n1)
+        for (size_t t = 0; t < n; ++t) {
+            r[t] += inner_sum[(t + k * n1) % n];
         }
-        rotate(inner_sum.begin(), inner_sum.begin() + (k * n1), inner_sum.end());
-        r = add(r, inner_sum);
     }
     return r;
 }
@@ -233,50 +308,21 @@ int log2_64(uint64_t value) {
     return tab64[((uint64_t) ((value - (value >> 1)) * 0x07EDD5E59A4E28C2)) >> 58];
 }
 
-vec general_mvp_from_diagonals(std::vector<vec> diagonals, vec v) {
+vec general_mvp_from_diagonals(const std::vector<vec> &diagonals, vec_view v) {
     const size_t m = diagonals.size();
-    if (m == 0) {
-        throw invalid_argument(
-                "Matrix must not be empty!");
-    }
-    const size_t n = diagonals[0].size();
-    if (n != v.size() || n == 0) {
-        throw invalid_argument(
-                "Matrix and vector must have matching non-zero dimension");
-    }
-    size_t n_div_m = n / m;
-    size_t log2_n_div_m = ceil(log2(n_div_m));
-    if (m * n_div_m != n || (2ULL << (log2_n_div_m - 1) != n_div_m && n_div_m != 1)) {
-        throw invalid_argument(
-                "Matrix dimension m must divide n and the result must be power of two");
-    }
-
-    // Hybrid algorithm based on "GAZELLE: A Low Latency Framework for Secure Neural Network Inference" by Juvekar et al.
-    // Available at https://www.usenix.org/conference/usenixsecurity18/presentation/juvekar
-    // Actual Implementation based on the description in
-    // "DArL: Dynamic Parameter Adjustment for LWE-based Secure Inference" by Bian et al. 2019.
-    // Available at https://ieeexplore.ieee.org/document/8715110/ (paywall)
-
-    vec t(n, 0);
-    for (size_t i = 0; i < m; ++i) {
-        vec rotated_v = v;
-        rotate(rotated_v.begin(), rotated_v.begin() + i, rotated_v.end());
-        auto temp = mult(diagonals[i], rotated_v);
-        t = add(t, temp);
-    }
-
-    vec r = t;
-    //TODO: if n/m isn't a power of two, we need to masking/padding here
-    for (int i = 0; i < log2_n_div_m; ++i) {
-        vec rotated_r = r;
-        size_t offset = n / (2ULL << i);
-        rotate(rotated_r.begin(), rotated_r.begin() + offset, rotated_r.end());
-        r = add(r, rotated_r);
+    const size_t n = m > 0 ? diagonals[0].size() : 0;
+    check_general_dimensions(m, n, v.size());
+    for (const auto &d : diagonals) {
+        if (d.size() != n) {
+            throw invalid_argument("All diagonals must have the same length");
+        }
     }
+    return general_mvp_impl(diagonals, m, n, v);
+}
 
-    r.resize(m);
-
-    return r;
+vec general_mvp_from_diagonal_matrix(matrix_view diagonals, vec_view v) {
+    check_general_dimensions(diagonals.rows(), diagonals.cols(), v.size());
+    return general_mvp_impl(diagonals, diagonals.rows(), diagonals.cols(), v);
 }
 
 bool perfect_square(unsigned long long x) {
@@ -284,15 +330,18 @@ bool perfect_square(unsigned long long x) {
     return (sqrt_x * sqrt_x == x);
 }
 
-vec rnn_with_relu(vec x, vec h, matrix W_x, matrix W_h, vec b) {
+vec rnn_with_relu(vec_view x, vec_view h, matrix_view W_x, matrix_view W_h, vec_view b) {
     const size_t dim = x.size();
-    if (dim == 0 || h.size() != dim || W_x.size() != dim || W_h.size() != dim || b.size() != dim) {
+    if (dim == 0 || h.size() != dim || W_x.rows() != dim || W_h.rows() != dim || b.size() != dim) {
         throw invalid_argument("All dimensions must be non-zero and matching");
     }
 
     // Compute W_x * x + W_h * h + b
-    vec r = add(mvp(W_x, x), mvp(W_h, h));
-    r = add(r, b);
+    vec r = mvp(W_x, x);
+    const vec r_h = mvp(W_h, h);
+    for (size_t i = 0; i < dim; ++i) {
+        r[i] = (r[i] + r_h[i]) + b[i];
+    }
 
     // ReLU(x) = max(0,x)
     for (auto &t : r) {
@@ -302,15 +351,18 @@ vec rnn_with_relu(vec x, vec h, matrix W_x, matrix W_h, vec b) {
     return r;
 }
 
-vec rnn_with_squaring(vec x, vec h, matrix W_x, matrix W_h, vec b) {
+vec rnn_with_squaring(vec_view x, vec_view h, matrix_view W_x, matrix_view W_h, vec_view b) {
     const size_t dim = x.size();
-    if (dim == 0 || h.size() != dim || W_x.size() != dim || W_h.size() != dim || b.size() != dim) {
+    if (dim == 0 || h.size() != dim || W_x.rows() != dim || W_h.rows() != dim || b.size() != dim) {
         throw invalid_argument("All dimensions must be non-zero and matching");
     }
 
     // Compute W_x * x + W_h * h + b
-    vec r = add(mvp(W_x, x), mvp(W_h, h));
-    r = add(r, b);
+    vec r = mvp(W_x, x);
+    const vec r_h = mvp(W_h, h);
+    for (size_t i = 0; i < dim; ++i) {
+        r[i] = (r[i] + r_h[i]) + b[i];
+    }
 
     // squaring as activation function
     for (auto &t : r) {
@@ -319,7 +371,7 @@ vec rnn_with_squaring(vec x, vec h, matrix W_x, matrix W_h, vec b) {
     return r;
 }
 
-bool equal(vec r, vec expected, float tolerance) {
+bool equal(vec_view r, vec_view expected, float tolerance) {
     bool equal = true;
     for (size_t i = 0; i < r.size(); ++i) {
         // Test if value is within tolerance of the actual value or 10 sig figs
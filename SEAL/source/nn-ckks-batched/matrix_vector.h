@@ -1,14 +1,181 @@
 #pragma once
 
+#include <cstddef>
 #include <vector>
 
-/// Matrix in row-major order
-typedef std::vector<std::vector<double>> matrix;
-
 /// Vector
 /// Defined to allow clear semantic difference in the code between std::vectors and vectors in the mathematical sense)
 typedef std::vector<double> vec;
 
+/**
+ * \brief Non-owning view of contiguous elements, e.g. a vec or a row of a Matrix.
+ *  Cheap to copy, so functions take it by value instead of copying the vector it points into.
+ *  The viewed elements must outlive the view.
+ * \tparam T Element type, const double for read-only views
+ */
+template<typename T>
+class Span {
+public:
+    Span() = default;
+
+    Span(T *data, size_t size) : elements(data), length(size) {}
+
+    /// View of a whole vector (only for read-only views, so that temporaries can be passed as well)
+    Span(const vec &v) : elements(v.data()), length(v.size()) {}
+
+    /// View of a whole vector
+    Span(vec &v) : elements(v.data()), length(v.size()) {}
+
+    /// Read-only view of a view
+    template<typename U>
+    Span(const Span<U> &other) : elements(other.data()), length(other.size()) {}
+
+    T *data() const { return elements; }
+
+    size_t size() const { return length; }
+
+    bool empty() const { return length == 0; }
+
+    T &operator[](size_t i) const { return elements[i]; }
+
+    T *begin() const { return elements; }
+
+    T *end() const { return elements + length; }
+
+    /// Copy of the viewed elements
+    vec to_vec() const { return vec(begin(), end()); }
+
+private:
+    T *elements = nullptr;
+
+    size_t length = 0;
+};
+
+/// Read-only view of a vector
+typedef Span<const double> vec_view;
+
+/// Iterates over the rows of a row-major matrix, yielding a Span per row
+template<typename T>
+class RowIterator {
+public:
+    RowIterator(T *data, size_t cols, size_t row) : current(data + row * cols, cols), index(row) {}
+
+    const Span<T> &operator*() const { return current; }
+
+    const Span<T> *operator->() const { return &current; }
+
+    RowIterator &operator++() {
+        current = Span<T>(current.data() + current.size(), current.size());
+        ++index;
+        return *this;
+    }
+
+    bool operator==(const RowIterator &other) const { return index == other.index; }
+
+    bool operator!=(const RowIterator &other) const { return index != other.index; }
+
+private:
+    Span<T> current;
+
+    size_t index;
+};
+
+class Matrix;
+
+/// Read-only, non-owning view of a row-major matrix, e.g. of a Matrix or of diagonals memory-mapped from a WeightFile
+class MatrixView {
+public:
+    MatrixView() = default;
+
+    MatrixView(const double *data, size_t rows, size_t cols) : elements(data), num_rows(rows), num_cols(cols) {}
+
+    /// View of a whole Matrix
+    MatrixView(const Matrix &M);
+
+    size_t rows() const { return num_rows; }
+
+    size_t cols() const { return num_cols; }
+
+    /// Number of rows
+    size_t size() const { return num_rows; }
+
+    /// Whether the matrix has no rows
+    bool empty() const { return num_rows == 0; }
+
+    const double *data() const { return elements; }
+
+    vec_view operator[](size_t i) const { return {elements + i * num_cols, num_cols}; }
+
+    RowIterator<const double> begin() const { return {elements, num_cols, 0}; }
+
+    RowIterator<const double> end() const { return {elements, num_cols, num_rows}; }
+
+private:
+    const double *elements = nullptr;
+
+    size_t num_rows = 0;
+
+    size_t num_cols = 0;
+};
+
+/**
+ * \brief Matrix stored contiguously in row-major order. M[i][j] is the element in row i and column j,
+ *  and iterating over a matrix yields its rows, each as a Span.
+ */
+class Matrix {
+public:
+    Matrix() = default;
+
+    /**
+     * \brief Create a rows x cols matrix
+     * \param rows Number of rows
+     * \param cols Number of columns
+     * \param value Value of all elements
+     */
+    explicit Matrix(size_t rows, size_t cols = 0, double value = 0)
+            : num_rows(rows), num_cols(cols), elements(rows * cols, value) {}
+
+    size_t rows() const { return num_rows; }
+
+    size_t cols() const { return num_cols; }
+
+    /// Number of rows
+    size_t size() const { return num_rows; }
+
+    /// Whether the matrix has no rows
+    bool empty() const { return num_rows == 0; }
+
+    double *data() { return elements.data(); }
+
+    const double *data() const { return elements.data(); }
+
+    Span<double> operator[](size_t i) { return {elements.data() + i * num_cols, num_cols}; }
+
+    vec_view operator[](size_t i) const { return {elements.data() + i * num_cols, num_cols}; }
+
+    RowIterator<double> begin() { return {elements.data(), num_cols, 0}; }
+
+    RowIterator<double> end() { return {elements.data(), num_cols, num_rows}; }
+
+    RowIterator<const double> begin() const { return {elements.data(), num_cols, 0}; }
+
+    RowIterator<const double> end() const { return {elements.data(), num_cols, num_rows}; }
+
+private:
+    size_t num_rows = 0;
+
+    size_t num_cols = 0;
+
+    vec elements;
+};
+
+inline MatrixView::MatrixView(const Matrix &M) : elements(M.data()), num_rows(M.rows()), num_cols(M.cols()) {}
+
+/// Matrix in row-major order
+typedef Matrix matrix;
+
+/// Read-only view of a matrix
+typedef MatrixView matrix_view;
 
 /// \name Plaintext Matrix-Vector Helpers
 ///@{
@@ -49,7 +216,7 @@ vec random_vector(size_t dim);
  * \return The matrix-vector product between M and v, a vector of length d1
  * \throw std::invalid_argument if the dimensions mismatch
  */
-vec mvp(matrix M, vec v);
+vec mvp(matrix_view M, vec_view v);
 
 /**
  * \brief Addition between two matrices (component-wise). Both matrices must have the same dimensions
@@ -58,7 +225,7 @@ vec mvp(matrix M, vec v);
  * \return The sum between A and B, a matrix of the same size d1xd2 as the inputs
  * \throw std::invalid_argument if the dimensions mismatch
  */
-matrix add(matrix A, matrix B);
+matrix add(matrix_view A, matrix_view B);
 
 /**
  * \brief Addition between two vectors (component-wise). Both vectors must have the same length
@@ -67,7 +234,7 @@ matrix add(matrix A, matrix B);
  * \return The sum between a and b, a vector of the same length d as the inputs
  * \throw std::invalid_argument if the dimensions mismatch
  */
-vec add(vec a, vec b);
+vec add(vec_view a, vec_view b);
 
 /**
  * \brief Multiplication between two vectors (component-wise). Both vectors must have the same length
@@ -76,7 +243,7 @@ vec add(vec a, vec b);
  * \return The component-wise product between a and b, a vector of the same length d as the inputs
  * \throw std::invalid_argument if the dimensions mismatch
  */
-vec mult(vec a, vec b);
+vec mult(vec_view a, vec_view b);
 
 /**
  * \brief The d-th (generalized) diagonal of a matrix. The matrix M must be "squat".
@@ -85,7 +252,7 @@ vec mult(vec a, vec b);
  * \return d-th diagonal  of M, a vector of length m
  * \throw std::invalid_argument if M is non-squat or d is geq than n
  */
-vec diag(matrix M, size_t d);
+vec diag(matrix_view M, size_t d);
 
 /**
  * \brief Returns a list of all the (generalized) diagonals of a "squat" matrix. Numbering starts with the main diagonal and moves up with wrap-around, i.e. the last element is the diagonal one below the main diagonal).
@@ -93,14 +260,34 @@ vec diag(matrix M, size_t d);
  * \return The list of length m of all the diagonals of M, each a vector of length n
  * \throw std::invalid_argument if M is non-squat
  */
-std::vector<vec> diagonals(const matrix M);
+std::vector<vec> diagonals(matrix_view M);
 
 /**
  * \brief Returns a vector of twice the length, with the elements repeated in the same sequence
  * \param v Vector of length d
  * \return Vector of length 2*d that contains two concatenated copies of the input vector
  */
-vec duplicate(const vec v);
+vec duplicate(vec_view v);
+
+/**
+ * \brief Packs several vectors into one, each at the start of its own block (padded with zeros), e.g. to batch several inputs into one ciphertext
+ * \param vs Vectors to pack, each of length at most block_size
+ * \param block_size Distance between the starts of two consecutive vectors
+ * \return Vector of length vs.size() * block_size, where block b starts with vs[b]
+ * \throw std::invalid_argument if block_size is zero or one of the vectors is longer than block_size
+ */
+vec pack_blocks(const std::vector<vec> &vs, size_t block_size);
+
+/**
+ * \brief Inverse of pack_blocks, returns the start of each block
+ * \param v Packed vector
+ * \param block_size Distance between the starts of two consecutive blocks
+ * \param length Number of elements to take from the start of each block, at most block_size
+ * \param num_blocks Number of blocks
+ * \return num_blocks vectors of the given length
+ * \throw std::invalid_argument if length > block_size or v is shorter than num_blocks * block_size
+ */
+std::vector<vec> unpack_blocks(vec_view v, size_t block_size, size_t length, size_t num_blocks);
 
 /**
  * \brief Computes the matrix-vector-product between a *square* matrix M, represented by its diagonals, and a vector.
@@ -110,7 +297,7 @@ vec duplicate(const vec v);
  * \return The matrix-vector product between M and v, a vector of length d
  * \throw std::invalid_argument if the dimensions mismatch
  */
-vec mvp_from_diagonals(std::vector<vec> diagonals, vec v);
+vec mvp_from_diagonals(const std::vector<vec> &diagonals, vec_view v);
 
 /**
  * \brief Computes the matrix-vector-product between a *square* matrix M, represented by its diagonals, and a vector.
@@ -120,7 +307,7 @@ vec mvp_from_diagonals(std::vector<vec> diagonals, vec v);
  * \return The matrix-vector product between M and v, a vector of length d
  * \throw std::invalid_argument if the dimensions mismatch or the dimension is not a square number
  */
-vec mvp_from_diagonals_bsgs(std::vector<vec> diagonals, vec v);
+vec mvp_from_diagonals_bsgs(const std::vector<vec> &diagonals, vec_view v);
 
 /**
  * \brief Split n int n1 and n2 s.t. n1 * n2 = n and n1 is close to sqrt(n)
@@ -138,7 +325,16 @@ size_t find_factor(size_t n);
  * \return The matrix-vector product between M and v, a vector of length n
  * \throw std::invalid_argument if the dimensions mismatch
  */
-vec general_mvp_from_diagonals(std::vector<vec> diagonals, vec v);
+vec general_mvp_from_diagonals(const std::vector<vec> &diagonals, vec_view v);
+
+/**
+ * \brief Same as above, but with the diagonals as the rows of a matrix, e.g. in the contiguous layout of a WeightFile
+ * \param diagonals Matrix of size m x n represented by the its (generalized) diagonals, one per row
+ * \param v Vector of length n
+ * \return The matrix-vector product between M and v, a vector of length m
+ * \throw std::invalid_argument if the dimensions mismatch
+ */
+vec general_mvp_from_diagonal_matrix(matrix_view diagonals, vec_view v);
 
 /**
  * \brief Test if x is a perfect square, i.e. x = y^2 for an integer y?
@@ -157,7 +353,7 @@ bool perfect_square(unsigned long long x);
  * \return Vector of length d, containing ReLU(W_x * x + W_h * h + b)
  * \throw std::invalid_argument if the dimensions mismatch
  */
-vec rnn_with_relu(vec x, vec h, matrix W_x, matrix W_h, vec b);
+vec rnn_with_relu(vec_view x, vec_view h, matrix_view W_x, matrix_view W_h, vec_view b);
 
 /**
  * \brief Computes a single step of a simple recurrent neural network (RNN) using x^2 rather than tanh() or ReLU as the activation function
@@ -169,7 +365,7 @@ vec rnn_with_relu(vec x, vec h, matrix W_x, matrix W_h, vec b);
  * \return Vector of length d, containing (W_x * x + W_h * h + b)^2
  * \throw std::invalid_argument if the dimensions mismatch
  */
-vec rnn_with_squaring(vec x, vec h, matrix W_x, matrix W_h, vec b);
+vec rnn_with_squaring(vec_view x, vec_view h, matrix_view W_x, matrix_view W_h, vec_view b);
 
 /**
  * \brief Checks if two vectors are (approximately) equal
@@ -178,6 +374,6 @@ vec rnn_with_squaring(vec x, vec h, matrix W_x, matrix W_h, vec b);
  * \param[in] tolerance Ratio by which values can disagree. Default 0.001, i.e. 0.1%
  * \throw std::invalid_argument if the dimensions mismatch
  */
-bool equal(vec r, vec expected, float tolerance = 0.001);
+bool equal(vec_view r, vec_view expected, float tolerance = 0.001);
 
 ///@} // End of Plaintext Matrix-Vector Helpers
\ No newline at end of file
@@ -1,8 +1,356 @@
 #include "matrix_vector_crypto.h"
+#include <functional>
+#include <set>
+#include <string>
+#include "hoisted_rotations.h"
+#include "seal/util/numth.h"
 
 using namespace std;
 using namespace seal;
 
+namespace {
+    /// Checks the requirements of the baby-step giant-step algorithm, see ptxt_matrix_enc_vector_product_bsgs
+    void check_bsgs_arguments(size_t dim, const vector<vec> &diagonals, size_t slots) {
+        if (dim == 0 || diagonals[0].size() != dim || !perfect_square(dim)) {
+            throw invalid_argument(
+                    "Matrix must be square, Matrix and vector must have matching non-zero dimension, Dimension must be a square number!");
+        }
+        if (slots != dim && slots < 2 * dim) {
+            throw invalid_argument(
+                    "The number of ciphertext slots must be either exactly dim, or at least 2*dim to allow for duplicate encoding for meaningful rotations.");
+        }
+    }
+
+    /// Checks the requirements of the hybrid algorithm on the dimensions, see ptxt_general_matrix_enc_vector_product
+    void check_general_dimensions(size_t m, size_t n) {
+        if (m == 0 || n == 0) {
+            throw invalid_argument(
+                    "Matrix must not be empty!");
+        }
+        size_t n_div_m = n / m;
+        size_t log2_n_div_m = ceil(log2(n_div_m));
+        if (m * n_div_m != n || (2ULL << (log2_n_div_m - 1) != n_div_m && n_div_m != 1)) {
+            throw invalid_argument(
+                    "Matrix dimension m must divide n and the result must be power of two");
+        }
+    }
+
+    /// Checks the requirements of the hybrid algorithm, see ptxt_general_matrix_enc_vector_product
+    void check_general_arguments(size_t m, size_t n, const vector<vec> &diagonals) {
+        if (m == 0 || m != diagonals.size()) {
+            throw invalid_argument(
+                    "Matrix must not be empty, and diagonals vector must have size m!");
+        }
+        if (n != diagonals[0].size() || n == 0) {
+            throw invalid_argument(
+                    "Diagonals must have non-zero dimension that matches n");
+        }
+        check_general_dimensions(m, n);
+    }
+
+    /// Size of the blocks when batching num_blocks vectors of length n, see PreparedMatrix
+    size_t block_size(size_t num_blocks, size_t slots, size_t n) {
+        const size_t size = num_blocks ? slots / num_blocks : 0;
+        if (num_blocks == 0 || slots % num_blocks != 0 || size < 2 * n) {
+            throw invalid_argument(
+                    "The number of blocks must divide the number of slots and each block must fit a duplicated vector!");
+        }
+        return size;
+    }
+
+    /// The diagonal used in giant step k and baby step j of the baby-step giant-step algorithm,
+    /// i.e. diagonal k*sqrt_dim+j rotated by -k*sqrt_dim to match the not-yet-enough-rotated vector v
+    vec bsgs_diagonal(const vector<vec> &diagonals, size_t dim, size_t sqrt_dim, size_t k, size_t j,
+                      bool duplicating) {
+        vec current_diagonal = diagonals[(k * sqrt_dim + j) % dim];
+        rotate(current_diagonal.begin(), current_diagonal.begin() + current_diagonal.size() - k * sqrt_dim,
+               current_diagonal.end());
+        // Duplicate only if necessary
+        return duplicating ? duplicate(current_diagonal) : current_diagonal;
+    }
+
+    /// Adds up all parts in a binary tree, where the additions on each level of the tree run in parallel.
+    /// The parts are overwritten in the process.
+    void tree_sum(ThreadPool &pool, Evaluator &evaluator, vector<Ciphertext> &parts, Ciphertext &result) {
+        for (size_t stride = 1; stride < parts.size(); stride *= 2) {
+            const size_t pairs = (parts.size() + 2 * stride - 1) / (2 * stride);
+            pool.parallel_for(pairs, [&](size_t p) {
+                const size_t i = 2 * stride * p;
+                if (i + stride < parts.size()) {
+                    evaluator.add_inplace(parts[i], parts[i + stride]);
+                }
+            });
+        }
+        result = std::move(parts[0]);
+    }
+
+    /// Giant-step part of the baby-step giant-step algorithm, given the sqrt(dim) baby-step rotations of the vector
+    /// and a function returning the encoded diagonal for giant step k and baby step j at the level of rotated_vs[j]
+    /// (which may use the scratch plaintext to encode into). With a pool, the giant steps run in parallel.
+    template<typename DiagonalProvider>
+    void bsgs_giant_steps(const GaloisKeys &galois_keys, Evaluator &evaluator, const vector<Ciphertext> &rotated_vs,
+                          DiagonalProvider &&ptxt_diagonal, Ciphertext &enc_result, ThreadPool *pool = nullptr) {
+        const size_t sqrt_dim = rotated_vs.size();
+
+        auto giant_step = [&](size_t k, Ciphertext &inner_sum) {
+            Plaintext scratch;
+            for (size_t j = 0; j < sqrt_dim; ++j) {
+                // inner_sum += rot(current_diagonal) * current_rot_v
+                // multiply
+                Ciphertext temp;
+                evaluator.multiply_plain(rotated_vs[j], ptxt_diagonal(k, j, rotated_vs[j], scratch), temp);
+                // add
+                if (j == 0) {
+                    inner_sum = temp;
+                } else {
+                    evaluator.add_inplace(inner_sum, temp);
+                }
+            }
+
+            // Apply "missing bit" of rotation
+            evaluator.rotate_vector_inplace(inner_sum, k * sqrt_dim, galois_keys);
+        };
+
+        if (pool) {
+            // The giant steps are independent until the final sum
+            vector<Ciphertext> inner_sums(sqrt_dim);
+            pool->parallel_for(sqrt_dim, [&](size_t k) { giant_step(k, inner_sums[k]); });
+            tree_sum(*pool, evaluator, inner_sums, enc_result);
+        } else {
+            for (size_t k = 0; k < sqrt_dim; ++k) {
+                Ciphertext inner_sum;
+                giant_step(k, inner_sum);
+                if (k == 0) {
+                    enc_result = inner_sum;
+                } else {
+                    evaluator.add_inplace(enc_result, inner_sum);
+                }
+            }
+        }
+    }
+
+    /// Giant steps with diagonals that are encoded on the fly
+    void bsgs_giant_steps(const GaloisKeys &galois_keys, Evaluator &evaluator, CKKSEncoder &encoder, size_t dim,
+                          const vector<vec> &diagonals, const vector<Ciphertext> &rotated_vs,
+                          Ciphertext &enc_result) {
+        /// Whether or not we need to duplicate elements in the diagonals vectors during encoding to ensure meaningful rotations
+        const bool duplicating = (rotated_vs[0].poly_modulus_degree() / 2) != dim;
+        const size_t sqrt_dim = rotated_vs.size();
+
+        bsgs_giant_steps(galois_keys, evaluator, rotated_vs,
+                         [&](size_t k, size_t j, const Ciphertext &rotated_v, Plaintext &scratch) -> const Plaintext & {
+                             encoder.encode(bsgs_diagonal(diagonals, dim, sqrt_dim, k, j, duplicating),
+                                            rotated_v.parms_id(), rotated_v.scale(), scratch);
+                             return scratch;
+                         }, enc_result);
+    }
+
+    /// Baby-step giant-step algorithm with diagonals from a PreparedMatrix,
+    /// using hoisted baby steps if a context is given and running in parallel if a pool is given
+    void bsgs_prepared(ThreadPool *pool, const SEALContext *hoisting_context, const GaloisKeys &galois_keys,
+                       Evaluator &evaluator, const PreparedMatrix &matrix, const Ciphertext &ctv,
+                       Ciphertext &enc_result) {
+        if (matrix.algorithm() != PreparedMatrix::Algorithm::bsgs) {
+            throw invalid_argument("Matrix was not prepared for the baby-step giant-step algorithm!");
+        }
+        const vector<Plaintext> &ptxt_diagonals = matrix.diagonals(ctv.parms_id());
+        const size_t sqrt_dim = sqrt(matrix.n());
+
+        // Baby steps
+        vector<Ciphertext> rotated_vs(sqrt_dim);
+        if (hoisting_context) {
+            HoistedCiphertext hoisted_v(*hoisting_context, ctv);
+            for_each_index(pool, sqrt_dim, [&](size_t j) {
+                hoisted_v.rotate_vector(j, galois_keys, rotated_vs[j]);
+            });
+        } else {
+            for_each_index(pool, sqrt_dim, [&](size_t j) {
+                evaluator.rotate_vector(ctv, j, galois_keys, rotated_vs[j]);
+            });
+        }
+
+        // Giant steps
+        bsgs_giant_steps(galois_keys, evaluator, rotated_vs,
+                         [&](size_t k, size_t j, const Ciphertext &, Plaintext &) -> const Plaintext & {
+                             return ptxt_diagonals[k * sqrt_dim + j];
+                         }, enc_result, pool);
+    }
+
+    /// Hybrid algorithm, given a function returning the encoded diagonal i at the level of the (rotated) ciphertext
+    /// (which may use the scratch plaintext to encode into). With a pool, the m diagonal products run in parallel.
+    template<typename DiagonalProvider>
+    void general_mvp(const GaloisKeys &galois_keys, Evaluator &evaluator, size_t m, size_t n,
+                     DiagonalProvider &&ptxt_diagonal, const Ciphertext &ctv, Ciphertext &enc_result,
+                     ThreadPool *pool = nullptr) {
+        // Hybrid algorithm based on "GAZELLE: A Low Latency Framework for Secure Neural Network Inference" by Juvekar et al.
+        // Available at https://www.usenix.org/conference/usenixsecurity18/presentation/juvekar
+        // Actual Implementation based on the description in
+        // "DArL: Dynamic Parameter Adjustment for LWE-based Secure Inference" by Bian et al. 2019.
+        // Available at https://ieeexplore.ieee.org/document/8715110/ (paywall)
+
+        auto diagonal_product = [&](size_t i, Ciphertext &ctxt_tmp) {
+            // rotated_v = rot(v,i)
+            Ciphertext ctxt_rotated_v = ctv;
+            if (i != 0) evaluator.rotate_vector_inplace(ctxt_rotated_v, i, galois_keys);
+
+            // auto tmp = mult(diagonals[i], rotated_v);
+            Plaintext scratch;
+            evaluator.multiply_plain(ctxt_rotated_v, ptxt_diagonal(i, ctxt_rotated_v, scratch), ctxt_tmp);
+        };
+
+        //  vec t(n, 0);
+        Ciphertext ctxt_t;
+
+        if (pool) {
+            // The diagonal products are independent until the final sum
+            vector<Ciphertext> products(m);
+            pool->parallel_for(m, [&](size_t i) { diagonal_product(i, products[i]); });
+            tree_sum(*pool, evaluator, products, ctxt_t);
+        } else {
+            for (size_t i = 0; i < m; ++i) {
+                Ciphertext ctxt_tmp;
+                diagonal_product(i, ctxt_tmp);
+
+                // t = add(t, tmp);
+                if (i == 0) {
+                    ctxt_t = ctxt_tmp;
+                } else {
+                    evaluator.add_inplace(ctxt_t, ctxt_tmp);
+                }
+            }
+        }
+
+        // vec r = t;
+        Ciphertext ctxt_r = std::move(ctxt_t);
+
+        //TODO: if n/m isn't a power of two, we need to masking/padding here
+        size_t log2_n_div_m = ceil(log2(n / m));
+        for (int i = 0; i < log2_n_div_m; ++i) {
+            // vec rotated_r = r;
+            Ciphertext ctxt_rotated_r = ctxt_r;
+
+            // Calculate offset
+            size_t offset = n / (2ULL << i);
+
+            // rotated_r = rot(rotated_r, offset)
+            evaluator.rotate_vector_inplace(ctxt_rotated_r, offset, galois_keys);
+
+            // r = add(r, rotated_r);
+            evaluator.add_inplace(ctxt_r, ctxt_rotated_r);
+        }
+        //  r.resize(m); <- has to be done by the client
+        // for efficiency we do not mask away the other entries
+        enc_result = std::move(ctxt_r);
+    }
+
+    /// Hybrid algorithm with diagonals from a PreparedMatrix, running in parallel if a pool is given
+    void general_prepared(ThreadPool *pool, const GaloisKeys &galois_keys, Evaluator &evaluator,
+                          const PreparedMatrix &matrix, const Ciphertext &ctv, Ciphertext &enc_result) {
+        if (matrix.algorithm() != PreparedMatrix::Algorithm::general) {
+            throw invalid_argument("Matrix was not prepared for the hybrid algorithm!");
+        }
+        const vector<Plaintext> &ptxt_diagonals = matrix.diagonals(ctv.parms_id());
+        general_mvp(galois_keys, evaluator, matrix.m(), matrix.n(),
+                    [&](size_t i, const Ciphertext &, Plaintext &) -> const Plaintext & {
+                        return ptxt_diagonals[i];
+                    }, ctv, enc_result, pool);
+    }
+}
+
+PreparedMatrix::PreparedMatrix(CKKSEncoder &encoder, Algorithm algorithm, size_t m, size_t n,
+                               const vector<vec> &diagonals, const vector<parms_id_type> &parms_ids,
+                               double scale, size_t num_blocks)
+        : algo(algorithm), num_rows(m), num_cols(n), blocks(num_blocks) {
+    if (algorithm == Algorithm::bsgs) {
+        if (m != n) {
+            throw invalid_argument("Matrix must be square for the baby-step giant-step algorithm!");
+        }
+        if (num_blocks != 1) {
+            // The giant-step rotations would move results across block boundaries
+            throw invalid_argument("Batching several vectors is not supported by the baby-step giant-step algorithm!");
+        }
+        check_bsgs_arguments(n, diagonals, encoder.slot_count());
+        const bool duplicating = encoder.slot_count() != n;
+        const size_t sqrt_dim = sqrt(n);
+        encode_diagonals(encoder, n, [&](size_t i) {
+            return bsgs_diagonal(diagonals, n, sqrt_dim, i / sqrt_dim, i % sqrt_dim, duplicating);
+        }, parms_ids, scale);
+    } else {
+        check_general_arguments(m, n, diagonals);
+        if (num_blocks == 1) {
+            encode_diagonals(encoder, m, [&](size_t i) { return diagonals[i]; }, parms_ids, scale);
+        } else {
+            const size_t size = block_size(num_blocks, encoder.slot_count(), n);
+            encode_diagonals(encoder, m, [&](size_t i) {
+                return pack_blocks(vector<vec>(num_blocks, diagonals[i]), size);
+            }, parms_ids, scale);
+        }
+    }
+}
+
+PreparedMatrix::PreparedMatrix(CKKSEncoder &encoder, Algorithm algorithm, size_t m, size_t n,
+                               const double *diagonals, const vector<parms_id_type> &parms_ids,
+                               double scale, size_t num_blocks)
+        : algo(algorithm), num_rows(m), num_cols(n), blocks(num_blocks) {
+    auto diagonal = [&](size_t i) { return vec(diagonals + i * n, diagonals + (i + 1) * n); };
+    if (algorithm == Algorithm::bsgs) {
+        // The diagonals are rotated against each other before encoding, so they are all needed as vectors
+        vector<vec> diagonal_vectors;
+        for (size_t i = 0; i < m; ++i) {
+            diagonal_vectors.push_back(diagonal(i));
+        }
+        *this = PreparedMatrix(encoder, algorithm, m, n, diagonal_vectors, parms_ids, scale, num_blocks);
+    } else {
+        check_general_dimensions(m, n);
+        if (num_blocks == 1) {
+            encode_diagonals(encoder, m, diagonal, parms_ids, scale);
+        } else {
+            const size_t size = block_size(num_blocks, encoder.slot_count(), n);
+            encode_diagonals(encoder, m, [&](size_t i) {
+                return pack_blocks(vector<vec>(num_blocks, diagonal(i)), size);
+            }, parms_ids, scale);
+        }
+    }
+}
+
+void PreparedMatrix::encode_diagonals(CKKSEncoder &encoder, size_t count,
+                                      const function<vec(size_t)> &encodable_diagonal,
+                                      const vector<parms_id_type> &parms_ids, double scale) {
+    for (const auto &parms_id : parms_ids) {
+        encoded_diagonals[parms_id].resize(count);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const vec diagonal = encodable_diagonal(i);
+        for (const auto &parms_id : parms_ids) {
+            encoder.encode(diagonal, parms_id, scale, encoded_diagonals[parms_id][i]);
+        }
+    }
+}
+
+PreparedMatrix::Algorithm PreparedMatrix::algorithm() const {
+    return algo;
+}
+
+size_t PreparedMatrix::m() const {
+    return num_rows;
+}
+
+size_t PreparedMatrix::n() const {
+    return num_cols;
+}
+
+size_t PreparedMatrix::num_blocks() const {
+    return blocks;
+}
+
+const vector<Plaintext> &PreparedMatrix::diagonals(const parms_id_type &parms_id) const {
+    auto it = encoded_diagonals.find(parms_id);
+    if (it == encoded_diagonals.end()) {
+        throw invalid_argument("Matrix was not prepared for the level of the encrypted vector!");
+    }
+    return it->second;
+}
+
 void ptxt_matrix_enc_vector_product(const GaloisKeys &galois_keys, Evaluator &evaluator,
                                     size_t dim, vector<Plaintext> ptxt_diagonals, const Ciphertext &ctv,
                                     Ciphertext &enc_result) {
@@ -10,8 +358,28 @@ void ptxt_matrix_enc_vector_product(const GaloisKeys &galois_keys, Evaluator &ev
     for (size_t i = 0; i < dim; i++) {
         //  Rotate v
         evaluator.rotate_vector(ctv, i, galois_keys, temp);
-        //TODO: Implement Halevi-Shoup "Hoisting", where you save the common parts of the rotations?
-        // See Appendix of "GAZELLE: A Low Latency Framework for  Secure Neural Network Inference"
+        // See ptxt_matrix_enc_vector_product_hoisted for a variant that shares the common parts of the rotations
+
+        // multiply
+        evaluator.mod_switch_to_inplace(ptxt_diagonals[i], temp.parms_id());
+        evaluator.multiply_plain_inplace(temp, ptxt_diagonals[i]);
+        if (i == 0) {
+            enc_result = temp;
+        } else {
+            evaluator.add_inplace(enc_result, temp);
+        }
+    }
+}
+
+void ptxt_matrix_enc_vector_product_hoisted(const SEALContext &context, const GaloisKeys &galois_keys,
+                                            Evaluator &evaluator, size_t dim, vector<Plaintext> ptxt_diagonals,
+                                            const Ciphertext &ctv, Ciphertext &enc_result) {
+    // Decompose v once, all dim rotations below reuse the decomposition
+    HoistedCiphertext hoisted_v(context, ctv);
+    Ciphertext temp;
+    for (size_t i = 0; i < dim; i++) {
+        //  Rotate v
+        hoisted_v.rotate_vector(i, galois_keys, temp);
 
         // multiply
         evaluator.mod_switch_to_inplace(ptxt_diagonals[i], temp.parms_id());
@@ -27,17 +395,7 @@ void ptxt_matrix_enc_vector_product(const GaloisKeys &galois_keys, Evaluator &ev
 void ptxt_matrix_enc_vector_product_bsgs(const GaloisKeys &galois_keys, Evaluator &evaluator,
                                          CKKSEncoder &encoder, size_t dim, vector<vec> diagonals,
                                          const Ciphertext &ctv, Ciphertext &enc_result) {
-    if (dim == 0 || diagonals[0].size() != dim || !perfect_square(dim)) {
-        throw invalid_argument(
-                "Matrix must be square, Matrix and vector must have matching non-zero dimension, Dimension must be a square number!");
-    }
-    if (ctv.poly_modulus_degree() / 2 != dim && ctv.poly_modulus_degree() / 2 < 2 * dim) {
-        throw invalid_argument(
-                "The number of ciphertext slots must be either exactly dim, or at least 2*dim to allow for duplicate encoding for meaningful rotations.");
-    }
-    /// Whether or not we need to duplicate elements in the diagonals vectors during encoding to ensure meaningful rotations
-    const bool duplicating = (ctv.poly_modulus_degree() / 2) != dim;
-
+    check_bsgs_arguments(dim, diagonals, ctv.poly_modulus_degree() / 2);
 
     // Since dim is a power-of-two, this should be accurate even with the conversion to double and back
     const size_t sqrt_dim = sqrt(dim);
@@ -48,116 +406,82 @@ void ptxt_matrix_enc_vector_product_bsgs(const GaloisKeys &galois_keys, Evaluato
     // Note that here, n1 = n2 = sqrt(n)
 
     // Precompute the inner rotations (space-runtime tradeoff of BSGS) at the cost of n2 rotations and some memory
+    // See ptxt_matrix_enc_vector_product_bsgs_hoisted for a variant that shares the common parts of the rotations
     vector<Ciphertext> rotated_vs(sqrt_dim, ctv);
     for (size_t j = 0; j < sqrt_dim; ++j) {
-        // TODO: Implement Halevi-Shoup "Hoisting", where you save the common parts of the rotations?
-        // See Appendix of "GAZELLE: A Low Latency Framework for  Secure Neural Network Inference"
         evaluator.rotate_vector(ctv, j, galois_keys, rotated_vs[j]);
     }
 
-    for (size_t k = 0; k < sqrt_dim; ++k) {
-        Ciphertext inner_sum;
-        for (size_t j = 0; j < sqrt_dim; ++j) {
-            // Take the current_diagonal and rotate it by -k*sqrt_dim to match the not-yet-enough-rotated vector v
-            vec current_diagonal = diagonals[(k * sqrt_dim + j) % dim];
-            rotate(current_diagonal.begin(), current_diagonal.begin() + current_diagonal.size() - k * sqrt_dim,
-                   current_diagonal.end());
-            Plaintext ptxt_current_diagonal;
-            current_diagonal = duplicating ? duplicate(current_diagonal) : current_diagonal;
-            // Duplicate only if necessary
-            encoder.encode(current_diagonal, rotated_vs[j].parms_id(), rotated_vs[j].scale(), ptxt_current_diagonal);
-
-            // inner_sum += rot(current_diagonal) * current_rot_v
-            // multiply
-            Ciphertext temp;
-            evaluator.multiply_plain(rotated_vs[j], ptxt_current_diagonal, temp);
-            // add
-            if (j == 0) {
-                inner_sum = temp;
-            } else {
-                evaluator.add_inplace(inner_sum, temp);
-            }
-        }
-
-        // Apply "missing bit" of rotation
-        evaluator.rotate_vector_inplace(inner_sum, k * sqrt_dim, galois_keys);
-
-        if (k == 0) {
-            enc_result = inner_sum;
-        } else {
-            evaluator.add_inplace(enc_result, inner_sum);
-        }
-    }
+    bsgs_giant_steps(galois_keys, evaluator, encoder, dim, diagonals, rotated_vs, enc_result);
 }
 
-void ptxt_general_matrix_enc_vector_product(const seal::GaloisKeys &galois_keys, seal::Evaluator &evaluator,
-                                            seal::CKKSEncoder &encoder, size_t m, size_t n,
-                                            std::vector<vec> diagonals,
-                                            const seal::Ciphertext &ctv, seal::Ciphertext &enc_result) {
-    if (m == 0 || m != diagonals.size()) {
-        throw invalid_argument(
-                "Matrix must not be empty, and diagonals vector must have size m!");
-    }
-    if (n != diagonals[0].size() || n == 0) {
-        throw invalid_argument(
-                "Diagonals must have non-zero dimension that matches n");
-    }
-    size_t n_div_m = n / m;
-    size_t log2_n_div_m = ceil(log2(n_div_m));
-    if (m * n_div_m != n || (2ULL << (log2_n_div_m - 1) != n_div_m && n_div_m != 1)) {
-        throw invalid_argument(
-                "Matrix dimension m must divide n and the result must be power of two");
-    }
+void ptxt_matrix_enc_vector_product_bsgs_hoisted(const SEALContext &context, const GaloisKeys &galois_keys,
+                                                 Evaluator &evaluator, CKKSEncoder &encoder, size_t dim,
+                                                 vector<vec> diagonals, const Ciphertext &ctv,
+                                                 Ciphertext &enc_result) {
+    check_bsgs_arguments(dim, diagonals, ctv.poly_modulus_degree() / 2);
 
-    // Hybrid algorithm based on "GAZELLE: A Low Latency Framework for Secure Neural Network Inference" by Juvekar et al.
-    // Available at https://www.usenix.org/conference/usenixsecurity18/presentation/juvekar
-    // Actual Implementation based on the description in
-    // "DArL: Dynamic Parameter Adjustment for LWE-based Secure Inference" by Bian et al. 2019.
-    // Available at https://ieeexplore.ieee.org/document/8715110/ (paywall)
+    // Since dim is a power-of-two, this should be accurate even with the conversion to double and back
+    const size_t sqrt_dim = sqrt(dim);
 
-    //  vec t(n, 0);
-    Ciphertext ctxt_t;
+    // Same as ptxt_matrix_enc_vector_product_bsgs, except that v is decomposed only once for all baby steps
+    HoistedCiphertext hoisted_v(context, ctv);
+    vector<Ciphertext> rotated_vs(sqrt_dim);
+    for (size_t j = 0; j < sqrt_dim; ++j) {
+        hoisted_v.rotate_vector(j, galois_keys, rotated_vs[j]);
+    }
 
-    for (size_t i = 0; i < m; ++i) {
+    bsgs_giant_steps(galois_keys, evaluator, encoder, dim, diagonals, rotated_vs, enc_result);
+}
 
-        // rotated_v = rot(v,i)
-        Ciphertext ctxt_rotated_v = ctv;
-        if (i != 0) evaluator.rotate_vector_inplace(ctxt_rotated_v, i, galois_keys);
+void ptxt_matrix_enc_vector_product_bsgs(const GaloisKeys &galois_keys, Evaluator &evaluator,
+                                         const PreparedMatrix &matrix,
+                                         const Ciphertext &ctv, Ciphertext &enc_result) {
+    bsgs_prepared(nullptr, nullptr, galois_keys, evaluator, matrix, ctv, enc_result);
+}
 
-        // auto tmp = mult(diagonals[i], rotated_v);
-        Plaintext ptxt_current_diagonal;
-        encoder.encode(diagonals[i], ctxt_rotated_v.parms_id(), ctxt_rotated_v.scale(), ptxt_current_diagonal);
-        Ciphertext ctxt_tmp;
-        evaluator.multiply_plain(ctxt_rotated_v, ptxt_current_diagonal, ctxt_tmp);
+void ptxt_matrix_enc_vector_product_bsgs(ThreadPool &pool, const GaloisKeys &galois_keys, Evaluator &evaluator,
+                                         const PreparedMatrix &matrix,
+                                         const Ciphertext &ctv, Ciphertext &enc_result) {
+    bsgs_prepared(&pool, nullptr, galois_keys, evaluator, matrix, ctv, enc_result);
+}
 
-        // t = add(t, tmp);
-        if (i == 0) {
-            ctxt_t = ctxt_tmp;
-        } else {
-            evaluator.add_inplace(ctxt_t, ctxt_tmp);
-        }
-    }
+void ptxt_matrix_enc_vector_product_bsgs_hoisted(const SEALContext &context, const GaloisKeys &galois_keys,
+                                                 Evaluator &evaluator, const PreparedMatrix &matrix,
+                                                 const Ciphertext &ctv, Ciphertext &enc_result) {
+    bsgs_prepared(nullptr, &context, galois_keys, evaluator, matrix, ctv, enc_result);
+}
 
-    // vec r = t;
-    Ciphertext ctxt_r = std::move(ctxt_t);
+void ptxt_matrix_enc_vector_product_bsgs_hoisted(ThreadPool &pool, const SEALContext &context,
+                                                 const GaloisKeys &galois_keys, Evaluator &evaluator,
+                                                 const PreparedMatrix &matrix,
+                                                 const Ciphertext &ctv, Ciphertext &enc_result) {
+    bsgs_prepared(&pool, &context, galois_keys, evaluator, matrix, ctv, enc_result);
+}
 
-    //TODO: if n/m isn't a power of two, we need to masking/padding here
-    for (int i = 0; i < log2_n_div_m; ++i) {
-        // vec rotated_r = r;
-        Ciphertext ctxt_rotated_r = ctxt_r;
+void ptxt_general_matrix_enc_vector_product(const seal::GaloisKeys &galois_keys, seal::Evaluator &evaluator,
+                                            seal::CKKSEncoder &encoder, size_t m, size_t n,
+                                            std::vector<vec> diagonals,
+                                            const seal::Ciphertext &ctv, seal::Ciphertext &enc_result) {
+    check_general_arguments(m, n, diagonals);
 
-        // Calculate offset
-        size_t offset = n / (2ULL << i);
+    general_mvp(galois_keys, evaluator, m, n,
+                [&](size_t i, const Ciphertext &ctxt_rotated_v, Plaintext &scratch) -> const Plaintext & {
+                    encoder.encode(diagonals[i], ctxt_rotated_v.parms_id(), ctxt_rotated_v.scale(), scratch);
+                    return scratch;
+                }, ctv, enc_result);
+}
 
-        // rotated_r = rot(rotated_r, offset)
-        evaluator.rotate_vector_inplace(ctxt_rotated_r, offset, galois_keys);
+void ptxt_general_matrix_enc_vector_product(const seal::GaloisKeys &galois_keys, seal::Evaluator &evaluator,
+                                            const PreparedMatrix &matrix,
+                                            const seal::Ciphertext &ctv, seal::Ciphertext &enc_result) {
+    general_prepared(nullptr, galois_keys, evaluator, matrix, ctv, enc_result);
+}
 
-        // r = add(r, rotated_r);
-        evaluator.add_inplace(ctxt_r, ctxt_rotated_r);
-    }
-    //  r.resize(m); <- has to be done by the client
-    // for efficiency we do not mask away the other entries
-    enc_result = std::move(ctxt_r);
+void ptxt_general_matrix_enc_vector_product(ThreadPool &pool, const seal::GaloisKeys &galois_keys,
+                                            seal::Evaluator &evaluator, const PreparedMatrix &matrix,
+                                            const seal::Ciphertext &ctv, seal::Ciphertext &enc_result) {
+    general_prepared(&pool, galois_keys, evaluator, matrix, ctv, enc_result);
 }
 
 void ptxt_weights_enc_input_rnn(const seal::GaloisKeys &galois_keys,
@@ -204,6 +528,58 @@ void ptxt_weights_enc_input_rnn(const seal::GaloisKeys &galois_keys,
     evaluator.square_inplace(ctxt_h);
 }
 
+vector<int> general_mvp_rotation_steps(size_t m, size_t n) {
+    vector<int> steps;
+    for (size_t i = 1; i < m; ++i) {
+        steps.push_back(static_cast<int>(i));
+    }
+    for (size_t offset = n / 2; offset >= m && offset > 0; offset /= 2) {
+        steps.push_back(static_cast<int>(offset));
+    }
+    return steps;
+}
+
+vector<int> bsgs_rotation_steps(size_t dim) {
+    const size_t sqrt_dim = sqrt(dim);
+    vector<int> steps;
+    for (size_t j = 1; j < sqrt_dim; ++j) {
+        steps.push_back(static_cast<int>(j));
+    }
+    for (size_t k = 1; k < sqrt_dim; ++k) {
+        steps.push_back(static_cast<int>(k * sqrt_dim));
+    }
+    return steps;
+}
+
+vector<int> rotation_key_steps(const vector<int> &steps) {
+    set<int> key_steps;
+    for (int step : steps) {
+        if (step == 0) {
+            continue;
+        }
+        for (int naf_step : util::naf(step)) {
+            key_steps.insert(naf_step);
+        }
+    }
+    return vector<int>(key_steps.begin(), key_steps.end());
+}
+
+void ensure_rotation_keys(const SEALContext &context, const GaloisKeys &galois_keys, const vector<int> &steps) {
+    auto galois_tool = context.key_context_data()->galois_tool();
+    for (int step : steps) {
+        if (step == 0 || galois_keys.has_key(galois_tool->get_elt_from_step(step))) {
+            continue;
+        }
+        for (int naf_step : util::naf(step)) {
+            if (!galois_keys.has_key(galois_tool->get_elt_from_step(naf_step))) {
+                throw invalid_argument("Galois keys do not contain a key for a rotation by " + to_string(naf_step) +
+                                       " steps, which is required for the rotation by " + to_string(step) +
+                                       " steps.");
+            }
+        }
+    }
+}
+
 bool decrypt_and_compare(const seal::Ciphertext &ctxt_r,
                          vec expected,
                          seal::Decryptor &decryptor,
@@ -214,5 +590,6 @@ bool decrypt_and_compare(const seal::Ciphertext &ctxt_r,
     vec r;
     encoder.decode(ptxt_t, r);
     r.resize(expected.size());
-    return equal(r, expected, tolerance);
+    // Qualified, since argument-dependent lookup would pick std::equal for two vecs
+    return ::equal(r, expected, tolerance);
 }
\ No newline at end of file
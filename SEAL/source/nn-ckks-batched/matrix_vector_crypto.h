@@ -1,7 +1,92 @@
 #pragma once
 
+#include <functional>
+#include <map>
 #include "matrix_vector.h"
 #include "seal/seal.h"
+#include "../thread_pool.h"
+
+/**
+ * \brief A plaintext matrix whose diagonals have already been encoded, for repeated products with encrypted vectors.
+ *  The MVP functions otherwise rotate, duplicate and encode every diagonal on every call, even though the weights of a
+ *  model never change between requests. Since a diagonal must be encoded at the level of the ciphertext it is
+ *  multiplied with, the diagonals are encoded once for each level the matrix will be used at.
+ */
+class PreparedMatrix {
+public:
+    /// Algorithm the diagonals are prepared for, the baby-step giant-step algorithm uses pre-rotated diagonals
+    enum class Algorithm {
+        /// See ptxt_matrix_enc_vector_product_bsgs, requires a square matrix whose dimension is a square number
+        bsgs,
+        /// See ptxt_general_matrix_enc_vector_product
+        general
+    };
+
+    /**
+     * \brief Encode the diagonals of a matrix for the given algorithm, at each of the given levels
+     * \param[in] encoder Encoder object from SEAL
+     * \param[in] algorithm Algorithm the matrix will be used with
+     * \param[in] m First dimension of the matrix, i.e. the number of diagonals
+     * \param[in] n Second dimension of the matrix, i.e. the length of the vector
+     * \param[in] diagonals The plaintext matrix, represented by the its diagonals (numbering starts with the main diagonal and moves up with wrap-around, i.e. the last element is the diagonal one below the main diagonal)
+     * \param[in] parms_ids Levels at which the matrix will be used, i.e. the parms_ids of the encrypted vectors
+     * \param[in] scale Scale at which to encode the diagonals, usually the scale of the encrypted vectors
+     * \param[in] num_blocks Number of vectors batched into one ciphertext (Algorithm::general only).
+     *  The slots are split into num_blocks blocks of equal size, each starting with one (duplicated) vector, see pack_blocks.
+     *  The diagonals are repeated in every block, so that one product computes the MVP for all vectors at once.
+     *  Since the rotations of the hybrid algorithm never reach further than 2n slots, the blocks do not interfere.
+     *  The result for block b then starts at slot b * (slot_count / num_blocks).
+     * \throw std::invalid_argument if the dimensions do not meet the requirements of the algorithm or the blocks are smaller than 2n
+     */
+    PreparedMatrix(seal::CKKSEncoder &encoder, Algorithm algorithm, size_t m, size_t n,
+                   const std::vector<vec> &diagonals, const std::vector<seal::parms_id_type> &parms_ids,
+                   double scale, size_t num_blocks = 1);
+
+    /**
+     * \brief Same as above, but with the diagonals in one contiguous array, e.g. memory-mapped from a WeightFile.
+     *  Only one diagonal at a time is copied for encoding.
+     * \param[in] diagonals m diagonals of length n, one after the other
+     */
+    PreparedMatrix(seal::CKKSEncoder &encoder, Algorithm algorithm, size_t m, size_t n, const double *diagonals,
+                   const std::vector<seal::parms_id_type> &parms_ids, double scale, size_t num_blocks = 1);
+
+    /// Algorithm the diagonals are prepared for
+    Algorithm algorithm() const;
+
+    /// First dimension of the matrix
+    size_t m() const;
+
+    /// Second dimension of the matrix
+    size_t n() const;
+
+    /// Number of vectors batched into one ciphertext
+    size_t num_blocks() const;
+
+    /**
+     * \brief Get the encoded diagonals for a level
+     * \param[in] parms_id Level of the encrypted vector
+     * \return For Algorithm::general, the encoded diagonals. For Algorithm::bsgs, the rotated (and duplicated)
+     *  diagonals in the order they are used, i.e. the one for giant step k and baby step j is at index k*sqrt(n)+j
+     * \throw std::invalid_argument if the matrix was not prepared for this level
+     */
+    const std::vector<seal::Plaintext> &diagonals(const seal::parms_id_type &parms_id) const;
+
+private:
+    Algorithm algo;
+
+    size_t num_rows;
+
+    size_t num_cols;
+
+    size_t blocks;
+
+    std::map<seal::parms_id_type, std::vector<seal::Plaintext>> encoded_diagonals;
+
+    /// Encodes the count diagonals returned by encodable_diagonal at each level, computing each diagonal only once
+    void encode_diagonals(seal::CKKSEncoder &encoder, size_t count,
+                          const std::function<vec(size_t)> &encodable_diagonal,
+                          const std::vector<seal::parms_id_type> &parms_ids, double scale);
+};
 
 /**
  * \brief Compute the matrix-vector-product between a *square* plaintext matrix, represented by its diagonals, and an encrypted vector.
@@ -19,6 +104,23 @@ void ptxt_matrix_enc_vector_product(const seal::GaloisKeys &galois_keys, seal::E
                                     size_t dim, std::vector<seal::Plaintext> ptxt_diagonals,
                                     const seal::Ciphertext &ctv, seal::Ciphertext &enc_result);
 
+/**
+ * \brief Same as ptxt_matrix_enc_vector_product, but uses Halevi-Shoup "hoisting" for the rotations of ctv:
+ *  ctv is decomposed for key switching only once, and this decomposition is shared by all dim rotations (see HoistedCiphertext)
+ * \param[in] context SEAL context that ctv belongs to
+ * \param[in] galois_keys Rotation keys, **must contain a key for each of the steps 1, ..., dim-1**
+ * \param[in] evaluator Evaluation object from SEAL
+ * \param[in] ptxt_diagonals The plaintext matrix, represented by the its diagonals (numbering starts with the main diagonal and moves up with wrap-around, i.e. the last element is the diagonal one below the main diagonal)
+ * \param[in] ctv The encrypted vector, batched into a single ciphertext. The length must match the matrix dimension
+ * \param[out] enc_result  Encrypted vector, batched into a single ciphertext
+ * \param[in] dim Length of the vector and dimension of the (square) Matrix, which must match
+ * \throw std::invalid_argument if galois_keys is missing one of the required keys
+ */
+void ptxt_matrix_enc_vector_product_hoisted(const seal::SEALContext &context, const seal::GaloisKeys &galois_keys,
+                                            seal::Evaluator &evaluator, size_t dim,
+                                            std::vector<seal::Plaintext> ptxt_diagonals,
+                                            const seal::Ciphertext &ctv, seal::Ciphertext &enc_result);
+
 
 /**
  * \brief Compute the matrix-vector-product between a *square* plaintext matrix, represented by its diagonals, and an encrypted vector.
@@ -40,6 +142,84 @@ void ptxt_matrix_enc_vector_product_bsgs(const seal::GaloisKeys &galois_keys, se
                                          std::vector<vec> diagonals,
                                          const seal::Ciphertext &ctv, seal::Ciphertext &enc_result);
 
+/**
+ * \brief Same as ptxt_matrix_enc_vector_product_bsgs, but with diagonals that have already been encoded
+ * \param[in] galois_keys Rotation keys, should allow arbitrary rotations (reality is slightly more complicated due to baby-step--giant-step algorithm)
+ * \param[in] evaluator Evaluation object from SEAL
+ * \param[in] matrix The plaintext matrix, prepared for PreparedMatrix::Algorithm::bsgs at the level of ctv
+ * \param[in] ctv The encrypted vector, batched into a single ciphertext. The length must match the matrix dimension
+ * \param[out] enc_result  Encrypted vector, batched into a single ciphertext
+ * \throw std::invalid_argument if the matrix was prepared for a different algorithm or level
+ */
+void ptxt_matrix_enc_vector_product_bsgs(const seal::GaloisKeys &galois_keys, seal::Evaluator &evaluator,
+                                         const PreparedMatrix &matrix,
+                                         const seal::Ciphertext &ctv, seal::Ciphertext &enc_result);
+
+/**
+ * \brief Same as ptxt_matrix_enc_vector_product_bsgs with a PreparedMatrix, but spreads the work across a thread pool:
+ *  the baby-step rotations and the giant steps run in parallel, and the giant-step results are added up in a tree
+ * \param[in] pool Thread pool to run on (the calling thread takes part as well)
+ * \param[in] galois_keys Rotation keys, should allow arbitrary rotations (reality is slightly more complicated due to baby-step--giant-step algorithm)
+ * \param[in] evaluator Evaluation object from SEAL
+ * \param[in] matrix The plaintext matrix, prepared for PreparedMatrix::Algorithm::bsgs at the level of ctv
+ * \param[in] ctv The encrypted vector, batched into a single ciphertext. The length must match the matrix dimension
+ * \param[out] enc_result  Encrypted vector, batched into a single ciphertext
+ * \throw std::invalid_argument if the matrix was prepared for a different algorithm or level
+ */
+void ptxt_matrix_enc_vector_product_bsgs(ThreadPool &pool, const seal::GaloisKeys &galois_keys,
+                                         seal::Evaluator &evaluator, const PreparedMatrix &matrix,
+                                         const seal::Ciphertext &ctv, seal::Ciphertext &enc_result);
+
+/**
+ * \brief Same as ptxt_matrix_enc_vector_product_bsgs, but uses Halevi-Shoup "hoisting" for the baby-step rotations:
+ *  ctv is decomposed for key switching only once, and this decomposition is shared by all sqrt(dim) baby steps (see HoistedCiphertext)
+ * \param[in] context SEAL context that ctv belongs to
+ * \param[in] galois_keys Rotation keys, **must contain a key for each of the baby steps 1, ..., sqrt(dim)-1**,
+ *  the giant steps k*sqrt(dim) are done as usual and may be composed of several rotations
+ * \param[in] evaluator Evaluation object from SEAL
+ * \param[in] encoder Encoder object from SEAL
+ * \param[in] dim Length of the vector and dimension of the (square) Matrix, which must match and **dim must be a square number**
+ * \param[in] diagonals The plaintext matrix, represented by the its diagonals (numbering starts with the main diagonal and moves up with wrap-around, i.e. the last element is the diagonal one below the main diagonal)
+ * \param[in] ctv The encrypted vector, batched into a single ciphertext. The length must match the matrix dimension
+ * \param[out] enc_result  Encrypted vector, batched into a single ciphertext
+ * \throw std::invalid_argument if the dimensions mismatch, the dimension is not a square number or galois_keys is missing one of the required keys
+ */
+void ptxt_matrix_enc_vector_product_bsgs_hoisted(const seal::SEALContext &context, const seal::GaloisKeys &galois_keys,
+                                                 seal::Evaluator &evaluator, seal::CKKSEncoder &encoder, size_t dim,
+                                                 std::vector<vec> diagonals,
+                                                 const seal::Ciphertext &ctv, seal::Ciphertext &enc_result);
+
+/**
+ * \brief Same as ptxt_matrix_enc_vector_product_bsgs_hoisted, but with diagonals that have already been encoded
+ * \param[in] context SEAL context that ctv belongs to
+ * \param[in] galois_keys Rotation keys, **must contain a key for each of the baby steps 1, ..., sqrt(dim)-1**
+ * \param[in] evaluator Evaluation object from SEAL
+ * \param[in] matrix The plaintext matrix, prepared for PreparedMatrix::Algorithm::bsgs at the level of ctv
+ * \param[in] ctv The encrypted vector, batched into a single ciphertext. The length must match the matrix dimension
+ * \param[out] enc_result  Encrypted vector, batched into a single ciphertext
+ * \throw std::invalid_argument if the matrix was prepared for a different algorithm or level or galois_keys is missing one of the required keys
+ */
+void ptxt_matrix_enc_vector_product_bsgs_hoisted(const seal::SEALContext &context, const seal::GaloisKeys &galois_keys,
+                                                 seal::Evaluator &evaluator, const PreparedMatrix &matrix,
+                                                 const seal::Ciphertext &ctv, seal::Ciphertext &enc_result);
+
+/**
+ * \brief Same as ptxt_matrix_enc_vector_product_bsgs_hoisted with a PreparedMatrix, but spreads the work across a thread pool:
+ *  the hoisted baby-step rotations and the giant steps run in parallel, and the giant-step results are added up in a tree
+ * \param[in] pool Thread pool to run on (the calling thread takes part as well)
+ * \param[in] context SEAL context that ctv belongs to
+ * \param[in] galois_keys Rotation keys, **must contain a key for each of the baby steps 1, ..., sqrt(dim)-1**
+ * \param[in] evaluator Evaluation object from SEAL
+ * \param[in] matrix The plaintext matrix, prepared for PreparedMatrix::Algorithm::bsgs at the level of ctv
+ * \param[in] ctv The encrypted vector, batched into a single ciphertext. The length must match the matrix dimension
+ * \param[out] enc_result  Encrypted vector, batched into a single ciphertext
+ * \throw std::invalid_argument if the matrix was prepared for a different algorithm or level or galois_keys is missing one of the required keys
+ */
+void ptxt_matrix_enc_vector_product_bsgs_hoisted(ThreadPool &pool, const seal::SEALContext &context,
+                                                 const seal::GaloisKeys &galois_keys, seal::Evaluator &evaluator,
+                                                 const PreparedMatrix &matrix,
+                                                 const seal::Ciphertext &ctv, seal::Ciphertext &enc_result);
+
 
 /**
  * \brief Compute the matrix-vector-product between a squat plaintext matrix, represented by its diagonals, and an encrypted vector.
@@ -61,6 +241,34 @@ void ptxt_general_matrix_enc_vector_product(const seal::GaloisKeys &galois_keys,
                                             std::vector<vec> diagonals,
                                             const seal::Ciphertext &ctv, seal::Ciphertext &enc_result);
 
+/**
+ * \brief Same as ptxt_general_matrix_enc_vector_product, but with diagonals that have already been encoded
+ * \param[in] galois_keys Rotation keys, should allow arbitrary rotations (reality is slightly more complicated due to baby-step--giant-step algorithm)
+ * \param[in] evaluator Evaluation object from SEAL
+ * \param[in] matrix The plaintext matrix, prepared for PreparedMatrix::Algorithm::general at the level of ctv
+ * \param[in] ctv The encrypted vector, batched into a single ciphertext. The length must match n
+ * \param[out] enc_result  Encrypted vector, batched into a single ciphertext
+ * \throw std::invalid_argument if the matrix was prepared for a different algorithm or level
+ */
+void ptxt_general_matrix_enc_vector_product(const seal::GaloisKeys &galois_keys, seal::Evaluator &evaluator,
+                                            const PreparedMatrix &matrix,
+                                            const seal::Ciphertext &ctv, seal::Ciphertext &enc_result);
+
+/**
+ * \brief Same as ptxt_general_matrix_enc_vector_product with a PreparedMatrix, but spreads the work across a thread pool:
+ *  the m rotations and diagonal products run in parallel and are added up in a tree, before the (sequential) rotate-and-sum steps
+ * \param[in] pool Thread pool to run on (the calling thread takes part as well)
+ * \param[in] galois_keys Rotation keys, should allow arbitrary rotations (reality is slightly more complicated due to baby-step--giant-step algorithm)
+ * \param[in] evaluator Evaluation object from SEAL
+ * \param[in] matrix The plaintext matrix, prepared for PreparedMatrix::Algorithm::general at the level of ctv
+ * \param[in] ctv The encrypted vector, batched into a single ciphertext. The length must match n
+ * \param[out] enc_result  Encrypted vector, batched into a single ciphertext
+ * \throw std::invalid_argument if the matrix was prepared for a different algorithm or level
+ */
+void ptxt_general_matrix_enc_vector_product(ThreadPool &pool, const seal::GaloisKeys &galois_keys,
+                                            seal::Evaluator &evaluator, const PreparedMatrix &matrix,
+                                            const seal::Ciphertext &ctv, seal::Ciphertext &enc_result);
+
 /**
  * \brief Computes a single step of a simple RNN, where the non-linearity/activation function is approximated by x^2, i.e. it returns (W_x * x + W_h * h + b)^2
  * *ATTENTION*: Batching must be done in a way so that if the matrix has dimension d, rotating the vector left d times results in a correct cyclic rotation of the first d elements!
@@ -82,6 +290,42 @@ void ptxt_weights_enc_input_rnn(const seal::GaloisKeys &galois_keys, seal::Evalu
                                 std::vector<vec> diagonals_W_h, vec b,
                                 const seal::Ciphertext &ctxt_x, seal::Ciphertext &ctxt_h);
 
+/**
+ * \brief Rotation steps used by ptxt_general_matrix_enc_vector_product for an m x n matrix
+ * \param[in] m First dimension of the matrix
+ * \param[in] n Second dimension of the matrix
+ * \return The steps 1, ..., m-1 of the diagonal products followed by the steps n/2, n/4, ..., m of the rotate-and-sum
+ */
+std::vector<int> general_mvp_rotation_steps(size_t m, size_t n);
+
+/**
+ * \brief Rotation steps used by ptxt_matrix_enc_vector_product_bsgs for a dim x dim matrix
+ * \param[in] dim Dimension of the matrix, must be a square number
+ * \return The baby steps 1, ..., sqrt(dim)-1 followed by the giant steps sqrt(dim), ..., (sqrt(dim)-1)*sqrt(dim)
+ */
+std::vector<int> bsgs_rotation_steps(size_t dim);
+
+/**
+ * \brief The steps to generate galois keys for, so that all of the given rotations can be computed.
+ *  Rotations without a key of their own are split by SEAL into their non-adjacent form (NAF), a sum of signed powers
+ *  of two, so only keys for the power-of-two rotations occurring in these NAFs are needed.
+ *  This is the smallest key set that supports the given rotations with seal::Evaluator::rotate_vector.
+ *  Hoisted rotations (see HoistedCiphertext) cannot be split and need their exact steps instead.
+ * \param[in] steps Rotations that will be computed
+ * \return Sorted power-of-two steps (positive and negative) without duplicates
+ */
+std::vector<int> rotation_key_steps(const std::vector<int> &steps);
+
+/**
+ * \brief Checks that seal::Evaluator::rotate_vector can compute all of the given rotations with the given keys,
+ *  either with the key for the exact step or with the keys for the power-of-two steps of its NAF
+ * \param[in] context SEAL context the keys belong to
+ * \param[in] galois_keys Rotation keys to check
+ * \param[in] steps Rotations that will be computed
+ * \throw std::invalid_argument if a key required for one of the rotations is missing
+ */
+void ensure_rotation_keys(const seal::SEALContext &context, const seal::GaloisKeys &galois_keys,
+                          const std::vector<int> &steps);
 
 /**
  * \brief Decrypts a ciphertext and compares it to an expected vector of plaintext values.
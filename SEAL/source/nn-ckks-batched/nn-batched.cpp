@@ -2,31 +2,12 @@
 #include "../common.h"
 #include "matrix_vector_crypto.h"
 
-/// Create only the required power-of-two rotations
-/// This can save quite a bit, for example for poly_modulus_degree = 16384
-/// The default galois keys (with zlib compression) are 247 MB large
-/// Whereas with dimension = 256, they are only 152 MB
-/// For poly_modulus_degree = 32768, the default keys are 532 MB large
-/// while with dimension = 256, they are only 304 MB
-std::vector<int> custom_steps(size_t dimension) {
-    if (dimension == 256) {
-        // Slight further optimization: No -128, no -256
-        return {1, -1, 2, -2, 4, -4, 8, -8, 16, -16, 32, -32, 64, -64, 128, 256};
-    } else {
-        std::vector<int> steps{};
-        for (int i = 1; i <= dimension; i <<= 1) {
-            steps.push_back(i);
-            steps.push_back(-i);
-        }
-        return steps;
-    }
-}
-
 /*
  * Batched CKKS implementation for nn benchmark.
  */
 
-void NNBatched::setup_context_ckks(std::size_t poly_modulus_degree) {
+void NNBatched::setup_context_ckks(std::size_t poly_modulus_degree, const std::vector<int> &galois_steps,
+                                   std::size_t num_threads) {
     seal::EncryptionParameters params(seal::scheme_type::ckks);
     params.set_poly_modulus_degree(poly_modulus_degree);
     params.set_coeff_modulus(seal::CoeffModulus::Create(
@@ -58,8 +39,10 @@ void NNBatched::setup_context_ckks(std::size_t poly_modulus_degree) {
     // ofs_rk.close();
 
     // Only generate those keys that are actually required/used
-    std::vector<int> steps = custom_steps(1024);
-    keyGenerator.create_galois_keys(galoisKeys);
+    // This can save quite a bit, for example for poly_modulus_degree = 16384
+    // the default galois keys (with zlib compression) are 247 MB large,
+    // whereas the power-of-two keys up to 256 are only 152 MB
+    keyGenerator.create_galois_keys(galois_steps, galoisKeys);
     // std::ofstream ofs_gk("galois_keys.dat", std::ios::binary);
     // galoisKeys->save(ofs_gk);
     // ofs_gk.close();
@@ -70,6 +53,7 @@ void NNBatched::setup_context_ckks(std::size_t poly_modulus_degree) {
     evaluator = std::make_unique<seal::Evaluator>(*context);
     decryptor = std::make_unique<seal::Decryptor>(*context, secretKey);
     encoder = std::make_unique<seal::CKKSEncoder>(*context);
+    thread_pool = std::make_unique<ThreadPool>(std::max<std::size_t>(num_threads, 1) - 1);
     // std::cout << "Number of slots: " << encoder->slot_count() << std::endl;
 }
 
@@ -118,37 +102,92 @@ namespace {
     }
 }  // namespace
 
-void NNBatched::run_nn() {
+void NNBatched::run_nn(std::size_t num_threads, std::size_t num_images) {
     std::stringstream ss_time;
 
     auto t0 = Time::now();
+
+    // Create the Weights and Biases for the dense layers
+    // A trained model is mapped from the weight file given by MODEL_FILE (see WeightFile), random weights are used otherwise
+    std::unique_ptr<DenseLayer> d1_ptr, d2_ptr;
+    auto model_file_env = std::getenv("MODEL_FILE");
+    if (model_file_env != nullptr) {
+        auto model_file = std::make_shared<const WeightFile>(model_file_env);
+        if (model_file->num_layers() != 2) {
+            throw std::invalid_argument("The weight file must contain exactly two dense layers");
+        }
+        d1_ptr = std::make_unique<DenseLayer>(model_file, 0);
+        d2_ptr = std::make_unique<DenseLayer>(model_file, 1);
+        if (d2_ptr->input_size() != d1_ptr->units()) {
+            throw std::invalid_argument("The input size of the second layer must match the units of the first");
+        }
+    } else {
+        d1_ptr = std::make_unique<DenseLayer>(32, 1024);
+        // We use 16, even though MNIST has only 10 classes, because of the power-of-two requirement
+        // The model should have the weights for those 6 "dummy classes" forced to zero and the client can simply ignore them
+        d2_ptr = std::make_unique<DenseLayer>(16, d1_ptr->units());
+    }
+    DenseLayer &d1 = *d1_ptr;
+    DenseLayer &d2 = *d2_ptr;
+
+    /// Size of the input vector, i.e. a flattened 28x28 image padded to 1024 values (see below)
+    const size_t input_size = 1024;
+    if (d1.input_size() != input_size) {
+        throw std::invalid_argument("The first layer takes " + std::to_string(d1.input_size()) +
+                                    " inputs, but the padded MNIST image has " + std::to_string(input_size));
+    }
+
     // poly_modulus_degree:
     // - must be a power of two
     // - determines the number of ciphertext slots
     // - determines the max. of the sum of coeff_moduli bits
-    setup_context_ckks(16384);
+    // Galois keys are only generated for the rotations of the two MVPs and of the re-duplication in between
+    setup_context_ckks(16384, rotation_key_steps(nn_rotation_steps(d1, d2)), num_threads);
+
+    // Several images are classified at once, each in its own block of slots
+    // Each block holds a duplicated image, the hidden layer output and its duplicate fit into that as well
+    if (num_images == 0 || encoder->slot_count() % num_images != 0 ||
+        encoder->slot_count() / num_images < 2 * input_size) {
+        throw std::invalid_argument("Number of images must divide the number of slots and leave room for a duplicated image");
+    }
+    const size_t block_size = encoder->slot_count() / num_images;
+
+    // Like a server loading its model, we encode the weights only once, at the levels of the layer inputs
+    d1.prepare(*encoder, context->first_parms_id(), initial_scale, num_images);
+    // The input of d2 is three levels further down: after the MVP, the activation and the masking
+    auto d2_input_context_data = context->first_context_data();
+    for (int i = 0; i < 3; ++i) {
+        d2_input_context_data = d2_input_context_data->next_context_data();
+    }
+    d2.prepare(*encoder, d2_input_context_data->parms_id(), initial_scale, num_images);
 
     auto t1 = Time::now();
     log_time(ss_time, t0, t1, false);
 
     // === client-side computation ====================================
 
-    /// Size of the input vector, i.e. flattened 32x32 image
-    size_t input_size = 1024; // 32x32
-
-    // We pad the MNIST images from 28x28 to 32x32
+    // We pad the flattened MNIST images from 28*28 = 784 to 1024 values (at the end, like export_weights.py)
     // because of fast MVP we use requires that the input size divides # of units in the dense layers
     // and the result must be a power of two
 
-    /// vectorized (padded) MNIST image
-    std::vector<double> image = random_vector(input_size);
+    /// vectorized (padded) MNIST images
+    std::vector<vec> images;
+    for (size_t b = 0; b < num_images; ++b) {
+        vec image = random_vector(28 * 28);
+        image.resize(input_size, 0);
+        images.push_back(image);
+    }
 
 
     // encode and encrypt the input
     // We duplicate because we require rotations to work consistently
     // (see documentation of fast mvp method)
     auto t2 = Time::now();
-    seal::Ciphertext image_ctxt = encode_and_encrypt(duplicate(image));
+    std::vector<vec> duplicated_images;
+    for (const auto &image : images) {
+        duplicated_images.push_back(duplicate(image));
+    }
+    seal::Ciphertext image_ctxt = encode_and_encrypt(pack_blocks(duplicated_images, block_size));
 
     auto t3 = Time::now();
     log_time(ss_time, t2, t3, false);
@@ -159,30 +198,22 @@ void NNBatched::run_nn() {
 
     auto t4 = Time::now();
 
-    // Create the Weights and Biases for the first dense layer
-    DenseLayer d1(32, input_size);
-
-
-
     // First, compute the MVP between d1_weights and the input
 
     // PTXT check
-    auto r = general_mvp_from_diagonals(d1.weights_as_diags(), image);
+    auto r = general_mvp_from_diagonal_matrix(d1.weights_as_diags(), images[0]);
     // CTXT actual
+    ensure_rotation_keys(*context, galoisKeys, d1.rotation_steps());
     seal::Ciphertext result;
-    ptxt_general_matrix_enc_vector_product(galoisKeys,
+    ptxt_general_matrix_enc_vector_product(*thread_pool,
+                                           galoisKeys,
                                            *evaluator,
-                                           *encoder,
-                                           d1.units(),
-                                           d1.input_size(),
-                                           d1.weights_as_diags(),
+                                           d1.prepared_weights(),
                                            image_ctxt,
                                            result);
 
     // Now add the bias
-    seal::Plaintext b1;
-    encoder->encode(d1.bias(), result.parms_id(), result.scale(), b1);
-    evaluator->add_plain_inplace(result, b1);
+    evaluator->add_plain_inplace(result, d1.prepared_bias(*encoder, result.parms_id(), result.scale()));
 
     // Rescale, since MVP does not rescale internally
     evaluator->rescale_to_next_inplace(result);
@@ -192,34 +223,29 @@ void NNBatched::run_nn() {
     evaluator->relinearize_inplace(result, relinKeys);
     evaluator->rescale_to_next_inplace(result);
 
-    // In order to fulfill the requirements for a "well rotatable" input vector, we must "duplicate" homomorphically
+    // In order to fulfill the requirements for a "well rotatable" input vector, we must "duplicate" homomorphically:
+    // keep only the first units slots of each block and copy them into the next units slots with a rotation to the right
     seal::Plaintext mask;
-    encoder->encode(vec(1, d1.units()), result.parms_id(), result.scale(), mask);
+    encoder->encode(pack_blocks(std::vector<vec>(num_images, vec(d1.units(), 1)), block_size),
+                    result.parms_id(), result.scale(), mask);
     evaluator->multiply_plain_inplace(result, mask);
     seal::Ciphertext tmp;
-    evaluator->rotate_vector(result, d1.units(), galoisKeys, tmp);
+    ensure_rotation_keys(*context, galoisKeys, {duplication_step(d1)});
+    evaluator->rotate_vector(result, duplication_step(d1), galoisKeys, tmp);
     evaluator->add_inplace(tmp, result);
     evaluator->rescale_to_next_inplace(tmp);
 
-    // Create the Weights and Biases for the second  dense layer
-    // We use 16, even though MNIST has only 10 classes, because of the power-of-two requirement
-    // The model should have the weights for those 6 "dummy classes" forced to zero and the client can simply ignore them
-    DenseLayer d2(16, d1.units());
-
     // Weights
-    ptxt_general_matrix_enc_vector_product(galoisKeys,
+    ensure_rotation_keys(*context, galoisKeys, d2.rotation_steps());
+    ptxt_general_matrix_enc_vector_product(*thread_pool,
+                                           galoisKeys,
                                            *evaluator,
-                                           *encoder,
-                                           d2.units(),
-                                           d2.input_size(),
-                                           d2.weights_as_diags(),
+                                           d2.prepared_weights(),
                                            tmp,
                                            result);
 
     // Bias
-    seal::Plaintext b2;
-    encoder->encode(d2.bias(), result.parms_id(), result.scale(), b2);
-    evaluator->add_plain_inplace(result, b2);
+    evaluator->add_plain_inplace(result, d2.prepared_bias(*encoder, result.parms_id(), result.scale()));
 
     // Rescale, since MVP does not rescale internally
     evaluator->rescale_to_next_inplace(result);
@@ -239,9 +265,12 @@ void NNBatched::run_nn() {
     std::vector<double> dec;
     encoder->decode(p, dec);
 
-    std::cout << "Result:" << std::endl;
-    for (int i = 0; i < 10; ++i) {
-        std::cout << (double) dec[i] << std::endl;
+    const auto results = unpack_blocks(dec, block_size, 10, num_images);
+    for (size_t b = 0; b < num_images; ++b) {
+        std::cout << "Result" << (num_images > 1 ? " " + std::to_string(b) : "") << ":" << std::endl;
+        for (int i = 0; i < 10; ++i) {
+            std::cout << (double) results[b][i] << std::endl;
+        }
     }
     auto t7 = Time::now();
     log_time(ss_time, t6, t7, true);
@@ -260,32 +289,290 @@ void NNBatched::run_nn() {
     write_parameters_to_file(context, "fhe_parameters_nn.txt");
 }
 
-DenseLayer::DenseLayer(size_t units, size_t input_size) {
-    bias_vec = random_vector(units);
-    diags = std::vector<vec>();
-    for (int i = 0; i < units; ++i) {
-        diags.push_back(random_vector((input_size)));
+void NNBatched::run_cnn(std::size_t num_threads) {
+    std::stringstream ss_time;
+    // Only the convolutional blocks are benchmarked, make sure nobody mistakes the output for a classification
+    std::cout << "Running the convolutional blocks of LeNet-5 with random weights, x^2 instead of the model's "
+              << "PolyAct activation and without the dense layers: the result is not a LeNet-5 prediction"
+              << std::endl;
+
+    auto t0 = Time::now();
+
+    /// Layout of the input image, MNIST images are 28x28 with a single channel
+    const ImageLayout input_layout = ImageLayout::dense(28, 28);
+
+    // Create the layers
+    ConvLayer c1(1, 32, 5);
+    AvgPoolLayer p1(2);
+    const ImageLayout c2_layout = p1.output_layout(input_layout);
+    ConvLayer c2(32, 64, 5);
+    // The pooling layers only sum up, the division is folded into the next convolution
+    c2.fold_input_factor(p1.factor());
+    AvgPoolLayer p2(2);
+
+    // The convolutions use hoisted rotations, so they need the keys for their exact steps
+    std::vector<int> steps = c1.rotation_steps(input_layout);
+    const std::vector<int> p1_steps = p1.rotation_steps(input_layout);
+    const std::vector<int> c2_steps = c2.rotation_steps(c2_layout);
+    const std::vector<int> p2_steps = p2.rotation_steps(c2_layout);
+    for (const auto &layer_steps : {p1_steps, c2_steps, p2_steps}) {
+        steps.insert(steps.end(), layer_steps.begin(), layer_steps.end());
+    }
+    std::sort(steps.begin(), steps.end());
+    steps.erase(std::unique(steps.begin(), steps.end()), steps.end());
+    setup_context_ckks(16384, steps, num_threads);
+
+    // Weights and masks are multiplied one after the other before a single rescale, see PreparedConvolution
+    const double weight_scale = std::sqrt(initial_scale);
+    c1.prepare(*encoder, input_layout, context->first_parms_id(), weight_scale);
+    // The input of c2 is two levels further down: after the convolution and the activation
+    auto c2_input_context_data = context->first_context_data()->next_context_data()->next_context_data();
+    c2.prepare(*encoder, c2_layout, c2_input_context_data->parms_id(), weight_scale);
+
+    auto t1 = Time::now();
+    log_time(ss_time, t0, t1, false);
+
+    // === client-side computation ====================================
+
+    /// vectorized MNIST image
+    std::vector<double> image = random_vector(input_layout.height * input_layout.width);
+
+    auto t2 = Time::now();
+    std::vector<seal::Ciphertext> channels{encode_and_encrypt(input_layout.pack(image))};
+
+    auto t3 = Time::now();
+    log_time(ss_time, t2, t3, false);
+
+    // // transmit data to server...
+
+    // // === server-side computation ====================================
+
+    auto t4 = Time::now();
+
+    // Convolution, bias, activation x -> x^2 and pooling
+    auto conv_block = [&](ConvLayer &conv, AvgPoolLayer &pool, const ImageLayout &layout) {
+        std::vector<seal::Ciphertext> outputs;
+        ptxt_weights_enc_input_conv(*thread_pool, *context, galoisKeys, *evaluator, *encoder,
+                                    conv.prepared_weights(), channels, outputs);
+        thread_pool->parallel_for(outputs.size(), [&](size_t o) {
+            seal::Plaintext bias;
+            encoder->encode(conv.bias()[o], outputs[o].parms_id(), outputs[o].scale(), bias);
+            evaluator->add_plain_inplace(outputs[o], bias);
+            // Rescale, since the convolution does not rescale internally
+            evaluator->rescale_to_next_inplace(outputs[o]);
+            evaluator->square_inplace(outputs[o]);
+            evaluator->relinearize_inplace(outputs[o], relinKeys);
+            evaluator->rescale_to_next_inplace(outputs[o]);
+            enc_sum_pool(galoisKeys, *evaluator, layout, pool.pool_size(), outputs[o], outputs[o]);
+        });
+        channels = std::move(outputs);
+    };
+    conv_block(c1, p1, input_layout);
+    conv_block(c2, p2, c2_layout);
+
+    auto t5 = Time::now();
+    log_time(ss_time, t4, t5, false);
+
+    // // === retrieve final result ====================================
+    auto t6 = Time::now();
+    const ImageLayout output_layout = p2.output_layout(c2_layout);
+    seal::Plaintext p;
+    decryptor->decrypt(channels[0], p);
+    std::vector<double> dec;
+    encoder->decode(p, dec);
+
+    // The last pooling layer has no next layer to fold its factor into
+    std::cout << "Result (channel 0, sum pooled, x^2 activations, no dense layers):" << std::endl;
+    for (double v : output_layout.unpack(dec)) {
+        std::cout << v << std::endl;
+    }
+    auto t7 = Time::now();
+    log_time(ss_time, t6, t7, true);
+
+    // write ss_time into file
+    std::ofstream myfile;
+    auto out_filename = std::getenv("OUTPUT_FILENAME");
+    myfile.open(out_filename, std::ios::out | std::ios::app);
+    if (myfile.fail()) throw std::ios_base::failure(std::strerror(errno));
+    // make sure write fails with exception if something is wrong
+    myfile.exceptions(myfile.exceptions() | std::ios::failbit |
+                      std::ifstream::badbit);
+    myfile << ss_time.str() << std::endl;
+
+    // write FHE parameters into file
+    write_parameters_to_file(context, "fhe_parameters_cnn.txt");
+}
+
+DenseLayer::DenseLayer(size_t units, size_t input_size) : num_units(units), num_inputs(input_size) {
+    owned_weights = random_vector(units * input_size + units);
+    diag_data = owned_weights.data();
+    bias_data = owned_weights.data() + units * input_size;
+}
+
+DenseLayer::DenseLayer(std::shared_ptr<const WeightFile> file, size_t layer) : weight_file(std::move(file)) {
+    const WeightFile::DenseWeights &weights = weight_file->dense(layer);
+    num_units = weights.units;
+    num_inputs = weights.input_size;
+    diag_data = weights.diagonals;
+    bias_data = weights.bias;
+}
+
+void DenseLayer::prepare(seal::CKKSEncoder &encoder, seal::parms_id_type parms_id, double scale,
+                         size_t num_blocks) {
+    prepared_diags = std::make_unique<PreparedMatrix>(encoder, PreparedMatrix::Algorithm::general, units(),
+                                                      input_size(), diag_data,
+                                                      std::vector<seal::parms_id_type>{parms_id}, scale, num_blocks);
+    this->num_blocks = num_blocks;
+    // Force the bias to be encoded again for the new layout
+    prepared_bias_ptxt = seal::Plaintext();
+}
+
+const PreparedMatrix &DenseLayer::prepared_weights() {
+    if (!prepared_diags) {
+        throw std::logic_error("Weights must be prepared before use!");
+    }
+    return *prepared_diags;
+}
+
+const seal::Plaintext &DenseLayer::prepared_bias(seal::CKKSEncoder &encoder, seal::parms_id_type parms_id,
+                                                 double scale) {
+    if (prepared_bias_ptxt.parms_id() != parms_id || prepared_bias_ptxt.scale() != scale) {
+        const size_t block_size = encoder.slot_count() / num_blocks;
+        encoder.encode(pack_blocks(std::vector<vec>(num_blocks, bias().to_vec()), block_size), parms_id, scale,
+                       prepared_bias_ptxt);
     }
+    return prepared_bias_ptxt;
 }
 
-const std::vector<vec> &DenseLayer::weights_as_diags() {
-    return diags;
+matrix_view DenseLayer::weights_as_diags() {
+    return {diag_data, num_units, num_inputs};
 }
 
-const vec &DenseLayer::bias() {
-    return bias_vec;
+vec_view DenseLayer::bias() {
+    return {bias_data, num_units};
 }
 
 size_t DenseLayer::units() {
-    return diags.size();
+    return num_units;
 }
 
 size_t DenseLayer::input_size() {
-    return diags[0].size();
+    return num_inputs;
+}
+
+std::vector<int> DenseLayer::rotation_steps() {
+    return general_mvp_rotation_steps(units(), input_size());
+}
+
+ConvLayer::ConvLayer(size_t in_channels, size_t out_channels, size_t kernel_size) {
+    bias_vec = random_vector(out_channels);
+    kernels = std::vector<std::vector<matrix>>(out_channels);
+    for (auto &out_channel : kernels) {
+        for (size_t i = 0; i < in_channels; ++i) {
+            out_channel.push_back(random_square_matrix(kernel_size));
+        }
+    }
+}
+
+const std::vector<std::vector<matrix>> &ConvLayer::weights() {
+    return kernels;
+}
+
+const vec &ConvLayer::bias() {
+    return bias_vec;
+}
+
+void ConvLayer::fold_input_factor(double factor) {
+    for (auto &out_channel : kernels) {
+        for (auto &kernel : out_channel) {
+            for (auto &row : kernel) {
+                for (auto &w : row) {
+                    w *= factor;
+                }
+            }
+        }
+    }
+    prepared_kernels.reset();
+}
+
+void ConvLayer::prepare(seal::CKKSEncoder &encoder, const ImageLayout &layout, seal::parms_id_type parms_id,
+                        double scale) {
+    prepared_kernels = std::make_unique<PreparedConvolution>(encoder, kernels, layout, parms_id, scale);
+}
+
+const PreparedConvolution &ConvLayer::prepared_weights() {
+    if (!prepared_kernels) {
+        throw std::logic_error("Weights must be prepared before use!");
+    }
+    return *prepared_kernels;
+}
+
+size_t ConvLayer::in_channels() {
+    return kernels[0].size();
+}
+
+size_t ConvLayer::out_channels() {
+    return kernels.size();
+}
+
+size_t ConvLayer::kernel_size() {
+    return kernels[0][0].size();
+}
+
+std::vector<int> ConvLayer::rotation_steps(const ImageLayout &layout) {
+    return conv_rotation_steps(layout, kernel_size());
+}
+
+AvgPoolLayer::AvgPoolLayer(size_t pool_size) : size(pool_size) {}
+
+size_t AvgPoolLayer::pool_size() {
+    return size;
+}
+
+double AvgPoolLayer::factor() {
+    return 1.0 / (size * size);
+}
+
+ImageLayout AvgPoolLayer::output_layout(const ImageLayout &input_layout) {
+    return input_layout.pooled(size);
+}
+
+std::vector<int> AvgPoolLayer::rotation_steps(const ImageLayout &input_layout) {
+    return sum_pool_rotation_steps(input_layout, size);
+}
+
+int duplication_step(DenseLayer &layer) {
+    return -static_cast<int>(layer.units());
+}
+
+std::vector<int> nn_rotation_steps(DenseLayer &d1, DenseLayer &d2) {
+    std::vector<int> steps = d1.rotation_steps();
+    steps.push_back(duplication_step(d1));
+    const std::vector<int> d2_steps = d2.rotation_steps();
+    steps.insert(steps.end(), d2_steps.begin(), d2_steps.end());
+    return steps;
 }
 
 int main(int argc, char *argv[]) {
     std::cout << "Starting benchmark 'nn-batched-ckks'..." << std::endl;
-    NNBatched().run_nn();
+    // Number of threads for the matrix-vector products, the single-threaded version is the default
+    std::size_t num_threads = 1;
+    auto num_threads_env = std::getenv("NUM_THREADS");
+    if (num_threads_env != nullptr) {
+        num_threads = std::max(1, std::atoi(num_threads_env));
+    }
+    // Number of images classified at once, packed into one ciphertext (at most 4 for 32x32 images)
+    std::size_t num_images = 1;
+    auto num_images_env = std::getenv("NUM_IMAGES");
+    if (num_images_env != nullptr) {
+        num_images = std::max(1, std::atoi(num_images_env));
+    }
+    // Which network to run: "dense" (default) or "cnn" for the convolutional part of LeNet-5
+    auto model_env = std::getenv("NN_MODEL");
+    if (model_env != nullptr && std::string(model_env) == "cnn") {
+        NNBatched().run_cnn(num_threads);
+    } else {
+        NNBatched().run_nn(num_threads, num_images);
+    }
     return 0;
 }
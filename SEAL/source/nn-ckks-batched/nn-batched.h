@@ -19,6 +19,9 @@
 
 #include "helpers.h"
 #include "matrix_vector.h"
+#include "matrix_vector_crypto.h"
+#include "conv_crypto.h"
+#include "weight_file.h"
 #include "seal/seal.h"
 
 typedef std::chrono::high_resolution_clock Time;
@@ -46,14 +49,32 @@ private:
     std::unique_ptr<seal::Decryptor> decryptor;
     std::unique_ptr<seal::CKKSEncoder> encoder;
 
+    /// workers for the matrix-vector products, the thread calling run_nn takes part as well
+    std::unique_ptr<ThreadPool> thread_pool;
+
     double initial_scale;
 
     void internal_print_info(std::string variable_name, seal::Ciphertext &ctxt);
 
 public:
-    void setup_context_ckks(std::size_t poly_modulus_degree);
+    /// \param poly_modulus_degree must be a power of two, determines the number of ciphertext slots
+    /// \param galois_steps steps to generate galois keys for, e.g. rotation_key_steps of the rotations that will be computed
+    /// \param num_threads number of threads to use for the matrix-vector products (including the calling thread)
+    void setup_context_ckks(std::size_t poly_modulus_degree, const std::vector<int> &galois_steps,
+                            std::size_t num_threads = 1);
+
+    /// \param num_threads number of threads to use for the matrix-vector products (including the calling thread)
+    /// \param num_images number of images to classify at once, packed into blocks of one ciphertext (see pack_blocks)
+    /// \throws std::invalid_argument if a block of the ciphertext is too small for a duplicated image, or if the first
+    /// layer of MODEL_FILE does not take a flattened 28x28 image padded to 1024 values
+    void run_nn(std::size_t num_threads = 1, std::size_t num_images = 1);
 
-    void run_nn();
+    /// Runs the convolutional part of LeNet-5-large (scripts/models/mnist) on one 28x28 image:
+    /// conv 5x5 (32 filters), x^2, avg pool 2x2, conv 5x5 (64 filters), x^2, avg pool 2x2
+    /// The weights are random, x^2 replaces the model's PolyAct and the dense layers are left out, so the output is
+    /// only the pooled feature maps (the program says so, too)
+    /// \param num_threads number of threads to use for the convolutions (including the calling thread)
+    void run_cnn(std::size_t num_threads = 1);
 
     seal::Ciphertext encode_and_encrypt(std::vector<double> number);
 
@@ -64,8 +85,29 @@ public:
 
 class DenseLayer {
 private:
-    std::vector<vec> diags;
-    vec bias_vec;
+    size_t num_units;
+    size_t num_inputs;
+
+    /// units diagonals of length input_size, one after the other, followed by the bias (random weights only)
+    std::vector<double> owned_weights;
+
+    /// file the weights are mapped from (loaded weights only), kept alive as long as the layer uses it
+    std::shared_ptr<const WeightFile> weight_file;
+
+    /// units diagonals of length input_size, one after the other, in owned_weights or weight_file
+    const double *diag_data;
+
+    /// bias of length units, in owned_weights or weight_file
+    const double *bias_data;
+
+    /// weights encoded for ptxt_general_matrix_enc_vector_product, see prepare
+    std::unique_ptr<PreparedMatrix> prepared_diags;
+
+    /// bias encoded at the level and scale of the last MVP result
+    seal::Plaintext prepared_bias_ptxt;
+
+    /// number of inputs batched into one ciphertext, see prepare
+    size_t num_blocks = 1;
 public:
     /// Create random weights and biases for a dense or fully-connected layer
     /// \param units number of units, i.e. output size
@@ -73,27 +115,145 @@ public:
     /// \throws std::invalid_argument if units != input_size because fast MVP is only defined over square matrices
     DenseLayer(size_t units, size_t input_size);
 
+    /// Use the weights and biases of a dense layer from a weight file, without copying them
+    /// \param file the weight file, which is kept open (and mapped) as long as the layer exists
+    /// \param layer index of the layer in the file
+    /// \throws std::out_of_range if the file has no such layer
+    DenseLayer(std::shared_ptr<const WeightFile> file, size_t layer);
+
     /// Get Weights
-    /// \return The weights matrix of size input_size x units, represented by its diagonals
-    const std::vector<vec> &weights_as_diags();
+    /// \return View of the weights matrix of size input_size x units, represented by its diagonals (one per row)
+    matrix_view weights_as_diags();
 
     /// Get Weights
-    /// \return A bias vector of length units
-    const vec &bias();
+    /// \return View of the bias vector of length units
+    vec_view bias();
+
+    /// Encode the weights once, so that they do not have to be encoded again for every input
+    /// \param encoder Encoder object from SEAL
+    /// \param parms_id level of the (encrypted) input of this layer
+    /// \param scale scale at which to encode the weights
+    /// \param num_blocks number of inputs batched into one ciphertext, in blocks of slot_count / num_blocks slots
+    /// \throws std::invalid_argument if a block is too small for a duplicated input
+    void prepare(seal::CKKSEncoder &encoder, seal::parms_id_type parms_id, double scale, size_t num_blocks = 1);
+
+    /// Get prepared weights
+    /// \return The weights matrix, encoded for ptxt_general_matrix_enc_vector_product at the level given to prepare
+    /// \throws std::logic_error if prepare was not called before
+    const PreparedMatrix &prepared_weights();
+
+    /// Get encoded bias
+    /// The bias is encoded on first use and then only again if the level or scale of the MVP result changes
+    /// It is repeated in every block, like the weights
+    /// \param encoder Encoder object from SEAL
+    /// \param parms_id level of the MVP result the bias is added to
+    /// \param scale scale of the MVP result the bias is added to
+    /// \return The bias vector, encoded at parms_id and scale
+    const seal::Plaintext &prepared_bias(seal::CKKSEncoder &encoder, seal::parms_id_type parms_id, double scale);
 
     /// Get number of units
     size_t units();
 
     /// Get size of input
     size_t input_size();
+
+    /// Get rotations
+    /// \return The rotation steps used by ptxt_general_matrix_enc_vector_product for the weights of this layer
+    std::vector<int> rotation_steps();
 };
 
-/// Create only the required power-of-two rotations
-/// This can save quite a bit, for example for poly_modulus_degree = 16384
-/// The default galois keys (with zlib compression) are 247 MB large
-/// Whereas with dimension = 256, they are only 152 MB
-/// For poly_modulus_degree = 32768, the default keys are 532 MB large
-/// while with dimension = 256, they are only 304 MB
-std::vector<int> custom_steps(size_t dimension);
+class ConvLayer {
+private:
+    /// kernels[o][i] is the kernel from input channel i to output channel o
+    std::vector<std::vector<matrix>> kernels;
+    vec bias_vec;
+
+    /// kernels encoded for ptxt_weights_enc_input_conv, see prepare
+    std::unique_ptr<PreparedConvolution> prepared_kernels;
+public:
+    /// Create random kernels and biases for a 2D convolution layer with "same" padding and stride 1
+    /// \param in_channels number of input channels
+    /// \param out_channels number of output channels (filters)
+    /// \param kernel_size size k of the k x k kernels, must be odd
+    ConvLayer(size_t in_channels, size_t out_channels, size_t kernel_size);
+
+    /// Get Weights
+    /// \return The kernels, indexed by output channel and input channel
+    const std::vector<std::vector<matrix>> &weights();
+
+    /// Get Weights
+    /// \return A bias vector of length out_channels
+    const vec &bias();
+
+    /// Multiply all kernels with a factor that the input still has to be multiplied with, e.g. AvgPoolLayer::factor
+    /// Must be called before prepare
+    /// \param factor factor to fold into the kernels
+    void fold_input_factor(double factor);
+
+    /// Encode the masks once, so that they do not have to be encoded again for every input
+    /// \param encoder Encoder object from SEAL
+    /// \param layout layout of the input channels
+    /// \param parms_id level of the (encrypted) input channels
+    /// \param scale scale at which to encode the weights and masks, see PreparedConvolution
+    void prepare(seal::CKKSEncoder &encoder, const ImageLayout &layout, seal::parms_id_type parms_id, double scale);
+
+    /// Get prepared weights
+    /// \return The kernels, prepared for ptxt_weights_enc_input_conv at the level given to prepare
+    /// \throws std::logic_error if prepare was not called before
+    const PreparedConvolution &prepared_weights();
+
+    /// Get number of input channels
+    size_t in_channels();
+
+    /// Get number of output channels
+    size_t out_channels();
+
+    /// Get kernel size
+    size_t kernel_size();
+
+    /// Get rotations
+    /// \param layout layout of the input channels
+    /// \return The rotation steps used by ptxt_weights_enc_input_conv, galois keys are needed for these exact steps
+    std::vector<int> rotation_steps(const ImageLayout &layout);
+};
+
+class AvgPoolLayer {
+private:
+    size_t size;
+public:
+    /// Average pooling over non-overlapping windows
+    /// \param pool_size size of the pool_size x pool_size windows
+    explicit AvgPoolLayer(size_t pool_size);
+
+    /// Get size of the windows
+    size_t pool_size();
+
+    /// The encrypted layer only sums up the windows (see enc_sum_pool)
+    /// \return The factor 1 / pool_size^2 that has to be folded into the next layer, see ConvLayer::fold_input_factor
+    double factor();
+
+    /// Get layout of the output
+    /// \param input_layout layout of the input
+    /// \return the layout of the pooled image
+    ImageLayout output_layout(const ImageLayout &input_layout);
+
+    /// Get rotations
+    /// \param input_layout layout of the input
+    /// \return The rotation steps used by enc_sum_pool
+    std::vector<int> rotation_steps(const ImageLayout &input_layout);
+};
+
+/// Rotation that "duplicates" the masked output of a layer, so that it becomes a well rotatable input of the next layer
+/// \param layer the layer whose output is duplicated
+/// \return -units, i.e. a rotation to the right by the output size of the layer
+int duplication_step(DenseLayer &layer);
+
+/// All rotations of the network: both MVPs and the duplication in between
+/// Generating keys only for these, instead of the default galois keys for all power-of-two rotations,
+/// saves key generation time and memory, since the network never rotates by more than 512 slots
+/// \param d1 first dense layer
+/// \param d2 second dense layer
+/// \return rotation steps, possibly with duplicates
+std::vector<int> nn_rotation_steps(DenseLayer &d1, DenseLayer &d2);
 
 int main(int argc, char *argv[]);
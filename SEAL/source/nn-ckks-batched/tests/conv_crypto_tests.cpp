@@ -0,0 +1,172 @@
+#include "gtest/gtest.h"
+#include "../conv_crypto.h"
+
+using namespace std;
+using namespace seal;
+
+namespace ConvCryptoTests {
+
+    /**
+     * \brief Plaintext reference: 2D convolution with "same" padding and stride 1
+     * \param inputs Input channels of size height x width in row-major order
+     * \param kernels kernels[o][i] is the kernel from input channel i to output channel o
+     * \return Output channels of size height x width in row-major order
+     */
+    vector<vec> conv2d(const vector<vec> &inputs, const vector<vector<matrix>> &kernels, size_t height, size_t width) {
+        const long k = kernels[0][0].size();
+        vector<vec> outputs(kernels.size(), vec(height * width, 0));
+        for (size_t o = 0; o < kernels.size(); ++o) {
+            for (size_t i = 0; i < inputs.size(); ++i) {
+                for (long y = 0; y < (long) height; ++y) {
+                    for (long x = 0; x < (long) width; ++x) {
+                        for (long dy = 0; dy < k; ++dy) {
+                            for (long dx = 0; dx < k; ++dx) {
+                                const long src_y = y + dy - k / 2;
+                                const long src_x = x + dx - k / 2;
+                                if (src_y >= 0 && src_y < (long) height && src_x >= 0 && src_x < (long) width) {
+                                    outputs[o][y * width + x] +=
+                                            kernels[o][i][dy][dx] * inputs[i][src_y * width + src_x];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return outputs;
+    }
+
+    /**
+     * \brief Helper function to test encrypted convolutions
+     * \param layout Layout of the channels
+     * \param in_channels Number of input channels
+     * \param out_channels Number of output channels
+     * \param kernel_size Size of the kernels
+     * \param threaded Whether or not to use a ThreadPool
+     */
+    void ConvTest(ImageLayout layout, size_t in_channels, size_t out_channels, size_t kernel_size,
+                  bool threaded = false) {
+        vector<vector<matrix>> kernels(out_channels);
+        for (auto &out_channel : kernels) {
+            for (size_t i = 0; i < in_channels; ++i) {
+                out_channel.push_back(random_square_matrix(kernel_size));
+            }
+        }
+        vector<vec> inputs;
+        for (size_t i = 0; i < in_channels; ++i) {
+            inputs.push_back(random_vector(layout.height * layout.width));
+        }
+        const auto expected = conv2d(inputs, kernels, layout.height, layout.width);
+
+        // Setup SEAL Parameters
+        EncryptionParameters params(scheme_type::CKKS);
+        const double scale = pow(2.0, 40);
+        params.set_poly_modulus_degree(8192);
+        params.set_coeff_modulus(CoeffModulus::Create(8192, {50, 40, 50}));
+        auto context = SEALContext::Create(params);
+
+        // Generate required keys
+        KeyGenerator keygen(context);
+        auto secret_key = keygen.secret_key();
+        auto galois_keys = keygen.galois_keys_local(conv_rotation_steps(layout, kernel_size));
+        Encryptor encryptor(context, secret_key);
+        Decryptor decryptor(context, secret_key);
+        CKKSEncoder encoder(context);
+        Evaluator evaluator(context);
+
+        // Encrypt input channels
+        vector<Ciphertext> ctxt_inputs(in_channels);
+        for (size_t i = 0; i < in_channels; ++i) {
+            Plaintext ptxt;
+            encoder.encode(layout.pack(inputs[i]), scale, ptxt);
+            encryptor.encrypt_symmetric(ptxt, ctxt_inputs[i]);
+        }
+
+        // Convolve
+        PreparedConvolution conv(encoder, kernels, layout, ctxt_inputs[0].parms_id(), pow(2.0, 20));
+        vector<Ciphertext> ctxt_outputs;
+        if (threaded) {
+            ThreadPool pool(3);
+            ptxt_weights_enc_input_conv(pool, *context, galois_keys, evaluator, encoder, conv, ctxt_inputs,
+                                        ctxt_outputs);
+        } else {
+            ptxt_weights_enc_input_conv(*context, galois_keys, evaluator, encoder, conv, ctxt_inputs, ctxt_outputs);
+        }
+        ASSERT_EQ(ctxt_outputs.size(), out_channels);
+
+        // Decrypt, decode and compare
+        for (size_t o = 0; o < out_channels; ++o) {
+            Plaintext ptxt_r;
+            decryptor.decrypt(ctxt_outputs[o], ptxt_r);
+            vec r;
+            encoder.decode(ptxt_r, r);
+            const auto image = layout.unpack(r);
+            for (size_t p = 0; p < image.size(); ++p) {
+                // Test if value is within 0.1% of the actual value or 5 sig figs
+                EXPECT_NEAR(image[p], expected[o][p], max(0.0001, abs(0.001 * expected[o][p])));
+            }
+        }
+    }
+
+    TEST(EncryptedConv, Conv_8x8_1_2_3) {
+        ConvTest(ImageLayout::dense(8, 8), 1, 2, 3);
+    }
+
+    TEST(EncryptedConv, Conv_8x8_3_2_5) {
+        ConvTest(ImageLayout::dense(8, 8), 3, 2, 5);
+    }
+
+    TEST(EncryptedConv, ConvStrided_7x7_2_2_3) {
+        // Layout after a 2x2 pooling of a 14x14 image
+        ConvTest(ImageLayout::dense(14, 14).pooled(2), 2, 2, 3);
+    }
+
+    TEST(EncryptedConv, ConvThreaded_8x8_4_4_3) {
+        ConvTest(ImageLayout::dense(8, 8), 4, 4, 3, true);
+    }
+
+    TEST(EncryptedConv, Conv_EvenKernel) {
+        EXPECT_THROW(ConvTest(ImageLayout::dense(8, 8), 1, 1, 4), invalid_argument);
+    }
+
+    TEST(EncryptedConv, SumPool_8x8_2) {
+        const ImageLayout layout = ImageLayout::dense(8, 8);
+        const auto image = random_vector(64);
+
+        EncryptionParameters params(scheme_type::CKKS);
+        params.set_poly_modulus_degree(8192);
+        params.set_coeff_modulus(CoeffModulus::Create(8192, {50, 40, 50}));
+        auto context = SEALContext::Create(params);
+        KeyGenerator keygen(context);
+        auto secret_key = keygen.secret_key();
+        auto galois_keys = keygen.galois_keys_local(sum_pool_rotation_steps(layout, 2));
+        Encryptor encryptor(context, secret_key);
+        Decryptor decryptor(context, secret_key);
+        CKKSEncoder encoder(context);
+        Evaluator evaluator(context);
+
+        Plaintext ptxt;
+        encoder.encode(layout.pack(image), pow(2.0, 40), ptxt);
+        Ciphertext ctxt;
+        encryptor.encrypt_symmetric(ptxt, ctxt);
+        Ciphertext ctxt_r;
+        enc_sum_pool(galois_keys, evaluator, layout, 2, ctxt, ctxt_r);
+
+        Plaintext ptxt_r;
+        decryptor.decrypt(ctxt_r, ptxt_r);
+        vec r;
+        encoder.decode(ptxt_r, r);
+        const auto pooled = layout.pooled(2).unpack(r);
+        for (size_t y = 0; y < 4; ++y) {
+            for (size_t x = 0; x < 4; ++x) {
+                const double expected = image[2 * y * 8 + 2 * x] + image[2 * y * 8 + 2 * x + 1] +
+                                        image[(2 * y + 1) * 8 + 2 * x] + image[(2 * y + 1) * 8 + 2 * x + 1];
+                EXPECT_NEAR(pooled[y * 4 + x], expected, 0.0001);
+            }
+        }
+    }
+
+    TEST(EncryptedConv, SumPool_OddSize) {
+        EXPECT_THROW(ImageLayout::dense(7, 7).pooled(2), invalid_argument);
+    }
+}
@@ -11,12 +11,19 @@ namespace MVCryptoTests {
      * \param n Length of vector and second dimension of matrix
      * \param bsgs Whether or not to use the baby-step giant-step algorithm
      * \param m Second dimension of matrix. If m != 0, we use general MVP
-     * \throws std::invalid_argument if both bsgs and m != 0
+     * \param hoisted Whether or not to use hoisted rotations
+     * \param prepared Whether or not to encode the diagonals ahead of time, using a PreparedMatrix (BSGS and general MVP only)
+     * \param num_threads Number of threads to compute the MVP with (prepared only). If num_threads > 1, we use a ThreadPool
+     * \throws std::invalid_argument if both bsgs and m != 0 or both hoisted and m != 0
      */
-    void MatrixVectorProductTest(size_t n, bool bsgs = false, size_t m = 0) {
+    void MatrixVectorProductTest(size_t n, bool bsgs = false, size_t m = 0, bool hoisted = false,
+                                 bool prepared = false, size_t num_threads = 1) {
         if (bsgs && m) {
             throw std::invalid_argument("Cannot enable BSGS for general setting");
         }
+        if (hoisted && m) {
+            throw std::invalid_argument("Cannot enable hoisting for general setting");
+        }
         matrix M;
         bool general = false;
         if (m) {
@@ -44,7 +51,23 @@ namespace MVCryptoTests {
         auto public_key = keygen.public_key();
         auto secret_key = keygen.secret_key();
         auto relin_keys = keygen.relin_keys_local();
-        auto galois_keys = keygen.galois_keys_local();
+        GaloisKeys galois_keys;
+        if (hoisted) {
+            // Hoisted rotations need a key for every single baby step
+            vector<int> steps;
+            const size_t baby_steps = bsgs ? (size_t) sqrt(n) : n;
+            for (size_t i = 1; i < baby_steps; ++i) {
+                steps.push_back(static_cast<int>(i));
+            }
+            if (bsgs) {
+                for (size_t i = 1; i < baby_steps; ++i) {
+                    steps.push_back(static_cast<int>(i * baby_steps));
+                }
+            }
+            galois_keys = keygen.galois_keys_local(steps);
+        } else {
+            galois_keys = keygen.galois_keys_local();
+        }
 
         Encryptor encryptor(context, public_key);
         encryptor.set_secret_key(secret_key);
@@ -84,10 +107,36 @@ namespace MVCryptoTests {
         // Decrypt and compare
         // Compute MVP
         Ciphertext ctxt_r;
-        if (general) {
+        if (prepared) {
+            const auto algorithm = general ? PreparedMatrix::Algorithm::general : PreparedMatrix::Algorithm::bsgs;
+            PreparedMatrix prepared_M(encoder, algorithm, m, n, diagonals(M), {ctxt_v.parms_id()}, scale);
+            if (num_threads > 1) {
+                ThreadPool pool(num_threads - 1);
+                if (general) {
+                    ptxt_general_matrix_enc_vector_product(pool, galois_keys, evaluator, prepared_M, ctxt_v, ctxt_r);
+                } else if (hoisted) {
+                    ptxt_matrix_enc_vector_product_bsgs_hoisted(pool, *context, galois_keys, evaluator, prepared_M,
+                                                                ctxt_v, ctxt_r);
+                } else {
+                    ptxt_matrix_enc_vector_product_bsgs(pool, galois_keys, evaluator, prepared_M, ctxt_v, ctxt_r);
+                }
+            } else if (general) {
+                ptxt_general_matrix_enc_vector_product(galois_keys, evaluator, prepared_M, ctxt_v, ctxt_r);
+            } else if (hoisted) {
+                ptxt_matrix_enc_vector_product_bsgs_hoisted(*context, galois_keys, evaluator, prepared_M, ctxt_v,
+                                                            ctxt_r);
+            } else {
+                ptxt_matrix_enc_vector_product_bsgs(galois_keys, evaluator, prepared_M, ctxt_v, ctxt_r);
+            }
+        } else if (general) {
             ptxt_general_matrix_enc_vector_product(galois_keys, evaluator, encoder, m, n, diagonals(M), ctxt_v, ctxt_r);
+        } else if (bsgs && hoisted) {
+            ptxt_matrix_enc_vector_product_bsgs_hoisted(*context, galois_keys, evaluator, encoder, n, diagonals(M),
+                                                        ctxt_v, ctxt_r);
         } else if (bsgs) {
             ptxt_matrix_enc_vector_product_bsgs(galois_keys, evaluator, encoder, n, diagonals(M), ctxt_v, ctxt_r);
+        } else if (hoisted) {
+            ptxt_matrix_enc_vector_product_hoisted(*context, galois_keys, evaluator, n, ptxt_diagonals, ctxt_v, ctxt_r);
         } else {
             ptxt_matrix_enc_vector_product(galois_keys, evaluator, n, ptxt_diagonals, ctxt_v, ctxt_r);
         }
@@ -163,6 +212,64 @@ EXPECT_THROW(MatrixVectorProductTest(5000, true), invalid_argument
 }
 
 
+TEST(EncryptedMVP, MatrixVectorProductHoisted_15
+)
+{
+MatrixVectorProductTest(15, false, 0, true);
+}
+
+TEST(EncryptedMVP, MatrixVectorProductBSGSHoisted_16
+)
+{
+MatrixVectorProductTest(16, true, 0, true);
+}
+
+TEST(EncryptedMVP, MatrixVectorProductBSGSHoisted_49
+)
+{
+MatrixVectorProductTest(49, true, 0, true);
+}
+
+TEST(EncryptedMVP, MatrixVectorProductBSGSHoisted_256
+)
+{
+MatrixVectorProductTest(256, true, 0, true);
+}
+
+
+TEST(EncryptedMVP, MatrixVectorProductBSGSPrepared_16
+)
+{
+MatrixVectorProductTest(16, true, 0, false, true);
+}
+
+TEST(EncryptedMVP, MatrixVectorProductBSGSPreparedHoisted_49
+)
+{
+MatrixVectorProductTest(49, true, 0, true, true);
+}
+
+TEST(EncryptedMVP, MatrixVectorProductBSGSPrepared_15
+)
+{
+// BSGS currently only supports square-number  dimensions
+EXPECT_THROW(MatrixVectorProductTest(15, true, 0, false, true), invalid_argument
+);
+}
+
+
+TEST(EncryptedMVP, MatrixVectorProductBSGSThreaded_256
+)
+{
+MatrixVectorProductTest(256, true, 0, false, true, 4);
+}
+
+TEST(EncryptedMVP, MatrixVectorProductBSGSHoistedThreaded_49
+)
+{
+MatrixVectorProductTest(49, true, 0, true, true, 4);
+}
+
 TEST(EncryptedGeneralMVP, MatrixVectorProduct_4
 )
 {
@@ -205,6 +312,102 @@ TEST(EncryptedGeneralMVP, MatrixVectorProduct_16_32
 MatrixVectorProductTest(32, false, 16);
 }
 
+TEST(EncryptedGeneralMVP, MatrixVectorProductPrepared_16_32
+)
+{
+MatrixVectorProductTest(32, false, 16, false, true);
+}
+
+TEST(EncryptedGeneralMVP, MatrixVectorProductPrepared_32_1024
+)
+{
+MatrixVectorProductTest(1024, false, 32, false, true);
+}
+
+TEST(EncryptedGeneralMVP, MatrixVectorProductThreaded_32_1024
+)
+{
+MatrixVectorProductTest(1024, false, 32, false, true, 4);
+}
+
+/**
+ * \brief Helper function to test plaintext-matrix-encrypted-vector products on several vectors batched into one ciphertext.
+ * \param m First dimension of matrix
+ * \param n Length of vectors and second dimension of matrix
+ * \param num_blocks Number of vectors
+ */
+void BatchedMatrixVectorProductTest(size_t m, size_t n, size_t num_blocks) {
+    const auto M = random_matrix(m, n);
+    vector<vec> vs;
+    vector<vec> duplicated_vs;
+    for (size_t b = 0; b < num_blocks; ++b) {
+        vs.push_back(random_vector(n));
+        duplicated_vs.push_back(duplicate(vs.back()));
+    }
+
+    // Setup SEAL Parameters
+    EncryptionParameters params(scheme_type::CKKS);
+    const double scale = pow(2.0, 40);
+    params.set_poly_modulus_degree(8192);
+    params.set_coeff_modulus(CoeffModulus::Create(8192, {50, 40, 50}));
+    auto context = SEALContext::Create(params);
+
+    // Generate required keys
+    KeyGenerator keygen(context);
+    auto secret_key = keygen.secret_key();
+    auto galois_keys = keygen.galois_keys_local();
+    Encryptor encryptor(context, secret_key);
+    Decryptor decryptor(context, secret_key);
+    CKKSEncoder encoder(context);
+    Evaluator evaluator(context);
+
+    // Encrypt all vectors into one ciphertext
+    const size_t block_size = encoder.slot_count() / num_blocks;
+    Plaintext ptxt_v;
+    encoder.encode(pack_blocks(duplicated_vs, block_size), scale, ptxt_v);
+    Ciphertext ctxt_v;
+    encryptor.encrypt_symmetric(ptxt_v, ctxt_v);
+
+    // Compute MVP
+    PreparedMatrix prepared_M(encoder, PreparedMatrix::Algorithm::general, m, n, diagonals(M), {ctxt_v.parms_id()},
+                              scale, num_blocks);
+    Ciphertext ctxt_r;
+    ptxt_general_matrix_enc_vector_product(galois_keys, evaluator, prepared_M, ctxt_v, ctxt_r);
+
+    // Decrypt, decode and compare each block
+    Plaintext ptxt_r;
+    decryptor.decrypt(ctxt_r, ptxt_r);
+    vec r;
+    encoder.decode(ptxt_r, r);
+    const auto rs = unpack_blocks(r, block_size, m, num_blocks);
+    for (size_t b = 0; b < num_blocks; ++b) {
+        const auto expected = mvp(M, vs[b]);
+        for (size_t i = 0; i < m; ++i) {
+            // Test if value is within 0.1% of the actual value or 5 sig figs
+            EXPECT_NEAR(rs[b][i], expected[i], max(0.0001, abs(0.001 * expected[i])));
+        }
+    }
+}
+
+TEST(EncryptedGeneralMVP, MatrixVectorProductBatched_16_32_4
+)
+{
+BatchedMatrixVectorProductTest(16, 32, 4);
+}
+
+TEST(EncryptedGeneralMVP, MatrixVectorProductBatched_32_1024_2
+)
+{
+BatchedMatrixVectorProductTest(32, 1024, 2);
+}
+
+TEST(EncryptedGeneralMVP, MatrixVectorProductBatched_BlocksTooSmall
+)
+{
+EXPECT_THROW(BatchedMatrixVectorProductTest(32, 1024, 4), invalid_argument
+);
+}
+
 
 /**
  * \brief Helper function to test RNN cell.
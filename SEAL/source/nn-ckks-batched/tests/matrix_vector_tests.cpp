@@ -504,6 +504,29 @@ EXPECT_EQ(r[dim + i], v[i]
 }
 }
 
+TEST(PlaintextOperations, PackBlocks
+)
+{
+const auto v = random_vector(dim);
+const auto w = random_vector(dim2);
+
+const auto r = pack_blocks({v, w}, dim2);
+
+ASSERT_EQ(r.size(), 2 * dim2);
+for (size_t i = 0; i < dim2; ++i) {
+EXPECT_EQ(r[i], i < dim ? v[i] : 0);
+EXPECT_EQ(r[dim2 + i], w[i]);
+}
+
+const auto unpacked = unpack_blocks(r, dim2, dim, 2);
+ASSERT_EQ(unpacked.size(), 2);
+EXPECT_EQ(unpacked[0], v);
+EXPECT_EQ(unpacked[1], vec(w.begin(), w.begin() + dim));
+
+EXPECT_THROW(pack_blocks({w}, dim), invalid_argument);
+EXPECT_THROW(unpack_blocks(r, dim2, dim, 3), invalid_argument);
+}
+
 TEST(PlaintextOperations, MatrixVectorFromDiagonals
 )
 {
@@ -809,4 +832,39 @@ TEST(PlaintextOperations, MatrixVectorFromDiagonals_32_1024
 GeneralMatrixVector(32, 1024);
 }
 
+TEST(PlaintextOperations, GeneralMatrixVectorFromDiagonalMatrix
+)
+{
+const auto m = random_matrix(32, 1024);
+const auto v = random_vector(1024);
+const auto expected = general_mvp_from_diagonals(diagonals(m), v);
+
+// The same diagonals, but as the rows of one contiguous matrix
+const auto d = diagonals(m);
+matrix diagonal_rows(32, 1024);
+for (size_t i = 0; i < 32; ++i) {
+copy(d[i].begin(), d[i].end(), diagonal_rows[i].begin());
+}
+const auto r = general_mvp_from_diagonal_matrix(diagonal_rows, v);
+ASSERT_EQ(r.size(), 32);
+for (size_t i = 0; i < 32; ++i) {
+EXPECT_EQ(r[i], expected[i]);
+}
+}
+
+TEST(Generation, MatrixIsRowMajor
+)
+{
+const auto m = random_matrix(dim, dim2);
+const matrix_view view = m;
+ASSERT_EQ(view.rows(), dim);
+ASSERT_EQ(view.cols(), dim2);
+for (size_t i = 0; i < dim; ++i) {
+for (size_t j = 0; j < dim2; ++j) {
+EXPECT_EQ(&m[i][j], m.data() + i * dim2 + j);
+EXPECT_EQ(view[i][j], m[i][j]);
+}
+}
+}
+
 }
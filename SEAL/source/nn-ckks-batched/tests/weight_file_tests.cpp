@@ -0,0 +1,71 @@
+#include <cstdio>
+#include <fstream>
+#include "gtest/gtest.h"
+#include "../weight_file.h"
+
+using namespace std;
+
+namespace WeightFileTests {
+
+    void write_uint64(ofstream &out, uint64_t value) {
+        for (size_t i = 0; i < 8; ++i) {
+            out.put(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+    }
+
+    /// Writes a file with a single 2 x 4 layer whose diagonals hold 0, 1, ..., 7 and whose biases are 8, 9
+    string write_test_file(bool truncated = false) {
+        const string path = "weight_file_test.bin";
+        ofstream out(path, ios::binary);
+        out.write("SOKWGT01", 8);
+        write_uint64(out, 1);
+        write_uint64(out, 2);
+        write_uint64(out, 4);
+        write_uint64(out, 48);
+        write_uint64(out, 48 + 8 * 8);
+        for (int i = 0; i < (truncated ? 5 : 10); ++i) {
+            const double value = i;
+            out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+        return path;
+    }
+
+    TEST(WeightFile, ReadDense
+    )
+    {
+    const auto path = write_test_file();
+    {
+    WeightFile file(path);
+    ASSERT_EQ(file.num_layers(), 1);
+    const auto &layer = file.dense(0);
+    ASSERT_EQ(layer.units, 2);
+    ASSERT_EQ(layer.input_size, 4);
+    for (size_t i = 0; i < 2; ++i) {
+    for (size_t k = 0; k < 4; ++k) {
+    EXPECT_EQ(layer.diagonal(i)[k], i * 4 + k);
+    }
+    EXPECT_EQ(layer.bias[i], 8 + i);
+    }
+    EXPECT_THROW(file.dense(1), out_of_range
+    );
+    }
+    remove(path.c_str());
+}
+
+TEST(WeightFile, Truncated
+)
+{
+const auto path = write_test_file(true);
+EXPECT_THROW(WeightFile file(path), runtime_error
+);
+remove(path.c_str());
+}
+
+TEST(WeightFile, Missing
+)
+{
+EXPECT_THROW(WeightFile file("does_not_exist.bin"), runtime_error
+);
+}
+
+}
@@ -0,0 +1,111 @@
+#include "weight_file.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+    const char magic[8] = {'S', 'O', 'K', 'W', 'G', 'T', '0', '1'};
+
+    /// Reads the little-endian uint64 at offset, the file is mapped as a whole so this cannot go past its end
+    uint64_t read_uint64(const unsigned char *data, size_t offset) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < 8; ++i) {
+            value |= static_cast<uint64_t>(data[offset + i]) << (8 * i);
+        }
+        return value;
+    }
+
+    /// Whether [offset, offset + count doubles) lies inside a file of the given size and is aligned for doubles
+    bool valid_array(uint64_t offset, uint64_t count, size_t file_size) {
+        return offset % sizeof(double) == 0 && offset <= file_size &&
+               count <= (file_size - offset) / sizeof(double);
+    }
+
+    bool little_endian() {
+        const uint16_t one = 1;
+        unsigned char first_byte;
+        memcpy(&first_byte, &one, 1);
+        return first_byte == 1;
+    }
+}
+
+const double *WeightFile::DenseWeights::diagonal(size_t i) const {
+    return diagonals + i * input_size;
+}
+
+WeightFile::WeightFile(const string &path) {
+    if (!little_endian()) {
+        // The doubles are used in place, so they have to be in the byte order of the host
+        throw runtime_error("Weight files can only be used on little-endian hosts.");
+    }
+
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("Cannot open weight file " + path + ": " + strerror(errno));
+    }
+    struct stat file_stat{};
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0) {
+        close(fd);
+        throw runtime_error("Cannot read the size of weight file " + path);
+    }
+    mapping_size = static_cast<size_t>(file_stat.st_size);
+    mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after closing the file
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        throw runtime_error("Cannot map weight file " + path + ": " + strerror(errno));
+    }
+
+    try {
+        const auto *data = static_cast<const unsigned char *>(mapping);
+        if (mapping_size < 16 || memcmp(data, magic, sizeof(magic)) != 0) {
+            throw runtime_error("Not a weight file: " + path);
+        }
+        const uint64_t num_layers = read_uint64(data, 8);
+        if (num_layers > (mapping_size - 16) / 32) {
+            throw runtime_error("Weight file " + path + " is truncated.");
+        }
+        for (size_t l = 0; l < num_layers; ++l) {
+            const size_t header = 16 + 32 * l;
+            const uint64_t units = read_uint64(data, header);
+            const uint64_t input_size = read_uint64(data, header + 8);
+            const uint64_t diagonals_offset = read_uint64(data, header + 16);
+            const uint64_t bias_offset = read_uint64(data, header + 24);
+            if (units == 0 || input_size == 0 || units > mapping_size || input_size > mapping_size ||
+                !valid_array(diagonals_offset, units * input_size, mapping_size) ||
+                !valid_array(bias_offset, units, mapping_size)) {
+                throw runtime_error("Layer " + to_string(l) + " of weight file " + path + " is invalid.");
+            }
+            layers.push_back({units, input_size,
+                              reinterpret_cast<const double *>(data + diagonals_offset),
+                              reinterpret_cast<const double *>(data + bias_offset)});
+        }
+    } catch (...) {
+        munmap(mapping, mapping_size);
+        throw;
+    }
+}
+
+WeightFile::~WeightFile() {
+    if (mapping) {
+        munmap(mapping, mapping_size);
+    }
+}
+
+size_t WeightFile::num_layers() const {
+    return layers.size();
+}
+
+const WeightFile::DenseWeights &WeightFile::dense(size_t layer) const {
+    if (layer >= layers.size()) {
+        throw out_of_range("Weight file has no layer " + to_string(layer));
+    }
+    return layers[layer];
+}
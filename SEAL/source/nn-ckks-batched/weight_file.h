@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * \brief Read-only, memory-mapped file with the weights of the dense layers of a model, as written by
+ *  scripts/models/mnist/export_weights.py. The weights are used directly from the mapping, nothing is copied on load.
+ *
+ *  Format (all integers are little-endian uint64, all weights little-endian IEEE 754 doubles):
+ *  - magic "SOKWGT01" (8 bytes)
+ *  - number of layers L
+ *  - L layer headers: units m, input size n, byte offset of the diagonals, byte offset of the bias
+ *  - the data: for each layer, the m diagonals of the m x n weight matrix (in the order and form of diagonals(),
+ *    i.e. as expected by ptxt_general_matrix_enc_vector_product), each of length n, followed by the m biases.
+ *    All offsets are multiples of 8, so the doubles are aligned in the mapping.
+ */
+class WeightFile {
+public:
+    /// Weights of one dense layer, pointing into the mapping
+    struct DenseWeights {
+        /// Number of units, i.e. output size
+        size_t units;
+
+        /// Dimension of the input
+        size_t input_size;
+
+        /// units diagonals of length input_size each, one after the other
+        const double *diagonals;
+
+        /// units biases
+        const double *bias;
+
+        /// Diagonal i, of length input_size
+        const double *diagonal(size_t i) const;
+    };
+
+    /**
+     * \brief Map a weight file into memory and check its structure
+     * \param path Path of the file
+     * \throw std::runtime_error if the file cannot be mapped or is not a valid weight file
+     */
+    explicit WeightFile(const std::string &path);
+
+    WeightFile(const WeightFile &) = delete;
+
+    WeightFile &operator=(const WeightFile &) = delete;
+
+    /// Unmaps the file, all DenseWeights of this file become invalid
+    ~WeightFile();
+
+    /// Number of dense layers in the file
+    size_t num_layers() const;
+
+    /**
+     * \brief Get the weights of a dense layer
+     * \param layer Index of the layer, in the order of the model
+     * \return The weights, valid as long as this object exists
+     * \throw std::out_of_range if there is no such layer
+     */
+    const DenseWeights &dense(size_t layer) const;
+
+private:
+    void *mapping = nullptr;
+
+    size_t mapping_size = 0;
+
+    std::vector<DenseWeights> layers;
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include "seal/seal.h"
+
+/**
+ * \brief Encodes constant plaintexts (masks, all-ones vectors, fixed inputs) only once per level and scale and
+ *  hands out references to them. Encoding a full vector costs an inverse NTT per modulus, which adds up quickly when
+ *  the same constant is needed for every bit of a comparison.
+ *  References stay valid until clear() is called or the cache is destroyed. Safe to use from several threads.
+ */
+class PlaintextCache {
+public:
+    /**
+     * \brief Get a constant, encoding it on first use
+     * \param[in] name Identifies the constant, must always be used for the same values
+     * \param[in] parms_id Level the constant is encoded at (seal::parms_id_zero for BFV, whose plaintexts do not
+     *  depend on the level)
+     * \param[in] scale Scale the constant is encoded at (0 for BFV)
+     * \param[in] encode Encodes the constant into the given plaintext, only called if it is not cached yet
+     * \return The cached plaintext
+     */
+    const seal::Plaintext &get(const std::string &name, const seal::parms_id_type &parms_id, double scale,
+                               const std::function<void(seal::Plaintext &)> &encode) {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto key = std::make_tuple(name, parms_id, scale);
+        auto it = cache.find(key);
+        if (it == cache.end()) {
+            seal::Plaintext ptxt;
+            encode(ptxt);
+            it = cache.emplace(key, std::move(ptxt)).first;
+        }
+        return it->second;
+    }
+
+    /// Number of cached plaintexts
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return cache.size();
+    }
+
+    /// Drops all plaintexts, e.g. after switching to a new context
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        cache.clear();
+    }
+
+private:
+    mutable std::mutex mutex;
+
+    std::map<std::tuple<std::string, seal::parms_id_type, double>, seal::Plaintext> cache;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "thread_pool.h"
+
+/**
+ * \brief A set of tasks with dependencies between them (a DAG), e.g. the intermediate results of a circuit.
+ *  Tasks whose dependencies have all finished run concurrently on a ThreadPool, so independent branches of a circuit
+ *  are evaluated in parallel while the order within each branch is kept.
+ *  Tasks of the same graph must only share data they read, or data that one of them finished writing before the other
+ *  (transitively) depends on it.
+ */
+class TaskGraph {
+public:
+    /// Handle of a task, to depend on it
+    typedef std::size_t Task;
+
+    /**
+     * \brief Adds a task
+     * \param body Callable without arguments
+     * \param dependencies Tasks that have to finish before this one starts, all added before
+     * \return Handle of the new task
+     */
+    Task add(std::function<void()> body, const std::vector<Task> &dependencies = {}) {
+        const Task task = tasks.size();
+        tasks.push_back({std::move(body), dependencies.size(), {}});
+        for (auto dependency : dependencies) {
+            tasks.at(dependency).dependents.push_back(task);
+        }
+        return task;
+    }
+
+    /// Number of tasks
+    std::size_t size() const {
+        return tasks.size();
+    }
+
+    /**
+     * \brief Runs every task once and waits until all are done. The calling thread works on the graph as well.
+     *  The graph is consumed, tasks have to be added again to run them another time.
+     * \param pool Thread pool to run on, may be nullptr to run the tasks sequentially in the order they were added
+     * \throw Rethrows the first exception thrown by a task, once the running tasks have finished. Tasks that have not
+     *  started yet are skipped.
+     */
+    void run(ThreadPool *pool) {
+        if (!pool || pool->size() == 0) {
+            // dependencies are always added before their dependents
+            for (auto &task : tasks) {
+                task.body();
+            }
+            tasks.clear();
+            return;
+        }
+
+        struct State {
+            std::vector<Node> tasks;
+            std::deque<Task> ready;
+            std::size_t done = 0;
+            std::mutex mutex;
+            std::condition_variable changed;
+            std::exception_ptr error;
+        };
+        auto state = std::make_shared<State>();
+        state->tasks = std::move(tasks);
+        tasks.clear();
+        const std::size_t n = state->tasks.size();
+        for (Task task = 0; task < n; ++task) {
+            if (state->tasks[task].missing == 0) {
+                state->ready.push_back(task);
+            }
+        }
+
+        // Workers that only start once all tasks are done return right away, so it is fine that they might
+        // outlive this call (they only hold the shared state)
+        auto work = [state, n] {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            while (true) {
+                state->changed.wait(lock, [&] { return state->done == n || !state->ready.empty(); });
+                if (state->done == n) {
+                    return;
+                }
+                const Task task = state->ready.front();
+                state->ready.pop_front();
+
+                if (!state->error) {
+                    lock.unlock();
+                    std::exception_ptr error;
+                    try {
+                        state->tasks[task].body();
+                    } catch (...) {
+                        error = std::current_exception();
+                    }
+                    lock.lock();
+                    if (error && !state->error) {
+                        state->error = error;
+                    }
+                }
+                state->done++;
+                for (auto dependent : state->tasks[task].dependents) {
+                    if (--state->tasks[dependent].missing == 0) {
+                        state->ready.push_back(dependent);
+                    }
+                }
+                state->changed.notify_all();
+            }
+        };
+
+        const std::size_t helpers = std::min(pool->size(), n > 0 ? n - 1 : 0);
+        for (std::size_t h = 0; h < helpers; ++h) {
+            pool->submit(work);
+        }
+        work();
+
+        if (state->error) {
+            std::rethrow_exception(state->error);
+        }
+    }
+
+private:
+    struct Node {
+        std::function<void()> body;
+
+        /// Number of dependencies that have not finished yet
+        std::size_t missing;
+
+        std::vector<Task> dependents;
+    };
+
+    std::vector<Node> tasks;
+};
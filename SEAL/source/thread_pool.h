@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/**
+ * \brief A fixed set of worker threads that execute submitted tasks in FIFO order.
+ *  Homomorphic operations on different ciphertexts are independent, and SEAL's Evaluator and encoders are safe to
+ *  share between threads (all their operations are const), so independent parts of a computation can run on the pool.
+ */
+class ThreadPool {
+public:
+    /**
+     * \brief Start the worker threads
+     * \param num_workers Number of worker threads. With zero workers, parallel_for runs everything on the calling thread
+     */
+    explicit ThreadPool(size_t num_workers) {
+        for (size_t i = 0; i < num_workers; ++i) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /// Finishes all queued tasks and joins the worker threads
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    /// Number of worker threads
+    size_t size() const {
+        return workers.size();
+    }
+
+    /**
+     * \brief Queue a task for execution on one of the workers
+     * \param task Callable without arguments
+     * \return Future that becomes ready with the result of the task (or the exception it threw)
+     */
+    template<typename F>
+    auto submit(F &&task) -> std::future<decltype(task())> {
+        using result_type = decltype(task());
+        auto packaged = std::make_shared<std::packaged_task<result_type()>>(std::forward<F>(task));
+        auto future = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            tasks.emplace([packaged] { (*packaged)(); });
+        }
+        condition.notify_one();
+        return future;
+    }
+
+    /**
+     * \brief Run body(i) for all i in [0, n) on the calling thread and the workers, and wait until all are done.
+     *  The calling thread works on the loop as well, so this can also be called from within a task of the same pool.
+     * \param n Number of iterations
+     * \param body Callable taking the index of the iteration
+     * \throw Rethrows the first exception thrown by body, once all iterations have finished
+     */
+    template<typename F>
+    void parallel_for(size_t n, F &&body) {
+        if (n == 0) {
+            return;
+        }
+        struct Loop {
+            std::atomic<size_t> next{0};
+            size_t done = 0;
+            std::mutex mutex;
+            std::condition_variable finished;
+            std::exception_ptr error;
+        };
+        auto loop = std::make_shared<Loop>();
+
+        // Workers that only start once all iterations have been claimed return without touching body,
+        // so it is fine that they might outlive this call
+        auto run = [loop, n, &body] {
+            for (size_t i = loop->next++; i < n; i = loop->next++) {
+                std::exception_ptr error;
+                try {
+                    body(i);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                std::lock_guard<std::mutex> lock(loop->mutex);
+                if (error && !loop->error) {
+                    loop->error = error;
+                }
+                if (++loop->done == n) {
+                    loop->finished.notify_all();
+                }
+            }
+        };
+
+        const size_t helpers = std::min(workers.size(), n - 1);
+        if (helpers > 0) {
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                for (size_t h = 0; h < helpers; ++h) {
+                    tasks.emplace(run);
+                }
+            }
+            condition.notify_all();
+        }
+        run();
+
+        std::unique_lock<std::mutex> lock(loop->mutex);
+        loop->finished.wait(lock, [&] { return loop->done == n; });
+        if (loop->error) {
+            std::rethrow_exception(loop->error);
+        }
+    }
+
+private:
+    std::vector<std::thread> workers;
+
+    std::queue<std::function<void()>> tasks;
+
+    std::mutex queue_mutex;
+
+    std::condition_variable condition;
+
+    bool stopping = false;
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+};
+
+/**
+ * \brief Run body(i) for all i in [0, n), spread across the pool if there is one and sequentially in order otherwise
+ * \param pool Thread pool to run on, may be nullptr
+ * \param n Number of iterations
+ * \param body Callable taking the index of the iteration
+ */
+template<typename F>
+void for_each_index(ThreadPool *pool, size_t n, F &&body) {
+    if (pool) {
+        pool->parallel_for(n, body);
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            body(i);
+        }
+    }
+}
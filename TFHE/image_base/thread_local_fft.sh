@@ -0,0 +1,56 @@
+#!/bin/bash
+# Makes the FFTW processor of libtfhe per-thread, so that gates can be bootstrapped on several threads at once.
+#
+# libtfhe keeps the FFT buffers in one global FFT_Processor_fftw (fp1024_fftw) and every polynomial remembers a pointer
+# to it, so concurrent bootstrappings overwrite each other's buffers. This script
+#   - declares fp1024_fftw thread_local,
+#   - lets the transforms use the processor of the calling thread instead of the remembered pointer,
+#   - serializes creating and destroying the FFTW plans, since the FFTW planner is not thread-safe (executing is).
+# The programs in source/ are built with TFHE_THREAD_SAFE_FFT=ON against the patched library.
+#
+# argument 1 ($1):
+#	the directory of the FFTW processor in the libtfhe sources (e.g., /tfhe/src/libtfhe/fft_processors/fftw)
+
+set -eu
+
+FFT_DIR=$1
+cd "${FFT_DIR}"
+
+fail() {
+  echo "thread_local_fft.sh: $1, the libtfhe sources changed and the patch has to be adapted" >&2
+  exit 1
+}
+
+SOURCES=$(ls *.cpp *.h)
+PROCESSOR=$(grep -l '^FFT_Processor_fftw fp1024_fftw(' ${SOURCES}) || fail "no definition of fp1024_fftw"
+
+# one processor per thread, the declaration has to match the definition
+sed -i 's/^FFT_Processor_fftw fp1024_fftw(/thread_local &/' ${PROCESSOR}
+grep -q 'extern FFT_Processor_fftw fp1024_fftw;' ${SOURCES} || fail "no declaration of fp1024_fftw"
+sed -i 's/extern FFT_Processor_fftw fp1024_fftw;/extern thread_local FFT_Processor_fftw fp1024_fftw;/' ${SOURCES}
+
+# the pointer stored in a polynomial refers to the processor of the thread that created it
+grep -q -- '->proc->' ${SOURCES} || fail "no transform uses the processor of a polynomial"
+sed -i -E 's/[A-Za-z_]+->proc->/fp1024_fftw./g' ${SOURCES}
+
+# the processors of the threads create (and destroy) their plans one at a time
+grep -q 'fftw_plan_dft' ${PROCESSOR} || fail "no FFTW plan is created in ${PROCESSOR}"
+sed -i '0,/^FFT_Processor_fftw::FFT_Processor_fftw(/s//#include <mutex>\
+\/\/ the FFTW planner is not thread-safe\
+static std::mutex fftw_planner_mutex;\
+\
+&/' ${PROCESSOR}
+sed -i '0,/fftw_plan_dft/{/fftw_plan_dft/i\    std::lock_guard<std::mutex> plan_lock(fftw_planner_mutex);
+}' ${PROCESSOR}
+if grep -q 'fftw_destroy_plan' ${PROCESSOR}; then
+  sed -i '0,/fftw_destroy_plan/{/fftw_destroy_plan/i\    std::lock_guard<std::mutex> plan_lock(fftw_planner_mutex);
+}' ${PROCESSOR}
+fi
+
+# check the result
+grep -q '^thread_local FFT_Processor_fftw fp1024_fftw(' ${PROCESSOR} || fail "fp1024_fftw is not thread_local"
+grep -q 'extern thread_local FFT_Processor_fftw fp1024_fftw;' ${SOURCES} || fail "the declaration is not thread_local"
+! grep -q -- '->proc->' ${SOURCES} || fail "a transform still uses the processor of a polynomial"
+[ "$(grep -c 'static std::mutex fftw_planner_mutex;' ${PROCESSOR})" -eq 1 ] || fail "no planner mutex"
+grep -B1 'fftw_plan_dft' ${PROCESSOR} | grep -q 'plan_lock(fftw_planner_mutex)' || fail "planning is not serialized"
+echo "libtfhe FFTW processor is thread_local now"
@@ -0,0 +1,97 @@
+#ifndef ADDERS_H_
+#define ADDERS_H_
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "gate_dag.h"
+
+/// Carry computation of an adder
+enum class AdderType {
+  /// serial carry chain: fewest gates, depth linear in the number of bits
+  RIPPLE,
+  /// parallel prefix with all prefixes computed in every level: depth log2(n), ~n log2(n) prefix gates
+  KOGGE_STONE,
+  /// parallel prefix as an up- and a down-sweep: depth ~2 log2(n), ~2n prefix gates
+  BRENT_KUNG
+};
+
+/// Adder selected by the environment variable TFHE_ADDER (ripple, kogge_stone or brent_kung, default: ripple)
+inline AdderType adder_type() {
+  const char *adder = std::getenv("TFHE_ADDER");
+  if (!adder || std::strcmp(adder, "ripple") == 0) return AdderType::RIPPLE;
+  if (std::strcmp(adder, "kogge_stone") == 0) return AdderType::KOGGE_STONE;
+  if (std::strcmp(adder, "brent_kung") == 0) return AdderType::BRENT_KUNG;
+  std::cerr << "Unknown TFHE_ADDER " << adder << ", using ripple" << std::endl;
+  return AdderType::RIPPLE;
+}
+
+/// Parallel prefix adder, a drop-in replacement for the ripple carry adders of the TFHE programs.
+///
+/// Every bit i gets a generate g_i = a_i AND b_i and a propagate p_i = a_i XOR b_i (the carry in is folded into g_0),
+/// the prefix network combines them into the carries c_i = G[i-1:0] and the sum is s_i = p_i XOR c_i.
+/// Groups are combined with G = G_hi XOR (P_hi AND G_lo), which equals the usual OR since a group can not both
+/// generate and propagate a carry. P is only computed for groups that do not reach down to bit 0.
+/// \param dag      [in,out]   circuit the gates are recorded in, a GateDag or any type with the same XOR and AND
+///                            (e.g. a plaintext model to check the networks)
+/// \param s        [out]      result (bits 0 to nb_bits - 1 are set), may be a or b
+/// \param carry    [in,out]   carry in, set to the carry into bit nb_bits - 1 (like the ripple carry adders)
+/// \param a        [in]       lhs (must have at least nb_bits bits)
+/// \param b        [in]       rhs (must have at least nb_bits bits)
+/// \param nb_bits  [in]       size of lhs and rhs
+/// \param type     [in]       KOGGE_STONE or BRENT_KUNG
+template <class Circuit>
+void prefix_adder(Circuit &dag,
+                  Word &s,
+                  Wire &carry,
+                  const Word &a,
+                  const Word &b,
+                  const int nb_bits,
+                  AdderType type) {
+  Word p(nb_bits), g(nb_bits);
+  for (int i = 0; i < nb_bits; ++i) {
+    p[i] = dag.XOR(a[i], b[i]);
+    g[i] = dag.AND(a[i], b[i]);
+  }
+  g[0] = dag.XOR(g[0], dag.AND(p[0], carry));
+
+  // (group_g, group_p)[i] covers the bits lowest[i] to i, only the first nb_bits - 1 are needed for the carries
+  const int n = nb_bits - 1;
+  Word group_g(g.begin(), g.begin() + n), group_p(p.begin(), p.begin() + n);
+  std::vector<int> lowest(n);
+  for (int i = 0; i < n; ++i) lowest[i] = i;
+  // extends group i by the adjacent group j below it
+  auto combine = [&](int i, int j) {
+    group_g[i] = dag.XOR(group_g[i], dag.AND(group_p[i], group_g[j]));
+    lowest[i] = lowest[j];
+    if (lowest[i] > 0) group_p[i] = dag.AND(group_p[i], group_p[j]);
+  };
+
+  if (type == AdderType::KOGGE_STONE) {
+    for (int d = 1; d < n; d *= 2) {
+      // downwards, so group i - d is still the one of the previous level
+      for (int i = n - 1; i >= d; --i) {
+        if (lowest[i] > 0) combine(i, i - d);
+      }
+    }
+  } else {
+    int d = 1;
+    for (; 2*d <= n; d *= 2) {
+      for (int i = 2*d - 1; i < n; i += 2*d) combine(i, i - d);
+    }
+    for (d /= 2; d >= 1; d /= 2) {
+      for (int i = 3*d - 1; i < n; i += 2*d) combine(i, i - d);
+    }
+  }
+
+  // c_0 is the carry in, c_i = G[i-1:0]
+  Word sum(nb_bits);
+  sum[0] = dag.XOR(p[0], carry);
+  for (int i = 1; i < nb_bits; ++i) sum[i] = dag.XOR(p[i], group_g[i - 1]);
+  if (nb_bits > 1) carry = group_g[nb_bits - 2];
+  for (int i = 0; i < nb_bits; ++i) s[i] = sum[i];
+}
+
+#endif  // ADDERS_H_
@@ -1,11 +1,19 @@
 #include <tfhe/tfhe.h>
 #include <tfhe/tfhe_io.h>
 #include <stdio.h>
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <random>
+#include <vector>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 
+#include "../adders.h"
+#include "../gate_dag.h"
+#include "../lwe_arena.h"
+
 typedef std::chrono::milliseconds ms;
 typedef std::chrono::high_resolution_clock Time;
 
@@ -24,19 +32,28 @@ std::stringstream ss_time;
 // Counters for gates
 int and_gates = 0;
 int xor_gates = 0;
+// Bootstrapped gates that were skipped because of constant inputs
+int folded_gates = 0;
+
+// Adder used for all additions, selected by TFHE_ADDER
+const AdderType ADDER_TYPE = adder_type();
+
+// Threads the gates are evaluated on, selected by TFHE_THREADS (checked before anything is computed)
+const int NUM_THREADS = gate_dag_threads();
 
 void client();
 void cloud();
-void verify();
+int verify();
 
 int main() {
   client();
   cloud();
-  verify();
+  const int wrong_records = verify();
 
   // Report total gate numbers
   std::cout << "and: " << and_gates << std::endl;
   std::cout << "xor: " << xor_gates << std::endl;
+  std::cout << "folded: " << folded_gates << std::endl;
 
   // Print out times:
   std::cout << ss_time.str() << std::endl;
@@ -47,7 +64,7 @@ int main() {
   myfile.open(out_filename, std::ios_base::app);
   myfile << ss_time.str() << std::endl;
   myfile.close();
-  return 0;
+  return wrong_records == 0 ? 0 : 1;
 }
 
 const int NB_FLAGS = 5;
@@ -59,6 +76,57 @@ const int PRESSURE_FIELD = 4;
 
 const int NB_VALUES = 8;
 
+/// Number of values of a patient: the flags, age, hdl, height, weight, physical_act and drinking
+const int NB_FIELDS = 7;
+
+/// Number of records (patients) evaluated in one run, from the environment variable NUM_RECORDS (default: 1)
+int num_records() {
+  const char *records = std::getenv("NUM_RECORDS");
+  return records ? std::max(1, std::atoi(records)) : 1;
+}
+
+/// Number of records recorded in the DAG and evaluated together, enough to keep all threads busy while the memory
+/// of the DAG stays bounded
+int records_per_run() { return 4 * NUM_THREADS; }
+
+/// Keystream the values of a record are encrypted with, the first record uses the original keystream
+std::vector<int> keystream(int record) {
+  std::vector<int> KS = {241, 210, 225, 219, 92, 43, 197};
+  if (record > 0) {
+    std::mt19937 rng(record);
+    for (auto &k : KS) k = rng() & 0xFF;
+  }
+  return KS;
+}
+
+/// Values of a patient (flags, age, hdl, height, weight, physical_act and drinking), the first record is the
+/// original patient and the others are random
+std::vector<int> patient(int record) {
+  std::vector<int> values = {15, 55, 50, 80, 80, 45, 4};
+  if (record > 0) {
+    // a different stream than the keystream of the record
+    std::mt19937 rng(record + 0x10000);
+    values[0] = rng() % (1 << NB_FLAGS);
+    values[1] = 20 + rng() % 70;
+    values[2] = 20 + rng() % 60;
+    values[3] = 60 + rng() % 100;
+    values[4] = 60 + rng() % 100;
+    values[5] = rng() % 90;
+    values[6] = rng() % 8;
+  }
+  return values;
+}
+
+/// Number of risk factors of a patient, computed in plaintext to check the circuit
+int cardio_plain(const std::vector<int> &values) {
+  const int flags = values[0], age = values[1], hdl = values[2], height = values[3], weight = values[4];
+  const int physical_act = values[5], drinking = values[6];
+  const bool sex = (flags >> SEX_FIELD) & 1;
+  return (sex && age > 50) + (!sex && age > 60) + ((flags >> ANTECEDENT_FIELD) & 1) + ((flags >> SMOKER_FIELD) & 1)
+      + ((flags >> DIABETES_FIELD) & 1) + ((flags >> PRESSURE_FIELD) & 1) + (hdl < 40) + (height + 10 < weight)
+      + (physical_act < 30) + (sex && drinking > 3) + (!sex && drinking > 2);
+}
+
 //#define DEBUG
 
 #ifdef DEBUG
@@ -75,13 +143,17 @@ int decrypt_array(const LweSample *array, int nb_size, const TFheGateBootstrappi
   return int_answer;
 }
 
-LweSample *encode_n(int n, const TFheGateBootstrappingCloudKeySet *bk) {
-  LweSample *p = new_gate_bootstrapping_ciphertext_array(NB_VALUES, bk->params);
-  for (int i = 0; i < NB_VALUES; ++i) {
-    bootsCONSTANT(&p[i], (n >> i) & 1, bk);
+#ifdef DEBUG
+/// Evaluates the gates recorded so far and decrypts the first nb_size bits of word
+int decrypt_word(GateDag &dag, const Word &word, int nb_size) {
+  dag.run();
+  int int_answer = 0;
+  for (int i = 0; i < nb_size; i++) {
+    int_answer |= (bootsSymDecrypt(dag.sample(word[i]), SECRET_KEY) << i);
   }
-  return p;
+  return int_answer;
 }
+#endif
 
 void client() {
   auto t0 = Time::now();
@@ -109,23 +181,34 @@ void client() {
 
   auto t2 = Time::now();
 
-  /// Keystream
-  std::vector<int> KS = {241, 210, 225, 219, 92, 43, 197};
-
-  // encrypt the KS
-  LweSample *ks[7];
-  for (int i = 0; i < 7; ++i) {
-    ks[i] = new_gate_bootstrapping_ciphertext_array(NB_VALUES, params);
-    for (int j = 0; j < NB_VALUES; ++j) {
-      bootsSymEncrypt(&ks[i][j], (KS[i] >> j) & 1, key);
-    }
+  LweSample *ks[NB_FIELDS];
+  for (auto &k : ks) {
+    k = new_gate_bootstrapping_ciphertext_array(NB_VALUES, params);
   }
 
-  //export the ciphertexts to a file (for the cloud)
+  //mask the values of every record with its KS, encrypt the KS and export both
+  //to a file (for the cloud)
   FILE *cloud_data = fopen("cloud.data", "wb");
-  for (auto &k : ks) {
-    for (int j = 0; j < NB_VALUES; ++j) {
-      export_gate_bootstrapping_ciphertext_toFile(cloud_data, &k[j], params);
+  for (int record = 0; record < num_records(); ++record) {
+    /// Keystream
+    std::vector<int> KS = keystream(record);
+
+    // age, hdl, height, weight, physical_act and drinking are actually
+    // not encrypted under FHE, but instead under the KS
+    std::vector<int> values = patient(record);
+    uint8_t masked[NB_FIELDS];
+    for (int i = 0; i < NB_FIELDS; ++i) masked[i] = values[i] ^ KS[i];
+    fwrite(masked, 1, NB_FIELDS, cloud_data);
+
+    for (int i = 0; i < NB_FIELDS; ++i) {
+      for (int j = 0; j < NB_VALUES; ++j) {
+        bootsSymEncrypt(&ks[i][j], (KS[i] >> j) & 1, key);
+      }
+    }
+    for (auto &k : ks) {
+      for (int j = 0; j < NB_VALUES; ++j) {
+        export_gate_bootstrapping_ciphertext_toFile(cloud_data, &k[j], params);
+      }
     }
   }
   fclose(cloud_data);
@@ -146,340 +229,327 @@ void client() {
 
 }
 /// Simple ripple carry adder
-/// \param s        [out]      result
+/// \param dag      [in,out]   circuit the gates are recorded in
+/// \param s        [out]      result (bits 0 to nb_bits - 1 are set)
 /// \param carry    [in,out]
-/// \param a        [in]       lhs (must be array of size nb_bits)
-/// \param b        [in]       rhs (must be array of size nb_bits)
+/// \param a        [in]       lhs (must have at least nb_bits bits)
+/// \param b        [in]       rhs (must have at least nb_bits bits)
 /// \param nb_bits  [in]       size of lhs and rhs
-/// \param bk       [in]
-void ripple_carry_adder(LweSample *s,
-                        LweSample *carry,
-                        const LweSample *a,
-                        const LweSample *b,
-                        const int nb_bits,
-                        const TFheGateBootstrappingCloudKeySet *bk) {
+void ripple_carry_adder(GateDag &dag,
+                        Word &s,
+                        Wire &carry,
+                        const Word &a,
+                        const Word &b,
+                        const int nb_bits) {
 #ifdef DEBUG
-  std::cout << "adding " << decrypt_array(a, nb_bits, SECRET_KEY) << " + " << decrypt_array(b, nb_bits, SECRET_KEY)
-            << " with carry in " << bootsSymDecrypt(carry, SECRET_KEY) << std::endl;
+  std::cout << "adding " << decrypt_word(dag, a, nb_bits) << " + " << decrypt_word(dag, b, nb_bits)
+            << " with carry in " << decrypt_word(dag, {carry}, 1) << std::endl;
 #endif
 
-  // Create temp ctxt's
-  LweSample *n1 = new_gate_bootstrapping_ciphertext(bk->params);
-  LweSample *n2 = new_gate_bootstrapping_ciphertext(bk->params);
-  LweSample *n1_AND_n2 = new_gate_bootstrapping_ciphertext(bk->params);
-
   for (int i = 0; i < nb_bits; i++) {
-    bootsXOR(n1, carry, &a[i], bk);
-    bootsXOR(n2, carry, &b[i], bk);
-    bootsXOR(&s[i], n1, &b[i], bk);
+    Wire n1 = dag.XOR(carry, a[i]);
+    Wire n2 = dag.XOR(carry, b[i]);
+    s[i] = dag.XOR(n1, b[i]);
     xor_gates += 3;
     if (i < nb_bits - 1) {
-      bootsAND(n1_AND_n2, n1, n2, bk);
+      Wire n1_AND_n2 = dag.AND(n1, n2);
       ++and_gates;
-      bootsXOR(carry, n1_AND_n2, carry, bk);
+      carry = dag.XOR(n1_AND_n2, carry);
       ++xor_gates;
     }
   }
 #ifdef DEBUG
-  std::cout << "result: " << decrypt_array(s, nb_bits, SECRET_KEY)
-            << " carry out: " << bootsSymDecrypt(carry, SECRET_KEY) << std::endl;
+  std::cout << "result: " << decrypt_word(dag, s, nb_bits)
+            << " carry out: " << decrypt_word(dag, {carry}, 1) << std::endl;
 #endif
+}
 
-  // Clean up  temp ctxt's
-  delete_gate_bootstrapping_ciphertext(n1);
-  delete_gate_bootstrapping_ciphertext(n2);
-  delete_gate_bootstrapping_ciphertext(n1_AND_n2);
+/// Adds a and b with the adder selected by TFHE_ADDER, see ripple_carry_adder for the parameters
+void adder(GateDag &dag,
+           Word &s,
+           Wire &carry,
+           const Word &a,
+           const Word &b,
+           const int nb_bits) {
+  if (ADDER_TYPE == AdderType::RIPPLE) {
+    ripple_carry_adder(dag, s, carry, a, b, nb_bits);
+    return;
+  }
+  const int and_before = dag.requested(GateType::AND);
+  const int xor_before = dag.requested(GateType::XOR);
+  prefix_adder(dag, s, carry, a, b, nb_bits, ADDER_TYPE);
+  and_gates += dag.requested(GateType::AND) - and_before;
+  xor_gates += dag.requested(GateType::XOR) - xor_before;
 }
 
-// this function compares two multibit words, and puts (a<=b) into result
-void less(LweSample *result,
-          const LweSample *a,
-          const LweSample *b,
-          const int nb_bits,
-          const TFheGateBootstrappingCloudKeySet *bk) {
+// this function compares two multibit words, and returns (a<b)
+// It folds best with a constant b: c < x is computed as !(x < c + 1)
+Wire less(GateDag &dag,
+          const Word &a,
+          const Word &b,
+          const int nb_bits) {
 #ifdef DEBUG
-  std::cout << "comparing " << decrypt_array(a, nb_bits, SECRET_KEY) << " < "
-            << decrypt_array(b, nb_bits, SECRET_KEY)
+  std::cout << "comparing " << decrypt_word(dag, a, nb_bits) << " < "
+            << decrypt_word(dag, b, nb_bits)
             << std::endl;
 #endif
 
   // Circuit as described in Cingulata's lower.cxx (LowerCompSize::oper)
-  LweSample *n1 = new_gate_bootstrapping_ciphertext(bk->params);
-  LweSample *n2 = new_gate_bootstrapping_ciphertext(bk->params);
-  LweSample *n1_AND_n2 = new_gate_bootstrapping_ciphertext(bk->params);
-  bootsCONSTANT(result, 0, bk);
+  Wire result = dag.constant(0);
   for (int i = 0; i < nb_bits; ++i) {
-    bootsXOR(n1, result, &a[i], bk);
-    bootsXOR(n2, result, &b[i], bk);
-    bootsAND(n1_AND_n2, n1, n2, bk);
-    bootsXOR(result, n1_AND_n2, &b[i], bk);
+    Wire n1 = dag.XOR(result, a[i]);
+    Wire n2 = dag.XOR(result, b[i]);
+    Wire n1_AND_n2 = dag.AND(n1, n2);
+    result = dag.XOR(n1_AND_n2, b[i]);
   }
 
-  delete_gate_bootstrapping_ciphertext(n1);
-  delete_gate_bootstrapping_ciphertext(n2);
-  delete_gate_bootstrapping_ciphertext(n1_AND_n2);
-
 #ifdef DEBUG
-  std::cout << "result: " << bootsSymDecrypt(result, SECRET_KEY) << std::endl;
+  std::cout << "result: " << decrypt_word(dag, {result}, 1) << std::endl;
 #endif
-
+  return result;
 }
 
-void cloud() {
-  auto t4 = Time::now();
-
-  //reads the cloud key from file
-  FILE *cloud_key = fopen("cloud.key", "rb");
-  TFheGateBootstrappingCloudKeySet *bk = new_tfheGateBootstrappingCloudKeySet_fromFile(cloud_key);
-  fclose(cloud_key);
-
-  //if necessary, the params are inside the key
-  const TFheGateBootstrappingParameterSet *params = bk->params;
-
+/// Records the circuit of one record
+/// \param dag  [in,out]   circuit the gates are recorded in
+/// \param ks      [in]    encrypted keystream of the record (NB_FIELDS arrays of NB_VALUES bits)
+/// \param masked  [in]    values of the record masked with the keystream (<value> ^ KS[i])
+/// \return the number of risk factors (bits 0 to NB_VALUES - 1)
+Word cardio_circuit(GateDag &dag, const std::vector<LweArena::Array> &ks, const std::vector<int> &masked) {
   // age, hdl, height, weight, physical_act and drinking are actually
-  // not encrypted under FHE, but instead under the KS
-  /// This is provided here only for simplicity, in a real deployment the server
-  /// would of course only see (<value> ^ KS[i])
-  std::vector<int> KS = {241, 210, 225, 219, 92, 43, 197};
-  LweSample *flags = new_gate_bootstrapping_ciphertext_array(NB_FLAGS, params);
-  LweSample *age = new_gate_bootstrapping_ciphertext_array(NB_VALUES, params);
-  LweSample *hdl = new_gate_bootstrapping_ciphertext_array(NB_VALUES, params);
-  LweSample *height = new_gate_bootstrapping_ciphertext_array(NB_VALUES, params);
-  LweSample *weight = new_gate_bootstrapping_ciphertext_array(NB_VALUES, params);
-  LweSample *physical_cat = new_gate_bootstrapping_ciphertext_array(NB_VALUES, params);
-  LweSample *drinking = new_gate_bootstrapping_ciphertext_array(NB_VALUES, params);
-  for (int i = 0; i < NB_FLAGS; i++) {
-    bootsCONSTANT(&flags[i], ((15 ^ KS[0]) >> i) & 1, bk);
-  }
-  for (int i = 0; i < NB_VALUES; i++) {
-    bootsCONSTANT(&age[i], ((55 ^ KS[1]) >> i) & 1, bk);
-    bootsCONSTANT(&hdl[i], ((50 ^ KS[2]) >> i) & 1, bk);
-    bootsCONSTANT(&height[i], ((80 ^ KS[3]) >> i) & 1, bk);
-    bootsCONSTANT(&weight[i], ((80 ^ KS[4]) >> i) & 1, bk);
-    bootsCONSTANT(&physical_cat[i], ((45 ^ KS[5]) >> i) & 1, bk);
-    bootsCONSTANT(&drinking[i], ((4 ^ KS[6]) >> i) & 1, bk);
-  }
-
-  LweSample *ks[7];
-  for (auto &k : ks) {
-    k = new_gate_bootstrapping_ciphertext_array(NB_VALUES, params);
-  }
-
-  //reads the encrypted KS from the cloud file
-  FILE *cloud_data = fopen("cloud.data", "rb");
-  for (auto &k : ks) {
-    for (int i = 0; i < NB_VALUES; ++i) {
-      import_gate_bootstrapping_ciphertext_fromFile(cloud_data, &k[i], params);
-    }
-  }
-  fclose(cloud_data);
+  // not encrypted under FHE, but instead under the KS, the server only
+  // sees (<value> ^ KS[i])
+  Word flags = dag.constant(masked[0], NB_FLAGS);
+  Word age = dag.constant(masked[1], NB_VALUES);
+  Word hdl = dag.constant(masked[2], NB_VALUES);
+  Word height = dag.constant(masked[3], NB_VALUES);
+  Word weight = dag.constant(masked[4], NB_VALUES);
+  Word physical_cat = dag.constant(masked[5], NB_VALUES);
+  Word drinking = dag.constant(masked[6], NB_VALUES);
 
   // Apply the Keystream
   for (int i = 0; i < NB_FLAGS; ++i) {
-    bootsXOR(&flags[i], &flags[i], &ks[0][i], bk);
+    flags[i] = dag.XOR(flags[i], dag.input(&ks[0][i]));
     ++xor_gates;
   }
   for (int i = 0; i < NB_VALUES; ++i) {
-    bootsXOR(&age[i], &age[i], &ks[1][i], bk);
-    bootsXOR(&hdl[i], &hdl[i], &ks[2][i], bk);
-    bootsXOR(&height[i], &height[i], &ks[3][i], bk);
-    bootsXOR(&weight[i], &weight[i], &ks[4][i], bk);
-    bootsXOR(&physical_cat[i], &physical_cat[i], &ks[5][i], bk);
-    bootsXOR(&drinking[i], &drinking[i], &ks[6][i], bk);
+    age[i] = dag.XOR(age[i], dag.input(&ks[1][i]));
+    hdl[i] = dag.XOR(hdl[i], dag.input(&ks[2][i]));
+    height[i] = dag.XOR(height[i], dag.input(&ks[3][i]));
+    weight[i] = dag.XOR(weight[i], dag.input(&ks[4][i]));
+    physical_cat[i] = dag.XOR(physical_cat[i], dag.input(&ks[5][i]));
+    drinking[i] = dag.XOR(drinking[i], dag.input(&ks[6][i]));
     xor_gates += 6;
   }
 
 #ifdef DEBUG
-  std::cout << "flags: " << decrypt_array(flags, NB_FLAGS, SECRET_KEY) << std::endl;
-  std::cout << "age: " << decrypt_array(age, NB_VALUES, SECRET_KEY) << std::endl;
-  std::cout << "hdl: " << decrypt_array(hdl, NB_VALUES, SECRET_KEY) << std::endl;
-  std::cout << "height: " << decrypt_array(height, NB_VALUES, SECRET_KEY) << std::endl;
-  std::cout << "weight: " << decrypt_array(weight, NB_VALUES, SECRET_KEY) << std::endl;
-  std::cout << "physical_cat: " << decrypt_array(physical_cat, NB_VALUES, SECRET_KEY) << std::endl;
-  std::cout << "drinking: " << decrypt_array(drinking, NB_VALUES, SECRET_KEY) << std::endl;
+  std::cout << "flags: " << decrypt_word(dag, flags, NB_FLAGS) << std::endl;
+  std::cout << "age: " << decrypt_word(dag, age, NB_VALUES) << std::endl;
+  std::cout << "hdl: " << decrypt_word(dag, hdl, NB_VALUES) << std::endl;
+  std::cout << "height: " << decrypt_word(dag, height, NB_VALUES) << std::endl;
+  std::cout << "weight: " << decrypt_word(dag, weight, NB_VALUES) << std::endl;
+  std::cout << "physical_cat: " << decrypt_word(dag, physical_cat, NB_VALUES) << std::endl;
+  std::cout << "drinking: " << decrypt_word(dag, drinking, NB_VALUES) << std::endl;
 #endif
 
   // Compute first complex condition: flags(sex_field) && (50 < age) [should be true]
-  LweSample *fifty = encode_n(50, bk);
-  LweSample *age_gt_50 = new_gate_bootstrapping_ciphertext(params);
-  less(age_gt_50, fifty, age, NB_VALUES, bk);
-  LweSample *factor_1 = encode_n(0, bk);
-  bootsAND(&factor_1[0], &flags[SEX_FIELD], age_gt_50, bk);
+  // 50 < age <=> !(age < 51)
+  Wire age_gt_50 = dag.NOT(less(dag, age, dag.constant(51, NB_VALUES), NB_VALUES));
+  Word factor_1 = dag.constant(0, NB_VALUES);
+  factor_1[0] = dag.AND(flags[SEX_FIELD], age_gt_50);
   ++and_gates;
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, fifty);
-  delete_gate_bootstrapping_ciphertext(age_gt_50);
 #ifdef DEBUG
-  std::cout << "factor_1: " << decrypt_array(factor_1, NB_VALUES, SECRET_KEY) << std::endl;
+  std::cout << "factor_1: " << decrypt_word(dag, factor_1, NB_VALUES) << std::endl;
 #endif
 
 
   // Compute second complex condition: !flags(sex_field) && (60 < age) [should be false]
-  LweSample *sixty = encode_n(60, bk);
-  LweSample *age_gt_60 = new_gate_bootstrapping_ciphertext(params);
-  less(age_gt_60, sixty, age, NB_VALUES, bk);
-  LweSample *not_sex_field = new_gate_bootstrapping_ciphertext(params);
-  bootsNOT(not_sex_field, &flags[SEX_FIELD], bk);
-  LweSample *factor_2 = encode_n(0, bk);
-  bootsAND(&factor_2[0], not_sex_field, age_gt_60, bk);
+  // 60 < age <=> !(age < 61)
+  Wire age_gt_60 = dag.NOT(less(dag, age, dag.constant(61, NB_VALUES), NB_VALUES));
+  Wire not_sex_field = dag.NOT(flags[SEX_FIELD]);
+  Word factor_2 = dag.constant(0, NB_VALUES);
+  factor_2[0] = dag.AND(not_sex_field, age_gt_60);
   ++and_gates;
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, sixty);
-  delete_gate_bootstrapping_ciphertext(age_gt_60);
-  // not sex field is used again later, so not deleted here
 #ifdef DEBUG
-  std::cout << "factor_2: " << decrypt_array(factor_2, NB_VALUES, SECRET_KEY) << std::endl;
+  std::cout << "factor_2: " << decrypt_word(dag, factor_2, NB_VALUES) << std::endl;
 #endif
 
   // factors 3,4,5,6 are just flags [3-5 should be true, 6 false]
-  LweSample *factor_3 = encode_n(0, bk);
-  bootsCOPY(&factor_3[0], &flags[ANTECEDENT_FIELD], bk);
-  LweSample *factor_4 = encode_n(0, bk);
-  bootsCOPY(&factor_4[0], &flags[SMOKER_FIELD], bk);
-  LweSample *factor_5 = encode_n(0, bk);
-  bootsCOPY(&factor_5[0], &flags[DIABETES_FIELD], bk);
-  LweSample *factor_6 = encode_n(0, bk);
-  bootsCOPY(&factor_6[0], &flags[PRESSURE_FIELD], bk);
+  Word factor_3 = dag.constant(0, NB_VALUES);
+  factor_3[0] = dag.COPY(flags[ANTECEDENT_FIELD]);
+  Word factor_4 = dag.constant(0, NB_VALUES);
+  factor_4[0] = dag.COPY(flags[SMOKER_FIELD]);
+  Word factor_5 = dag.constant(0, NB_VALUES);
+  factor_5[0] = dag.COPY(flags[DIABETES_FIELD]);
+  Word factor_6 = dag.constant(0, NB_VALUES);
+  factor_6[0] = dag.COPY(flags[PRESSURE_FIELD]);
 #ifdef DEBUG
-  std::cout << "factor_3: " << decrypt_array(factor_3, NB_VALUES, SECRET_KEY) << std::endl;
-  std::cout << "factor_4: " << decrypt_array(factor_4, NB_VALUES, SECRET_KEY) << std::endl;
-  std::cout << "factor_5: " << decrypt_array(factor_5, NB_VALUES, SECRET_KEY) << std::endl;
-  std::cout << "factor_6: " << decrypt_array(factor_6, NB_VALUES, SECRET_KEY) << std::endl;
+  std::cout << "factor_3: " << decrypt_word(dag, factor_3, NB_VALUES) << std::endl;
+  std::cout << "factor_4: " << decrypt_word(dag, factor_4, NB_VALUES) << std::endl;
+  std::cout << "factor_5: " << decrypt_word(dag, factor_5, NB_VALUES) << std::endl;
+  std::cout << "factor_6: " << decrypt_word(dag, factor_6, NB_VALUES) << std::endl;
 #endif
 
   // compute 7th factor: hdl < 40 [Should be false]
-  LweSample *forty = encode_n(40, bk);
-  LweSample *factor_7 = encode_n(0, bk);
-  less(&factor_7[0], hdl, forty, NB_VALUES, bk);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, forty);
+  Word factor_7 = dag.constant(0, NB_VALUES);
+  factor_7[0] = less(dag, hdl, dag.constant(40, NB_VALUES), NB_VALUES);
 #ifdef DEBUG
-  std::cout << "factor_7: " << decrypt_array(factor_7, NB_VALUES, SECRET_KEY) << std::endl;
+  std::cout << "factor_7: " << decrypt_word(dag, factor_7, NB_VALUES) << std::endl;
 #endif
 
   // compute 8-th factor: weight - 10 > height <=> height + 10 < weight [should be false]
-  LweSample *ten = encode_n(10, bk);
-  LweSample *height_plus_10 = new_gate_bootstrapping_ciphertext_array(NB_VALUES, params);
-  LweSample *carry = new_gate_bootstrapping_ciphertext(params);
-  bootsCONSTANT(carry, 0, bk);
-  ripple_carry_adder(height_plus_10, carry, height, ten, NB_VALUES, bk);
-  LweSample *factor_8 = encode_n(0, bk);
-  less(&factor_8[0], height_plus_10, weight, NB_VALUES, bk);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, ten);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, height_plus_10);
-  delete_gate_bootstrapping_ciphertext(carry);
+  Word height_plus_10(NB_VALUES);
+  Wire carry = dag.constant(0);
+  adder(dag, height_plus_10, carry, height, dag.constant(10, NB_VALUES), NB_VALUES);
+  Word factor_8 = dag.constant(0, NB_VALUES);
+  factor_8[0] = less(dag, height_plus_10, weight, NB_VALUES);
 #ifdef DEBUG
-  std::cout << "factor_8: " << decrypt_array(factor_8, NB_VALUES, SECRET_KEY) << std::endl;
+  std::cout << "factor_8: " << decrypt_word(dag, factor_8, NB_VALUES) << std::endl;
 #endif
 
   // Compute 9th factor: physical_act < 30 [should be false]
-  LweSample *thirty = encode_n(30, bk);
-  LweSample *factor_9 = encode_n(0, bk);
-  less(&factor_9[0], physical_cat, thirty, NB_VALUES, bk);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, thirty);
+  Word factor_9 = dag.constant(0, NB_VALUES);
+  factor_9[0] = less(dag, physical_cat, dag.constant(30, NB_VALUES), NB_VALUES);
 #ifdef DEBUG
-  std::cout << "factor_9: " << decrypt_array(factor_9, NB_VALUES, SECRET_KEY) << std::endl;
+  std::cout << "factor_9: " << decrypt_word(dag, factor_9, NB_VALUES) << std::endl;
 #endif
 
   // Compute 10th factor: sex && (drinking > 3) [should be true]
-  LweSample *three = encode_n(3, bk);
-  LweSample *drinking_gt_3 = new_gate_bootstrapping_ciphertext(params);
-  less(drinking_gt_3, three, drinking, NB_VALUES, bk);
-  LweSample *factor_10 = encode_n(0, bk);
-  bootsAND(&factor_10[0], &flags[SEX_FIELD], drinking_gt_3, bk);
+  // 3 < drinking <=> !(drinking < 4)
+  Wire drinking_gt_3 = dag.NOT(less(dag, drinking, dag.constant(4, NB_VALUES), NB_VALUES));
+  Word factor_10 = dag.constant(0, NB_VALUES);
+  factor_10[0] = dag.AND(flags[SEX_FIELD], drinking_gt_3);
   ++and_gates;
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, three);
-  delete_gate_bootstrapping_ciphertext(drinking_gt_3);
 #ifdef DEBUG
-  std::cout << "factor_10: " << decrypt_array(factor_10, NB_VALUES, SECRET_KEY) << std::endl;
+  std::cout << "factor_10: " << decrypt_word(dag, factor_10, NB_VALUES) << std::endl;
 #endif
 
   // Compute 11th factor: !sex && (drinking > 2) [should be false]
-  LweSample *two = encode_n(2, bk);
-  LweSample *drinking_gt_2 = new_gate_bootstrapping_ciphertext(params);
-  less(drinking_gt_2, two, drinking, NB_VALUES, bk);
-  LweSample *factor_11 = encode_n(0, bk);
-  bootsAND(&factor_11[0], not_sex_field, drinking_gt_2, bk);
+  // 2 < drinking <=> !(drinking < 3)
+  Wire drinking_gt_2 = dag.NOT(less(dag, drinking, dag.constant(3, NB_VALUES), NB_VALUES));
+  Word factor_11 = dag.constant(0, NB_VALUES);
+  factor_11[0] = dag.AND(not_sex_field, drinking_gt_2);
   ++and_gates;
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, two);
-  delete_gate_bootstrapping_ciphertext(drinking_gt_2);
-  delete_gate_bootstrapping_ciphertext(not_sex_field);
-  //not_sex_field no longer needed
 #ifdef DEBUG
-  std::cout << "factor_11: " << decrypt_array(factor_11, NB_VALUES, SECRET_KEY) << std::endl;
+  std::cout << "factor_11: " << decrypt_word(dag, factor_11, NB_VALUES) << std::endl;
 #endif
 
   // Start adding up all the factors:
-  carry = new_gate_bootstrapping_ciphertext(params);
-
-  bootsCONSTANT(carry, 0, bk);
-  ripple_carry_adder(factor_1, carry, factor_1, factor_2, 2, bk);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, factor_2);
+  carry = dag.constant(0);
+  adder(dag, factor_1, carry, factor_1, factor_2, 2);
 
-  bootsCONSTANT(carry, 0, bk);
-  ripple_carry_adder(factor_3, carry, factor_3, factor_4, 2, bk);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, factor_4);
+  carry = dag.constant(0);
+  adder(dag, factor_3, carry, factor_3, factor_4, 2);
 
-  bootsCONSTANT(carry, 0, bk);
-  ripple_carry_adder(factor_5, carry, factor_5, factor_6, 2, bk);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, factor_6);
+  carry = dag.constant(0);
+  adder(dag, factor_5, carry, factor_5, factor_6, 2);
 
-  bootsCONSTANT(carry, 0, bk);
-  ripple_carry_adder(factor_7, carry, factor_7, factor_8, 2, bk);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, factor_8);
+  carry = dag.constant(0);
+  adder(dag, factor_7, carry, factor_7, factor_8, 2);
 
-  bootsCONSTANT(carry, 0, bk);
-  ripple_carry_adder(factor_9, carry, factor_9, factor_10, 2, bk);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, factor_10);
+  carry = dag.constant(0);
+  adder(dag, factor_9, carry, factor_9, factor_10, 2);
 
   // 1-4
   // Adding 4 bits will never result in a number larger than 2 bits
-  bootsCONSTANT(carry, 0, bk);
-  ripple_carry_adder(factor_1, carry, factor_1, factor_3, 2, bk);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, factor_3);
+  carry = dag.constant(0);
+  adder(dag, factor_1, carry, factor_1, factor_3, 2);
 
   // 5-8
-  // Adding 4 bits will never result in a number larger than 2 bits
-  bootsCONSTANT(carry, 0, bk);
-  ripple_carry_adder(factor_5, carry, factor_5, factor_7, 2, bk);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, factor_7);
+  // Adding 4 bits can result in 4, which needs 3 bits
+  carry = dag.constant(0);
+  adder(dag, factor_5, carry, factor_5, factor_7, 3);
 
   //9-11
   // Adding 3 bits will never result in a number larger than 2 bits
-  bootsCONSTANT(carry, 0, bk);
-  ripple_carry_adder(factor_9, carry, factor_9, factor_11, 2, bk);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, factor_11);
+  carry = dag.constant(0);
+  adder(dag, factor_9, carry, factor_9, factor_11, 2);
 
   // 1-8
-  // Adding 8 bits will never result in a number larger than 3 bits
-  bootsCONSTANT(carry, 0, bk);
-  ripple_carry_adder(factor_1, carry, factor_1, factor_5, 3, bk);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, factor_5);
+  // factors 1 and 2 exclude each other, so this is at most 7 and fits in 3 bits
+  carry = dag.constant(0);
+  adder(dag, factor_1, carry, factor_1, factor_5, 3);
 
   // 1-11
   // Adding 11 bits will never result in a number larger than 3 bits
-  bootsCONSTANT(carry, 0, bk);
-  ripple_carry_adder(factor_1, carry, factor_1, factor_9, 4, bk);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, factor_9);
+  carry = dag.constant(0);
+  adder(dag, factor_1, carry, factor_1, factor_9, 4);
 
+  return factor_1;
+}
 
-  //export the resulting ciphertext to a file (for the cloud)
-  FILE *answer_data = fopen("answer.data", "wb");
-  for (int i = 0; i < NB_VALUES; i++) {
-    export_gate_bootstrapping_ciphertext_toFile(answer_data, &factor_1[i], params);
-  }
-  fclose(answer_data);
+void cloud() {
+  auto t4 = Time::now();
 
-  //clean up all pointers
-  delete_gate_bootstrapping_ciphertext_array(NB_FLAGS, flags);
-  for (auto &v : {age, hdl, height, weight, physical_cat, drinking}) {
-    delete_gate_bootstrapping_ciphertext_array(NB_VALUES, v);
+  //reads the cloud key from file
+  FILE *cloud_key = fopen("cloud.key", "rb");
+  TFheGateBootstrappingCloudKeySet *bk = new_tfheGateBootstrappingCloudKeySet_fromFile(cloud_key);
+  fclose(cloud_key);
+
+  //if necessary, the params are inside the key
+  const TFheGateBootstrappingParameterSet *params = bk->params;
+
+  {
+    // The gates are only recorded here and evaluated by run(), independent
+    // gates (e.g. of different factors) in parallel. All ciphertexts of the
+    // evaluation live in the arena of the DAG and are released together with it,
+    // the DAG is scoped so that this happens before the cloud key is deleted.
+    GateDag dag(bk, gate_dag_folding());
+
+    //reads the encrypted KS of the records from the cloud file, the circuits of
+    //records_per_run() records are recorded in the same DAG so their gates are
+    //evaluated in parallel as well, then the DAG is cleared for the next ones
+    const int nb_records = num_records();
+    FILE *cloud_data = fopen("cloud.data", "rb");
+    FILE *answer_data = fopen("answer.data", "wb");
+    for (int first = 0; first < nb_records; first += records_per_run()) {
+      const int last = std::min(nb_records, first + records_per_run());
+      {
+        // the ciphertexts have to stay until the DAG is evaluated
+        std::vector<std::vector<LweArena::Array>> ks;
+        std::vector<Word> results;
+        for (int record = first; record < last; ++record) {
+          uint8_t masked[NB_FIELDS];
+          if (fread(masked, 1, NB_FIELDS, cloud_data) != NB_FIELDS) {
+            std::cerr << "cloud.data ends before record " << record << std::endl;
+            exit(EXIT_FAILURE);
+          }
+          ks.emplace_back();
+          for (int k = 0; k < NB_FIELDS; ++k) {
+            ks.back().push_back(dag.arena().array(NB_VALUES));
+            for (int i = 0; i < NB_VALUES; ++i) {
+              import_gate_bootstrapping_ciphertext_fromFile(cloud_data, &ks.back()[k][i], params);
+            }
+          }
+          results.push_back(cardio_circuit(dag, ks.back(), std::vector<int>(masked, masked + NB_FIELDS)));
+        }
+
+        // evaluate the recorded circuits
+        dag.run(NUM_THREADS);
+
+        //export the resulting ciphertexts to a file (for the cloud)
+        for (auto &result : results) {
+          for (int i = 0; i < NB_VALUES; i++) {
+            export_gate_bootstrapping_ciphertext_toFile(answer_data, dag.sample(result[i]), params);
+          }
+        }
+      }
+      folded_gates += dag.folded_gates();
+      // all samples (including the ones of the keystream) are reused for the next records
+      dag.clear();
+    }
+    fclose(cloud_data);
+    fclose(answer_data);
   }
+
+  //clean up all pointers (the ciphertexts were released with the DAG)
   delete_gate_bootstrapping_cloud_keyset(bk);
-  delete_gate_bootstrapping_ciphertext_array(NB_VALUES, factor_1);
 
   auto t5 = Time::now();
   log_time(ss_time, t4, t5, false);
 }
 
-void verify() {
+/// \return the number of records whose result differs from cardio_plain
+int verify() {
 
   auto t6 = Time::now();
 
@@ -494,16 +564,30 @@ void verify() {
   //create the ciphertext for the result
   LweSample *answer = new_gate_bootstrapping_ciphertext_array(NB_VALUES, params);
 
-  //import the  ciphertexts from the answer file
+  //import the  ciphertexts of every record from the answer file
+  const int nb_records = num_records();
+  int wrong_records = 0;
   FILE *answer_data = fopen("answer.data", "rb");
-  for (int i = 0; i < NB_VALUES; i++)
-    import_gate_bootstrapping_ciphertext_fromFile(answer_data, &answer[i], params);
-  fclose(answer_data);
+  for (int record = 0; record < nb_records; ++record) {
+    for (int i = 0; i < NB_VALUES; i++)
+      import_gate_bootstrapping_ciphertext_fromFile(answer_data, &answer[i], params);
 
-  //decrypt and rebuild the plaintext answer
-  uint8_t int_answer = decrypt_array(answer, NB_VALUES, key);
+    //decrypt and rebuild the plaintext answer
+    uint8_t int_answer = decrypt_array(answer, NB_VALUES, key);
+
+    if (nb_records == 1) printf("And the result is: %d\n", int_answer);
+    else printf("And the result of record %d is: %d\n", record, int_answer);
+
+    //compare with the plaintext computation
+    const int expected = cardio_plain(patient(record));
+    if (int_answer != expected) {
+      printf("Wrong result, expected: %d\n", expected);
+      ++wrong_records;
+    }
+  }
+  fclose(answer_data);
+  if (wrong_records > 0) printf("%d of %d records are wrong!\n", wrong_records, nb_records);
 
-  printf("And the result is: %d\n", int_answer);
   printf("I hope you remember what was the question!\n");
 
   //clean up all pointers
@@ -512,4 +596,5 @@ void verify() {
 
   auto t7 = Time::now();
   log_time(ss_time, t6, t7, true);
+  return wrong_records;
 }
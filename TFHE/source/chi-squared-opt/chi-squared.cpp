@@ -1,13 +1,22 @@
 #include <tfhe/tfhe.h>
 #include <tfhe/tfhe_io.h>
 #include <stdio.h>
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <random>
+#include <vector>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 #include <assert.h>
 #include <functional>
 #include <queue>
+#include <tuple>
+
+#include "../adders.h"
+#include "../gate_dag.h"
+#include "../lwe_arena.h"
 
 typedef std::chrono::milliseconds ms;
 typedef std::chrono::high_resolution_clock Time;
@@ -25,21 +34,30 @@ void log_time(std::stringstream &ss,
 // Counters for gates
 int and_gates = 0;
 int xor_gates = 0;
+// Bootstrapped gates that were skipped because of constant inputs
+int folded_gates = 0;
+
+// Adder used for all additions, selected by TFHE_ADDER
+const AdderType ADDER_TYPE = adder_type();
+
+// Threads the gates are evaluated on, selected by TFHE_THREADS (checked before anything is computed)
+const int NUM_THREADS = gate_dag_threads();
 
 std::stringstream ss_time;
 
 void client();
 void cloud();
-void verify();
+int verify();
 
 int main() {
   client();
   cloud();
-  verify();
+  const int wrong_records = verify();
 
   // Report total gate numbers
   std::cout << "and: " << and_gates << std::endl;
   std::cout << "xor: " << xor_gates << std::endl;
+  std::cout << "folded: " << folded_gates << std::endl;
 
   // Print out times:
   std::cout << ss_time.str() << std::endl;
@@ -51,12 +69,48 @@ int main() {
   myfile.open(out_filename, std::ios_base::app);
   myfile << ss_time.str() << std::endl;
   myfile.close();
-  return 0;
+  return wrong_records == 0 ? 0 : 1;
 }
 
 /// Number of bits in numerical parameters
 const int BIT_SIZE = 8;
 
+/// Number of records (SNPs) evaluated in one run, from the environment variable NUM_RECORDS (default: 1)
+int num_records() {
+  const char *records = std::getenv("NUM_RECORDS");
+  return records ? std::max(1, std::atoi(records)) : 1;
+}
+
+/// Number of records recorded in the DAG and evaluated together, enough to keep all threads busy while the memory
+/// of the DAG stays bounded
+int records_per_run() { return 4 * NUM_THREADS; }
+
+/// Genotype counts n0, n1 and n2 of a record, the first record uses the original counts.
+/// The others are random, but small enough for the circuit: 2n0 + n1 and 2n2 + n1 are added in BIT_SIZE bits and
+/// 4n0n2 + n1^2 in 2*BIT_SIZE bits.
+std::vector<uint32_t> genotype_counts(int record) {
+  std::vector<uint32_t> counts = {10, 20, 30};
+  if (record > 0) {
+    const uint32_t max_term = (1u << BIT_SIZE) - 1;
+    std::mt19937 rng(record);
+    // n1 < 2^(BIT_SIZE - 1), 2n0 + n1 <= max_term and 2n2 + n1 <= max_term, so 4n0n2 + n1^2 <= max_term^2
+    counts[1] = rng() % (1u << (BIT_SIZE - 1));
+    counts[0] = rng() % ((max_term - counts[1]) / 2 + 1);
+    counts[2] = rng() % ((max_term - counts[1]) / 2 + 1);
+  }
+  return counts;
+}
+
+/// alpha, beta1, beta2 and beta3 of a record in plaintext, modulo 2^BIT_SIZE like the exported results
+std::vector<uint32_t> chi_squared_plain(const std::vector<uint32_t> &counts) {
+  const uint32_t n0 = counts[0], n1 = counts[1], n2 = counts[2];
+  const uint32_t sqrt_alpha = 4*n0*n2 + n1*n1;
+  const uint32_t term1 = 2*n0 + n1;
+  const uint32_t term2 = 2*n2 + n1;
+  const uint32_t mask = (1u << BIT_SIZE) - 1;
+  return {(sqrt_alpha*sqrt_alpha) & mask, (2*term1*term1) & mask, (term1*term2) & mask, (2*term2*term2) & mask};
+}
+
 //#define DEBUG
 
 //#define DEBUG_WALLACE
@@ -75,6 +129,18 @@ int decrypt_array(const LweSample *array, int nb_size, const TFheGateBootstrappi
   return int_answer;
 }
 
+#ifdef DEBUG
+/// Evaluates the gates recorded so far and decrypts the first nb_size bits of word
+int decrypt_word(GateDag &dag, const Word &word, int nb_size) {
+  dag.run();
+  uint32_t int_answer = 0;
+  for (int i = 0; i < nb_size; i++) {
+    int_answer |= (bootsSymDecrypt(dag.sample(word[i]), SECRET_KEY) << i);
+  }
+  return int_answer;
+}
+#endif
+
 void client() {
   auto t0 = Time::now();
   //generate a keyset
@@ -104,29 +170,33 @@ void client() {
   LweSample *n0 = new_gate_bootstrapping_ciphertext_array(BIT_SIZE, params);
   LweSample *n1 = new_gate_bootstrapping_ciphertext_array(BIT_SIZE, params);
   LweSample *n2 = new_gate_bootstrapping_ciphertext_array(BIT_SIZE, params);
-  uint8_t n0_ptxt = 10;
-  uint8_t n1_ptxt = 20;
-  uint8_t n2_ptxt = 30;
-  for (int i = 0; i < BIT_SIZE; i++) {
-    bootsSymEncrypt(&n0[i], (n0_ptxt >> i) & 1, key);
-    bootsSymEncrypt(&n1[i], (n1_ptxt >> i) & 1, key);
-    bootsSymEncrypt(&n2[i], (n2_ptxt >> i) & 1, key);
-
-  }
 
   printf("Hi there! Today we will calculate a chi-squared-naive test !\n");
 
-  //export the ciphertexts to a file (for the cloud)
+  //export the ciphertexts of every record to a file (for the cloud)
   FILE *cloud_data = fopen("cloud.data", "wb");
 
-  for (int i = 0; i < BIT_SIZE; i++)
-    export_gate_bootstrapping_ciphertext_toFile(cloud_data, &n0[i], params);
+  for (int record = 0; record < num_records(); ++record) {
+    std::vector<uint32_t> counts = genotype_counts(record);
+    uint32_t n0_ptxt = counts[0];
+    uint32_t n1_ptxt = counts[1];
+    uint32_t n2_ptxt = counts[2];
+    for (int i = 0; i < BIT_SIZE; i++) {
+      bootsSymEncrypt(&n0[i], (n0_ptxt >> i) & 1, key);
+      bootsSymEncrypt(&n1[i], (n1_ptxt >> i) & 1, key);
+      bootsSymEncrypt(&n2[i], (n2_ptxt >> i) & 1, key);
 
-  for (int i = 0; i < BIT_SIZE; i++)
-    export_gate_bootstrapping_ciphertext_toFile(cloud_data, &n1[i], params);
+    }
 
-  for (int i = 0; i < BIT_SIZE; i++)
-    export_gate_bootstrapping_ciphertext_toFile(cloud_data, &n2[i], params);
+    for (int i = 0; i < BIT_SIZE; i++)
+      export_gate_bootstrapping_ciphertext_toFile(cloud_data, &n0[i], params);
+
+    for (int i = 0; i < BIT_SIZE; i++)
+      export_gate_bootstrapping_ciphertext_toFile(cloud_data, &n1[i], params);
+
+    for (int i = 0; i < BIT_SIZE; i++)
+      export_gate_bootstrapping_ciphertext_toFile(cloud_data, &n2[i], params);
+  }
 
   fclose(cloud_data);
 
@@ -148,72 +218,80 @@ void client() {
 }
 
 /// Simple ripple carry adder
-/// \param s        [out]      result
+/// \param dag      [in,out]   circuit the gates are recorded in
+/// \param s        [out]      result (bits 0 to nb_bits - 1 are set)
 /// \param carry    [in,out]
-/// \param a        [in]       lhs (must be array of size nb_bits)
-/// \param b        [in]       rhs (must be array of size nb_bits)
+/// \param a        [in]       lhs (must have at least nb_bits bits)
+/// \param b        [in]       rhs (must have at least nb_bits bits)
 /// \param nb_bits  [in]       size of lhs and rhs
-/// \param bk       [in]
-void ripple_carry_adder(LweSample *s,
-                        LweSample *carry,
-                        const LweSample *a,
-                        const LweSample *b,
-                        const int nb_bits,
-                        const TFheGateBootstrappingCloudKeySet *bk) {
+void ripple_carry_adder(GateDag &dag,
+                        Word &s,
+                        Wire &carry,
+                        const Word &a,
+                        const Word &b,
+                        const int nb_bits) {
 #ifdef DEBUG
-  std::cout << "adding " << decrypt_array(a, nb_bits, SECRET_KEY) << " + " << decrypt_array(b, nb_bits, SECRET_KEY)
-            << " with carry in " << bootsSymDecrypt(carry, SECRET_KEY) << std::endl;
+  std::cout << "adding " << decrypt_word(dag, a, nb_bits) << " + " << decrypt_word(dag, b, nb_bits)
+            << " with carry in " << decrypt_word(dag, {carry}, 1) << std::endl;
 #endif
 
-  // Create temp ctxt's
-  LweSample *n1 = new_gate_bootstrapping_ciphertext(bk->params);
-  LweSample *n2 = new_gate_bootstrapping_ciphertext(bk->params);
-  LweSample *n1_AND_n2 = new_gate_bootstrapping_ciphertext(bk->params);
-
   for (int i = 0; i < nb_bits; i++) {
-    bootsXOR(n1, carry, &a[i], bk);
-    bootsXOR(n2, carry, &b[i], bk);
-    bootsXOR(&s[i], n1, &b[i], bk);
+    Wire n1 = dag.XOR(carry, a[i]);
+    Wire n2 = dag.XOR(carry, b[i]);
+    s[i] = dag.XOR(n1, b[i]);
     xor_gates += 3;
     if (i < nb_bits - 1) {
-      bootsAND(n1_AND_n2, n1, n2, bk);
+      Wire n1_AND_n2 = dag.AND(n1, n2);
       ++and_gates;
-      bootsXOR(carry, n1_AND_n2, carry, bk);
+      carry = dag.XOR(n1_AND_n2, carry);
       ++xor_gates;
     }
   }
 #ifdef DEBUG
-  std::cout << "addition result: " << decrypt_array(s, nb_bits, SECRET_KEY)
-            << " carry out: " << bootsSymDecrypt(carry, SECRET_KEY) << std::endl;
+  std::cout << "addition result: " << decrypt_word(dag, s, nb_bits)
+            << " carry out: " << decrypt_word(dag, {carry}, 1) << std::endl;
 #endif
+}
 
-  // Clean up  temp ctxt's
-  delete_gate_bootstrapping_ciphertext(n1);
-  delete_gate_bootstrapping_ciphertext(n2);
-  delete_gate_bootstrapping_ciphertext(n1_AND_n2);
+/// Adds a and b with the adder selected by TFHE_ADDER, see ripple_carry_adder for the parameters
+void adder(GateDag &dag,
+           Word &s,
+           Wire &carry,
+           const Word &a,
+           const Word &b,
+           const int nb_bits) {
+  if (ADDER_TYPE == AdderType::RIPPLE) {
+    ripple_carry_adder(dag, s, carry, a, b, nb_bits);
+    return;
+  }
+  const int and_before = dag.requested(GateType::AND);
+  const int xor_before = dag.requested(GateType::XOR);
+  prefix_adder(dag, s, carry, a, b, nb_bits, ADDER_TYPE);
+  and_gates += dag.requested(GateType::AND) - and_before;
+  xor_gates += dag.requested(GateType::XOR) - xor_before;
 }
 
 /// Wallace multiplier, implementation based on Cingulata's multiplier.cxx
-/// \param result
+/// \param dag
+/// \param result  bits 0 to 2*nb_bits - 1 are set (only bit 0 if nb_bits is 1)
 /// \param lhs
 /// \param rhs
 /// \param nb_bits
-/// \param bk
-void wallace_multiplier(LweSample *result,
-                        const LweSample *lhs,
-                        const LweSample *rhs,
-                        const int nb_bits, /* input length */
-                        const TFheGateBootstrappingCloudKeySet *bk) {
+void wallace_multiplier(GateDag &dag,
+                        Word &result,
+                        const Word &lhs,
+                        const Word &rhs,
+                        const int nb_bits /* input length */) {
 #ifdef DEBUG
-  std::cout << "multiplying " << decrypt_array(lhs, nb_bits, SECRET_KEY) << " * "
-            << decrypt_array(rhs, nb_bits, SECRET_KEY)
+  std::cout << "multiplying " << decrypt_word(dag, lhs, nb_bits) << " * "
+            << decrypt_word(dag, rhs, nb_bits)
             << std::endl;
 #endif
   if (nb_bits==1) {
-    bootsAND(&result[0], &lhs[0], &rhs[0], bk);
+    result[0] = dag.AND(lhs[0], rhs[0]);
     ++and_gates;
   } else {
-    using T = std::tuple<int, LweSample *>;
+    using T = std::tuple<int, Word>;
     std::priority_queue<T, std::vector<T>, std::function<bool(const T &, const T &)>>
         elems_sorted_by_depth(
         [](const T &a, const T &b) -> bool { return std::get<0>(a) > std::get<0>(b); });
@@ -222,30 +300,27 @@ void wallace_multiplier(LweSample *result,
     for (int i = 0; i < nb_bits; ++i) {
       // take rhs, shift it by i, i.e. save to ..[j+i] and AND each bit with lhs[i]
       // then write into i-th intermediate result
-      LweSample *temp = new_gate_bootstrapping_ciphertext_array(2*nb_bits, bk->params);
-      for (int k = 0; k < 2*nb_bits; ++k) {
-        bootsCONSTANT(&temp[k], 0, bk); //initialize all the other positions
-      }
+      Word temp = dag.constant(0, 2*nb_bits); //initialize all the other positions
       for (int j = 0; j < nb_bits; ++j) {
-        bootsAND(&temp[j + i], &lhs[i], &rhs[j], bk);
+        temp[j + i] = dag.AND(lhs[i], rhs[j]);
 #ifdef  DEBUG_WALLACE
         std::cout << "i: " << i
-                  << ", lhs[i]=" << bootsSymDecrypt(&lhs[i], SECRET_KEY)
-                  << ", rhs[j]=" << bootsSymDecrypt(&rhs[j], SECRET_KEY)
-                  << ", AND=" << bootsSymDecrypt(&temp[j + i], SECRET_KEY)
+                  << ", lhs[i]=" << decrypt_word(dag, {lhs[i]}, 1)
+                  << ", rhs[j]=" << decrypt_word(dag, {rhs[j]}, 1)
+                  << ", AND=" << decrypt_word(dag, {temp[j + i]}, 1)
                   << std::endl;
 #endif
       }
 #ifdef  DEBUG_WALLACE
-      std::cout << "Adding to queue: " << decrypt_array(temp, 2*nb_bits, SECRET_KEY) << std::endl;
+      std::cout << "Adding to queue: " << decrypt_word(dag, temp, 2*nb_bits) << std::endl;
 #endif
-      elems_sorted_by_depth.push(std::forward_as_tuple(1, temp));
+      elems_sorted_by_depth.push(std::make_tuple(1, std::move(temp)));
 
     }
 
     while (elems_sorted_by_depth.size() > 2) {
       int da, db, dc;
-      LweSample *a, *b, *c;
+      Word a, b, c;
 
       std::tie(da, a) = elems_sorted_by_depth.top();
       elems_sorted_by_depth.pop();
@@ -256,21 +331,21 @@ void wallace_multiplier(LweSample *result,
 
 #ifdef  DEBUG_WALLACE
       std::cout << "3-for-2: " << std::endl
-                << "a: " << decrypt_array(a, 2*nb_bits, SECRET_KEY) << std::endl
-                << "b: " << decrypt_array(b, 2*nb_bits, SECRET_KEY) << std::endl
-                << "c: " << decrypt_array(c, 2*nb_bits, SECRET_KEY) << std::endl;
+                << "a: " << decrypt_word(dag, a, 2*nb_bits) << std::endl
+                << "b: " << decrypt_word(dag, b, 2*nb_bits) << std::endl
+                << "c: " << decrypt_word(dag, c, 2*nb_bits) << std::endl;
 #endif
 
       // tmp1 = lhs ^ rhs ^ c;
-      LweSample *tmp1 = new_gate_bootstrapping_ciphertext_array(2*nb_bits, bk->params);
+      Word tmp1(2*nb_bits);
       for (int i = 0; i < 2*nb_bits; ++i) {
-        bootsXOR(&tmp1[i], &a[i], &b[i], bk);
+        tmp1[i] = dag.XOR(a[i], b[i]);
         ++xor_gates;
-        bootsXOR(&tmp1[i], &tmp1[i], &c[i], bk);
+        tmp1[i] = dag.XOR(tmp1[i], c[i]);
         ++xor_gates;
       }
 #ifdef  DEBUG_WALLACE
-      std::cout << "tmp1: " << decrypt_array(tmp1, 2*nb_bits, SECRET_KEY) << std::endl;
+      std::cout << "tmp1: " << decrypt_word(dag, tmp1, 2*nb_bits) << std::endl;
 #endif
       // Shift a, b and c 1 to the right
       // Actually, we instead later shift tmp2!
@@ -280,37 +355,30 @@ void wallace_multiplier(LweSample *result,
       //      c >>= 1;
 
       // tmp2 = ((a ^ c) & (b ^ c)) ^c;
-      LweSample *tmp2 = new_gate_bootstrapping_ciphertext_array(2*nb_bits, bk->params);
-      LweSample *a_XOR_c = new_gate_bootstrapping_ciphertext_array(2*nb_bits, bk->params);
-      LweSample *b_XOR_c = new_gate_bootstrapping_ciphertext_array(2*nb_bits, bk->params);
-      LweSample *a_x_c_AND_b_x_c = new_gate_bootstrapping_ciphertext_array(2*nb_bits, bk->params);
-      bootsCONSTANT(&tmp2[0], 0, bk); //because we do the shift during the bootsXOR
+      Word tmp2(2*nb_bits);
+      tmp2[0] = dag.constant(0); //because we do the shift during the XOR
       for (int i = 0; i < 2*nb_bits; ++i) {
-        bootsXOR(&a_XOR_c[i], &a[i], &c[i], bk);
+        Wire a_XOR_c = dag.XOR(a[i], c[i]);
         ++xor_gates;
-        bootsXOR(&b_XOR_c[i], &b[i], &c[i], bk);
+        Wire b_XOR_c = dag.XOR(b[i], c[i]);
         ++xor_gates;
-        bootsAND(&a_x_c_AND_b_x_c[i], &a_XOR_c[i], &b_XOR_c[i], bk);
+        Wire a_x_c_AND_b_x_c = dag.AND(a_XOR_c, b_XOR_c);
         ++and_gates;
         if (i < 2*nb_bits - 1) {
-          bootsXOR(&tmp2[i + 1], &a_x_c_AND_b_x_c[i], &c[i], bk);
+          tmp2[i + 1] = dag.XOR(a_x_c_AND_b_x_c, c[i]);
         }
       }
 
 #ifdef  DEBUG_WALLACE
-      std::cout << "tmp2: " << decrypt_array(tmp2, 2*nb_bits, SECRET_KEY) << std::endl << std::endl;
+      std::cout << "tmp2: " << decrypt_word(dag, tmp2, 2*nb_bits) << std::endl << std::endl;
 #endif
 
-      delete_gate_bootstrapping_ciphertext_array(2*nb_bits, a_XOR_c);
-      delete_gate_bootstrapping_ciphertext_array(2*nb_bits, b_XOR_c);
-      delete_gate_bootstrapping_ciphertext_array(2*nb_bits, a_x_c_AND_b_x_c);
-
-      elems_sorted_by_depth.push(std::forward_as_tuple(dc, tmp1));
-      elems_sorted_by_depth.push(std::forward_as_tuple(dc + 1, tmp2));
+      elems_sorted_by_depth.push(std::make_tuple(dc, std::move(tmp1)));
+      elems_sorted_by_depth.push(std::make_tuple(dc + 1, std::move(tmp2)));
     }
 
     int da, db;
-    LweSample *a, *b;
+    Word a, b;
 
     std::tie(da, a) = elems_sorted_by_depth.top();
     elems_sorted_by_depth.pop();
@@ -318,241 +386,230 @@ void wallace_multiplier(LweSample *result,
     elems_sorted_by_depth.pop();
 
     /// add final two numbers
-    LweSample *carry = new_gate_bootstrapping_ciphertext(bk->params);
-    bootsCONSTANT(carry, 0, bk);
-    ripple_carry_adder(result, carry, a, b, 2*nb_bits, bk);
+    Wire carry = dag.constant(0);
+    adder(dag, result, carry, a, b, 2*nb_bits);
   }
 #ifdef DEBUG
-  std::cout << "multiplication result: " << decrypt_array(result, 2*nb_bits, SECRET_KEY) << std::endl;
+  std::cout << "multiplication result: " << decrypt_word(dag, result, 2*nb_bits) << std::endl;
 #endif
 
 }
 
-void cloud() {
-  auto t4 = Time::now();
-
-  //reads the cloud key from file
-  FILE *cloud_key = fopen("cloud.key", "rb");
-  TFheGateBootstrappingCloudKeySet *bk = new_tfheGateBootstrappingCloudKeySet_fromFile(cloud_key);
-  fclose(cloud_key);
-
-  //if necessary, the params are inside the key
-  const TFheGateBootstrappingParameterSet *params = bk->params;
-
-  //create the ciphertexts
-  LweSample *n0 = new_gate_bootstrapping_ciphertext_array(BIT_SIZE, params);
-  LweSample *n1 = new_gate_bootstrapping_ciphertext_array(BIT_SIZE, params);
-  LweSample *n2 = new_gate_bootstrapping_ciphertext_array(BIT_SIZE, params);
-
-
-  //reads the ciphertexts from the cloud file
-  FILE *cloud_data = fopen("cloud.data", "rb");
-
-  for (int j = 0; j < BIT_SIZE; j++)
-    import_gate_bootstrapping_ciphertext_fromFile(cloud_data, &n0[j], params);
-
-  for (int j = 0; j < BIT_SIZE; j++)
-    import_gate_bootstrapping_ciphertext_fromFile(cloud_data, &n1[j], params);
-
-  for (int j = 0; j < BIT_SIZE; j++)
-    import_gate_bootstrapping_ciphertext_fromFile(cloud_data, &n2[j], params);
-
+/// Records the circuit of one record
+/// \param dag  [in,out]   circuit the gates are recorded in
+/// \param n0   [in]       genotype count n0 (BIT_SIZE bits)
+/// \param n1   [in]       genotype count n1 (BIT_SIZE bits)
+/// \param n2   [in]       genotype count n2 (BIT_SIZE bits)
+/// \return alpha, beta1, beta2 and beta3 (4*BIT_SIZE bits each)
+std::vector<Word> chi_squared_circuit(GateDag &dag, const Word &n0, const Word &n1, const Word &n2) {
 #ifdef DEBUG
   // DECRYPT ALL THE CIPHERTEXTS
-  int n0_ptxt = decrypt_array(n0, BIT_SIZE, SECRET_KEY);
+  int n0_ptxt = decrypt_word(dag, n0, BIT_SIZE);
   printf("n0: %u\n", n0_ptxt);
-  int n1_ptxt = decrypt_array(n1, BIT_SIZE, SECRET_KEY);
+  int n1_ptxt = decrypt_word(dag, n1, BIT_SIZE);
   printf("n1: %u\n", n1_ptxt);
-  int n2_ptxt = decrypt_array(n2, BIT_SIZE, SECRET_KEY);
+  int n2_ptxt = decrypt_word(dag, n2, BIT_SIZE);
   printf("n2: %u\n", n2_ptxt);
 #endif
 
   /// alpha = (4(n0*n2) - n1*n1)^2
-  LweSample *alpha = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  for (int i = 0; i < 4*BIT_SIZE; ++i) {
-    bootsCONSTANT(&alpha[i], 0, bk);
-  }
+  Word alpha = dag.constant(0, 4*BIT_SIZE);
   /// beta1 = 2*(2n0 + n1)^2
-  LweSample *beta1 = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  for (int i = 0; i < 4*BIT_SIZE; ++i) {
-    bootsCONSTANT(&beta1[i], 0, bk);
-  }
+  Word beta1 = dag.constant(0, 4*BIT_SIZE);
   /// beta2 = (2n0+n1) * (2n2 + n1)
-  LweSample *beta2 = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  for (int i = 0; i < 4*BIT_SIZE; ++i) {
-    bootsCONSTANT(&beta2[i], 0, bk);
-  }
+  Word beta2 = dag.constant(0, 4*BIT_SIZE);
   /// beta3 = 2*(2n2 + n1)^2
-  LweSample *beta3 = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  for (int i = 0; i < 4*BIT_SIZE; ++i) {
-    bootsCONSTANT(&beta3[i], 0, bk);
-  }
+  Word beta3 = dag.constant(0, 4*BIT_SIZE);
 
 
   /// term1 = (2n0 + n1) // 2*10 + 20 = 40
-  LweSample *term1 = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  for (int i = 0; i < 4*BIT_SIZE; ++i) {
-    bootsCONSTANT(&term1[i], 0, bk);
-  }
+  Word term1 = dag.constant(0, 4*BIT_SIZE);
   // start by copying n0, but right-shifting it (multiplies by two)
-  LweSample *n0_twice = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  for (int i = 0; i < 4*BIT_SIZE; ++i) {
-    bootsCONSTANT(&n0_twice[i], 0, bk);
-  }
+  Word n0_twice = dag.constant(0, 4*BIT_SIZE);
   for (int i = 0; i < BIT_SIZE; ++i) {
-    bootsCOPY(&n0_twice[i + 1], &n0[i], bk);
+    n0_twice[i + 1] = dag.COPY(n0[i]);
   }
   // Now add n1
-  ripple_carry_adder(term1, &term1[BIT_SIZE + 1], n0_twice, n1, BIT_SIZE, bk);
-  delete_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, n0_twice);
+  adder(dag, term1, term1[BIT_SIZE + 1], n0_twice, n1, BIT_SIZE);
 
   /// term2 = (2n2 + n1) // 2*30 + 20 = 80
-  LweSample *term2 = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  for (int i = 0; i < 4*BIT_SIZE; ++i) {
-    bootsCONSTANT(&term2[i], 0, bk);
-  }
+  Word term2 = dag.constant(0, 4*BIT_SIZE);
   // start by copying n2, but right-shifting it (multiplies by two)
-  LweSample *n2_twice = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  for (int i = 0; i < 4*BIT_SIZE; ++i) {
-    bootsCONSTANT(&n2_twice[i], 0, bk);
-  }
+  Word n2_twice = dag.constant(0, 4*BIT_SIZE);
   for (int i = 0; i < BIT_SIZE; ++i) {
-    bootsCOPY(&n2_twice[i + 1], &n2[i], bk);
+    n2_twice[i + 1] = dag.COPY(n2[i]);
   }
   // Now add n1
-  ripple_carry_adder(term2, &term2[BIT_SIZE + 1], n2_twice, n1, BIT_SIZE, bk);
-  delete_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, n2_twice);
+  adder(dag, term2, term2[BIT_SIZE + 1], n2_twice, n1, BIT_SIZE);
 
 #ifdef DEBUG
   // VERIFY TERM RESULTS
-  auto term1_ptxt = decrypt_array(term1, 4*BIT_SIZE, SECRET_KEY);
+  auto term1_ptxt = decrypt_word(dag, term1, 4*BIT_SIZE);
   printf("term1: %u\n", term1_ptxt);
-  auto term2_ptxt = decrypt_array(term2, 4*BIT_SIZE, SECRET_KEY);
+  auto term2_ptxt = decrypt_word(dag, term2, 4*BIT_SIZE);
   printf("term2: %u\n", term2_ptxt);
 #endif
 
   // Multiply n0 and n2
-  LweSample *n0_n2 = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  for (int i = 0; i < 4*BIT_SIZE; ++i) {
-    bootsCONSTANT(&n0_n2[i], 0, bk);
-  }
-  wallace_multiplier(n0_n2, n0, n2, BIT_SIZE, bk);
+  Word n0_n2 = dag.constant(0, 4*BIT_SIZE);
+  wallace_multiplier(dag, n0_n2, n0, n2, BIT_SIZE);
 
 #ifdef DEBUG
-  auto n02_n2_ptxt = decrypt_array(n0_n2, 4*BIT_SIZE, SECRET_KEY);
+  auto n02_n2_ptxt = decrypt_word(dag, n0_n2, 4*BIT_SIZE);
   printf("n0*n2: %u\n", n02_n2_ptxt);
 #endif
 
   // shift result by 2
-  LweSample *four_n0_n2 = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  for (int i = 0; i < 4*BIT_SIZE; ++i) {
-    bootsCONSTANT(&four_n0_n2[i], 0, bk);
-  }
+  Word four_n0_n2 = dag.constant(0, 4*BIT_SIZE);
   for (int i = 0; i < 2*BIT_SIZE; ++i) {
-    bootsCOPY(&four_n0_n2[i + 2], &n0_n2[i], bk);
+    four_n0_n2[i + 2] = dag.COPY(n0_n2[i]);
   }
-  delete_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, n0_n2);
 
 #ifdef DEBUG
-  auto four_n02_n2_ptxt = decrypt_array(four_n0_n2, 4*BIT_SIZE, SECRET_KEY);
+  auto four_n02_n2_ptxt = decrypt_word(dag, four_n0_n2, 4*BIT_SIZE);
   printf("4*n0*n2: %u\n", four_n02_n2_ptxt);
 #endif
   // square n1
-  LweSample *n1_squared = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  for (int i = 0; i < 4*BIT_SIZE; ++i) {
-    bootsCONSTANT(&n1_squared[i], 0, bk);
-  }
-  wallace_multiplier(n1_squared, n1, n1, BIT_SIZE, bk);
+  Word n1_squared = dag.constant(0, 4*BIT_SIZE);
+  wallace_multiplier(dag, n1_squared, n1, n1, BIT_SIZE);
 
 #ifdef DEBUG
-  auto n1_squared_ptxt = decrypt_array(n1_squared, 4*BIT_SIZE, SECRET_KEY);
+  auto n1_squared_ptxt = decrypt_word(dag, n1_squared, 4*BIT_SIZE);
   printf("n1^2: %u\n", n1_squared_ptxt);
 #endif
 
   // Alpha:
   // first add (yes, original formula is minus, but runtime is pretty much the same and it's already implemented)
-  LweSample *sqrt_alpha = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  for (int i = 0; i < 4*BIT_SIZE; ++i) {
-    bootsCONSTANT(&sqrt_alpha[i], 0, bk);
-  }
-  ripple_carry_adder(sqrt_alpha, &sqrt_alpha[2*BIT_SIZE + 1], four_n0_n2, n1_squared, 2*BIT_SIZE, bk);
-
-  delete_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, four_n0_n2);
-  delete_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, n1_squared);
+  Word sqrt_alpha = dag.constant(0, 4*BIT_SIZE);
+  adder(dag, sqrt_alpha, sqrt_alpha[2*BIT_SIZE + 1], four_n0_n2, n1_squared, 2*BIT_SIZE);
 
 #ifdef DEBUG
-  auto sqrt_alpha_ptxt = decrypt_array(sqrt_alpha, 4*BIT_SIZE, SECRET_KEY);
+  auto sqrt_alpha_ptxt = decrypt_word(dag, sqrt_alpha, 4*BIT_SIZE);
   printf("sqrt_alpha: %u\n", sqrt_alpha_ptxt);
 #endif
 
   // now square
-  wallace_multiplier(alpha, sqrt_alpha, sqrt_alpha, 2*BIT_SIZE, bk);
-  delete_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, sqrt_alpha);
+  wallace_multiplier(dag, alpha, sqrt_alpha, sqrt_alpha, 2*BIT_SIZE);
 
 
   // Square term 1
-  LweSample *term1_squared = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  for (int i = 0; i < 4*BIT_SIZE; ++i) {
-    bootsCONSTANT(&term1_squared[i], 0, bk);
-  }
-  wallace_multiplier(term1_squared, term1, term1, BIT_SIZE, bk);
+  Word term1_squared = dag.constant(0, 4*BIT_SIZE);
+  wallace_multiplier(dag, term1_squared, term1, term1, BIT_SIZE);
 
 #ifdef DEBUG
-  auto term1_squared_ptxt = decrypt_array(term1_squared, 4*BIT_SIZE, SECRET_KEY);
+  auto term1_squared_ptxt = decrypt_word(dag, term1_squared, 4*BIT_SIZE);
   printf("term1_squared: %u\n", term1_squared_ptxt);
 #endif
 
   // Square term 2
-  LweSample *term2_squared = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  for (int i = 0; i < 4*BIT_SIZE; ++i) {
-    bootsCONSTANT(&term2_squared[i], 0, bk);
-  }
-  wallace_multiplier(term2_squared, term2, term2, BIT_SIZE, bk);
+  Word term2_squared = dag.constant(0, 4*BIT_SIZE);
+  wallace_multiplier(dag, term2_squared, term2, term2, BIT_SIZE);
 
 #ifdef DEBUG
-  auto term2_squared_ptxt = decrypt_array(term2_squared, 4*BIT_SIZE, SECRET_KEY);
+  auto term2_squared_ptxt = decrypt_word(dag, term2_squared, 4*BIT_SIZE);
   printf("term2_squared: %u\n", term2_squared_ptxt);
 #endif
 
   // beta 1 is  2*(term1)^2 so we shift by one
   for (int i = 0; i < 2*BIT_SIZE; ++i) {
-    bootsCOPY(&beta1[i + 1], &term1_squared[i], bk);
+    beta1[i + 1] = dag.COPY(term1_squared[i]);
   }
 
   // beta 2 is term1 * term2
-  wallace_multiplier(beta2, term1, term2, BIT_SIZE, bk);
+  wallace_multiplier(dag, beta2, term1, term2, BIT_SIZE);
 
 
   // beta 3 is  2*(term2)^2 so we shift by one
   for (int i = 0; i < 2*BIT_SIZE; ++i) {
-    bootsCOPY(&beta3[i + 1], &term2_squared[i], bk);
+    beta3[i + 1] = dag.COPY(term2_squared[i]);
   }
 
+  return {alpha, beta1, beta2, beta3};
+}
 
-  //export the resulting ciphertexts to lhs file (for the cloud)
-  FILE *answer_data = fopen("answer.data", "wb");
-  for (int i = 0; i < BIT_SIZE; i++) export_gate_bootstrapping_ciphertext_toFile(answer_data, &alpha[i], params);
-  for (int i = 0; i < BIT_SIZE; i++) export_gate_bootstrapping_ciphertext_toFile(answer_data, &beta1[i], params);
-  for (int i = 0; i < BIT_SIZE; i++) export_gate_bootstrapping_ciphertext_toFile(answer_data, &beta2[i], params);
-  for (int i = 0; i < BIT_SIZE; i++) export_gate_bootstrapping_ciphertext_toFile(answer_data, &beta3[i], params);
-  fclose(answer_data);
+void cloud() {
+  auto t4 = Time::now();
 
-  //clean up all pointers
-  delete_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, term1);
-  delete_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, term2);
-  delete_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, term1_squared);
-  delete_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, term2_squared);
-  delete_gate_bootstrapping_ciphertext_array(BIT_SIZE, n0);
-  delete_gate_bootstrapping_ciphertext_array(BIT_SIZE, n1);
-  delete_gate_bootstrapping_ciphertext_array(BIT_SIZE, n2);
+  //reads the cloud key from file
+  FILE *cloud_key = fopen("cloud.key", "rb");
+  TFheGateBootstrappingCloudKeySet *bk = new_tfheGateBootstrappingCloudKeySet_fromFile(cloud_key);
+  fclose(cloud_key);
+
+  //if necessary, the params are inside the key
+  const TFheGateBootstrappingParameterSet *params = bk->params;
 
+  {
+    // The gates are only recorded here and evaluated by run(), independent
+    // gates (e.g. of alpha and the betas) in parallel. All ciphertexts of the
+    // evaluation live in the arena of the DAG and are released together with it,
+    // the DAG is scoped so that this happens before the cloud key is deleted.
+    GateDag dag(bk, gate_dag_folding());
+
+    //reads the ciphertexts of the records from the cloud file, the circuits of
+    //records_per_run() records are recorded in the same DAG so their gates are
+    //evaluated in parallel as well, then the DAG is cleared for the next ones
+    const int nb_records = num_records();
+    FILE *cloud_data = fopen("cloud.data", "rb");
+    FILE *answer_data = fopen("answer.data", "wb");
+    for (int first = 0; first < nb_records; first += records_per_run()) {
+      const int last = std::min(nb_records, first + records_per_run());
+      {
+        // the ciphertexts have to stay until the DAG is evaluated
+        std::vector<LweArena::Array> ctxts;
+        std::vector<std::vector<Word>> results;
+        for (int record = first; record < last; ++record) {
+          //create the ciphertexts
+          LweArena::Array n0_ctxt = dag.arena().array(BIT_SIZE);
+          LweArena::Array n1_ctxt = dag.arena().array(BIT_SIZE);
+          LweArena::Array n2_ctxt = dag.arena().array(BIT_SIZE);
+
+          for (int j = 0; j < BIT_SIZE; j++)
+            import_gate_bootstrapping_ciphertext_fromFile(cloud_data, &n0_ctxt[j], params);
+
+          for (int j = 0; j < BIT_SIZE; j++)
+            import_gate_bootstrapping_ciphertext_fromFile(cloud_data, &n1_ctxt[j], params);
+
+          for (int j = 0; j < BIT_SIZE; j++)
+            import_gate_bootstrapping_ciphertext_fromFile(cloud_data, &n2_ctxt[j], params);
+
+          Word n0 = dag.input(n0_ctxt.get(), BIT_SIZE);
+          Word n1 = dag.input(n1_ctxt.get(), BIT_SIZE);
+          Word n2 = dag.input(n2_ctxt.get(), BIT_SIZE);
+          results.push_back(chi_squared_circuit(dag, n0, n1, n2));
+
+          ctxts.push_back(std::move(n0_ctxt));
+          ctxts.push_back(std::move(n1_ctxt));
+          ctxts.push_back(std::move(n2_ctxt));
+        }
+
+        // evaluate the recorded circuits
+        dag.run(NUM_THREADS);
+
+        //export the resulting ciphertexts to lhs file (for the cloud)
+        for (auto &result : results) {
+          // alpha, beta1, beta2 and beta3
+          for (auto &word : result) {
+            for (int i = 0; i < BIT_SIZE; i++) export_gate_bootstrapping_ciphertext_toFile(answer_data, dag.sample(word[i]), params);
+          }
+        }
+      }
+      folded_gates += dag.folded_gates();
+      // all samples (including the ones of the inputs) are reused for the next records
+      dag.clear();
+    }
+    fclose(cloud_data);
+    fclose(answer_data);
+  }
+
+  //clean up all pointers (the ciphertexts were released with the DAG)
   delete_gate_bootstrapping_cloud_keyset(bk);
 
   auto t5 = Time::now();
   log_time(ss_time, t4, t5, false);
 }
 
-void verify() {
+/// \return the number of records whose results differ from chi_squared_plain
+int verify() {
 
   auto t6 = Time::now();
 
@@ -564,44 +621,62 @@ void verify() {
   //if necessary, the params are inside the key
   const TFheGateBootstrappingParameterSet *params = key->params;
 
-  //create the ciphertext for the results
-  LweSample *alpha = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  LweSample *beta1 = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  LweSample *beta2 = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
-  LweSample *beta3 = new_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, params);
+  //create the ciphertext for the results (only the lowest BIT_SIZE bits are exported)
+  LweSample *alpha = new_gate_bootstrapping_ciphertext_array(BIT_SIZE, params);
+  LweSample *beta1 = new_gate_bootstrapping_ciphertext_array(BIT_SIZE, params);
+  LweSample *beta2 = new_gate_bootstrapping_ciphertext_array(BIT_SIZE, params);
+  LweSample *beta3 = new_gate_bootstrapping_ciphertext_array(BIT_SIZE, params);
 
-  //import the  ciphertexts from the answer file
+  //import the  ciphertexts of every record from the answer file
+  const int nb_records = num_records();
+  int wrong_records = 0;
   FILE *answer_data = fopen("answer.data", "rb");
-  for (int i = 0; i < BIT_SIZE; i++)
-    import_gate_bootstrapping_ciphertext_fromFile(answer_data, &alpha[i], params);
-  for (int i = 0; i < BIT_SIZE; i++)
-    import_gate_bootstrapping_ciphertext_fromFile(answer_data, &beta1[i], params);
-  for (int i = 0; i < BIT_SIZE; i++)
-    import_gate_bootstrapping_ciphertext_fromFile(answer_data, &beta2[i], params);
-  for (int i = 0; i < BIT_SIZE; i++)
-    import_gate_bootstrapping_ciphertext_fromFile(answer_data, &beta3[i], params);
+  for (int record = 0; record < nb_records; ++record) {
+    for (int i = 0; i < BIT_SIZE; i++)
+      import_gate_bootstrapping_ciphertext_fromFile(answer_data, &alpha[i], params);
+    for (int i = 0; i < BIT_SIZE; i++)
+      import_gate_bootstrapping_ciphertext_fromFile(answer_data, &beta1[i], params);
+    for (int i = 0; i < BIT_SIZE; i++)
+      import_gate_bootstrapping_ciphertext_fromFile(answer_data, &beta2[i], params);
+    for (int i = 0; i < BIT_SIZE; i++)
+      import_gate_bootstrapping_ciphertext_fromFile(answer_data, &beta3[i], params);
+
+    //decrypt and rebuild the plaintext answer
+    uint32_t int_alpha = decrypt_array(alpha, BIT_SIZE, key);
+    uint32_t int_beta1 = decrypt_array(beta1, BIT_SIZE, key);
+    uint32_t int_beta2 = decrypt_array(beta2, BIT_SIZE, key);
+    uint32_t int_beta3 = decrypt_array(beta3, BIT_SIZE, key);
+
+    if (nb_records > 1) printf("Record %d:\n", record);
+    printf("And the results are:\nalpha: %u\nbeta1: %u\nbeta2: %u\nbeta3: %u\n",
+           int_alpha,
+           int_beta1,
+           int_beta2,
+           int_beta3);
+
+    //compare with the plaintext computation
+    std::vector<uint32_t> expected = chi_squared_plain(genotype_counts(record));
+    if (std::vector<uint32_t>{int_alpha, int_beta1, int_beta2, int_beta3} != expected) {
+      printf("Wrong results, expected:\nalpha: %u\nbeta1: %u\nbeta2: %u\nbeta3: %u\n",
+             expected[0],
+             expected[1],
+             expected[2],
+             expected[3]);
+      ++wrong_records;
+    }
+  }
   fclose(answer_data);
-
-  //decrypt and rebuild the plaintext answer
-  uint32_t int_alpha = decrypt_array(alpha, 4*BIT_SIZE, key);
-  uint32_t int_beta1 = decrypt_array(beta1, 4*BIT_SIZE, key);
-  uint32_t int_beta2 = decrypt_array(beta2, 4*BIT_SIZE, key);
-  uint32_t int_beta3 = decrypt_array(beta3, 4*BIT_SIZE, key);
-
-  printf("And the results are:\nalpha: %u\nbeta1: %u\nbeta2: %u\nbeta3: %u\n",
-         int_alpha,
-         int_beta1,
-         int_beta2,
-         int_beta3);
+  if (wrong_records > 0) printf("%d of %d records are wrong!\n", wrong_records, nb_records);
   printf("I hope you remember what was the question!\n");
 
   //clean up all pointers
-  delete_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, alpha);
-  delete_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, beta1);
-  delete_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, beta2);
-  delete_gate_bootstrapping_ciphertext_array(4*BIT_SIZE, beta3);
+  delete_gate_bootstrapping_ciphertext_array(BIT_SIZE, alpha);
+  delete_gate_bootstrapping_ciphertext_array(BIT_SIZE, beta1);
+  delete_gate_bootstrapping_ciphertext_array(BIT_SIZE, beta2);
+  delete_gate_bootstrapping_ciphertext_array(BIT_SIZE, beta3);
   delete_gate_bootstrapping_secret_keyset(key);
 
   auto t7 = Time::now();
   log_time(ss_time, t6, t7, true);
+  return wrong_records;
 }
@@ -0,0 +1,412 @@
+#ifndef GATE_DAG_H_
+#define GATE_DAG_H_
+
+#include <tfhe/tfhe.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "lwe_arena.h"
+
+/// Output of a gate (or an input/constant bit) recorded in a GateDag
+typedef int Wire;
+
+/// Bits of an encrypted number, least significant bit first
+typedef std::vector<Wire> Word;
+
+enum class GateType { INPUT, CONSTANT, COPY, NOT, AND, OR, XOR, XNOR, NAND, NOR, MUX };
+
+/// Records a boolean circuit as a DAG of TFHE gates and evaluates it later.
+///
+/// Recording a gate only allocates its output, run() then bootstraps all gates whose inputs are available in parallel
+/// on a work-stealing pool: every worker takes ready gates from its own queue (most recent first, so a chain of gates
+/// stays on one thread) and steals the oldest ready gates of other workers when its own queue is empty.
+/// Each bootstrapped gate takes ~10-20 ms, so independent parts of a circuit (e.g. the factors of the cardio program)
+/// run almost linearly faster with more threads.
+///
+/// Gates are folded while they are recorded (unless disabled): a gate with a constant (public) input whose result is
+/// a constant, one of its inputs or the negation of one (NOT needs no bootstrapping) is not recorded, e.g.
+/// AND(x, 1) = x, XOR(x, 1) = NOT(x) or OR(x, 1) = 1. Comparing with or adding a constant thus takes about half the
+/// bootstrappings, and the zero bits of the Wallace multiplier cost nothing.
+///
+/// Note: the FFT processors of libtfhe (FFTW, Spqlios and Nayuki alike) keep their buffers in global objects, so
+/// concurrent bootstrappings corrupt each other. More than one thread is therefore only allowed if the programs are
+/// built with TFHE_THREAD_SAFE_FFT (CMake option of the same name), which declares that the linked libtfhe was patched
+/// to use per-thread FFT processors, like the one of the Docker image (image_base/thread_local_fft.sh). Otherwise run()
+/// exits with an error. With one thread, the gates are evaluated in the order they were recorded, exactly like calling
+/// the boots* functions directly.
+class GateDag {
+ public:
+  /// \param bk    [in] cloud key the gates are bootstrapped with, must outlive the DAG
+  /// \param fold  [in] whether gates with constant inputs are folded while they are recorded
+  explicit GateDag(const TFheGateBootstrappingCloudKeySet *bk, bool fold = true)
+      : bk(bk), fold(fold), samples(bk->params) {}
+
+  GateDag(const GateDag &) = delete;
+
+  GateDag &operator=(const GateDag &) = delete;
+
+  /// An existing ciphertext, which has to stay unchanged until the gates that use it are evaluated
+  Wire input(const LweSample *sample) {
+    Node node;
+    node.type = GateType::INPUT;
+    node.out = const_cast<LweSample *>(sample);
+    node.done = true;
+    return add(node);
+  }
+
+  /// The nb_bits ciphertexts of array
+  Word input(const LweSample *array, int nb_bits) {
+    Word word(nb_bits);
+    for (int i = 0; i < nb_bits; ++i) word[i] = input(&array[i]);
+    return word;
+  }
+
+  /// A trivial encryption of value (no bootstrapping needed)
+  Wire constant(int value) {
+    Node node;
+    node.type = GateType::CONSTANT;
+    node.value = value & 1;
+    node.out = samples.allocate(1);
+    bootsCONSTANT(node.out, node.value, bk);
+    node.done = true;
+    return add(node);
+  }
+
+  /// The nb_bits lowest bits of n as trivial encryptions
+  Word constant(int n, int nb_bits) {
+    Word word(nb_bits);
+    for (int i = 0; i < nb_bits; ++i) word[i] = constant((n >> i) & 1);
+    return word;
+  }
+
+  Wire COPY(Wire a) { return gate(GateType::COPY, a); }
+  Wire NOT(Wire a) { return gate(GateType::NOT, a); }
+  Wire AND(Wire a, Wire b) { return gate(GateType::AND, a, b); }
+  Wire OR(Wire a, Wire b) { return gate(GateType::OR, a, b); }
+  Wire XOR(Wire a, Wire b) { return gate(GateType::XOR, a, b); }
+  Wire XNOR(Wire a, Wire b) { return gate(GateType::XNOR, a, b); }
+  Wire NAND(Wire a, Wire b) { return gate(GateType::NAND, a, b); }
+  Wire NOR(Wire a, Wire b) { return gate(GateType::NOR, a, b); }
+
+  /// sel ? a : b
+  Wire MUX(Wire sel, Wire a, Wire b) { return gate(GateType::MUX, sel, a, b); }
+
+  /// Evaluates all gates recorded since the last run
+  /// \param num_threads [in] number of worker threads, at most one is used if less than two gates are pending
+  void run(int num_threads = 1) {
+    check_threads(num_threads);
+    std::vector<Wire> pending;
+    for (Wire w = first_pending; w < static_cast<Wire>(nodes.size()); ++w) {
+      if (!nodes[w].done) pending.push_back(w);
+    }
+    first_pending = nodes.size();
+    if (num_threads <= 1 || pending.size() < 2) {
+      // recording order is a topological order
+      for (auto w : pending) evaluate(w);
+      return;
+    }
+    run_parallel(pending, std::min<std::size_t>(num_threads, pending.size()));
+  }
+
+  /// Exits if the linked libtfhe can not bootstrap on several threads at the same time
+  static void check_threads(int num_threads) {
+#ifndef TFHE_THREAD_SAFE_FFT
+    if (num_threads > 1) {
+      std::cerr << "Evaluating TFHE gates on " << num_threads << " threads needs a libtfhe with thread-safe FFT "
+                << "processors, the default build (e.g. libtfhe-fftw) keeps its FFT buffers in globals and would "
+                << "return corrupted ciphertexts. Use TFHE_THREADS=1, or build with -DTFHE_THREAD_SAFE_FFT=ON against "
+                << "a thread-safe libtfhe." << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+#endif
+  }
+
+  /// Result of a wire, only valid after run()
+  const LweSample *sample(Wire w) const { return nodes.at(w).out; }
+
+  /// Copies the result of a wire (after run()) into dest
+  void output(Wire w, LweSample *dest) const { lweCopy(dest, nodes.at(w).out, bk->params->in_out_params); }
+
+  /// Copies the results of the bits of word (after run()) into the array dest
+  void output(const Word &word, LweSample *dest) const {
+    for (std::size_t i = 0; i < word.size(); ++i) output(word[i], &dest[i]);
+  }
+
+  /// Number of recorded gates of the given type
+  int count(GateType type) const {
+    return std::count_if(nodes.begin(), nodes.end(), [type](const Node &node) { return node.type == type; });
+  }
+
+  /// Value of a constant wire (0 or 1), or -1 if the wire is encrypted
+  int known(Wire w) const { return nodes.at(w).type == GateType::CONSTANT ? nodes[w].value : -1; }
+
+  /// Number of gates of the given type that were asked for, including the folded ones
+  int requested(GateType type) const { return num_requested[static_cast<int>(type)]; }
+
+  /// Number of gates that would have needed a bootstrapping but were folded
+  int folded_gates() const { return num_folded; }
+
+  /// Number of recorded gates that need a bootstrapping (everything except inputs, constants, COPY and NOT)
+  int bootstrapped_gates() const {
+    return std::count_if(nodes.begin(), nodes.end(), [](const Node &node) { return needs_bootstrapping(node.type); });
+  }
+
+  /// Removes all recorded gates, their samples (and all other samples of arena()) are reused by the gates recorded next
+  void clear() {
+    nodes.clear();
+    std::fill(std::begin(num_requested), std::end(num_requested), 0);
+    num_folded = 0;
+    first_pending = 0;
+    samples.reset();
+  }
+
+  /// Arena the outputs of the gates are allocated in, e.g. for the inputs of the circuit
+  LweArena &arena() { return samples; }
+
+  const TFheGateBootstrappingCloudKeySet *cloud_key() const { return bk; }
+
+ private:
+  struct Node {
+    GateType type;
+    Wire in[3] = {-1, -1, -1};
+    /// value of a constant
+    int value = 0;
+    LweSample *out = nullptr;
+    bool done = false;
+  };
+
+  const TFheGateBootstrappingCloudKeySet *bk;
+
+  bool fold;
+
+  int num_requested[static_cast<int>(GateType::MUX) + 1] = {};
+  int num_folded = 0;
+
+  /// outputs of all gates and constants, released together with the DAG
+  LweArena samples;
+
+  std::vector<Node> nodes;
+
+  /// All nodes before this one have been evaluated
+  Wire first_pending = 0;
+
+  static bool needs_bootstrapping(GateType type) {
+    return type != GateType::INPUT && type != GateType::CONSTANT && type != GateType::COPY && type != GateType::NOT;
+  }
+
+  Wire add(const Node &node) {
+    nodes.push_back(node);
+    return nodes.size() - 1;
+  }
+
+  Wire gate(GateType type, Wire a, Wire b = -1, Wire c = -1) {
+    Node node;
+    node.type = type;
+    node.in[0] = a;
+    node.in[1] = b;
+    node.in[2] = c;
+    for (auto w : node.in) {
+      if (w >= static_cast<Wire>(nodes.size())) std::abort();  // inputs must be recorded before
+    }
+    ++num_requested[static_cast<int>(type)];
+    if (fold) {
+      Wire folded = fold_gate(type, a, b, c);
+      if (folded >= 0) {
+        if (needs_bootstrapping(type)) ++num_folded;
+        return folded;
+      }
+    }
+    node.out = samples.allocate(1);
+    return add(node);
+  }
+
+  /// The wire a gate is equal to if its result is known without bootstrapping, or -1
+  Wire fold_gate(GateType type, Wire a, Wire b, Wire c) {
+    const int ka = known(a);
+    if (type == GateType::COPY) return a;
+    if (type == GateType::NOT) {
+      if (ka >= 0) return constant(!ka);
+      return nodes[a].type == GateType::NOT ? nodes[a].in[0] : -1;
+    }
+    if (type == GateType::MUX) {
+      if (ka >= 0) return ka ? b : c;
+      if (b == c) return b;
+      const int kb = known(b), kc = known(c);
+      if (kb < 0 || kc < 0) return -1;
+      return kb == kc ? b : (kb ? a : NOT(a));
+    }
+
+    const int kb = known(b);
+    if (ka >= 0 && kb >= 0) {
+      switch (type) {
+        case GateType::AND: return constant(ka & kb);
+        case GateType::OR: return constant(ka | kb);
+        case GateType::XOR: return constant(ka ^ kb);
+        case GateType::XNOR: return constant(!(ka ^ kb));
+        case GateType::NAND: return constant(!(ka & kb));
+        case GateType::NOR: return constant(!(ka | kb));
+        default: return -1;
+      }
+    }
+    if (ka < 0 && kb < 0) {
+      if (a != b) return -1;
+      switch (type) {
+        case GateType::AND:
+        case GateType::OR: return a;
+        case GateType::XOR: return constant(0);
+        case GateType::XNOR: return constant(1);
+        case GateType::NAND:
+        case GateType::NOR: return NOT(a);
+        default: return -1;
+      }
+    }
+    // one constant input k, and an encrypted input x
+    const int k = ka >= 0 ? ka : kb;
+    const Wire x = ka >= 0 ? b : a;
+    switch (type) {
+      case GateType::AND: return k ? x : constant(0);
+      case GateType::OR: return k ? constant(1) : x;
+      case GateType::XOR: return k ? NOT(x) : x;
+      case GateType::XNOR: return k ? x : NOT(x);
+      case GateType::NAND: return k ? NOT(x) : constant(1);
+      case GateType::NOR: return k ? constant(0) : NOT(x);
+      default: return -1;
+    }
+  }
+
+  void evaluate(Wire w) {
+    Node &node = nodes[w];
+    const LweSample *a = node.in[0] >= 0 ? nodes[node.in[0]].out : nullptr;
+    const LweSample *b = node.in[1] >= 0 ? nodes[node.in[1]].out : nullptr;
+    const LweSample *c = node.in[2] >= 0 ? nodes[node.in[2]].out : nullptr;
+    switch (node.type) {
+      case GateType::COPY: bootsCOPY(node.out, a, bk); break;
+      case GateType::NOT: bootsNOT(node.out, a, bk); break;
+      case GateType::AND: bootsAND(node.out, a, b, bk); break;
+      case GateType::OR: bootsOR(node.out, a, b, bk); break;
+      case GateType::XOR: bootsXOR(node.out, a, b, bk); break;
+      case GateType::XNOR: bootsXNOR(node.out, a, b, bk); break;
+      case GateType::NAND: bootsNAND(node.out, a, b, bk); break;
+      case GateType::NOR: bootsNOR(node.out, a, b, bk); break;
+      case GateType::MUX: bootsMUX(node.out, a, b, c, bk); break;
+      default: break;
+    }
+    node.done = true;
+  }
+
+  void run_parallel(const std::vector<Wire> &pending, std::size_t num_workers) {
+    // number of pending inputs of each pending gate, and the pending gates that use each gate
+    std::vector<std::atomic<int>> missing(nodes.size());
+    std::vector<std::vector<Wire>> users(nodes.size());
+    for (auto w : pending) {
+      int count = 0;
+      for (auto in : nodes[w].in) {
+        if (in >= 0 && !nodes[in].done) {
+          users[in].push_back(w);
+          ++count;
+        }
+      }
+      missing[w] = count;
+    }
+
+    struct Queue {
+      std::mutex mutex;
+      std::deque<Wire> gates;
+    };
+    std::vector<Queue> queues(num_workers);
+    std::mutex idle_mutex;
+    std::condition_variable idle;
+    // number of queued gates and of evaluated gates, changed under idle_mutex to not miss a wake-up
+    std::size_t queued = 0, evaluated = 0;
+
+    std::size_t next_queue = 0;
+    for (auto w : pending) {
+      if (missing[w] == 0) {
+        queues[next_queue++ % num_workers].gates.push_back(w);
+        ++queued;
+      }
+    }
+
+    auto take = [&](std::size_t self, Wire &w) {
+      for (std::size_t k = 0; k < num_workers; ++k) {
+        Queue &queue = queues[(self + k) % num_workers];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.gates.empty()) continue;
+        if (k == 0) {
+          w = queue.gates.back();
+          queue.gates.pop_back();
+        } else {
+          w = queue.gates.front();
+          queue.gates.pop_front();
+        }
+        return true;
+      }
+      return false;
+    };
+
+    auto work = [&](std::size_t self) {
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lock(idle_mutex);
+          idle.wait(lock, [&] { return queued > 0 || evaluated == pending.size(); });
+          if (evaluated == pending.size()) return;
+          --queued;  // reserves one of the queued gates for this worker
+        }
+        Wire w;
+        while (!take(self, w)) std::this_thread::yield();  // another worker is about to push the reserved gate
+        evaluate(w);
+
+        std::size_t ready = 0;
+        for (auto user : users[w]) {
+          if (--missing[user] == 0) {
+            std::lock_guard<std::mutex> lock(queues[self].mutex);
+            queues[self].gates.push_back(user);
+            ++ready;
+          }
+        }
+        {
+          std::lock_guard<std::mutex> lock(idle_mutex);
+          queued += ready;
+          ++evaluated;
+        }
+        idle.notify_all();
+      }
+    };
+
+    std::vector<std::thread> workers;
+    for (std::size_t t = 1; t < num_workers; ++t) workers.emplace_back(work, t);
+    work(0);
+    for (auto &worker : workers) worker.join();
+  }
+};
+
+/// Whether GateDags should fold gates with constant inputs, from the environment variable TFHE_FOLD (default: 1)
+inline bool gate_dag_folding() {
+  const char *fold = std::getenv("TFHE_FOLD");
+  return !fold || std::atoi(fold) != 0;
+}
+
+/// Number of threads GateDag::run() should use, from the environment variable TFHE_THREADS (default: all cores if
+/// built with TFHE_THREAD_SAFE_FFT, else 1).
+/// Exits with an error for more than one thread unless built with TFHE_THREAD_SAFE_FFT, see GateDag.
+inline int gate_dag_threads() {
+#ifdef TFHE_THREAD_SAFE_FFT
+  const int default_threads = std::max(1u, std::thread::hardware_concurrency());
+#else
+  const int default_threads = 1;
+#endif
+  const char *threads = std::getenv("TFHE_THREADS");
+  const int num_threads = threads ? std::max(1, std::atoi(threads)) : default_threads;
+  GateDag::check_threads(num_threads);
+  return num_threads;
+}
+
+#endif  // GATE_DAG_H_
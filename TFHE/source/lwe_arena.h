@@ -0,0 +1,128 @@
+#ifndef LWE_ARENA_H_
+#define LWE_ARENA_H_
+
+#include <tfhe/tfhe.h>
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// Allocates gate bootstrapping ciphertexts (LweSamples) in blocks and releases them all at once.
+///
+/// Samples are handed out from the current block, samples that are given back with recycle() are reused for later
+/// allocations of the same size. reset() makes all samples available again without freeing them, so a circuit that
+/// is evaluated many times (e.g. once per record) does not allocate after the first time. Nothing is freed before the
+/// arena is destroyed.
+class LweArena {
+ public:
+  /// Samples of the arena, given back to it when the handle is destroyed
+  class Array {
+   public:
+    Array() = default;
+
+    Array(const Array &) = delete;
+
+    Array &operator=(const Array &) = delete;
+
+    Array(Array &&other) noexcept { *this = std::move(other); }
+
+    Array &operator=(Array &&other) noexcept {
+      std::swap(arena, other.arena);
+      std::swap(samples, other.samples);
+      std::swap(nb_samples, other.nb_samples);
+      return *this;
+    }
+
+    ~Array() {
+      if (arena) arena->recycle(samples, nb_samples);
+    }
+
+    LweSample *get() const { return samples; }
+    LweSample &operator[](int i) const { return samples[i]; }
+    int size() const { return nb_samples; }
+
+   private:
+    friend class LweArena;
+
+    Array(LweArena *arena, LweSample *samples, int nb_samples)
+        : arena(arena), samples(samples), nb_samples(nb_samples) {}
+
+    LweArena *arena = nullptr;
+    LweSample *samples = nullptr;
+    int nb_samples = 0;
+  };
+
+  /// \param params      [in] parameters of the samples, must outlive the arena
+  /// \param block_size  [in] number of samples allocated at once (larger requests get a block of their own)
+  explicit LweArena(const TFheGateBootstrappingParameterSet *params, int block_size = 256)
+      : params(params), block_size(block_size) {}
+
+  LweArena(const LweArena &) = delete;
+
+  LweArena &operator=(const LweArena &) = delete;
+
+  ~LweArena() {
+    for (auto &block : blocks) delete_gate_bootstrapping_ciphertext_array(block.second, block.first);
+  }
+
+  /// nb_samples consecutive samples, valid until they are recycled or the arena is reset or destroyed
+  LweSample *allocate(int nb_samples) {
+    auto free = free_lists.find(nb_samples);
+    if (free != free_lists.end() && !free->second.empty()) {
+      LweSample *samples = free->second.back();
+      free->second.pop_back();
+      return samples;
+    }
+    // first block from the current one on with enough space left (reset() keeps the blocks)
+    while (current < blocks.size() && blocks[current].second - used < nb_samples) {
+      ++current;
+      used = 0;
+    }
+    if (current == blocks.size()) {
+      const int size = std::max(block_size, nb_samples);
+      blocks.emplace_back(new_gate_bootstrapping_ciphertext_array(size, params), size);
+      used = 0;
+    }
+    LweSample *samples = blocks[current].first + used;
+    used += nb_samples;
+    return samples;
+  }
+
+  /// Like allocate(), but the samples are recycled when the returned handle is destroyed
+  Array array(int nb_samples) { return Array(this, allocate(nb_samples), nb_samples); }
+
+  /// Gives back samples from allocate(), they are reused by the next allocation of the same size
+  void recycle(LweSample *samples, int nb_samples) { free_lists[nb_samples].push_back(samples); }
+
+  /// Makes all samples available again, pointers to them must not be used anymore (except to overwrite them) and all
+  /// Array handles must have been destroyed before
+  void reset() {
+    free_lists.clear();
+    current = 0;
+    used = 0;
+  }
+
+  /// Number of samples allocated in total
+  int capacity() const {
+    int total = 0;
+    for (auto &block : blocks) total += block.second;
+    return total;
+  }
+
+ private:
+  const TFheGateBootstrappingParameterSet *params;
+
+  int block_size;
+
+  /// first sample and size of each block
+  std::vector<std::pair<LweSample *, int>> blocks;
+
+  /// block samples are taken from, and the number of samples already taken from it
+  std::size_t current = 0;
+  int used = 0;
+
+  /// recycled samples, by number of samples
+  std::unordered_map<int, std::vector<LweSample *>> free_lists;
+};
+
+#endif  // LWE_ARENA_H_
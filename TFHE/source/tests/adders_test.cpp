@@ -0,0 +1,120 @@
+#include <tfhe/tfhe.h>
+#include <stdio.h>
+#include <cstdint>
+#include <random>
+
+#include "../adders.h"
+#include "../gate_dag.h"
+
+// Checks the Kogge-Stone and Brent-Kung networks of prefix_adder against ripple carry addition:
+// exhaustively on plaintext bits for up to 8 bits, and for a few additions on encrypted bits of a GateDag.
+
+/// Evaluates the gates right away on plaintext bits, a wire is the value of its bit
+struct PlainCircuit {
+  Wire XOR(Wire a, Wire b) { return a ^ b; }
+  Wire AND(Wire a, Wire b) { return a & b; }
+};
+
+/// Result of the ripple carry adders of the TFHE programs: a + b + carry_in modulo 2^nb_bits, and as carry out the
+/// carry into bit nb_bits - 1 (the carry in for a single bit)
+void ripple_reference(uint32_t a, uint32_t b, int carry_in, int nb_bits, uint32_t &sum, int &carry_out) {
+  const uint32_t mask = (1u << nb_bits) - 1;
+  sum = (a + b + carry_in) & mask;
+  if (nb_bits == 1) {
+    carry_out = carry_in;
+  } else {
+    const uint32_t low = (1u << (nb_bits - 1)) - 1;
+    carry_out = (((a & low) + (b & low) + carry_in) >> (nb_bits - 1)) & 1;
+  }
+}
+
+Word to_bits(uint32_t n, int nb_bits) {
+  Word word(nb_bits);
+  for (int i = 0; i < nb_bits; ++i) word[i] = (n >> i) & 1;
+  return word;
+}
+
+const char *name(AdderType type) {
+  return type == AdderType::KOGGE_STONE ? "kogge_stone" : "brent_kung";
+}
+
+/// \return number of wrong additions
+int check_plain(AdderType type, int max_bits) {
+  int failures = 0;
+  PlainCircuit circuit;
+  for (int nb_bits = 1; nb_bits <= max_bits; ++nb_bits) {
+    for (uint32_t a = 0; a < (1u << nb_bits); ++a) {
+      for (uint32_t b = 0; b < (1u << nb_bits); ++b) {
+        for (int carry_in = 0; carry_in < 2; ++carry_in) {
+          // the sum overwrites a, like in the programs
+          Word s = to_bits(a, nb_bits);
+          Wire carry = carry_in;
+          prefix_adder(circuit, s, carry, s, to_bits(b, nb_bits), nb_bits, type);
+
+          uint32_t sum = 0, expected_sum;
+          int expected_carry;
+          for (int i = 0; i < nb_bits; ++i) sum |= s[i] << i;
+          ripple_reference(a, b, carry_in, nb_bits, expected_sum, expected_carry);
+          if (sum != expected_sum || carry != expected_carry) {
+            if (failures++ < 10) {
+              printf("%s, %d bits: %u + %u + %d = %u (carry %d), expected %u (carry %d)\n",
+                     name(type), nb_bits, a, b, carry_in, sum, carry, expected_sum, expected_carry);
+            }
+          }
+        }
+      }
+    }
+  }
+  return failures;
+}
+
+/// \return number of wrong additions
+int check_encrypted(AdderType type, const TFheGateBootstrappingSecretKeySet *key, std::mt19937 &rng) {
+  int failures = 0;
+  for (int nb_bits : {1, 2, 5, 8, 16}) {
+    for (int k = 0; k < 2; ++k) {
+      const uint32_t a = rng() & ((1u << nb_bits) - 1);
+      const uint32_t b = rng() & ((1u << nb_bits) - 1);
+      const int carry_in = rng() & 1;
+
+      // without folding, all gates on the constants are bootstrapped like on encrypted inputs
+      GateDag dag(&key->cloud, false);
+      Word s = dag.constant(a, nb_bits);
+      Wire carry = dag.constant(carry_in);
+      prefix_adder(dag, s, carry, s, dag.constant(b, nb_bits), nb_bits, type);
+      dag.run();
+
+      uint32_t sum = 0, expected_sum;
+      int expected_carry;
+      for (int i = 0; i < nb_bits; ++i) sum |= bootsSymDecrypt(dag.sample(s[i]), key) << i;
+      const int carry_out = bootsSymDecrypt(dag.sample(carry), key);
+      ripple_reference(a, b, carry_in, nb_bits, expected_sum, expected_carry);
+      if (sum != expected_sum || carry_out != expected_carry) {
+        ++failures;
+        printf("%s, %d encrypted bits: %u + %u + %d = %u (carry %d), expected %u (carry %d)\n",
+               name(type), nb_bits, a, b, carry_in, sum, carry_out, expected_sum, expected_carry);
+      }
+    }
+  }
+  return failures;
+}
+
+int main() {
+  const int minimum_lambda = 100;
+  TFheGateBootstrappingParameterSet *params = new_default_gate_bootstrapping_parameters(minimum_lambda);
+  uint32_t seed[] = {314, 1592, 657};
+  tfhe_random_generator_setSeed(seed, 3);
+  TFheGateBootstrappingSecretKeySet *key = new_random_gate_bootstrapping_secret_keyset(params);
+  std::mt19937 rng(42);
+
+  int failures = 0;
+  for (auto type : {AdderType::KOGGE_STONE, AdderType::BRENT_KUNG}) {
+    failures += check_plain(type, 8);
+    failures += check_encrypted(type, key, rng);
+  }
+  printf("%d wrong additions\n", failures);
+
+  delete_gate_bootstrapping_secret_keyset(key);
+  delete_gate_bootstrapping_parameters(params);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+#include <tfhe/tfhe.h>
+#include <stdio.h>
+#include <random>
+#include <vector>
+
+#include "../gate_dag.h"
+
+// Checks the constant folding of GateDag: random circuits are recorded in a DAG with and one without folding, both
+// are evaluated and every gate output is compared with a plaintext evaluation of the circuit.
+
+/// A gate of a random circuit, its inputs are indices of earlier wires of the circuit
+struct RandomGate {
+  GateType type;
+  int in[3];
+};
+
+/// A circuit on nb_inputs encrypted inputs and the two constants (wires nb_inputs and nb_inputs + 1)
+struct RandomCircuit {
+  int nb_inputs;
+  std::vector<RandomGate> gates;
+};
+
+/// Random gates of all types, whose inputs are often the constants (both of them, e.g. for a MUX) or the same wire
+/// twice, so that every rule of GateDag::fold_gate is hit
+RandomCircuit random_circuit(int nb_inputs, int nb_gates, std::mt19937 &rng) {
+  static const GateType types[] = {GateType::COPY, GateType::NOT, GateType::AND, GateType::OR, GateType::XOR,
+                                   GateType::XNOR, GateType::NAND, GateType::NOR, GateType::MUX};
+  RandomCircuit circuit{nb_inputs, {}};
+  int nb_wires = nb_inputs + 2;
+  auto pick = [&](int previous) {
+    const int choice = rng() % 8;
+    if (choice == 0) return nb_inputs + static_cast<int>(rng() % 2);  // a constant
+    if (choice == 1 && previous >= 0) return previous;                // the same wire again
+    if (choice == 2 && previous >= nb_inputs && previous < nb_inputs + 2) {
+      return 2 * nb_inputs + 1 - previous;                            // the other constant
+    }
+    return static_cast<int>(rng() % nb_wires);
+  };
+  for (int g = 0; g < nb_gates; ++g) {
+    RandomGate gate{types[rng() % (sizeof(types) / sizeof(types[0]))], {-1, -1, -1}};
+    gate.in[0] = pick(-1);
+    gate.in[1] = pick(gate.in[0]);
+    gate.in[2] = pick(gate.in[1]);
+    circuit.gates.push_back(gate);
+    ++nb_wires;
+  }
+  return circuit;
+}
+
+/// \return the values of all wires of the circuit
+std::vector<int> evaluate_plain(const RandomCircuit &circuit, const std::vector<int> &inputs) {
+  std::vector<int> v(inputs);
+  v.push_back(0);
+  v.push_back(1);
+  for (auto &gate : circuit.gates) {
+    const int a = v[gate.in[0]], b = v[gate.in[1]], c = v[gate.in[2]];
+    switch (gate.type) {
+      case GateType::COPY: v.push_back(a); break;
+      case GateType::NOT: v.push_back(!a); break;
+      case GateType::AND: v.push_back(a & b); break;
+      case GateType::OR: v.push_back(a | b); break;
+      case GateType::XOR: v.push_back(a ^ b); break;
+      case GateType::XNOR: v.push_back(!(a ^ b)); break;
+      case GateType::NAND: v.push_back(!(a & b)); break;
+      case GateType::NOR: v.push_back(!(a | b)); break;
+      case GateType::MUX: v.push_back(a ? b : c); break;
+      default: v.push_back(-1); break;
+    }
+  }
+  return v;
+}
+
+/// Records the circuit in dag
+/// \return the wires of the circuit
+std::vector<Wire> record(GateDag &dag, const RandomCircuit &circuit, const LweSample *inputs) {
+  std::vector<Wire> w;
+  for (int i = 0; i < circuit.nb_inputs; ++i) w.push_back(dag.input(&inputs[i]));
+  w.push_back(dag.constant(0));
+  w.push_back(dag.constant(1));
+  for (auto &gate : circuit.gates) {
+    const Wire a = w[gate.in[0]], b = w[gate.in[1]], c = w[gate.in[2]];
+    switch (gate.type) {
+      case GateType::COPY: w.push_back(dag.COPY(a)); break;
+      case GateType::NOT: w.push_back(dag.NOT(a)); break;
+      case GateType::AND: w.push_back(dag.AND(a, b)); break;
+      case GateType::OR: w.push_back(dag.OR(a, b)); break;
+      case GateType::XOR: w.push_back(dag.XOR(a, b)); break;
+      case GateType::XNOR: w.push_back(dag.XNOR(a, b)); break;
+      case GateType::NAND: w.push_back(dag.NAND(a, b)); break;
+      case GateType::NOR: w.push_back(dag.NOR(a, b)); break;
+      case GateType::MUX: w.push_back(dag.MUX(a, b, c)); break;
+      default: break;
+    }
+  }
+  return w;
+}
+
+/// \return number of wrong wires of the DAG
+int check_dag(const char *name, int circuit_index, const GateDag &dag, const std::vector<Wire> &wires,
+              const std::vector<int> &expected, const TFheGateBootstrappingSecretKeySet *key) {
+  int failures = 0;
+  for (std::size_t i = 0; i < wires.size(); ++i) {
+    const int value = bootsSymDecrypt(dag.sample(wires[i]), key);
+    if (value != expected[i] && failures++ < 5) {
+      printf("circuit %d %s: wire %zu is %d, expected %d\n", circuit_index, name, i, value, expected[i]);
+    }
+  }
+  return failures;
+}
+
+int main() {
+  const int minimum_lambda = 100;
+  TFheGateBootstrappingParameterSet *params = new_default_gate_bootstrapping_parameters(minimum_lambda);
+  uint32_t seed[] = {314, 1592, 657};
+  tfhe_random_generator_setSeed(seed, 3);
+  TFheGateBootstrappingSecretKeySet *key = new_random_gate_bootstrapping_secret_keyset(params);
+  std::mt19937 rng(42);
+
+  const int nb_circuits = 20, nb_inputs = 6, nb_gates = 40;
+  LweSample *inputs = new_gate_bootstrapping_ciphertext_array(nb_inputs, params);
+  int failures = 0, folded = 0, bootstrapped[2] = {0, 0};
+  for (int k = 0; k < nb_circuits; ++k) {
+    const RandomCircuit circuit = random_circuit(nb_inputs, nb_gates, rng);
+    std::vector<int> bits;
+    for (int i = 0; i < nb_inputs; ++i) {
+      bits.push_back(rng() & 1);
+      bootsSymEncrypt(&inputs[i], bits[i], key);
+    }
+    const std::vector<int> expected = evaluate_plain(circuit, bits);
+
+    for (int fold = 0; fold < 2; ++fold) {
+      GateDag dag(&key->cloud, fold);
+      const std::vector<Wire> wires = record(dag, circuit, inputs);
+      dag.run();
+      failures += check_dag(fold ? "folded" : "not folded", k, dag, wires, expected, key);
+      bootstrapped[fold] += dag.bootstrapped_gates();
+      if (fold) folded += dag.folded_gates();
+    }
+  }
+  printf("%d bootstrapped gates without folding, %d with folding (%d folded)\n",
+         bootstrapped[0], bootstrapped[1], folded);
+  printf("%d wrong wires\n", failures);
+
+  delete_gate_bootstrapping_ciphertext_array(nb_inputs, inputs);
+  delete_gate_bootstrapping_secret_keyset(key);
+  delete_gate_bootstrapping_parameters(params);
+  return failures == 0 ? 0 : 1;
+}
@@ -158,6 +158,10 @@ def main():
     print('Test loss:', score[0])
     print('Test accuracy:', score[1])
 
+    # Full model, e.g. for export_weights.py
+    mkdir_p('./model')
+    model.save('./model/model.h5')
+
     for idx, layer in enumerate(model.layers):
         prefix = './model/' + "{:02d}_".format(idx) + layer.get_config()['name']
         with safe_open_w(prefix + '_config.txt') as config:
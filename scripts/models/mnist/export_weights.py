@@ -0,0 +1,124 @@
+"""Export the dense layers of a trained Keras model into the weight file format of nn-ckks-batched.
+
+The weights are written as the diagonals expected by ptxt_general_matrix_enc_vector_product, so the
+benchmark can map the file and encode them directly (see SEAL/source/nn-ckks-batched/weight_file.h).
+Layers are padded with zeros to the power-of-two dimensions the MVP requires, e.g. a dense layer on a flattened
+28x28 image becomes 1024 wide, so the client has to pad the flattened image at the end to match.
+The format only holds dense layers (the benchmark squares the values between them), so models with any other
+computing layer, e.g. the convolutions and PolyAct activations of LeNet-5, are rejected instead of exporting a part
+of them.
+
+Usage: python export_weights.py <model.h5> <weights.bin>
+"""
+import struct
+import sys
+
+import numpy as np
+import tensorflow as tf
+import tensorflow.keras.layers as layers
+
+from importlib import import_module
+
+MAGIC = b'SOKWGT01'
+HEADER_SIZE = 4 * 8
+
+
+def next_power_of_two(x: int) -> int:
+    p = 1
+    while p < x:
+        p *= 2
+    return p
+
+
+def pad_matrix(w: np.ndarray, b: np.ndarray, input_size: int):
+    """Pad the m x n weight matrix (and the bias) with zeros to the dimensions required by the MVP:
+    m must be a power of two, and n a multiple of m where the ratio is a power of two as well."""
+    m = next_power_of_two(w.shape[0])
+    n = max(input_size, m)
+    if n % m != 0 or (n // m) & (n // m - 1) != 0:
+        n = m * next_power_of_two(-(-n // m))
+    padded_w = np.zeros((m, n))
+    padded_w[:w.shape[0], :w.shape[1]] = w
+    padded_b = np.zeros(m)
+    padded_b[:b.shape[0]] = b
+    return padded_w, padded_b
+
+
+def diagonals(w: np.ndarray) -> np.ndarray:
+    """The m diagonals of length n of an m x n matrix, d_i[k] = w[k % m][(k + i) % n]"""
+    m, n = w.shape
+    k = np.arange(n)
+    return np.stack([w[k % m, (k + i) % n] for i in range(m)])
+
+
+# Layers that do not compute anything at inference time
+PASSTHROUGH_LAYERS = (layers.InputLayer, layers.Flatten, layers.Dropout)
+
+
+def dense_layers(model):
+    """The (m x n weight matrix, bias) of each dense layer, padded so that each layer takes the padded output of the
+    previous one as its input.
+    Raises a ValueError for layers the weight file can not represent."""
+    result = []
+    input_size = None
+    dense = [layer for layer in model.layers if isinstance(layer, layers.Dense)]
+    for layer in model.layers:
+        if isinstance(layer, PASSTHROUGH_LAYERS):
+            continue
+        if not isinstance(layer, layers.Dense):
+            raise ValueError('Layer %s (%s) can not be exported, the weight file only holds dense layers'
+                             % (layer.name, type(layer).__name__))
+        activation = layer.get_config()['activation']
+        # softmax does not change the predicted class, so the client can leave it out after the last layer
+        if activation != 'linear' and not (activation == 'softmax' and layer is dense[-1]):
+            raise ValueError('Activation %s of layer %s can not be exported' % (activation, layer.name))
+        kernel, bias = layer.get_weights()
+        # Keras computes x @ kernel, the MVP computes W x
+        w = kernel.T
+        if input_size is None:
+            input_size = w.shape[1]
+        w, b = pad_matrix(w, bias, input_size)
+        result.append((w, b))
+        input_size = w.shape[0]
+    return result
+
+
+def write_weight_file(path: str, dense):
+    offset = 16 + HEADER_SIZE * len(dense)
+    headers = []
+    for w, b in dense:
+        m, n = w.shape
+        headers.append((m, n, offset, offset + 8 * m * n))
+        offset += 8 * (m * n + m)
+    with open(path, 'wb') as f:
+        f.write(MAGIC)
+        f.write(struct.pack('<Q', len(dense)))
+        for header in headers:
+            f.write(struct.pack('<4Q', *header))
+        for w, b in dense:
+            f.write(diagonals(w).astype('<f8').tobytes())
+            f.write(b.astype('<f8').tobytes())
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__)
+        sys.exit(1)
+    # The approximated models use the polynomial activation defined with the training script
+    poly_act = import_module('LeNet-5-large').PolyAct
+    model = tf.keras.models.load_model(sys.argv[1], custom_objects={'PolyAct': poly_act})
+    try:
+        dense = dense_layers(model)
+    except ValueError as e:
+        print(e)
+        sys.exit(1)
+    if not dense:
+        print('The model has no dense layers.')
+        sys.exit(1)
+    write_weight_file(sys.argv[2], dense)
+    for idx, (w, _) in enumerate(dense):
+        print('Layer', idx, ':', w.shape[0], 'x', w.shape[1])
+
+
+if __name__ == '__main__':
+    main()